@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		Scheduler fairness benchmark.
+*
+* Runs two processes on the same CPU, one with a single CPU-bound thread and
+* one with several, and reports the share of the CPU that each got. With the
+* fair-share scheduler each process should get about half, regardless of how
+* many threads it runs.
+*/
+
+#include <kernel/process.h>
+#include <kernel/status.h>
+#include <kernel/thread.h>
+#include <kernel/time.h>
+
+#include <sys/wait.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** Default number of threads in the second process. */
+#define DEFAULT_THREADS 4
+
+/** How long to run for. */
+#define RUN_TIME        ((nstime_t)5000000000)
+
+/** Time at which all threads stop. */
+static nstime_t deadline;
+
+static void *
+spin_thread(void *arg)
+{
+    nstime_t *run_time = arg;
+    thread_sched_info_t info;
+    nstime_t now;
+
+    do {
+        kern_time_get(TIME_SYSTEM, &now);
+    } while(now < deadline);
+
+    kern_thread_info(THREAD_SELF, THREAD_INFO_SCHED, &info);
+    *run_time = info.run_time;
+    return NULL;
+}
+
+static int
+run_process(const char *name, size_t num_threads)
+{
+    nstime_t *run_times, total;
+    pthread_t *threads;
+    size_t i;
+
+    run_times = calloc(num_threads, sizeof(*run_times));
+    threads = calloc(num_threads, sizeof(*threads));
+    if(!run_times || !threads) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < num_threads; i++) {
+        if(pthread_create(&threads[i], NULL, spin_thread, &run_times[i]) != 0) {
+            fprintf(stderr, "Failed to create thread %zu\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    total = 0;
+    for(i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        total += run_times[i];
+    }
+
+    printf("%s: %zu threads, %" PRId64 "ms CPU time (%" PRId64 "%% of the run)\n",
+        name, num_threads, total / 1000000, (total * 100) / RUN_TIME);
+    for(i = 0; i < num_threads; i++)
+        printf("  thread %zu: %" PRId64 "ms\n", i, run_times[i] / 1000000);
+
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t num_threads;
+    int status, ret;
+    pid_t pids[2];
+    status_t err;
+    nstime_t now;
+    size_t i;
+
+    num_threads = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_THREADS;
+    if(!num_threads) {
+        fprintf(stderr, "Usage: %s [<threads>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Put everything on one CPU so that the processes compete. The mask is
+     * inherited by the children. */
+    err = kern_process_set_affinity(PROCESS_SELF, 1);
+    if(err != STATUS_SUCCESS) {
+        fprintf(stderr, "Failed to set affinity: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    kern_time_get(TIME_SYSTEM, &now);
+    deadline = now + RUN_TIME;
+
+    for(i = 0; i < 2; i++) {
+        pids[i] = fork();
+        if(pids[i] < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        } else if(pids[i] == 0) {
+            return (i == 0)
+                ? run_process("single", 1)
+                : run_process("multi", num_threads);
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+    for(i = 0; i < 2; i++) {
+        if(waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
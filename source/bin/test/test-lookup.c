@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		Process/thread lookup scaling benchmark.
+*
+* Runs an increasing number of threads that repeatedly look up threads by ID,
+* and reports the total number of operations per second for two tests:
+*
+*  - lookup: Each thread tries to open a thread ID that does not exist. This
+*    only walks the thread tree, without writing to anything shared between
+*    the threads, so it shows how well the lookup path scales. The rate
+*    should scale with the number of threads up to the number of CPUs.
+*  - open: Each thread opens and closes a handle to itself. This adds a
+*    reference to a different thread each time, but every open and close
+*    also writes to the handle table of the process, which all the threads
+*    share, so this is not expected to scale as well.
+*/
+
+#include <kernel/object.h>
+#include <kernel/status.h>
+#include <kernel/thread.h>
+#include <kernel/time.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Default and maximum number of threads. */
+#define DEFAULT_THREADS 8
+#define MAX_THREADS     64
+
+/** How long to run each test for. */
+#define RUN_TIME        ((nstime_t)1000000000)
+
+/** Number of operations between checks of the time. */
+#define CHECK_INTERVAL  64
+
+/** Thread IDs above this are never allocated. */
+#define INVALID_THREAD_ID 65536
+
+/** Benchmark tests. */
+enum {
+    TEST_LOOKUP,
+    TEST_OPEN,
+};
+
+/** Names of tests. */
+static const char *test_names[] = {
+    [TEST_LOOKUP] = "lookup",
+    [TEST_OPEN] = "open",
+};
+
+/** Per-thread results, each on its own cache line. */
+typedef struct result {
+    uint64_t count;
+} __attribute__((aligned(64))) result_t;
+
+static result_t results[MAX_THREADS];
+
+/** Current test. */
+static int test;
+
+/** Time at which the current test stops. */
+static nstime_t deadline;
+
+static void *
+lookup_thread(void *arg)
+{
+    result_t *result = arg;
+    thread_id_t id;
+    handle_t handle;
+    status_t ret;
+    uint64_t count = 0;
+    nstime_t now;
+    unsigned i;
+
+    id = (test == TEST_LOOKUP)
+        ? INVALID_THREAD_ID + (thread_id_t)(result - results)
+        : kern_thread_id(THREAD_SELF);
+
+    do {
+        for(i = 0; i < CHECK_INTERVAL; i++) {
+            ret = kern_thread_open(id, &handle);
+            if(test == TEST_LOOKUP) {
+                if(ret != STATUS_NOT_FOUND) {
+                    fprintf(stderr, "Unexpected lookup result: %d\n", ret);
+                    exit(EXIT_FAILURE);
+                }
+            } else {
+                if(ret != STATUS_SUCCESS) {
+                    fprintf(stderr, "Failed to open thread: %d\n", ret);
+                    exit(EXIT_FAILURE);
+                }
+
+                kern_handle_close(handle);
+            }
+        }
+
+        count += CHECK_INTERVAL;
+        kern_time_get(TIME_SYSTEM, &now);
+    } while(now < deadline);
+
+    result->count = count;
+    return NULL;
+}
+
+static int
+run_test(size_t num_threads)
+{
+    pthread_t threads[MAX_THREADS];
+    uint64_t total;
+    nstime_t now;
+    size_t i;
+
+    kern_time_get(TIME_SYSTEM, &now);
+    deadline = now + RUN_TIME;
+
+    for(i = 0; i < num_threads; i++) {
+        results[i].count = 0;
+
+        if(pthread_create(&threads[i], NULL, lookup_thread, &results[i]) != 0) {
+            fprintf(stderr, "Failed to create thread %zu\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    total = 0;
+    for(i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        total += results[i].count;
+    }
+
+    printf("%-6s %2zu threads: %10" PRIu64 " ops/s (%" PRIu64 " per thread)\n",
+        test_names[test], num_threads, total * 1000000000 / RUN_TIME,
+        total * 1000000000 / RUN_TIME / num_threads);
+
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t max_threads, i;
+
+    max_threads = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_THREADS;
+    if(!max_threads || max_threads > MAX_THREADS) {
+        fprintf(stderr, "Usage: %s [<max threads (1-%d)>]\n", argv[0], MAX_THREADS);
+        return EXIT_FAILURE;
+    }
+
+    for(test = TEST_LOOKUP; test <= TEST_OPEN; test++) {
+        for(i = 1; i <= max_threads; i *= 2) {
+            if(run_test(i) != EXIT_SUCCESS)
+                return EXIT_FAILURE;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		IPC wakeup locality benchmark.
+*
+* Runs a number of pairs of threads which bounce an empty message back and
+* forth over an IPC connection, and reports the average round trip time along
+* with how long each thread spent waiting to run after being woken. Each
+* message wakes the other thread of the pair, so this measures how well the
+* scheduler places a woken thread near to the one that woke it.
+*/
+
+#include <kernel/ipc.h>
+#include <kernel/object.h>
+#include <kernel/status.h>
+#include <kernel/thread.h>
+#include <kernel/time.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Default number of thread pairs. */
+#define DEFAULT_PAIRS   1
+
+/** Number of round trips made by each pair. */
+#define ROUND_TRIPS     10000
+
+/** Structure shared by a pair of threads. */
+typedef struct pair {
+    handle_t port;
+    nstime_t elapsed;
+    thread_sched_info_t ping_info;
+    thread_sched_info_t pong_info;
+} pair_t;
+
+static void *
+pong_thread(void *arg)
+{
+    pair_t *pair = arg;
+    ipc_message_t msg;
+    handle_t conn;
+    status_t ret;
+
+    ret = kern_port_listen(pair->port, NULL, -1, &conn);
+    if(ret != STATUS_SUCCESS) {
+        fprintf(stderr, "Failed to listen for connection: %d\n", ret);
+        exit(EXIT_FAILURE);
+    }
+
+    while(true) {
+        ret = kern_connection_receive(conn, &msg, NULL, -1);
+        if(ret != STATUS_SUCCESS) {
+            if(ret != STATUS_CONN_HUNGUP) {
+                fprintf(stderr, "Failed to receive message: %d\n", ret);
+                exit(EXIT_FAILURE);
+            }
+
+            break;
+        }
+
+        ret = kern_connection_send(conn, &msg, NULL, INVALID_HANDLE, -1);
+        if(ret != STATUS_SUCCESS) {
+            fprintf(stderr, "Failed to send message: %d\n", ret);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    kern_thread_info(THREAD_SELF, THREAD_INFO_SCHED, &pair->pong_info);
+    kern_handle_close(conn);
+    return NULL;
+}
+
+static void *
+ping_thread(void *arg)
+{
+    pair_t *pair = arg;
+    ipc_message_t msg;
+    nstime_t start, end;
+    handle_t conn;
+    status_t ret;
+    unsigned long i;
+
+    ret = kern_connection_open(pair->port, -1, &conn);
+    if(ret != STATUS_SUCCESS) {
+        fprintf(stderr, "Failed to open connection: %d\n", ret);
+        exit(EXIT_FAILURE);
+    }
+
+    msg.id = 0;
+    msg.size = 0;
+
+    kern_time_get(TIME_SYSTEM, &start);
+
+    for(i = 0; i < ROUND_TRIPS; i++) {
+        ret = kern_connection_send(conn, &msg, NULL, INVALID_HANDLE, -1);
+        if(ret != STATUS_SUCCESS) {
+            fprintf(stderr, "Failed to send message: %d\n", ret);
+            exit(EXIT_FAILURE);
+        }
+
+        ret = kern_connection_receive(conn, &msg, NULL, -1);
+        if(ret != STATUS_SUCCESS) {
+            fprintf(stderr, "Failed to receive message: %d\n", ret);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    kern_time_get(TIME_SYSTEM, &end);
+
+    pair->elapsed = end - start;
+    kern_thread_info(THREAD_SELF, THREAD_INFO_SCHED, &pair->ping_info);
+    kern_handle_close(conn);
+    return NULL;
+}
+
+static void
+print_info(const char *name, thread_sched_info_t *info)
+{
+    printf("  %s: waited %" PRId64 "us (max %" PRId64 "us), %" PRIu64
+        " voluntary/%" PRIu64 " involuntary switches\n", name,
+        info->wait_time / 1000, info->max_wait_time / 1000,
+        info->voluntary_switches, info->involuntary_switches);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t num_pairs, i;
+    pthread_t *threads;
+    pair_t *pairs;
+    status_t ret;
+
+    num_pairs = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_PAIRS;
+    if(!num_pairs) {
+        fprintf(stderr, "Usage: %s [<pairs>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    pairs = calloc(num_pairs, sizeof(*pairs));
+    threads = calloc(num_pairs * 2, sizeof(*threads));
+    if(!pairs || !threads) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < num_pairs; i++) {
+        ret = kern_port_create(&pairs[i].port);
+        if(ret != STATUS_SUCCESS) {
+            fprintf(stderr, "Failed to create port: %d\n", ret);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for(i = 0; i < num_pairs * 2; i++) {
+        if(pthread_create(&threads[i], NULL, (i & 1) ? ping_thread : pong_thread,
+            &pairs[i / 2]) != 0)
+        {
+            fprintf(stderr, "Failed to create thread %zu\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for(i = 0; i < num_pairs * 2; i++)
+        pthread_join(threads[i], NULL);
+
+    for(i = 0; i < num_pairs; i++) {
+        printf("Pair %zu: %d round trips in %" PRId64 "ms (%" PRId64 "ns each)\n",
+            i, ROUND_TRIPS, pairs[i].elapsed / 1000000,
+            pairs[i].elapsed / ROUND_TRIPS);
+        print_info("ping", &pairs[i].ping_info);
+        print_info("pong", &pairs[i].pong_info);
+
+        kern_handle_close(pairs[i].port);
+    }
+
+    free(threads);
+    free(pairs);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		Real-time wakeup latency benchmark.
+*
+* Starts a number of CPU-bound threads to load the system, then measures how
+* late a thread runs after waking from a periodic sleep. This is done first
+* with the measuring thread as a normal timesharing thread, and then again
+* with it as a real-time FIFO thread, which should see a much lower and more
+* consistent latency.
+*/
+
+#include <kernel/status.h>
+#include <kernel/thread.h>
+#include <kernel/time.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Default number of CPU-bound threads. */
+#define DEFAULT_HOGS    8
+
+/** Number of samples taken for each policy. */
+#define SAMPLES         1000
+
+/** Period between samples. */
+#define PERIOD          1000000
+
+/** Set when the CPU-bound threads should stop. */
+static volatile bool hogs_stop;
+
+static void *
+hog_thread(void *arg)
+{
+    volatile unsigned long count = 0;
+
+    while(!hogs_stop)
+        count++;
+
+    return NULL;
+}
+
+static void
+measure(const char *name)
+{
+    nstime_t target, now, latency, min, max, total;
+    size_t i;
+
+    min = INT64_MAX;
+    max = 0;
+    total = 0;
+
+    for(i = 0; i < SAMPLES; i++) {
+        kern_time_get(TIME_SYSTEM, &target);
+        target += PERIOD;
+
+        kern_thread_sleep(PERIOD, NULL);
+        kern_time_get(TIME_SYSTEM, &now);
+
+        latency = now - target;
+        if(latency < min)
+            min = latency;
+        if(latency > max)
+            max = latency;
+
+        total += latency;
+    }
+
+    printf("%-8s min %" PRId64 "us, avg %" PRId64 "us, max %" PRId64 "us\n",
+        name, min / 1000, total / SAMPLES / 1000, max / 1000);
+}
+
+int
+main(int argc, char **argv)
+{
+    thread_sched_t sched;
+    size_t num_hogs, i;
+    pthread_t *threads;
+    status_t ret;
+
+    num_hogs = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_HOGS;
+
+    threads = calloc(num_hogs, sizeof(*threads));
+    if(num_hogs && !threads) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < num_hogs; i++) {
+        if(pthread_create(&threads[i], NULL, hog_thread, NULL) != 0) {
+            fprintf(stderr, "Failed to create thread %zu\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("Wakeup latency with %zu CPU-bound threads:\n", num_hogs);
+
+    measure("Normal");
+
+    sched.policy = THREAD_SCHED_FIFO;
+    sched.priority = THREAD_RT_PRIORITY_MAX;
+    sched.quantum = 0;
+
+    ret = kern_thread_set_sched(THREAD_SELF, &sched);
+    if(ret != STATUS_SUCCESS) {
+        fprintf(stderr, "Failed to set real-time policy: %d\n", ret);
+    } else {
+        measure("FIFO");
+    }
+
+    hogs_stop = true;
+    for(i = 0; i < num_hogs; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    return (ret == STATUS_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		Compressed swap test application.
+*
+* Allocates and fills more anonymous memory than is available so that the
+* kernel is forced to swap pages out, then checks that every page reads back
+* intact. Should be run in an emulator with a small amount of RAM, e.g. with
+* "-m 64" and an argument of 96 (MiB).
+*/
+
+#include <kernel/process.h>
+#include <kernel/status.h>
+#include <kernel/system.h>
+#include <kernel/time.h>
+#include <kernel/vm.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Default amount of memory to allocate (MiB). */
+#define DEFAULT_SIZE    96
+
+static void
+fill_page(uint32_t *page, size_t count, size_t idx)
+{
+    size_t i;
+
+    /* Compressible, but different for every page. */
+    for(i = 0; i < count; i++)
+        page[i] = (i % 64) ? (uint32_t)idx : (uint32_t)(idx * 2654435761u + i);
+}
+
+static bool
+check_page(const uint32_t *page, size_t count, size_t idx)
+{
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        if(page[i] != ((i % 64) ? (uint32_t)idx : (uint32_t)(idx * 2654435761u + i)))
+            return false;
+    }
+
+    return true;
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t page_size, size, pages, count, i, errors = 0;
+    process_memory_info_t mem;
+    swap_info_t swap;
+    nstime_t start, end;
+    uint8_t *area;
+    status_t ret;
+
+    size = ((argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_SIZE) * 1024 * 1024;
+
+    kern_system_info(SYSTEM_INFO_PAGE_SIZE, &page_size);
+    pages = size / page_size;
+    count = page_size / sizeof(uint32_t);
+
+    ret = kern_vm_map((void **)&area, size, VM_ADDRESS_ANY,
+        VM_ACCESS_READ | VM_ACCESS_WRITE, VM_MAP_PRIVATE, INVALID_HANDLE, 0,
+        "test-swap");
+    if(ret != STATUS_SUCCESS) {
+        fprintf(stderr, "Failed to map %zu bytes: %" PRId32 "\n", size, ret);
+        return EXIT_FAILURE;
+    }
+
+    printf("Filling %zu pages...\n", pages);
+
+    kern_time_get(TIME_SYSTEM, &start);
+
+    for(i = 0; i < pages; i++) {
+        fill_page((uint32_t *)(area + (i * page_size)), count, i);
+
+        /* Hint that the first half will not be needed for a while. */
+        if(i == (pages / 2) - 1)
+            kern_vm_advise(area, (pages / 2) * page_size, VM_ADVISE_COLD);
+    }
+
+    printf("Verifying...\n");
+
+    for(i = 0; i < pages; i++) {
+        if(!check_page((uint32_t *)(area + (i * page_size)), count, i)) {
+            fprintf(stderr, "Page %zu is corrupt\n", i);
+            errors++;
+        }
+    }
+
+    kern_time_get(TIME_SYSTEM, &end);
+
+    kern_system_info(SYSTEM_INFO_SWAP, &swap);
+    kern_process_info(PROCESS_SELF, PROCESS_INFO_MEMORY, &mem);
+
+    printf("Completed in %" PRId64 "ms with %zu errors\n", (end - start) / 1000000, errors);
+    printf("Swap: stored %" PRIu64 " pages in %" PRIu64 " KiB (pool %" PRIu64 " KiB)\n",
+        swap.stored, swap.compressed / 1024, swap.pool_size / 1024);
+    printf("Swap: %" PRIu64 " out, %" PRIu64 " in, %" PRIu64 " rejected\n",
+        swap.swapped_out, swap.swapped_in, swap.rejected);
+    if(swap.swapped_in) {
+        printf("Swap: fault latency %" PRId64 "us average, %" PRId64 "us max\n",
+            (swap.fault_time / (nstime_t)swap.swapped_in) / 1000, swap.fault_max / 1000);
+    }
+    printf("Process: rss %" PRIu64 " KiB, %" PRIu64 " minor faults, %" PRIu64 " major faults\n",
+        mem.rss / 1024, mem.minor_faults, mem.major_faults);
+
+    kern_vm_unmap(area, size);
+    return (errors) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
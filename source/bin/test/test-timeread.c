@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		Clock read benchmark.
+*
+* Reports how many times per second the time can be read through each of the
+* available interfaces. Also checks that the monotonic clock never goes
+* backwards, which would show an inconsistency between CPUs or between the
+* kernel's and libkernel's calculations.
+*/
+
+#include <kernel/time.h>
+
+#include <sys/time.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** How long to run each test for. */
+#define RUN_TIME        ((nstime_t)1000000000)
+
+static uint64_t
+bench_kern_time_get(unsigned source, uint64_t *backwards)
+{
+    nstime_t start, now, prev;
+    uint64_t count = 0;
+
+    kern_time_get(TIME_SYSTEM, &start);
+    prev = 0;
+
+    do {
+        kern_time_get(source, &now);
+        if(now < prev)
+            (*backwards)++;
+
+        prev = now;
+        count++;
+
+        if(source != TIME_SYSTEM)
+            kern_time_get(TIME_SYSTEM, &now);
+    } while(now - start < RUN_TIME);
+
+    return count;
+}
+
+static uint64_t
+bench_clock_gettime(void)
+{
+    struct timespec ts;
+    nstime_t start, now;
+    uint64_t count = 0;
+
+    kern_time_get(TIME_SYSTEM, &start);
+
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = ((nstime_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+        count++;
+    } while(now - start < RUN_TIME);
+
+    return count;
+}
+
+static uint64_t
+bench_gettimeofday(void)
+{
+    struct timeval tv;
+    nstime_t start, now;
+    uint64_t count = 0;
+
+    kern_time_get(TIME_SYSTEM, &start);
+
+    do {
+        gettimeofday(&tv, NULL);
+        count++;
+        kern_time_get(TIME_SYSTEM, &now);
+    } while(now - start < RUN_TIME);
+
+    return count;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint64_t backwards = 0;
+
+    printf("kern_time_get(TIME_SYSTEM): %" PRIu64 " reads/s\n",
+        bench_kern_time_get(TIME_SYSTEM, &backwards));
+    printf("kern_time_get(TIME_REAL):   %" PRIu64 " reads/s\n",
+        bench_kern_time_get(TIME_REAL, &backwards));
+    printf("clock_gettime():            %" PRIu64 " reads/s\n",
+        bench_clock_gettime());
+    printf("gettimeofday():             %" PRIu64 " reads/s\n",
+        bench_gettimeofday());
+
+    if(backwards) {
+        printf("time went backwards %" PRIu64 " times\n", backwards);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		Kernel timer scalability benchmark.
+*
+* Starts a large number of long-running timers on a single CPU and reports
+* how long it takes to start and stop a timer as the number already queued on
+* that CPU grows. The timers are spread over several processes to stay within
+* the per-process handle limit. Run it against kernels with different timer
+* implementations to compare them.
+*/
+
+#include <kernel/object.h>
+#include <kernel/process.h>
+#include <kernel/status.h>
+#include <kernel/thread.h>
+#include <kernel/time.h>
+
+#include <sys/wait.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** Number of processes to create timers in. */
+#define NUM_PROCESSES   25
+
+/** Number of timers each process creates. */
+#define NUM_TIMERS      400
+
+/** Time between each process' turn. */
+#define STAGGER_TIME    ((nstime_t)20000000)
+
+/** Shortest and longest timer interval (none fire during the run). */
+#define MIN_INTERVAL    ((nstime_t)10000000000)
+#define MAX_INTERVAL    ((nstime_t)100000000000)
+
+/** Start of the run. */
+static nstime_t base_time;
+
+static void
+sleep_until(nstime_t target)
+{
+    nstime_t now;
+
+    kern_time_get(TIME_SYSTEM, &now);
+    if(target > now)
+        kern_thread_sleep(target - now, NULL);
+}
+
+static int
+run_process(size_t index)
+{
+    handle_t handles[NUM_TIMERS];
+    nstime_t start, end;
+    uint32_t seed;
+    status_t ret;
+    size_t i;
+
+    for(i = 0; i < NUM_TIMERS; i++) {
+        ret = kern_timer_create(0, &handles[i]);
+        if(ret != STATUS_SUCCESS) {
+            fprintf(stderr, "Failed to create timer %zu: %d\n", i, ret);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* Wait for the earlier processes to have started their timers. */
+    sleep_until(base_time + (index * STAGGER_TIME));
+
+    seed = index + 1;
+    kern_time_get(TIME_SYSTEM, &start);
+
+    for(i = 0; i < NUM_TIMERS; i++) {
+        seed = (seed * 1103515245) + 12345;
+        ret = kern_timer_start(handles[i],
+            MIN_INTERVAL + ((seed >> 8) % (MAX_INTERVAL - MIN_INTERVAL)),
+            TIMER_ONESHOT);
+        if(ret != STATUS_SUCCESS) {
+            fprintf(stderr, "Failed to start timer %zu: %d\n", i, ret);
+            return EXIT_FAILURE;
+        }
+    }
+
+    kern_time_get(TIME_SYSTEM, &end);
+    printf("start: %5zu queued, %" PRId64 "ns per timer\n",
+        index * NUM_TIMERS, (end - start) / NUM_TIMERS);
+
+    /* Stop in the same order, so the number queued goes back down. */
+    sleep_until(base_time + ((NUM_PROCESSES + index) * STAGGER_TIME));
+
+    kern_time_get(TIME_SYSTEM, &start);
+
+    for(i = 0; i < NUM_TIMERS; i++)
+        kern_timer_stop(handles[i], NULL);
+
+    kern_time_get(TIME_SYSTEM, &end);
+    printf("stop:  %5zu queued, %" PRId64 "ns per timer\n",
+        (NUM_PROCESSES - index) * NUM_TIMERS, (end - start) / NUM_TIMERS);
+
+    for(i = 0; i < NUM_TIMERS; i++)
+        kern_handle_close(handles[i]);
+
+    return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char **argv)
+{
+    pid_t pids[NUM_PROCESSES];
+    int status, ret;
+    status_t err;
+    size_t i;
+
+    /* Kernel timers are queued on the CPU that starts them, so put
+     * everything on one CPU. The mask is inherited by the children. */
+    err = kern_process_set_affinity(PROCESS_SELF, 1);
+    if(err != STATUS_SUCCESS) {
+        fprintf(stderr, "Failed to set affinity: %d\n", err);
+        return EXIT_FAILURE;
+    }
+
+    /* Leave time for all of the processes to be created. */
+    kern_time_get(TIME_SYSTEM, &base_time);
+    base_time += 1000000000;
+
+    for(i = 0; i < NUM_PROCESSES; i++) {
+        pids[i] = fork();
+        if(pids[i] < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+        } else if(pids[i] == 0) {
+            return run_process(i);
+        }
+    }
+
+    ret = EXIT_SUCCESS;
+    for(i = 0; i < NUM_PROCESSES; i++) {
+        if(waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            ret = EXIT_FAILURE;
+    }
+
+    return ret;
+}
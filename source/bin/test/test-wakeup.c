@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+* @file
+* @brief		Thread wakeup benchmark.
+*
+* Runs a number of pairs of threads which repeatedly wake each other up, and
+* reports the total wakeup rate. Running with increasing numbers of pairs
+* shows how well the scheduler's wakeup path scales with the number of CPUs.
+*/
+
+#include <kernel/status.h>
+#include <kernel/time.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Default number of thread pairs. */
+#define DEFAULT_PAIRS   4
+
+/** Number of round trips made by each pair. */
+#define ROUND_TRIPS     20000
+
+/** Structure shared by a pair of threads. */
+typedef struct pair {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool turn;
+    unsigned long count;
+} pair_t;
+
+static void *
+pair_thread(void *arg)
+{
+    pair_t *pair = arg;
+    unsigned long i;
+    bool self;
+
+    /* First thread to start goes first. */
+    pthread_mutex_lock(&pair->lock);
+    self = pair->count++ != 0;
+    pthread_mutex_unlock(&pair->lock);
+
+    for(i = 0; i < ROUND_TRIPS; i++) {
+        pthread_mutex_lock(&pair->lock);
+
+        while(pair->turn != self)
+            pthread_cond_wait(&pair->cond, &pair->lock);
+
+        pair->turn = !self;
+        pthread_cond_signal(&pair->cond);
+        pthread_mutex_unlock(&pair->lock);
+    }
+
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t num_pairs, i;
+    pthread_t *threads;
+    nstime_t start, end;
+    pair_t *pairs;
+    uint64_t wakeups;
+
+    num_pairs = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_PAIRS;
+    if(!num_pairs) {
+        fprintf(stderr, "Usage: %s [<pairs>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    pairs = calloc(num_pairs, sizeof(*pairs));
+    threads = calloc(num_pairs * 2, sizeof(*threads));
+    if(!pairs || !threads) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < num_pairs; i++) {
+        pthread_mutex_init(&pairs[i].lock, NULL);
+        pthread_cond_init(&pairs[i].cond, NULL);
+    }
+
+    kern_time_get(TIME_SYSTEM, &start);
+
+    for(i = 0; i < num_pairs * 2; i++) {
+        if(pthread_create(&threads[i], NULL, pair_thread, &pairs[i / 2]) != 0) {
+            fprintf(stderr, "Failed to create thread %zu\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for(i = 0; i < num_pairs * 2; i++)
+        pthread_join(threads[i], NULL);
+
+    kern_time_get(TIME_SYSTEM, &end);
+
+    wakeups = (uint64_t)num_pairs * ROUND_TRIPS * 2;
+    printf("%zu pairs: %" PRIu64 " wakeups in %" PRId64 "ms (%" PRIu64 " per second)\n",
+        num_pairs, wakeups, (end - start) / 1000000,
+        (end > start) ? (wakeups * 1000000000) / (uint64_t)(end - start) : 0);
+
+    free(threads);
+    free(pairs);
+    return EXIT_SUCCESS;
+}
@@ -19,12 +19,15 @@
  * @brief		AMD64 CPU management.
  */
 
+#include <arch/barrier.h>
+#include <arch/bitops.h>
 #include <arch/io.h>
 #include <arch/page.h>
 #include <arch/stack.h>
 
 #include <x86/cpu.h>
 #include <x86/descriptor.h>
+#include <x86/fpu.h>
 #include <x86/interrupt.h>
 #include <x86/lapic.h>
 #include <x86/tsc.h>
@@ -37,6 +40,7 @@
 #include <cpu.h>
 #include <kdb.h>
 #include <kernel.h>
+#include <time.h>
 
 extern void syscall_entry(void);
 
@@ -49,6 +53,42 @@ static uint8_t boot_doublefault_stack[KSTACK_SIZE] __aligned(PAGE_SIZE);
 /** Feature set present on all CPUs. */
 x86_features_t cpu_features;
 
+/** Whether idle CPUs use MWAIT rather than HLT. */
+static bool mwait_idle = false;
+
+/** Supported MWAIT sub-states for each C-state (CPUID leaf 5 EDX). */
+static uint32_t mwait_substates = 0;
+
+/** Deepest C-state that it is safe to enter. */
+static unsigned mwait_max_cstate = 1;
+
+/** Minimum expected idle time to enter each C-state from C1. These are
+ * conservative guesses, as without ACPI the real exit latencies are not
+ * known. */
+static const nstime_t mwait_residency[] = {
+	0, USECS2NSECS(20), USECS2NSECS(100), USECS2NSECS(400),
+};
+
+/** Default idle state selection function.
+ * @param duration	Expected time until the next timer event.
+ * @return		MWAIT hint for the state to enter. */
+static uint32_t default_idle_select(nstime_t duration) {
+	unsigned cstate;
+
+	for(cstate = mwait_max_cstate; cstate > 1; cstate--) {
+		if(!((mwait_substates >> (cstate * 4)) & 0xf))
+			continue;
+
+		if(duration < 0 || duration >= mwait_residency[cstate - 1])
+			return (cstate - 1) << 4;
+	}
+
+	return 0;
+}
+
+/** Function used to select the state to enter when idle. */
+x86_idle_select_t x86_idle_select = default_idle_select;
+
 /**
  * Get the current CPU ID.
  *
@@ -76,6 +116,9 @@ void cpu_dump(cpu_t *cpu) {
 	kprintf(LOG_NOTICE, "  cache_align: %d\n", cpu->arch.cache_alignment);
 	kprintf(LOG_NOTICE, "  phys_bits:   %d\n", cpu->arch.max_phys_bits);
 	kprintf(LOG_NOTICE, "  virt_bits:   %d\n", cpu->arch.max_virt_bits);
+	kprintf(LOG_NOTICE, "  topology:    package %" PRIu32 ", cache %" PRIu32
+		", core %" PRIu32 "\n", cpu->topology.package, cpu->topology.cache,
+		cpu->topology.core);
 }
 
 /** Perform early initialization common to all CPUs. */
@@ -230,6 +273,109 @@ static __init_text void detect_cpu_features(cpu_t *cpu, x86_features_t *features
 		cpu->arch.max_virt_bits = 48;
 }
 
+/** Get the number of APIC ID bits needed to number a set of items.
+ * @param count		Number of items.
+ * @return		Number of bits. */
+static __init_text unsigned topology_bits(uint32_t count) {
+	return (count > 1) ? fls(count - 1) + 1 : 0;
+}
+
+/** Get the number of APIC ID bits shared by the last level cache.
+ * @param leaf		Deterministic cache parameters leaf to use.
+ * @return		Number of bits, or -1 if no cache information. */
+static __init_text int detect_cache_bits(uint32_t leaf) {
+	uint32_t eax, ebx, ecx, edx, index, level, sharing = 0, highest = 0;
+
+	/* Sub-leaves are terminated by one with a null cache type. The level
+	 * and sharing count fields are the same in Intel's leaf 4 and AMD's
+	 * 0x8000001D. */
+	for(index = 0; index < 16; index++) {
+		x86_cpuid_count(leaf, index, &eax, &ebx, &ecx, &edx);
+		if(!(eax & 0x1f))
+			break;
+
+		level = (eax >> 5) & 0x7;
+		if(level > highest) {
+			highest = level;
+			sharing = ((eax >> 14) & 0xfff) + 1;
+		}
+	}
+
+	return (highest) ? (int)topology_bits(sharing) : -1;
+}
+
+/** Detect the position of the CPU in the system topology.
+ * @param cpu		Pointer to CPU structure for this CPU.
+ * @param features	Features detected for this CPU. */
+static __init_text void detect_cpu_topology(cpu_t *cpu, x86_features_t *features) {
+	uint32_t eax, ebx, ecx, edx, leaf, index, type, apic_id;
+	unsigned smt_bits = 0, package_bits = 0;
+	int cache_bits = -1;
+
+	/* Get the initial APIC ID and the legacy logical processor count. */
+	x86_cpuid(X86_CPUID_FEATURE_INFO, &eax, &ebx, &ecx, &edx);
+	apic_id = ebx >> 24;
+	if(features->htt)
+		package_bits = topology_bits((ebx >> 16) & 0xff);
+
+	/* Prefer the extended topology leaves, which give the exact shift
+	 * widths for each level. V2 (0x1F) is a superset of 0xB. */
+	leaf = 0;
+	if(features->highest_standard >= X86_CPUID_V2_TOPOLOGY) {
+		x86_cpuid_count(X86_CPUID_V2_TOPOLOGY, 0, &eax, &ebx, &ecx, &edx);
+		if(ebx)
+			leaf = X86_CPUID_V2_TOPOLOGY;
+	}
+	if(!leaf && features->highest_standard >= X86_CPUID_X2APIC) {
+		x86_cpuid_count(X86_CPUID_X2APIC, 0, &eax, &ebx, &ecx, &edx);
+		if(ebx)
+			leaf = X86_CPUID_X2APIC;
+	}
+
+	if(leaf) {
+		for(index = 0; index < 8; index++) {
+			x86_cpuid_count(leaf, index, &eax, &ebx, &ecx, &edx);
+			type = (ecx >> 8) & 0xff;
+			if(!type)
+				break;
+
+			/* Type 1 is SMT, anything above that is some level
+			 * within the package. The last level's shift gives
+			 * the package ID. EDX holds the full x2APIC ID. */
+			if(type == 1)
+				smt_bits = eax & 0x1f;
+			package_bits = eax & 0x1f;
+			apic_id = edx;
+		}
+	} else if(features->htt) {
+		/* Fall back on the core count to split the logical processor
+		 * count into cores and threads. */
+		if(features->highest_standard >= X86_CPUID_CACHE_PARMS) {
+			x86_cpuid_count(X86_CPUID_CACHE_PARMS, 0, &eax, &ebx, &ecx, &edx);
+			smt_bits = package_bits - min(package_bits,
+				topology_bits((eax >> 26) + 1));
+		} else if(features->highest_extended >= X86_CPUID_ADDRESS_SIZE) {
+			x86_cpuid(X86_CPUID_ADDRESS_SIZE, &eax, &ebx, &ecx, &edx);
+			smt_bits = package_bits - min(package_bits,
+				topology_bits((ecx & 0xff) + 1));
+		}
+	}
+
+	if(features->highest_standard >= X86_CPUID_CACHE_PARMS)
+		cache_bits = detect_cache_bits(X86_CPUID_CACHE_PARMS);
+	if(cache_bits < 0 && features->topoext
+		&& features->highest_extended >= X86_CPUID_CACHE_TOPOLOGY)
+	{
+		cache_bits = detect_cache_bits(X86_CPUID_CACHE_TOPOLOGY);
+	}
+	if(cache_bits < 0 || (unsigned)cache_bits > package_bits)
+		cache_bits = package_bits;
+
+	cpu->topology.core = apic_id >> smt_bits;
+	cpu->topology.cache = apic_id >> cache_bits;
+	cpu->topology.package = apic_id >> package_bits;
+}
+
 /** Initialize SYSCALL/SYSRET MSRs. */
 static __init_text void syscall_init(void) {
 	uint64_t fmask, lstar, star;
@@ -260,6 +406,31 @@ static __init_text void syscall_init(void) {
 	x86_write_msr(X86_MSR_STAR, star);
 }
 
+/** Check whether MWAIT can be used to idle. */
+static __init_text void detect_mwait(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	if(!cpu_features.monitor || cpu_features.highest_standard < X86_CPUID_MONITOR_MWAIT)
+		return;
+
+	/* Without the extensions we only know that C1 is available, which
+	 * is what a hint of 0 requests. */
+	x86_cpuid(X86_CPUID_MONITOR_MWAIT, &eax, &ebx, &ecx, &edx);
+	if(ecx & X86_MWAIT_EXTENSIONS)
+		mwait_substates = edx;
+
+	/* On some CPUs the LAPIC timer stops in states deeper than C1, which
+	 * would mean missing our own timers. Only go deeper if it is always
+	 * running. */
+	if(cpu_features.highest_standard >= X86_CPUID_DTS_POWER) {
+		x86_cpuid(X86_CPUID_DTS_POWER, &eax, &ebx, &ecx, &edx);
+		if(eax & X86_POWER_ARAT)
+			mwait_max_cstate = ARRAY_SIZE(mwait_residency);
+	}
+
+	mwait_idle = true;
+}
+
 /** Detect and set up the current CPU.
  * @param cpu		CPU structure for the current CPU. */
 __init_text void arch_cpu_early_init_percpu(cpu_t *cpu) {
@@ -275,6 +446,7 @@ __init_text void arch_cpu_early_init_percpu(cpu_t *cpu) {
 
 	/* Detect CPU features and information. */
 	detect_cpu_features(cpu, &features);
+	detect_cpu_topology(cpu, &features);
 
 	/* If this is the boot CPU, copy features to the global features
 	 * structure. Otherwise, check that the feature set matches the global
@@ -297,6 +469,9 @@ __init_text void arch_cpu_early_init_percpu(cpu_t *cpu) {
 		} else if(!cpu_features.pge) {
 			fatal("CPU does not support PGE");
 		}
+
+		detect_mwait();
+		x86_fpu_detect();
 	} else {
 		if(cpu_features.highest_standard != features.highest_standard
 			|| cpu_features.highest_extended != features.highest_extended
@@ -324,6 +499,9 @@ __init_text void arch_cpu_early_init_percpu(cpu_t *cpu) {
 	/* Enable PGE/OSFXSR. */
 	x86_write_cr4(x86_read_cr4() | X86_CR4_PGE | X86_CR4_OSFXSR);
 
+	/* Enable XSAVE-managed state components, if supported. */
+	x86_fpu_init_percpu();
+
 	/* Set WP/NE/MP/TS in CR0 (Write Protect, Numeric Error, Monitor
 	 * Coprocessor, Task Switch), and clear EM (Emulation). TS is set
 	 * because we do not want the FPU to be enabled initially. */
@@ -337,6 +515,86 @@ __init_text void arch_cpu_early_init_percpu(cpu_t *cpu) {
 	tsc_init_target();
 }
 
+/**
+ * Place the current CPU in an idle state until woken.
+ *
+ * Waits until either an interrupt occurs, or, if idling with MWAIT, until the
+ * CPU's need_resched word is written. Must be called with interrupts
+ * disabled, and returns with them disabled.
+ */
+void arch_cpu_idle(void) {
+	nstime_t duration = -1;
+	uint32_t hint;
+	cpu_t *cpu;
+
+	if(!mwait_idle) {
+		__asm__ volatile("sti; hlt; cli");
+		return;
+	}
+
+	cpu = curr_cpu;
+
+	/* Work out how long we are likely to be idle for to pick a state. */
+	spinlock_lock_noirq(&cpu->timer_lock);
+	if(cpu->timers.count)
+		duration = max(cpu->timers.next - system_time(), (nstime_t)0);
+	spinlock_unlock_noirq(&cpu->timer_lock);
+
+	hint = x86_idle_select(duration);
+
+	/* Pairs with the barrier in sched_kick_cpu(). */
+	cpu->idle_monitor = true;
+	memory_barrier();
+
+	x86_monitor(&cpu->need_resched, 0, 0);
+	if(!cpu->need_resched)
+		x86_mwait(hint, 0);
+
+	cpu->idle_monitor = false;
+}
+
+/** Show or set the idle method.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_idle(int argc, char **argv, kdb_filter_t *filter) {
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s [hlt|mwait]\n\n", argv[0]);
+
+		kdb_printf("Shows or sets the instruction used by idle CPUs. With MWAIT, an idle CPU\n");
+		kdb_printf("can be woken by another CPU without an IPI. The wakeup latency for each\n");
+		kdb_printf("method can be compared with the schedlat command.\n");
+		return KDB_SUCCESS;
+	} else if(argc > 2) {
+		kdb_printf("Incorrect number of arguments. See 'help %s' for help.\n", argv[0]);
+		return KDB_FAILURE;
+	}
+
+	if(argc == 2) {
+		if(strcmp(argv[1], "hlt") == 0) {
+			mwait_idle = false;
+		} else if(strcmp(argv[1], "mwait") == 0) {
+			if(!cpu_features.monitor) {
+				kdb_printf("MWAIT is not supported.\n");
+				return KDB_FAILURE;
+			}
+
+			mwait_idle = true;
+		} else {
+			kdb_printf("Unknown idle method '%s'.\n", argv[1]);
+			return KDB_FAILURE;
+		}
+	}
+
+	kdb_printf("Idle method: %s", (mwait_idle) ? "mwait" : "hlt");
+	if(mwait_idle) {
+		kdb_printf(" (deepest C-state C%u, sub-states 0x%" PRIx32 ")",
+			mwait_max_cstate, mwait_substates);
+	}
+	kdb_printf("\n");
+	return KDB_SUCCESS;
+}
+
 /** Display a list of running CPUs.
  * @param argc		Argument count.
  * @param argv		Argument array.
@@ -351,16 +609,19 @@ static kdb_status_t kdb_cmd_cpus(int argc, char **argv, kdb_filter_t *filter) {
 		return KDB_SUCCESS;
 	}
 
-	kdb_printf("ID   Freq (MHz) LAPIC Freq (MHz) Cache Align Model Name\n");
-	kdb_printf("==   ========== ================ =========== ==========\n");
+	kdb_printf("ID   Freq (MHz) LAPIC Freq (MHz) Cache Align Package Cache Core  Model Name\n");
+	kdb_printf("==   ========== ================ =========== ======= ===== ====  ==========\n");
 
 	for(i = 0; i <= highest_cpu_id; i++) {
 		if(!cpus[i])
 			continue;
 
-		kdb_printf("%-4" PRIu32 " %-10" PRIu64 " %-16" PRIu64 " %-11d %s\n",
+		kdb_printf("%-4" PRIu32 " %-10" PRIu64 " %-16" PRIu64 " %-11d "
+			"%-7" PRIu32 " %-5" PRIu32 " %-5" PRIu32 " %s\n",
 			cpus[i]->id, cpus[i]->arch.cpu_freq / 1000000,
 			cpus[i]->arch.lapic_freq / 1000000, cpus[i]->arch.cache_alignment,
+			cpus[i]->topology.package, cpus[i]->topology.cache,
+			cpus[i]->topology.core,
 			(cpus[i]->arch.model_name[0]) ? cpus[i]->arch.model_name : "Unknown");
 	}
 
@@ -370,7 +631,9 @@ static kdb_status_t kdb_cmd_cpus(int argc, char **argv, kdb_filter_t *filter) {
 /** Perform additional initialization. */
 __init_text void arch_cpu_init() {
 	kdb_register_command("cpus", "Display a list of CPUs.", kdb_cmd_cpus);
+	kdb_register_command("idle", "Show or set the CPU idle method.", kdb_cmd_idle);
 
+	x86_fpu_late_init();
 	lapic_init();
 }
 
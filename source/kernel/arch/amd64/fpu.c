@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/**
+ * @file
+ * @brief		AMD64 FPU state management.
+ *
+ * Where the CPU supports it, FPU state is saved with the XSAVE family of
+ * instructions so that AVX and AVX-512 state is preserved along with the
+ * x87/SSE state. XSAVEOPT is preferred over XSAVE as it skips writing state
+ * components that are unmodified since they were last restored, and XSAVES
+ * further skips components that are in their initial state by using the
+ * compacted format. The size of the save area depends on which components
+ * are enabled, so each thread's area is allocated from a slab cache sized
+ * once the boot CPU's XCR0 has been set up.
+ */
+
+#include <x86/cpu.h>
+#include <x86/fpu.h>
+#include <x86/tsc.h>
+
+#include <lib/string.h>
+
+#include <mm/slab.h>
+
+#include <cpu.h>
+#include <kdb.h>
+#include <kernel.h>
+
+/** AVX-512 state components, which are only usable together. */
+#define XCR0_AVX512		(X86_XCR0_OPMASK | X86_XCR0_ZMM_HI256 | X86_XCR0_HI16_ZMM)
+
+/** Size of the scratch save areas used for benchmarking. */
+#define FPU_BENCH_SIZE		4096
+
+/** Number of iterations to benchmark each method for. */
+#define FPU_BENCH_ITERATIONS	1000
+
+/** Method used to save and restore FPU state. */
+unsigned x86_fpu_method = X86_FPU_FXSAVE;
+
+/** State components enabled in XCR0 and saved on a context switch. */
+uint64_t x86_fpu_features = X86_XCR0_X87 | X86_XCR0_SSE;
+
+/** Size of a thread's FPU save area. */
+size_t x86_fpu_size = 512;
+
+/** Clean FPU state loaded when a thread first uses the FPU. Only the legacy
+ * area and header are needed, as the header marks all other components as
+ * being in their initial state. */
+char x86_fpu_init_state[X86_FPU_HEADER_SIZE] __aligned(X86_FPU_ALIGN);
+
+/** Bitmap of supported save methods. */
+static unsigned fpu_methods = (1 << X86_FPU_FXSAVE);
+
+/** Names of save methods. */
+static const char *fpu_method_names[] = {
+	[X86_FPU_FXSAVE] = "fxsave",
+	[X86_FPU_XSAVE] = "xsave",
+	[X86_FPU_XSAVEOPT] = "xsaveopt",
+	[X86_FPU_XSAVES] = "xsaves",
+};
+
+/** Slab cache for thread FPU save areas. */
+static slab_cache_t *fpu_state_cache;
+
+/** Scratch save areas used for benchmarking. */
+static char fpu_bench_state[2][FPU_BENCH_SIZE] __aligned(X86_FPU_ALIGN);
+
+/** Constructor for FPU save areas.
+ * @param obj		Object to construct.
+ * @param data		Unused. */
+static void fpu_state_ctor(void *obj, void *data) {
+	/* XRSTOR faults if the reserved parts of the header are not zero.
+	 * XSAVE never writes them, so they remain clear once the area has
+	 * been freed and reused. */
+	memset(obj, 0, x86_fpu_size);
+}
+
+/** Allocate an FPU save area.
+ * @param mmflag	Allocation behaviour flags.
+ * @return		Pointer to save area, or NULL on failure. */
+void *x86_fpu_alloc(unsigned mmflag) {
+	return slab_cache_alloc(fpu_state_cache, mmflag);
+}
+
+/** Free an FPU save area.
+ * @param state		Save area to free. */
+void x86_fpu_free(void *state) {
+	slab_cache_free(fpu_state_cache, state);
+}
+
+/** Time saving and restoring FPU state with each supported method.
+ * @note		The FPU must be enabled, and its state is clobbered. */
+static void fpu_bench(void) {
+	uint64_t save, restore, start, mid;
+	unsigned method, i;
+	void *buf;
+
+	buf = fpu_bench_state[1];
+
+	for(method = 0; method < X86_FPU_METHOD_COUNT; method++) {
+		if(!(fpu_methods & (1 << method)))
+			continue;
+
+		/* The first save fills in the header for the restores. */
+		memset(buf, 0, x86_fpu_size);
+		save = restore = 0;
+
+		for(i = 0; i < FPU_BENCH_ITERATIONS; i++) {
+			start = x86_rdtsc();
+			x86_fpu_save_method(method, buf);
+			mid = x86_rdtsc();
+			x86_fpu_restore_method(method, buf);
+			restore += x86_rdtsc() - mid;
+			save += mid - start;
+		}
+
+		save /= FPU_BENCH_ITERATIONS;
+		restore /= FPU_BENCH_ITERATIONS;
+		kdb_printf("%-9s save %5" PRIu64 " cycles (%" PRIu64 "ns), restore %5"
+			PRIu64 " cycles (%" PRIu64 "ns)\n", fpu_method_names[method],
+			save, (save * 1000) / curr_cpu->arch.cycles_per_us, restore,
+			(restore * 1000) / curr_cpu->arch.cycles_per_us);
+	}
+}
+
+/** Show FPU state information.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_fpu(int argc, char **argv, kdb_filter_t *filter) {
+	bool enabled;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s [bench]\n\n", argv[0]);
+
+		kdb_printf("Shows the method used to save FPU state on a context switch, the state\n");
+		kdb_printf("components saved, and the size of the save area. If 'bench' is given,\n");
+		kdb_printf("the cost of saving and restoring the state of the current CPU with each\n");
+		kdb_printf("supported method is measured. The state is unmodified between a restore\n");
+		kdb_printf("and the next save, as for a thread that does not touch the FPU.\n");
+		return KDB_SUCCESS;
+	} else if(argc > 2) {
+		kdb_printf("Incorrect number of arguments. See 'help %s' for help.\n", argv[0]);
+		return KDB_FAILURE;
+	} else if(argc == 2 && strcmp(argv[1], "bench") != 0) {
+		kdb_printf("Unknown argument '%s'.\n", argv[1]);
+		return KDB_FAILURE;
+	}
+
+	kdb_printf("Method:     %s\n", fpu_method_names[x86_fpu_method]);
+	kdb_printf("Components: 0x%" PRIx64 "\n", x86_fpu_features);
+	kdb_printf("Area size:  %zu bytes\n", x86_fpu_size);
+
+	if(argc < 2)
+		return KDB_SUCCESS;
+
+	if(x86_fpu_size > FPU_BENCH_SIZE) {
+		kdb_printf("Save area is too large to benchmark.\n");
+		return KDB_FAILURE;
+	}
+
+	kdb_printf("\n");
+
+	/* Preserve any state that is live in the FPU. */
+	enabled = x86_fpu_state();
+	if(enabled) {
+		x86_fpu_save(fpu_bench_state[0]);
+	} else {
+		x86_fpu_enable();
+	}
+
+	fpu_bench();
+
+	if(enabled) {
+		x86_fpu_restore(fpu_bench_state[0]);
+	} else {
+		x86_fpu_disable();
+	}
+
+	return KDB_SUCCESS;
+}
+
+/** Detect the FPU state save method to use.
+ * @note		Called on the boot CPU once its features are known. */
+__init_text void x86_fpu_detect(void) {
+	uint32_t eax, ebx, ecx, edx;
+	uint64_t supported;
+
+	if(!cpu_features.xsave)
+		return;
+
+	x86_cpuid_count(X86_CPUID_XSAVE, 0, &eax, &ebx, &ecx, &edx);
+	supported = ((uint64_t)edx << 32) | eax;
+
+	if(cpu_features.avx && supported & X86_XCR0_AVX) {
+		x86_fpu_features |= X86_XCR0_AVX;
+
+		if((supported & XCR0_AVX512) == XCR0_AVX512)
+			x86_fpu_features |= XCR0_AVX512;
+	}
+
+	fpu_methods |= (1 << X86_FPU_XSAVE);
+	x86_fpu_method = X86_FPU_XSAVE;
+
+	x86_cpuid_count(X86_CPUID_XSAVE, 1, &eax, &ebx, &ecx, &edx);
+	if(eax & X86_XSAVE_XSAVEOPT) {
+		fpu_methods |= (1 << X86_FPU_XSAVEOPT);
+		x86_fpu_method = X86_FPU_XSAVEOPT;
+	}
+	if(eax & X86_XSAVE_XSAVES) {
+		fpu_methods |= (1 << X86_FPU_XSAVES);
+		x86_fpu_method = X86_FPU_XSAVES;
+	}
+}
+
+/** Enable the FPU state components on the current CPU. */
+__init_text void x86_fpu_init_percpu(void) {
+	if(x86_fpu_method == X86_FPU_FXSAVE)
+		return;
+
+	x86_write_cr4(x86_read_cr4() | X86_CR4_OSXSAVE);
+	x86_write_xcr(0, x86_fpu_features);
+
+	/* No supervisor state components are used. */
+	if(fpu_methods & (1 << X86_FPU_XSAVES))
+		x86_write_msr(X86_MSR_XSS, 0);
+}
+
+/** Set up FPU save area allocation. */
+__init_text void x86_fpu_late_init(void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	/* The save area size depends on the components that are enabled, so
+	 * this must be done after they have been on the boot CPU. */
+	if(x86_fpu_method != X86_FPU_FXSAVE) {
+		x86_cpuid_count(X86_CPUID_XSAVE, (x86_fpu_method == X86_FPU_XSAVES) ? 1 : 0,
+			&eax, &ebx, &ecx, &edx);
+		x86_fpu_size = ebx;
+	}
+
+	*(uint16_t *)&x86_fpu_init_state[X86_FPU_OFF_FCW] = 0x37f;
+	*(uint32_t *)&x86_fpu_init_state[X86_FPU_OFF_MXCSR] = 0x1f80;
+	if(x86_fpu_method == X86_FPU_XSAVES)
+		*(uint64_t *)&x86_fpu_init_state[X86_FPU_OFF_XCOMP_BV] = (1ULL << 63) | x86_fpu_features;
+
+	kprintf(LOG_NOTICE, "fpu: using %s, components 0x%" PRIx64 ", %zu byte save area\n",
+		fpu_method_names[x86_fpu_method], x86_fpu_features, x86_fpu_size);
+
+	fpu_state_cache = slab_cache_create("fpu_state_cache", x86_fpu_size,
+		X86_FPU_ALIGN, fpu_state_ctor, NULL, NULL, 0, MM_BOOT);
+
+	kdb_register_command("fpu", "Show FPU state save information.", kdb_cmd_fpu);
+}
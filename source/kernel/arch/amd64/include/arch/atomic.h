@@ -92,7 +92,8 @@ static inline int32_t atomic_cas(atomic_t *var, int32_t cmp, int32_t val) {
 	__asm__ volatile(
 		"lock cmpxchgl	%3, %1\n\t"
 		: "=a"(r), "+m"(*var)
-		: "0"(cmp), "r"(val));
+		: "0"(cmp), "r"(val)
+		: "memory");
 	return r;
 }
 
@@ -165,7 +166,8 @@ static inline int64_t atomic_cas64(atomic64_t *var, int64_t cmp, int64_t val) {
 		"lock\n\t"
 		"cmpxchgq	%3, %1"
 		: "=a"(r), "+m"(*var)
-		: "0"(cmp), "r"(val));
+		: "0"(cmp), "r"(val)
+		: "memory");
 	return r;
 }
 
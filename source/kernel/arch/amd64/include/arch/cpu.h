@@ -40,6 +40,7 @@ typedef struct arch_cpu {
 
 	/** Time conversion factors. */
 	uint64_t cycles_per_us;			/**< CPU cycles per µs. */
+	uint64_t system_time_mult;		/**< Nanoseconds per cycle << TIME_PAGE_SHIFT. */
 	uint64_t lapic_timer_cv;		/**< LAPIC timer conversion factor. */
 	int64_t system_time_offset;		/**< Value to subtract from TSC value for system_time(). */
 
@@ -74,9 +75,13 @@ static inline __noreturn void arch_cpu_halt(void) {
 		__asm__ volatile("cli; hlt");
 }
 
-/** Place the CPU in an idle state until an interrupt occurs. */
-static inline void arch_cpu_idle(void) {
-	__asm__ volatile("sti; hlt; cli");
+/** Get the value of the CPU cycle counter.
+ * @return		Current cycle count. */
+static inline uint64_t arch_cpu_cycles(void) {
+	uint32_t high, low;
+
+	__asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
 }
 
 /** CPU-specific spin loop hint. */
@@ -92,4 +97,6 @@ static inline void arch_cpu_invalidate_caches(void) {
 	__asm__ volatile("wbinvd");
 }
 
+extern void arch_cpu_idle(void);
+
 #endif /* __ARCH_CPU_H */
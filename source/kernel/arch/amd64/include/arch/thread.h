@@ -54,8 +54,8 @@ typedef struct __packed arch_thread {
 	/** Number of consecutive runs that the FPU is used for. */
 	unsigned fpu_count;
 
-	/** FPU context save point. */
-	char fpu[512] __aligned(16);
+	/** FPU context save area (x86_fpu_size bytes). */
+	void *fpu;
 } arch_thread_t;
 
 /** Get the current thread structure pointer.
@@ -49,6 +49,7 @@
 #define X86_CR4_OSXMMEXCPT	(1<<10)		/**< OS Support for Unmasked SIMD FPU Exceptions. */
 #define X86_CR4_VMXE		(1<<13)		/**< VMX-Enable Bit. */
 #define X86_CR4_SMXE		(1<<14)		/**< SMX-Enable Bit. */
+#define X86_CR4_OSXSAVE		(1<<18)		/**< XSAVE and Processor Extended States Enable. */
 
 /** Flags in the debug status register (DR6). */
 #define X86_DR6_B0		(1<<0)		/**< Breakpoint 0 condition detected. */
@@ -90,7 +91,9 @@
 #define X86_MSR_MTRR_BASE0	0x200		/**< Base of the variable length MTRR base registers. */
 #define X86_MSR_MTRR_MASK0	0x201		/**< Base of the variable length MTRR mask registers. */
 #define X86_MSR_CR_PAT		0x277		/**< PAT. */
+#define X86_MSR_TSC_DEADLINE	0x6E0		/**< TSC-deadline timer target. */
 #define X86_MSR_MTRR_DEF_TYPE	0x2FF		/**< Default MTRR type. */
+#define X86_MSR_XSS		0xDA0		/**< Supervisor state components for XSAVES. */
 #define X86_MSR_EFER		0xC0000080	/**< Extended Feature Enable register. */
 #define X86_MSR_STAR		0xC0000081	/**< System Call Target Address. */
 #define X86_MSR_LSTAR		0xC0000082	/**< 64-bit System Call Target Address. */
@@ -98,6 +101,7 @@
 #define X86_MSR_FS_BASE		0xC0000100	/**< FS segment base register. */
 #define X86_MSR_GS_BASE		0xC0000101	/**< GS segment base register. */
 #define X86_MSR_KERNEL_GS_BASE	0xC0000102	/**< GS base to switch to with SWAPGS. */
+#define X86_MSR_TSC_AUX		0xC0000103	/**< Auxiliary TSC value (returned by RDTSCP). */
 
 /** EFER MSR flags. */
 #define X86_EFER_SCE		(1<<0)		/**< System Call Enable. */
@@ -117,6 +121,7 @@
 #define X86_CPUID_PERFMON	0x0000000A	/**< Architectural Performance Monitor Features. */
 #define X86_CPUID_X2APIC	0x0000000B	/**< x2APIC Features/Processor Topology. */
 #define X86_CPUID_XSAVE		0x0000000D	/**< XSAVE Features. */
+#define X86_CPUID_V2_TOPOLOGY	0x0000001F	/**< V2 Extended Processor Topology. */
 
 /** Extended CPUID function definitions. */
 #define X86_CPUID_EXT_MAX	0x80000000	/**< Largest Extended Function. */
@@ -127,6 +132,27 @@
 #define X86_CPUID_L2_CACHE	0x80000006	/**< Extended L2 Cache Features. */
 #define X86_CPUID_ADVANCED_PM	0x80000007	/**< Advanced Power Management. */
 #define X86_CPUID_ADDRESS_SIZE	0x80000008	/**< Virtual/Physical Address Sizes. */
+#define X86_CPUID_CACHE_TOPOLOGY 0x8000001D	/**< Cache Topology Information (AMD). */
+
+/** MONITOR/MWAIT leaf ECX flags. */
+#define X86_MWAIT_EXTENSIONS	(1<<0)		/**< Enumeration of extensions supported. */
+#define X86_MWAIT_INTR_BREAK	(1<<1)		/**< Interrupts break MWAIT with IF clear. */
+
+/** Power management leaf EAX flags. */
+#define X86_POWER_ARAT		(1<<2)		/**< APIC timer runs in all C-states. */
+
+/** XSAVE leaf sub-leaf 1 EAX flags. */
+#define X86_XSAVE_XSAVEOPT	(1<<0)		/**< XSAVEOPT is supported. */
+#define X86_XSAVE_XSAVEC	(1<<1)		/**< XSAVEC and the compacted format are supported. */
+#define X86_XSAVE_XSAVES	(1<<3)		/**< XSAVES/XRSTORS and IA32_XSS are supported. */
+
+/** Extended control register 0 (XCR0) state components. */
+#define X86_XCR0_X87		(1<<0)		/**< x87 FPU state. */
+#define X86_XCR0_SSE		(1<<1)		/**< SSE (XMM) state. */
+#define X86_XCR0_AVX		(1<<2)		/**< AVX (upper halves of YMM) state. */
+#define X86_XCR0_OPMASK		(1<<5)		/**< AVX-512 opmask state. */
+#define X86_XCR0_ZMM_HI256	(1<<6)		/**< AVX-512 upper halves of ZMM0-15. */
+#define X86_XCR0_HI16_ZMM	(1<<7)		/**< AVX-512 ZMM16-31. */
 
 #ifndef __ASM__
 
@@ -220,7 +246,9 @@ typedef struct x86_features {
 			unsigned syscall : 1;
 			unsigned : 8;
 			unsigned xd : 1;
-			unsigned : 8;
+			unsigned : 6;
+			unsigned rdtscp : 1;
+			unsigned : 1;
 			unsigned lmode : 1;
 		};
 		uint32_t extended_edx;
@@ -230,7 +258,9 @@ typedef struct x86_features {
 	union {
 		struct {
 			unsigned lahf : 1;
-			unsigned : 31;
+			unsigned : 21;
+			unsigned topoext : 1;
+			unsigned : 9;
 		};
 		uint32_t extended_ecx;
 	};
@@ -238,6 +268,14 @@ typedef struct x86_features {
 
 extern x86_features_t cpu_features;
 
+/** Type of an idle state selection function.
+ * @param duration	Expected time until the next timer event, or -1 if
+ *			there is none.
+ * @return		MWAIT hint for the state to enter. */
+typedef uint32_t (*x86_idle_select_t)(nstime_t duration);
+
+extern x86_idle_select_t x86_idle_select;
+
 #define GEN_READ_REG(name, type)	\
 	static inline type x86_read_ ## name (void) { \
 		type r; \
@@ -370,12 +408,60 @@ static inline void x86_cpuid(uint32_t level, uint32_t *a, uint32_t *b, uint32_t
 	__asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "0"(level));
 }
 
+/** Execute the CPUID instruction for a leaf with sub-leaves.
+ * @param level		CPUID level.
+ * @param index		Sub-leaf index.
+ * @param a		Where to store EAX value.
+ * @param b		Where to store EBX value.
+ * @param c		Where to store ECX value.
+ * @param d		Where to store EDX value. */
+static inline void x86_cpuid_count(uint32_t level, uint32_t index, uint32_t *a,
+	uint32_t *b, uint32_t *c, uint32_t *d) {
+	__asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d)
+		: "0"(level), "2"(index));
+}
+
 /** Invalidate a TLB entry.
  * @param addr		Address to invalidate. */
 static inline void x86_invlpg(ptr_t addr) {
 	__asm__ volatile("invlpg (%0)" :: "r"(addr));
 }
 
+/** Set up an address range for monitoring by MWAIT.
+ * @param addr		Address to monitor.
+ * @param ext		Extensions.
+ * @param hints		Hints. */
+static inline void x86_monitor(const volatile void *addr, uint32_t ext, uint32_t hints) {
+	__asm__ volatile("monitor" :: "a"(addr), "c"(ext), "d"(hints));
+}
+
+/** Enable interrupts and wait for a write to the monitored address.
+ * @note		Interrupts are disabled again on return. As with
+ *			STI; HLT, the STI interrupt shadow ensures that an
+ *			interrupt cannot be taken before MWAIT is executing.
+ * @param hints		MWAIT hints (target C-state).
+ * @param ext		Extensions. */
+static inline void x86_mwait(uint32_t hints, uint32_t ext) {
+	__asm__ volatile("sti; mwait; cli" :: "a"(hints), "c"(ext) : "memory");
+}
+
+/** Read an extended control register.
+ * @param index		Index of the register.
+ * @return		Value of the register. */
+static inline uint64_t x86_read_xcr(uint32_t index) {
+	uint32_t low, high;
+
+	__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(index));
+	return (((uint64_t)high) << 32) | low;
+}
+
+/** Write an extended control register.
+ * @param index		Index of the register.
+ * @param value		Value to write. */
+static inline void x86_write_xcr(uint32_t index, uint64_t value) {
+	__asm__ volatile("xsetbv" :: "a"((uint32_t)value), "d"((uint32_t)(value >> 32)), "c"(index));
+}
+
 extern uint64_t calculate_frequency(uint64_t (*func)());
 
 #endif /* __ASM__ */
@@ -32,16 +32,82 @@
 #define X86_FPU_STATUS_UE	(1<<4)	/**< Underflow. */
 #define X86_FPU_STATUS_PE	(1<<5)	/**< Precision. */
 
-/** Save FPU state.
+/** FPU state save methods, in order of preference. */
+#define X86_FPU_FXSAVE		0	/**< FXSAVE/FXRSTOR (x87/SSE only). */
+#define X86_FPU_XSAVE		1	/**< XSAVE/XRSTOR. */
+#define X86_FPU_XSAVEOPT	2	/**< XSAVEOPT/XRSTOR. */
+#define X86_FPU_XSAVES		3	/**< XSAVES/XRSTORS (compacted format). */
+#define X86_FPU_METHOD_COUNT	4
+
+/** Offsets of fields in the FPU save area. */
+#define X86_FPU_OFF_FCW		0	/**< x87 control word. */
+#define X86_FPU_OFF_MXCSR	24	/**< MXCSR register. */
+#define X86_FPU_OFF_XSTATE_BV	512	/**< XSAVE header: components saved. */
+#define X86_FPU_OFF_XCOMP_BV	520	/**< XSAVE header: compaction mask. */
+
+/** Size of the legacy area plus the XSAVE header. */
+#define X86_FPU_HEADER_SIZE	576
+
+/** Alignment required for the FPU save area. */
+#define X86_FPU_ALIGN		64
+
+extern unsigned x86_fpu_method;
+extern uint64_t x86_fpu_features;
+extern size_t x86_fpu_size;
+extern char x86_fpu_init_state[];
+
+/** Save FPU state with a specific method.
+ * @param method	Method to use (X86_FPU_*).
  * @param buf		Buffer to save into. */
-static inline void x86_fpu_save(char buf[512]) {
-	__asm__ __volatile__("fxsave (%0)" :: "r"(buf));
+static inline void x86_fpu_save_method(unsigned method, void *buf) {
+	uint32_t low = x86_fpu_features, high = x86_fpu_features >> 32;
+
+	switch(method) {
+	case X86_FPU_XSAVES:
+		__asm__ __volatile__("xsaves64 (%0)" :: "r"(buf), "a"(low), "d"(high) : "memory");
+		break;
+	case X86_FPU_XSAVEOPT:
+		__asm__ __volatile__("xsaveopt64 (%0)" :: "r"(buf), "a"(low), "d"(high) : "memory");
+		break;
+	case X86_FPU_XSAVE:
+		__asm__ __volatile__("xsave64 (%0)" :: "r"(buf), "a"(low), "d"(high) : "memory");
+		break;
+	default:
+		__asm__ __volatile__("fxsave (%0)" :: "r"(buf) : "memory");
+		break;
+	}
+}
+
+/** Restore FPU state with a specific method.
+ * @param method	Method that the state was saved with (X86_FPU_*).
+ * @param buf		Buffer to restore from. */
+static inline void x86_fpu_restore_method(unsigned method, void *buf) {
+	uint32_t low = x86_fpu_features, high = x86_fpu_features >> 32;
+
+	switch(method) {
+	case X86_FPU_XSAVES:
+		__asm__ __volatile__("xrstors64 (%0)" :: "r"(buf), "a"(low), "d"(high) : "memory");
+		break;
+	case X86_FPU_XSAVEOPT:
+	case X86_FPU_XSAVE:
+		__asm__ __volatile__("xrstor64 (%0)" :: "r"(buf), "a"(low), "d"(high) : "memory");
+		break;
+	default:
+		__asm__ __volatile__("fxrstor (%0)" :: "r"(buf) : "memory");
+		break;
+	}
+}
+
+/** Save FPU state.
+ * @param buf		Buffer to save into (x86_fpu_size bytes). */
+static inline void x86_fpu_save(void *buf) {
+	x86_fpu_save_method(x86_fpu_method, buf);
 }
 
 /** Restore FPU state.
  * @param buf		Buffer to restore from. */
-static inline void x86_fpu_restore(char buf[512]) {
-	__asm__ __volatile__("fxrstor (%0)" :: "r"(buf));
+static inline void x86_fpu_restore(void *buf) {
+	x86_fpu_restore_method(x86_fpu_method, buf);
 }
 
 /** Check whether the FPU is enabled.
@@ -60,9 +126,12 @@ static inline void x86_fpu_disable(void) {
 	x86_write_cr0(x86_read_cr0() | X86_CR0_TS);
 }
 
-/** Reset the FPU state. */
+/** Reset the FPU state.
+ * @note		This restores a clean state rather than using FNINIT,
+ *			so that no SSE/AVX register contents are left over
+ *			from the previous user of the FPU. */
 static inline void x86_fpu_init(void) {
-	__asm__ __volatile__("fninit");
+	x86_fpu_restore(x86_fpu_init_state);
 }
 
 /** Read the FPU control word.
@@ -92,4 +161,11 @@ static inline uint32_t x86_fpu_mxcsr(void) {
 	return mxcsr;
 }
 
+extern void *x86_fpu_alloc(unsigned mmflag);
+extern void x86_fpu_free(void *state);
+
+extern void x86_fpu_detect(void);
+extern void x86_fpu_init_percpu(void);
+extern void x86_fpu_late_init(void);
+
 #endif /* __X86_FPU_H */
@@ -81,6 +81,11 @@
 #define LAPIC_TIMER_DIV64		0x9	/**< Divide by 64. */
 #define LAPIC_TIMER_DIV128		0xA	/**< Divide by 128. */
 
+/** Local APIC LVT timer modes. */
+#define LAPIC_TIMER_ONESHOT		(0<<17)	/**< One-shot (initial count). */
+#define LAPIC_TIMER_PERIODIC		(1<<17)	/**< Periodic (initial count). */
+#define LAPIC_TIMER_TSC_DEADLINE	(2<<17)	/**< TSC-deadline (X86_MSR_TSC_DEADLINE). */
+
 /** Local APIC interrupt vectors. */
 #define LAPIC_VECT_TIMER		0xf0	/**< Timer. */
 #define LAPIC_VECT_SPURIOUS		0xf1	/**< Spurious. */
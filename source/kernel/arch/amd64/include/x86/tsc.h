@@ -30,6 +30,8 @@ static inline uint64_t x86_rdtsc(void) {
 	return ((uint64_t)high << 32) | low;
 }
 
+extern uint64_t tsc_from_system_time(nstime_t time);
+
 extern void tsc_init_target(void);
 extern void tsc_init_source(void);
 
@@ -35,6 +35,8 @@
 #include <proc/sched.h>
 #include <proc/thread.h>
 
+#include <sync/rcu.h>
+
 #include <kdb.h>
 #include <kernel.h>
 #include <setjmp.h>
@@ -283,6 +285,12 @@ void interrupt_handler(frame_t *frame) {
 		 * signal frame setup/restore code. */
 		curr_thread->arch.user_frame = frame;
 		thread_at_kernel_entry();
+
+		/* The CPU was not within an RCU read-side critical section. */
+		rcu_quiescent();
+	} else if(unlikely(curr_cpu->rcu_idle)) {
+		/* The handler may use RCU, so we must stop being idle. */
+		rcu_idle_exit();
 	}
 
 	/* Call the handler. */
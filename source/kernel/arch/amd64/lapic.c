@@ -19,11 +19,13 @@
  * @brief		AMD64 local APIC code.
  */
 
+#include <arch/barrier.h>
 #include <arch/io.h>
 
 #include <x86/cpu.h>
 #include <x86/interrupt.h>
 #include <x86/lapic.h>
+#include <x86/tsc.h>
 
 #include <lib/string.h>
 
@@ -38,6 +40,7 @@
 #include <time.h>
 
 LAOS_BOOLEAN_OPTION("lapic_disabled", "Disable Local APIC usage (disables SMP)", false);
+LAOS_BOOLEAN_OPTION("tsc_deadline_disabled", "Disable the LAPIC TSC-deadline timer mode", false);
 
 /** Local APIC mapping. If NULL the LAPIC is not present. */
 static volatile uint32_t *lapic_mapping = NULL;
@@ -45,6 +48,9 @@ static volatile uint32_t *lapic_mapping = NULL;
 /** Local APIC base address. */
 static phys_ptr_t lapic_base = 0;
 
+/** Whether the timer is in TSC-deadline mode. */
+static bool lapic_tsc_deadline = false;
+
 /** Read from a register in the current CPU's local APIC.
  * @param reg		Register to read from.
  * @return		Value read from register. */
@@ -84,6 +90,12 @@ static void lapic_timer_prepare(nstime_t nsecs) {
 	lapic_write(LAPIC_REG_TIMER_INITIAL, (count == 0 && nsecs != 0) ? 1 : count);
 }
 
+/** Prepare local APIC timer tick in TSC-deadline mode.
+ * @param target	System time to tick at. */
+static void lapic_deadline_prepare(nstime_t target) {
+	x86_write_msr(X86_MSR_TSC_DEADLINE, tsc_from_system_time(target));
+}
+
 /** Local APIC timer device. */
 static timer_device_t lapic_timer_device = {
 	.name = "LAPIC",
@@ -91,6 +103,14 @@ static timer_device_t lapic_timer_device = {
 	.prepare = lapic_timer_prepare,
 };
 
+/** Local APIC timer device in TSC-deadline mode. */
+static timer_device_t lapic_deadline_device = {
+	.name = "LAPIC TSC-deadline",
+	.type = TIMER_DEVICE_ONESHOT,
+	.prepare = lapic_timer_prepare,
+	.prepare_at = lapic_deadline_prepare,
+};
+
 /** Timer interrupt handler.
  * @param frame		Interrupt stack frame. */
 static void lapic_timer_interrupt(frame_t *frame) {
@@ -207,8 +227,12 @@ __init_text void lapic_init(void) {
 	kprintf(LOG_NOTICE, "lapic: physical location 0x%" PRIxPHYS ", mapped to %p\n",
 		base, lapic_mapping);
 
-	/* Install the LAPIC timer device. */
-	timer_device_set(&lapic_timer_device);
+	/* Install the LAPIC timer device. In TSC-deadline mode the timer is
+	 * programmed with the absolute TSC value to fire at, so there is no
+	 * conversion from a relative time and no calibration error. */
+	lapic_tsc_deadline = cpu_features.tscd
+		&& !laos_boolean_option("tsc_deadline_disabled");
+	timer_device_set((lapic_tsc_deadline) ? &lapic_deadline_device : &lapic_timer_device);
 
 	/* Install interrupt vectors. */
 	interrupt_table[LAPIC_VECT_SPURIOUS] = lapic_spurious_interrupt;
@@ -249,7 +273,17 @@ __init_text void lapic_init_percpu(void) {
 	/* Accept all interrupts. */
 	lapic_write(LAPIC_REG_TPR, lapic_read(LAPIC_REG_TPR) & 0xFFFFFF00);
 
-	/* Enable the timer: interrupt vector, no extra bits = Unmasked/One-shot. */
+	/* Enable the timer: interrupt vector, unmasked, one-shot or
+	 * TSC-deadline mode. */
 	lapic_write(LAPIC_REG_TIMER_INITIAL, 0);
-	lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_VECT_TIMER);
+	if(lapic_tsc_deadline) {
+		lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_VECT_TIMER | LAPIC_TIMER_TSC_DEADLINE);
+
+		/* Make sure the mode change is visible before the deadline
+		 * MSR is first written. */
+		memory_barrier();
+		x86_write_msr(X86_MSR_TSC_DEADLINE, 0);
+	} else {
+		lapic_write(LAPIC_REG_LVT_TIMER, LAPIC_VECT_TIMER | LAPIC_TIMER_ONESHOT);
+	}
 }
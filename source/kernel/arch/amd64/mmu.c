@@ -318,8 +318,11 @@ static status_t amd64_mmu_init(mmu_context_t *ctx, unsigned mmflag) {
  * @param ctx		Context to destroy. */
 static void amd64_mmu_destroy(mmu_context_t *ctx) {
 	uint64_t *pml4, *pdp, *pdir;
+	page_batch_t batch;
 	unsigned i, j, k;
 
+	page_batch_init(&batch);
+
 	/* Free all structures in the bottom half of the PML4 (user memory). */
 	pml4 = map_structure(ctx->arch.pml4);
 	for(i = 0; i < 256; i++) {
@@ -338,16 +341,17 @@ static void amd64_mmu_destroy(mmu_context_t *ctx) {
 
 				assert(!(pdir[k] & X86_PTE_LARGE));
 
-				phys_free(pdir[k] & PHYS_PAGE_MASK, PAGE_SIZE);
+				page_batch_add(&batch, page_lookup(pdir[k] & PHYS_PAGE_MASK));
 			}
 
-			phys_free(pdp[j] & PHYS_PAGE_MASK, PAGE_SIZE);
+			page_batch_add(&batch, page_lookup(pdp[j] & PHYS_PAGE_MASK));
 		}
 
-		phys_free(pml4[i] & PHYS_PAGE_MASK, PAGE_SIZE);
+		page_batch_add(&batch, page_lookup(pml4[i] & PHYS_PAGE_MASK));
 	}
 
-	phys_free(ctx->arch.pml4, PAGE_SIZE);
+	page_batch_add(&batch, page_lookup(ctx->arch.pml4));
+	page_batch_flush(&batch);
 }
 
 /** Map a page in a context.
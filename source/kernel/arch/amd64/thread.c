@@ -60,6 +60,7 @@ arch_thread_init(thread_t *thread)
     thread->arch.flags = 0;
     thread->arch.tls_base = 0;
     thread->arch.fpu_count = 0;
+    thread->arch.fpu = x86_fpu_alloc(MM_KERNEL);
 
     /* Point the RSP for SYSCALL entry at the top of the stack. */
     thread->arch.kernel_rsp = (ptr_t)thread->kstack + KSTACK_SIZE;
@@ -87,7 +88,7 @@ arch_thread_init(thread_t *thread)
 void
 arch_thread_destroy(thread_t *thread)
 {
-    /* Nothing happens. */
+    x86_fpu_free(thread->arch.fpu);
 }
 
 /**
@@ -107,8 +108,8 @@ arch_thread_clone(thread_t *thread, frame_t *frame)
         /* FPU is currently enabled so the latest state may not have
          * been saved. */
         x86_fpu_save(thread->arch.fpu);
-    } else if(curr_thread->flags & ARCH_THREAD_HAVE_FPU) {
-        memcpy(thread->arch.fpu, curr_thread->arch.fpu, sizeof(thread->arch.fpu));
+    } else if(curr_thread->arch.flags & ARCH_THREAD_HAVE_FPU) {
+        memcpy(thread->arch.fpu, curr_thread->arch.fpu, x86_fpu_size);
     }
 
     /* Duplicate the user interrupt frame. This should be valid as we
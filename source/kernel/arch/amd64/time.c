@@ -18,19 +18,20 @@
  * @file
  * @brief		AMD64 time handling functions.
  *
+ * The system time is calculated from the TSC with a fixed point multiplier:
+ * (tsc - offset) * mult >> TIME_PAGE_SHIFT. The multiplication is done to
+ * 128 bits so that none of the TSC is lost. The same calculation is done by
+ * libkernel using the values in the time page, with RDTSCP giving both the
+ * TSC and the ID of the CPU it was read on (through the TSC_AUX MSR).
+ *
  * @todo		Handle systems where the TSC is not invariant. We
  *			should use the HPET or PIT on such systems.
- * @todo		Because I'm lazy this is only microsecond resolution
- *			at the moment. Doing nanosecond resolution requires
- *			some fixed point maths fun. Something along the lines
- *			of:
- *			 cv_factor = (cpu_freq << 32) / ns_per_sec;
- *			 time = (tsc << 32) / ns_per_sec;
- *			The problem with this, however, is that you lose the
- *			top 32 bits of the TSC, which is really not very
- *			useful.
  */
 
+#include <arch/page.h>
+
+#include <kernel/private/time.h>
+
 #include <x86/cpu.h>
 #include <x86/smp.h>
 #include <x86/tsc.h>
@@ -46,15 +47,45 @@ static volatile nstime_t system_time_sync __init_data;
 /** Get the system time (number of nanoseconds since boot).
  * @return		Number of nanoseconds since system was booted. */
 nstime_t system_time(void) {
-	uint64_t usecs;
+	uint64_t cycles, mult;
 
 	preempt_disable();
+	cycles = x86_rdtsc() - curr_cpu->arch.system_time_offset;
+	mult = curr_cpu->arch.system_time_mult;
+	preempt_enable();
 
-	usecs = (x86_rdtsc() - curr_cpu->arch.system_time_offset)
-		/ curr_cpu->arch.cycles_per_us;
+	return ((unsigned __int128)cycles * mult) >> TIME_PAGE_SHIFT;
+}
 
-	preempt_enable();
-	return USECS2NSECS(usecs);
+/** Convert a number of CPU cycles to nanoseconds.
+ * @param cycles	Number of cycles (e.g. a difference between two
+ *			arch_cpu_cycles() values).
+ * @return		Number of nanoseconds. */
+nstime_t arch_cycles_to_nsecs(uint64_t cycles) {
+	return ((unsigned __int128)cycles * curr_cpu->arch.system_time_mult) >> TIME_PAGE_SHIFT;
+}
+
+/** Convert a system time to a TSC value on the current CPU.
+ * @param time		System time to convert.
+ * @return		Earliest TSC value at which system_time() returns at
+ *			least the given time. */
+uint64_t tsc_from_system_time(nstime_t time) {
+	uint64_t mult = curr_cpu->arch.system_time_mult;
+	uint64_t high, low, cycles, rem;
+
+	/* This is the inverse of system_time(): divide the time shifted up by
+	 * the multiplier, rounding up. The 128 by 64 bit division faults if
+	 * the quotient does not fit in 64 bits, so saturate instead. */
+	high = (uint64_t)time >> (64 - TIME_PAGE_SHIFT);
+	low = (uint64_t)time << TIME_PAGE_SHIFT;
+	if(high >= mult)
+		return UINT64_MAX;
+
+	__asm__("divq %4" : "=a"(cycles), "=d"(rem) : "a"(low), "d"(high), "rm"(mult));
+	if(rem)
+		cycles++;
+
+	return cycles + curr_cpu->arch.system_time_offset;
 }
 
 /** Spin for a certain amount of time.
@@ -98,6 +129,14 @@ void spin(nstime_t nsecs) {
 
 /** Set up the boot time offset. */
 __init_text void tsc_init_target(void) {
+	/* Work out the multiplier to convert cycles to nanoseconds. */
+	curr_cpu->arch.system_time_mult =
+		(SECS2NSECS(1) << TIME_PAGE_SHIFT) / curr_cpu->arch.cpu_freq;
+
+	/* Make RDTSCP return the CPU ID, for the time page. */
+	if(cpu_features.rdtscp)
+		x86_write_msr(X86_MSR_TSC_AUX, curr_cpu->id);
+
 	/* Calculate the offset to subtract from the TSC when calculating the
 	 * system time. For the boot CPU, this is the current value of the TSC,
 	 * so the system time at this point is 0. For other CPUs, we need to
@@ -120,6 +159,29 @@ __init_text void tsc_init_target(void) {
 	}
 }
 
+/** Fill in the per-CPU TSC parameters in the time page.
+ * @param page		Time page to fill in. */
+__init_text void arch_time_page_init(time_page_t *page) {
+	size_t max = (PAGE_SIZE - sizeof(*page)) / sizeof(page->cpus[0]);
+	cpu_id_t i;
+
+	/* Without RDTSCP, userspace cannot tell which CPU's parameters to use.
+	 * The page is left with no entries so that libkernel falls back to
+	 * kern_time_get(). */
+	if(!cpu_features.rdtscp || highest_cpu_id >= max)
+		return;
+
+	for(i = 0; i <= highest_cpu_id; i++) {
+		if(!cpus[i])
+			continue;
+
+		page->cpus[i].offset = cpus[i]->arch.system_time_offset;
+		page->cpus[i].mult = cpus[i]->arch.system_time_mult;
+	}
+
+	page->cpu_count = highest_cpu_id + 1;
+}
+
 /** Boot CPU side of TSC initialization. */
 __init_text void tsc_init_source(void) {
 	/* Wait for the AP to get into tsc_init_target(). */
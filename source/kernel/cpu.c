@@ -26,7 +26,9 @@
  */
 
 #include <lib/string.h>
+#include <lib/utility.h>
 
+#include <mm/kmem.h>
 #include <mm/malloc.h>
 #include <mm/page.h>
 
@@ -55,6 +57,7 @@ volatile int cpu_boot_wait = 0;
 static void cpu_ctor(cpu_t *cpu, cpu_id_t id, int state) {
 	memset(cpu, 0, sizeof(cpu_t));
 	list_init(&cpu->header);
+	list_init(&cpu->package_link);
 	cpu->id = id;
 	cpu->state = state;
 
@@ -65,7 +68,7 @@ static void cpu_ctor(cpu_t *cpu, cpu_id_t id, int state) {
 	#endif
 
 	/* Initialize timer information. */
-	list_init(&cpu->timers);
+	timer_wheel_init(&cpu->timers);
 	spinlock_init(&cpu->timer_lock, "timer_lock");
 }
 
@@ -79,7 +82,9 @@ cpu_t *cpu_register(cpu_id_t id, int state) {
 
 	assert(cpus);
 
-	cpu = kmalloc(sizeof(*cpu), MM_BOOT);
+	/* Parts of the structure are cache line aligned, which kmalloc()
+	 * does not guarantee. */
+	cpu = kmem_alloc(round_up(sizeof(*cpu), PAGE_SIZE), MM_BOOT);
 	cpu_ctor(cpu, id, state);
 
 	/* Resize the CPU array if required. */
@@ -114,8 +119,22 @@ __init_text void cpu_early_init(void) {
 /** Perform early per-CPU initialization.
  * @param cpu		Structure for the current CPU. */
 __init_text void cpu_early_init_percpu(cpu_t *cpu) {
+	cpu_t *other;
+
 	arch_cpu_early_init_percpu(cpu);
 
+	/* Now that the topology is known, join the ring of CPUs in the same
+	 * package, so that the scheduler does not have to search all CPUs
+	 * for nearby ones. */
+	LIST_FOREACH(&running_cpus, iter) {
+		other = list_entry(iter, cpu_t, header);
+
+		if(cpu_shares_package(cpu, other)) {
+			list_append(&other->package_link, &cpu->package_link);
+			break;
+		}
+	}
+
 	/* Add ourself to the running CPU list. */
 	cpu->state = CPU_RUNNING;
 	list_append(&running_cpus, &curr_cpu->header);
@@ -18,13 +18,22 @@
  * @file
  * @brief		Deferred procedure call functions.
  *
- * @todo		Per-CPU DPC thread.
+ * Each CPU has its own DPC thread and queues, so that deferring work does not
+ * contend with other CPUs and work is run on the CPU that queued it, where its
+ * data is likely to still be in the cache. A DPC is queued on whichever CPU
+ * calls dpc_queue(), and the thread for that CPU runs DPCs in priority order,
+ * oldest first within a priority.
+ *
+ * Users that queue the same work repeatedly, such as timers, embed a dpc_t in
+ * their own structures so that queueing never needs to allocate. One-off
+ * requests made with dpc_request() use structures from a per-CPU pool, which
+ * the DPC thread refills before it runs out so that requests can be made from
+ * interrupt context.
  */
 
-#include <lib/list.h>
+#include <lib/string.h>
 
-#include <mm/kmem.h>
-#include <mm/page.h>
+#include <mm/malloc.h>
 
 #include <proc/thread.h>
 
@@ -32,118 +41,377 @@
 #include <sync/spinlock.h>
 
 #include <assert.h>
+#include <cpu.h>
 #include <dpc.h>
+#include <kdb.h>
+#include <kernel.h>
 #include <status.h>
+#include <time.h>
+
+/** Number of pooled structures to allocate for each CPU initially. */
+#define DPC_POOL_SIZE		64
+
+/** Number of pooled structures below which the pool is refilled. */
+#define DPC_POOL_LOW		16
+
+/** DPC states. */
+#define DPC_IDLE		0	/**< Not queued. */
+#define DPC_QUEUEING		1	/**< Being added to a queue. */
+#define DPC_PENDING		2	/**< Queued and waiting to run. */
+
+/** Per-CPU DPC information structure. */
+typedef struct dpc_cpu {
+	spinlock_t lock;		/**< Lock to protect queues/pool. */
+	list_t queues[DPC_PRIORITY_COUNT];	/**< Queues of pending DPCs. */
+	semaphore_t sem;		/**< Semaphore that the thread waits on. */
+	thread_t *thread;		/**< DPC thread for the CPU. */
+
+	list_t pool;			/**< Free structures for dpc_request(). */
+	size_t pool_free;		/**< Number of free structures. */
+	size_t pool_total;		/**< Total number of structures allocated. */
+
+	/** Statistics. */
+	uint64_t queued;		/**< Number of DPCs queued. */
+	uint64_t run;			/**< Number of DPCs run. */
+	size_t depth;			/**< Current number of pending DPCs. */
+	size_t max_depth;		/**< Highest number of pending DPCs. */
+	nstime_t latency_total;		/**< Total time from queueing to running. */
+	nstime_t latency_max;		/**< Longest time from queueing to running. */
+} dpc_cpu_t;
+
+/** Add structures to a CPU's request pool.
+ * @param cpu		CPU to add to.
+ * @param count		Number of structures to add.
+ * @param mmflag	Allocation flags. */
+static void dpc_pool_grow(dpc_cpu_t *cpu, size_t count, unsigned mmflag) {
+	dpc_t *dpc;
+
+	while(count--) {
+		dpc = kmalloc(sizeof(*dpc), mmflag);
+		if(!dpc)
+			break;
+
+		dpc_prepare(dpc, NULL, NULL, DPC_PRIORITY_NORMAL);
+		dpc->dynamic = true;
 
-/** Structure describing a DPC request. */
-typedef struct dpc_request {
-	list_t header;			/**< Link to requests/free list. */
-	dpc_function_t function;	/**< Function to call. */
-	void *arg;			/**< Argument to pass to handler. */
-} dpc_request_t;
+		spinlock_lock(&cpu->lock);
+		list_append(&cpu->pool, &dpc->header);
+		cpu->pool_free++;
+		cpu->pool_total++;
+		spinlock_unlock(&cpu->lock);
+	}
+}
 
-/** Lists of free and pending DPC requests. */
-static LIST_DEFINE(dpc_free);
-static LIST_DEFINE(dpc_requests);
-static SPINLOCK_DEFINE(dpc_lock);
+/** Take the next DPC to run from a CPU's queues.
+ * @param cpu		CPU to take from (must be locked).
+ * @return		DPC to run, or NULL if none queued. */
+static dpc_t *dpc_next(dpc_cpu_t *cpu) {
+	dpc_t *dpc;
+	unsigned i;
 
-/** Semaphore that the DPC thread waits on. */
-static SEMAPHORE_DEFINE(dpc_request_sem, 0);
+	for(i = DPC_PRIORITY_COUNT; i > 0; i--) {
+		if(list_empty(&cpu->queues[i - 1]))
+			continue;
 
-/** DPC thread. */
-static thread_t *dpc_thread = NULL;
+		dpc = list_first(&cpu->queues[i - 1], dpc_t, header);
+		list_remove(&dpc->header);
+		atomic_set(&dpc->state, DPC_IDLE);
+		cpu->depth--;
+		return dpc;
+	}
+
+	return NULL;
+}
 
 /** DPC thread main function.
- * @param arg1		Unused.
+ * @param _cpu		DPC information for the thread's CPU.
  * @param arg2		Unused. */
-static void dpc_thread_func(void *arg1, void *arg2) {
-	dpc_request_t *request;
+static void dpc_thread_func(void *_cpu, void *arg2) {
+	dpc_cpu_t *cpu = _cpu;
+	dpc_function_t function;
+	nstime_t latency;
+	bool dynamic;
+	dpc_t *dpc;
+	void *arg;
 
 	while(true) {
-		semaphore_down(&dpc_request_sem);
-
-		/* Get the next request in the list. */
-		spinlock_lock(&dpc_lock);
-		assert(!list_empty(&dpc_requests));
-		request = list_first(&dpc_requests, dpc_request_t, header);
-		list_remove(&request->header);
-		spinlock_unlock(&dpc_lock);
-
-		/* Call the function. */
-		request->function(request->arg);
-
-		/* Return the structure to the free list. */
-		spinlock_lock(&dpc_lock);
-		list_prepend(&dpc_free, &request->header);
-		spinlock_unlock(&dpc_lock);
+		semaphore_down(&cpu->sem);
+
+		/* A cancelled DPC leaves the semaphore count behind, so the
+		 * queues may be empty. */
+		spinlock_lock(&cpu->lock);
+
+		dpc = dpc_next(cpu);
+		if(!dpc) {
+			spinlock_unlock(&cpu->lock);
+			continue;
+		}
+
+		latency = system_time() - dpc->queued_time;
+		cpu->run++;
+		cpu->latency_total += latency;
+		if(latency > cpu->latency_max)
+			cpu->latency_max = latency;
+
+		/* Once a pooled structure is back in the pool it may be reused
+		 * straight away, so take what we need from it first. */
+		function = dpc->function;
+		arg = dpc->arg;
+		dynamic = dpc->dynamic;
+		if(dynamic) {
+			list_append(&cpu->pool, &dpc->header);
+			cpu->pool_free++;
+		}
+
+		spinlock_unlock(&cpu->lock);
+
+		function(arg);
+
+		if(dynamic && cpu->pool_free < DPC_POOL_LOW)
+			dpc_pool_grow(cpu, DPC_POOL_SIZE - cpu->pool_free, MM_KERNEL);
 	}
 }
 
-/** DPC structure allocator.
- * @return		Pointer to allocated structure. */
-static dpc_request_t *dpc_request_alloc(void) {
-	dpc_request_t *request;
+/**
+ * Prepare a DPC.
+ *
+ * Initializes a DPC structure so that it can be queued with dpc_queue(). The
+ * structure must not be freed while it is queued.
+ *
+ * @param dpc		DPC to prepare.
+ * @param func		Function to call.
+ * @param arg		Argument to pass to the function.
+ * @param priority	Priority of the DPC (DPC_PRIORITY_*).
+ */
+void dpc_prepare(dpc_t *dpc, dpc_function_t func, void *arg, unsigned priority) {
+	assert(priority < DPC_PRIORITY_COUNT);
+
+	list_init(&dpc->header);
+	atomic_set(&dpc->state, DPC_IDLE);
+	dpc->cpu = NULL;
+	dpc->function = func;
+	dpc->arg = arg;
+	dpc->priority = priority;
+	dpc->dynamic = false;
+	dpc->queued_time = 0;
+}
+
+/** Add a DPC to the current CPU's queues.
+ * @param dpc		DPC to add (state must be DPC_QUEUEING). */
+static void dpc_enqueue(dpc_t *dpc) {
+	dpc_cpu_t *cpu = curr_cpu->dpc;
 
-	if(list_empty(&dpc_free)) {
-		/* TODO: Allocate more before we run out. */
-		fatal("Out of DPC request structures");
+	spinlock_lock_noirq(&cpu->lock);
+
+	dpc->cpu = cpu;
+	dpc->queued_time = system_time();
+	list_append(&cpu->queues[dpc->priority], &dpc->header);
+	atomic_set(&dpc->state, DPC_PENDING);
+
+	cpu->queued++;
+	if(++cpu->depth > cpu->max_depth)
+		cpu->max_depth = cpu->depth;
+
+	semaphore_up(&cpu->sem, 1);
+	spinlock_unlock_noirq(&cpu->lock);
+}
+
+/**
+ * Queue a DPC.
+ *
+ * Queues a DPC to be called by the DPC thread of the current CPU. If the DPC
+ * is already queued, it is not queued again and will only be called once.
+ * This function is safe to use from interrupt context.
+ *
+ * @param dpc		DPC to queue.
+ *
+ * @return		Whether the DPC was queued.
+ */
+bool dpc_queue(dpc_t *dpc) {
+	bool state;
+
+	/* Interrupts must be disabled while the DPC is in the queueing state,
+	 * as dpc_cancel() spins waiting for it to finish. */
+	state = local_irq_disable();
+
+	if(atomic_cas(&dpc->state, DPC_IDLE, DPC_QUEUEING) != DPC_IDLE) {
+		local_irq_restore(state);
+		return false;
 	}
 
-	request = list_first(&dpc_free, dpc_request_t, header);
-	list_remove(&request->header);
-	return request;
+	dpc_enqueue(dpc);
+	local_irq_restore(state);
+	return true;
+}
+
+/**
+ * Cancel a queued DPC.
+ *
+ * Removes a DPC from the queue it is on, if any. If the DPC has already been
+ * taken from the queue it may still be running or about to run on return.
+ *
+ * @param dpc		DPC to cancel.
+ *
+ * @return		Whether the DPC was removed from a queue.
+ */
+bool dpc_cancel(dpc_t *dpc) {
+	dpc_cpu_t *cpu;
+
+	while(true) {
+		switch(atomic_get(&dpc->state)) {
+		case DPC_IDLE:
+			return false;
+		case DPC_QUEUEING:
+			arch_cpu_spin_hint();
+			continue;
+		}
+
+		/* It may have been run and queued elsewhere since we looked,
+		 * check again now that the CPU is locked. */
+		cpu = dpc->cpu;
+		spinlock_lock(&cpu->lock);
+
+		if(dpc->cpu == cpu && atomic_get(&dpc->state) == DPC_PENDING) {
+			list_remove(&dpc->header);
+			atomic_set(&dpc->state, DPC_IDLE);
+			cpu->depth--;
+			spinlock_unlock(&cpu->lock);
+			return true;
+		}
+
+		spinlock_unlock(&cpu->lock);
+	}
 }
 
 /**
  * Make a DPC request.
  *
- * Adds a function to the DPC queue to be called by the DPC thread. This
- * function is safe to use from interrupt context.
+ * Queues a function to be called by the DPC thread of the current CPU, using
+ * a structure from the CPU's pool. This function is safe to use from
+ * interrupt context.
  *
  * @param function	Function to call.
  * @param arg		Argument to pass to the function.
+ *
+ * @return		STATUS_SUCCESS on success, STATUS_NO_MEMORY if the
+ *			pool is exhausted and more cannot be allocated.
  */
-void dpc_request(dpc_function_t function, void *arg) {
-	dpc_request_t *request;
+status_t dpc_request(dpc_function_t function, void *arg) {
+	dpc_cpu_t *cpu;
+	dpc_t *dpc;
+	bool state;
+
+	state = local_irq_disable();
+
+	cpu = curr_cpu->dpc;
+	spinlock_lock_noirq(&cpu->lock);
 
-	spinlock_lock(&dpc_lock);
+	if(list_empty(&cpu->pool)) {
+		spinlock_unlock_noirq(&cpu->lock);
+		local_irq_restore(state);
 
-	request = dpc_request_alloc();
-	request->function = function;
-	request->arg = arg;
+		/* If we were called with interrupts enabled we can allocate
+		 * a new structure, otherwise there is nothing we can do. */
+		if(!state)
+			return STATUS_NO_MEMORY;
+
+		dpc_pool_grow(cpu, 1, MM_KERNEL);
+		return dpc_request(function, arg);
+	}
 
-	/* Add it to the queue and wake up the DPC thread. */
-	list_append(&dpc_requests, &request->header);
-	semaphore_up(&dpc_request_sem, 1);
+	dpc = list_first(&cpu->pool, dpc_t, header);
+	list_remove(&dpc->header);
+	cpu->pool_free--;
 
-	spinlock_unlock(&dpc_lock);
+	spinlock_unlock_noirq(&cpu->lock);
+
+	dpc->function = function;
+	dpc->arg = arg;
+	dpc->priority = DPC_PRIORITY_NORMAL;
+	atomic_set(&dpc->state, DPC_QUEUEING);
+	dpc_enqueue(dpc);
+
+	local_irq_restore(state);
+	return STATUS_SUCCESS;
 }
 
 /** Check whether the DPC system has been initialized.
  * @return		Whether initialized. */
 bool dpc_inited(void) {
-	return dpc_thread;
+	return curr_cpu->dpc;
 }
 
-/** Initialize the DPC thread. */
+/** Print DPC statistics.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_dpc(int argc, char **argv, kdb_filter_t *filter) {
+	dpc_cpu_t *dpc;
+	cpu_t *cpu;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints the number of DPCs queued and run on each CPU, the current and\n");
+		kdb_printf("highest queue depth, how long DPCs waited to run, and the state of the\n");
+		kdb_printf("request pool.\n");
+		return KDB_SUCCESS;
+	}
+
+	kdb_printf("CPU  Queued     Run        Depth Max   Mean (us) Max (us)  Pool\n");
+	kdb_printf("===  ======     ===        ===== ===   ========= ========  ====\n");
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+		dpc = cpu->dpc;
+		if(!dpc)
+			continue;
+
+		kdb_printf("%-4" PRIu32 " %-10" PRIu64 " %-10" PRIu64 " %-5zu %-5zu "
+			"%-9" PRId64 " %-9" PRId64 " %zu/%zu\n", cpu->id,
+			dpc->queued, dpc->run, dpc->depth, dpc->max_depth,
+			(dpc->run) ? NSECS2USECS(dpc->latency_total / (nstime_t)dpc->run) : 0,
+			NSECS2USECS(dpc->latency_max), dpc->pool_free,
+			dpc->pool_total);
+	}
+
+	return KDB_SUCCESS;
+}
+
+/** Initialize the DPC system. */
 __init_text void dpc_init(void) {
-	dpc_request_t *alloc;
+	dpc_init_percpu();
+
+	kdb_register_command("dpc", "Print DPC statistics.", kdb_cmd_dpc);
+}
+
+/** Initialize DPCs for the current CPU. */
+__init_text void dpc_init_percpu(void) {
+	char name[THREAD_NAME_MAX];
+	dpc_cpu_t *cpu;
 	status_t ret;
-	size_t i;
-
-	/* Allocate a chunk of DPC structures. We do not allocate a new
-	 * structure upon every dpc_request() call to make it usable from
-	 * interrupt context. */
-	alloc = kmem_alloc(PAGE_SIZE, MM_BOOT);
-	for(i = 0; i < (PAGE_SIZE / sizeof(dpc_request_t)); i++) {
-		list_init(&alloc[i].header);
-		list_append(&dpc_free, &alloc[i].header);
-	}
+	unsigned i;
+
+	cpu = kmalloc(sizeof(*cpu), MM_BOOT);
+	memset(cpu, 0, sizeof(*cpu));
+	spinlock_init(&cpu->lock, "dpc_lock");
+	for(i = 0; i < DPC_PRIORITY_COUNT; i++)
+		list_init(&cpu->queues[i]);
+	semaphore_init(&cpu->sem, "dpc_sem", 0);
+	list_init(&cpu->pool);
 
-	/* Create the DPC thread */
-	ret = thread_create("dpc", NULL, 0, dpc_thread_func, NULL, NULL, &dpc_thread);
+	/* Allocate a chunk of structures for dpc_request(). We cannot
+	 * allocate upon every call to make it usable from interrupt context. */
+	dpc_pool_grow(cpu, DPC_POOL_SIZE, MM_BOOT);
+
+	/* Create the DPC thread, wired to this CPU. */
+	sprintf(name, "dpc-%" PRIu32, curr_cpu->id);
+	ret = thread_create(name, NULL, 0, dpc_thread_func, cpu, NULL, &cpu->thread);
 	if(ret != STATUS_SUCCESS)
 		fatal("Failed to create DPC thread: %d\n", ret);
 
-	thread_run(dpc_thread);
+	thread_wire(cpu->thread);
+
+	curr_cpu->dpc = cpu;
+	thread_run(cpu->thread);
 }
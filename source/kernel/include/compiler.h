@@ -34,6 +34,7 @@
 # define __printf(a, b)		__attribute__((format(printf, a, b)))
 # define __deprecated		__attribute__((deprecated))
 # define __always_inline	__attribute__((always_inline))
+# define __noinline		__attribute__((noinline))
 # ifdef __clang_analyzer__
 #  define __init_text		
 #  define __init_data		
@@ -26,6 +26,9 @@
 #include <lib/list.h>
 #include <sync/spinlock.h>
 
+#include <time.h>
+
+struct dpc_cpu;
 struct sched_cpu;
 struct smp_call;
 struct thread;
@@ -38,6 +41,22 @@ typedef struct cpu {
 	cpu_id_t id;			/**< ID of the CPU. */
 	arch_cpu_t arch;		/**< Architecture-specific information. */
 
+	/**
+	 * Position of the CPU in the system topology.
+	 *
+	 * These are filled in by the architecture code. The IDs are unique
+	 * across the whole system, so CPUs with the same ID at a level share
+	 * that level, but they have no meaning beyond that.
+	 */
+	struct {
+		uint32_t core;		/**< Core (shared by SMT threads). */
+		uint32_t cache;		/**< Last level cache. */
+		uint32_t package;	/**< Physical package. */
+	} topology;
+
+	/** Link into a ring of the running CPUs in the same package. */
+	list_t package_link;
+
 	/** Current state of the CPU. */
 	enum {
 		CPU_OFFLINE,		/**< Offline. */
@@ -51,10 +70,32 @@ typedef struct cpu {
 	bool should_preempt;		/**< Whether the CPU should be preempted. */
 	bool idle;			/**< Whether the CPU is idle. */
 
+	/**
+	 * Idle wakeup information.
+	 *
+	 * When the architecture supports it, an idle CPU waits for a write to
+	 * need_resched rather than for an interrupt, so that it can be woken
+	 * by a store instead of an IPI. idle_monitor is set while it does so.
+	 * These are on a cache line of their own, so that writes to other
+	 * fields of the structure do not cause spurious wakeups.
+	 */
+	struct {
+		volatile uint32_t need_resched;	/**< Set to wake the CPU from idle. */
+		volatile bool idle_monitor;	/**< Whether need_resched is being monitored. */
+	} __cacheline_aligned;
+
+	/** Deferred procedure call information. */
+	struct dpc_cpu *dpc;		/**< DPC queues and thread. */
+
 	/** Timer information. */
-	list_t timers;			/**< List of active timers. */
+	timer_wheel_t timers;		/**< Wheel of active timers. */
 	bool timer_enabled;		/**< Whether the timer device is enabled. */
-	spinlock_t timer_lock;		/**< Timer list lock. */
+	spinlock_t timer_lock;		/**< Timer wheel lock. */
+	bool timer_ticking;		/**< Whether timer handlers are being run. */
+
+	/** RCU information. */
+	volatile uint64_t rcu_qs;	/**< Number of quiescent states passed. */
+	volatile bool rcu_idle;		/**< Whether idle (always quiescent). */
 
 	#if CONFIG_SMP
 	/** SMP call information. */
@@ -62,6 +103,10 @@ typedef struct cpu {
 	bool ipi_sent;			/**< Whether an IPI has been sent to the CPU. */
 	struct smp_call *curr_call;	/**< SMP call currently being handled. */
 	spinlock_t call_lock;		/**< Lock to protect call queue. */
+
+	/** Spinlock queue information. */
+	spinlock_node_t spinlock_nodes[SPINLOCK_NODE_COUNT];
+	unsigned spinlock_node_count;	/**< Number of queue nodes in use. */
 	#endif
 } cpu_t;
 
@@ -75,6 +120,30 @@ typedef struct cpu {
  */
 #define curr_cpu	(arch_curr_cpu())
 
+/** Check whether two CPUs are threads of the same core.
+ * @param a		First CPU.
+ * @param b		Second CPU.
+ * @return		Whether the CPUs share a core. */
+static inline bool cpu_shares_core(cpu_t *a, cpu_t *b) {
+	return a->topology.core == b->topology.core;
+}
+
+/** Check whether two CPUs share their last level cache.
+ * @param a		First CPU.
+ * @param b		Second CPU.
+ * @return		Whether the CPUs share a cache. */
+static inline bool cpu_shares_cache(cpu_t *a, cpu_t *b) {
+	return a->topology.cache == b->topology.cache;
+}
+
+/** Check whether two CPUs are in the same physical package.
+ * @param a		First CPU.
+ * @param b		Second CPU.
+ * @return		Whether the CPUs share a package. */
+static inline bool cpu_shares_package(cpu_t *a, cpu_t *b) {
+	return a->topology.package == b->topology.package;
+}
+
 extern cpu_t boot_cpu;
 extern size_t highest_cpu_id;
 extern size_t cpu_count;
@@ -22,12 +22,40 @@
 #ifndef __DPC_H
 #define __DPC_H
 
+#include <lib/atomic.h>
+#include <lib/list.h>
+
+struct dpc_cpu;
+
 /** Handler function for a DPC.
  * @param arg		Argument passed to dpc_run(). */
 typedef void (*dpc_function_t)(void *arg);
 
-extern void dpc_request(dpc_function_t func, void *arg);
+/** Structure describing a DPC. */
+typedef struct dpc {
+	list_t header;			/**< Link to CPU's queue. */
+	atomic_t state;			/**< State of the DPC. */
+	struct dpc_cpu *cpu;		/**< CPU that the DPC is queued on. */
+	dpc_function_t function;	/**< Function to call. */
+	void *arg;			/**< Argument to pass to function. */
+	unsigned priority;		/**< Priority of the DPC. */
+	bool dynamic;			/**< Whether allocated by dpc_request(). */
+	nstime_t queued_time;		/**< Time that the DPC was queued. */
+} dpc_t;
+
+/** DPC priorities. */
+#define DPC_PRIORITY_NORMAL	0	/**< Normal priority. */
+#define DPC_PRIORITY_HIGH	1	/**< Run before any normal priority DPCs. */
+#define DPC_PRIORITY_COUNT	2	/**< Number of priorities. */
+
+extern void dpc_prepare(dpc_t *dpc, dpc_function_t func, void *arg,
+	unsigned priority);
+extern bool dpc_queue(dpc_t *dpc);
+extern bool dpc_cancel(dpc_t *dpc);
+extern status_t dpc_request(dpc_function_t func, void *arg);
+
 extern bool dpc_inited(void);
 extern void dpc_init(void);
+extern void dpc_init_percpu(void);
 
 #endif /* __DPC_H */
@@ -28,10 +28,16 @@
 extern "C" {
 #endif
 
+/** Priority inheritance futex value bits. */
+#define FUTEX_PI_WAITERS	((int32_t)0x80000000)	/**< Threads are waiting in the kernel. */
+#define FUTEX_PI_OWNER		0x7fffffff		/**< ID of the owning thread. */
+
 extern status_t kern_futex_wait(int32_t *addr, int32_t val, nstime_t timeout);
 extern status_t kern_futex_wake(int32_t *addr, size_t count, size_t *wokenp);
 extern status_t kern_futex_requeue(int32_t *addr1, int32_t val, size_t count,
 	int32_t *addr2, size_t *wokenp);
+extern status_t kern_futex_lock(int32_t *addr, nstime_t timeout);
+extern status_t kern_futex_unlock(int32_t *addr);
 
 #ifdef __cplusplus
 }
@@ -32,6 +32,8 @@ extern "C" {
 
 /** Actions for kern_thread_control(). */
 #define THREAD_SET_TLS_ADDR	1	/**< Set TLS base address. */
+#define THREAD_TIMER_SLACK	2	/**< Get timer slack. */
+#define THREAD_SET_TIMER_SLACK	3	/**< Set timer slack. */
 
 extern status_t kern_thread_control(unsigned action, const void *in, void *out);
 extern void kern_thread_restore(void);
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2009-2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Internal time functions/definitions.
+ */
+
+#ifndef __KERNEL_PRIVATE_TIME_H
+#define __KERNEL_PRIVATE_TIME_H
+
+#include <kernel/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __KERNEL_PRIVATE
+
+/** Shift applied to the time page counter multipliers. */
+#define TIME_PAGE_SHIFT		32
+
+/** Per-CPU counter conversion parameters. */
+typedef struct time_page_cpu {
+	uint64_t offset;		/**< Counter value at system time 0. */
+	uint64_t mult;			/**< Nanoseconds per count << TIME_PAGE_SHIFT. */
+} time_page_cpu_t;
+
+/**
+ * Kernel time data page.
+ *
+ * This page is mapped read-only into every process, to allow the current time
+ * to be calculated without a kernel call. The system time on a CPU is
+ * ((counter - offset) * mult) >> TIME_PAGE_SHIFT, using the entry for that
+ * CPU. The sequence count is odd while the kernel is updating the page: a
+ * reader should retry if it was odd, or if it changed while reading.
+ */
+typedef struct time_page {
+	volatile uint32_t seq;		/**< Sequence count. */
+	uint32_t cpu_count;		/**< Number of CPU entries (0 if not usable). */
+	nstime_t boot_unix_time;	/**< UNIX time at system time 0. */
+	time_page_cpu_t cpus[];		/**< Per-CPU conversion parameters. */
+} time_page_t;
+
+#ifdef __LIBKERNEL
+
+extern status_t _kern_time_get(unsigned source, nstime_t *timep);
+
+#endif /* __LIBKERNEL */
+#endif /* __KERNEL_PRIVATE */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __KERNEL_PRIVATE_TIME_H */
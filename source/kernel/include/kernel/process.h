@@ -87,6 +87,19 @@ typedef struct process_attrib {
 #define PRIORITY_CLASS_NORMAL	1	/**< Normal priority. */
 #define PRIORITY_CLASS_HIGH	2	/**< High priority. */
 
+/** Information types for kern_process_info(). */
+#define PROCESS_INFO_MEMORY	1	/**< Memory usage (process_memory_info_t). */
+
+/** Process memory usage information. */
+typedef struct process_memory_info {
+	uint64_t rss;			/**< Total resident memory (bytes). */
+	uint64_t anon;			/**< Resident anonymous memory (bytes). */
+	uint64_t file;			/**< Resident memory mapped from objects (bytes). */
+	uint64_t cow_breaks;		/**< Number of copy-on-write copies made. */
+	uint64_t minor_faults;		/**< Page faults handled without I/O. */
+	uint64_t major_faults;		/**< Page faults which required I/O. */
+} process_memory_info_t;
+
 /** Process creation flags. */
 #define PROCESS_CREATE_CRITICAL	(1<<0)	/**< Process is a critical system process. */
 
@@ -105,6 +118,9 @@ extern status_t kern_process_port(handle_t handle, int32_t id,
 	handle_t *handlep);
 extern status_t kern_process_status(handle_t handle, int *statusp, int *reasonp);
 extern status_t kern_process_kill(handle_t handle);
+extern status_t kern_process_info(handle_t handle, unsigned what, void *buf);
+extern status_t kern_process_affinity(handle_t handle, cpu_mask_t *maskp);
+extern status_t kern_process_set_affinity(handle_t handle, cpu_mask_t mask);
 
 extern status_t kern_process_token(handle_t *handlep);
 extern status_t kern_process_set_token(handle_t handle);
@@ -44,9 +44,10 @@ extern "C" {
 #define PRIV_FS_SETROOT			6	/**< Ability to use the fs_setroot() system call. */
 #define PRIV_FS_MOUNT			7	/**< Ability to mount/unmount filesystems. */
 #define PRIV_PROCESS_ADMIN		8	/**< Ability to control any process/thread. */
+#define PRIV_SCHED_REALTIME		9	/**< Ability to use real-time scheduling policies. */
 
 /** Currently highest defined privilege. */
-#define PRIV_MAX			8
+#define PRIV_MAX			9
 
 /** Structure defining the security context for a process/thread. */
 typedef struct security_context {
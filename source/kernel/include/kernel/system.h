@@ -30,9 +30,47 @@ extern "C" {
 
 /** System information values. */
 #define SYSTEM_INFO_PAGE_SIZE	1	/**< System page size (unsigned long). */
+#define SYSTEM_INFO_SWAP	2	/**< Compressed swap statistics (swap_info_t). */
+
+/** Compressed swap statistics. */
+typedef struct swap_info {
+	uint64_t stored;		/**< Number of pages currently stored. */
+	uint64_t compressed;		/**< Total compressed size of stored pages (bytes). */
+	uint64_t pool_size;		/**< Memory used to hold stored pages (bytes). */
+	uint64_t swapped_out;		/**< Total number of pages swapped out. */
+	uint64_t swapped_in;		/**< Total number of pages swapped in. */
+	uint64_t rejected;		/**< Pages which did not compress well enough. */
+	nstime_t fault_time;		/**< Total time spent decompressing pages. */
+	nstime_t fault_max;		/**< Longest time spent decompressing a page. */
+} swap_info_t;
 
 extern status_t kern_system_info(unsigned what, void *buf);
 
+/** Lock types for lock statistics. */
+#define LOCK_STAT_SPINLOCK	0	/**< Spinlock. */
+#define LOCK_STAT_MUTEX		1	/**< Mutex. */
+#define LOCK_STAT_RWLOCK_READ	2	/**< Readers-writer lock, read side. */
+#define LOCK_STAT_RWLOCK_WRITE	3	/**< Readers-writer lock, write side. */
+#define LOCK_STAT_CONDVAR	4	/**< Condition variable wait (never contended). */
+
+/** Maximum length of a lock name in lock statistics. */
+#define LOCK_STAT_NAME_MAX	32
+
+/** Statistics for a kernel lock class (a lock name and call site). */
+typedef struct lock_stat {
+	char name[LOCK_STAT_NAME_MAX];	/**< Name of the lock. */
+	ptr_t caller;			/**< Kernel address the lock was taken from. */
+	uint32_t type;			/**< Type of the lock. */
+	uint64_t acquisitions;		/**< Number of acquisitions. */
+	uint64_t contentions;		/**< Acquisitions that had to wait. */
+	nstime_t wait_time;		/**< Total time spent waiting (or asleep). */
+	nstime_t wait_max;		/**< Longest wait. */
+	nstime_t hold_time;		/**< Total time held (exclusive locks only). */
+	nstime_t hold_max;		/**< Longest hold. */
+} lock_stat_t;
+
+extern status_t kern_system_lock_stats(lock_stat_t *buf, size_t *countp);
+
 /** Actions for kern_shutdown(). */
 #define SHUTDOWN_REBOOT		1	/**< Reboot the system. */
 #define SHUTDOWN_POWEROFF	2	/**< Power off the system. */
@@ -82,6 +82,35 @@ typedef struct thread_context {
 #define THREAD_PRIORITY_NORMAL	1	/**< Normal priority. */
 #define THREAD_PRIORITY_HIGH	2	/**< High priority. */
 
+/** Thread scheduling policies. */
+#define THREAD_SCHED_NORMAL	0	/**< Timesharing, priority adjusted by behaviour. */
+#define THREAD_SCHED_FIFO	1	/**< Real-time, runs until it blocks or yields. */
+#define THREAD_SCHED_RR		2	/**< Real-time, round-robin within a priority. */
+
+/** Highest real-time priority. */
+#define THREAD_RT_PRIORITY_MAX	31
+
+/** Thread scheduling parameters. */
+typedef struct thread_sched {
+	int policy;			/**< Scheduling policy (THREAD_SCHED_*). */
+	int priority;			/**< Real-time priority (0 to THREAD_RT_PRIORITY_MAX). */
+	nstime_t quantum;		/**< Quantum for THREAD_SCHED_RR (0 for default). */
+} thread_sched_t;
+
+/** Information types for kern_thread_info(). */
+#define THREAD_INFO_SCHED	1	/**< Scheduling statistics (thread_sched_info_t). */
+
+/** Thread scheduling statistics. */
+typedef struct thread_sched_info {
+	nstime_t run_time;		/**< Total time spent running. */
+	nstime_t wait_time;		/**< Total time spent runnable, waiting to run. */
+	nstime_t max_wait_time;		/**< Longest single wait to run. */
+	nstime_t kernel_time;		/**< Time spent running in the kernel. */
+	nstime_t user_time;		/**< Time spent running in user mode. */
+	uint64_t voluntary_switches;	/**< Times the thread gave up the CPU. */
+	uint64_t involuntary_switches;	/**< Times the thread was preempted. */
+} thread_sched_info_t;
+
 /** Thread interrupt priority level (IPL) definitions. */
 #define THREAD_IPL_EXCEPTION	14	/**< Exception level. */
 #define THREAD_IPL_MAX		15	/**< Maximum IPL (all interrupts blocked). */
@@ -94,6 +123,11 @@ extern thread_id_t kern_thread_id(handle_t handle);
 extern status_t kern_thread_security(handle_t handle, security_context_t *ctx);
 extern status_t kern_thread_status(handle_t handle, int *statusp, int *reasonp);
 extern status_t kern_thread_kill(handle_t handle);
+extern status_t kern_thread_affinity(handle_t handle, cpu_mask_t *maskp);
+extern status_t kern_thread_set_affinity(handle_t handle, cpu_mask_t mask);
+extern status_t kern_thread_sched(handle_t handle, thread_sched_t *schedp);
+extern status_t kern_thread_set_sched(handle_t handle, const thread_sched_t *sched);
+extern status_t kern_thread_info(handle_t handle, unsigned what, void *buf);
 
 extern status_t kern_thread_ipl(unsigned *iplp);
 extern status_t kern_thread_set_ipl(unsigned ipl);
@@ -102,6 +136,8 @@ extern status_t kern_thread_set_token(handle_t handle);
 extern status_t kern_thread_set_exception_handler(unsigned code,
 	exception_handler_t handler);
 extern status_t kern_thread_set_exception_stack(const thread_stack_t *stack);
+extern status_t kern_thread_timer_slack(nstime_t *slackp);
+extern status_t kern_thread_set_timer_slack(nstime_t slack);
 
 extern status_t kern_thread_raise(exception_info_t *info);
 extern status_t kern_thread_sleep(nstime_t nsecs, nstime_t *remp);
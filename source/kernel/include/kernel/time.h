@@ -35,6 +35,9 @@ extern "C" {
 #define TIMER_ONESHOT		1	/**< Fire the timer event only once. */
 #define TIMER_PERIODIC		2	/**< Fire the event at regular intervals until stopped. */
 
+/** Timer creation flags. */
+#define TIMER_PRECISE		(1<<0)	/**< Do not apply the thread's timer slack. */
+
 extern status_t kern_timer_create(uint32_t flags, handle_t *handlep);
 extern status_t kern_timer_start(handle_t handle, nstime_t interval, unsigned mode);
 extern status_t kern_timer_stop(handle_t handle, nstime_t *remp);
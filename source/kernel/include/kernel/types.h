@@ -42,6 +42,7 @@ typedef int32_t handle_t;
 typedef long ssize_t;			/**< Signed version of size_t. */
 typedef int64_t nstime_t;		/**< Type used to store a time value in nanoseconds. */
 typedef int64_t offset_t;		/**< Type used to store an offset into an object. */
+typedef uint64_t cpu_mask_t;		/**< Type used to store a CPU affinity mask. */
 
 /** Object identifier types. */
 typedef int32_t process_id_t;		/**< Type used to store a process ID. */
@@ -52,4 +53,7 @@ typedef uint16_t mount_id_t;		/**< Type used to store a mount ID. */
 typedef uint64_t node_id_t;		/**< Type used to store a filesystem node ID. */
 typedef int16_t image_id_t;		/**< Type used to store a image ID. */
 
+/** CPU affinity mask allowing a thread to run on any CPU. */
+#define CPU_MASK_ALL		((cpu_mask_t)-1)
+
 #endif /* __KERNEL_TYPES_H */
@@ -43,10 +43,20 @@ extern "C" {
 #define VM_MAP_OVERCOMMIT	(1<<2)	/**< Allow overcommitting of memory. */
 #define VM_MAP_INHERIT		(1<<3)	/**< Region will be duplicated to child processes. */
 
+/** Advice values for kern_vm_advise(). */
+#define VM_ADVISE_NORMAL	0	/**< No special treatment (default). */
+#define VM_ADVISE_SEQUENTIAL	1	/**< Range will be accessed sequentially. */
+#define VM_ADVISE_RANDOM	2	/**< Range will be accessed randomly. */
+#define VM_ADVISE_WILLNEED	3	/**< Range will be needed soon, read it in. */
+#define VM_ADVISE_DONTNEED	4	/**< Range is no longer needed, drop its pages. */
+#define VM_ADVISE_POPULATE	5	/**< Map all pages in the range now. */
+#define VM_ADVISE_COLD		6	/**< Range is unlikely to be used, reclaim first. */
+
 extern status_t kern_vm_map(void **addrp, size_t size, unsigned spec,
 	uint32_t access, uint32_t flags, handle_t handle, offset_t offset,
 	const char *name);
 extern status_t kern_vm_unmap(void *start, size_t size);
+extern status_t kern_vm_advise(void *start, size_t size, unsigned advice);
 
 #ifdef __cplusplus
 }
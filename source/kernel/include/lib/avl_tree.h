@@ -24,6 +24,9 @@
 
 #include <types.h>
 
+/** Maximum height of an AVL tree (with 64-bit keys). */
+#define AVL_TREE_MAX_DEPTH	96
+
 /** AVL tree entry key type. */
 typedef uint64_t avl_tree_key_t;
 
@@ -39,6 +42,7 @@ typedef struct avl_tree_node {
 /** AVL tree structure. */
 typedef struct avl_tree {
 	avl_tree_node_t *root;		/**< Root of the tree. */
+	volatile uint32_t seq;		/**< Modification sequence count (odd while modifying). */
 } avl_tree_t;
 
 /** Iterates over an AVL tree, setting iter to the node on each iteration. */
@@ -56,6 +60,7 @@ typedef struct avl_tree {
 #define AVL_TREE_INITIALIZER() \
 	{ \
 		.root = NULL, \
+		.seq = 0, \
 	}
 
 /** Statically defines a new AVL tree. */
@@ -74,6 +79,7 @@ typedef struct avl_tree {
  * @param tree		Tree to initialize. */
 static inline void avl_tree_init(avl_tree_t *tree) {
 	tree->root = NULL;
+	tree->seq = 0;
 }
 
 /** Check whether the given AVL tree is empty. */
@@ -84,6 +90,8 @@ static inline bool avl_tree_empty(avl_tree_t *tree) {
 extern void avl_tree_insert(avl_tree_t *tree, avl_tree_key_t key, avl_tree_node_t *node);
 extern void avl_tree_remove(avl_tree_t *tree, avl_tree_node_t *node);
 extern avl_tree_node_t *avl_tree_lookup_node(avl_tree_t *tree, avl_tree_key_t key);
+extern bool avl_tree_lookup_node_rcu(avl_tree_t *tree, avl_tree_key_t key,
+	avl_tree_node_t **nodep);
 
 /** Look up an entry in an AVL tree.
  * @param tree		Tree to look up in.
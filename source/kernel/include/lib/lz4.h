@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		LZ4 compression functions.
+ */
+
+#ifndef __LIB_LZ4_H
+#define __LIB_LZ4_H
+
+#include <types.h>
+
+/** Maximum input size supported by the compressor. */
+#define LZ4_MAX_INPUT		0xffff
+
+/** Size of the work area required by lz4_compress(). */
+#define LZ4_WORK_SIZE		(4096 * sizeof(uint16_t))
+
+extern size_t lz4_compress(const void *src, size_t size, void *dest,
+	size_t max, void *work);
+extern size_t lz4_decompress(const void *src, size_t size, void *dest,
+	size_t max);
+
+#endif /* __LIB_LZ4_H */
@@ -47,6 +47,30 @@ static inline int refcount_inc(refcount_t *ref) {
 	return atomic_inc(ref) + 1;
 }
 
+/**
+ * Increase a reference count unless it is 0.
+ *
+ * Atomically increases the value of a reference count, unless it is 0. This
+ * is used to take a reference to an object found without holding a lock that
+ * prevents it from being destroyed (e.g. under RCU), where a count of 0 means
+ * that the object is being destroyed.
+ *
+ * @param ref		Reference count to increase.
+ *
+ * @return		Whether the count was increased.
+ */
+static inline bool refcount_inc_not_zero(refcount_t *ref) {
+	int val;
+
+	do {
+		val = atomic_get(ref);
+		if(!val)
+			return false;
+	} while(atomic_cas(ref, val, val + 1) != val);
+
+	return true;
+}
+
 /**
  * Decrease a reference count.
  *
@@ -121,6 +121,7 @@ extern mmu_ops_t *mmu_ops;
 
 extern void mmu_context_lock(mmu_context_t *ctx);
 extern void mmu_context_unlock(mmu_context_t *ctx);
+extern void mmu_context_flush(mmu_context_t *ctx);
 
 extern status_t mmu_context_map(mmu_context_t *ctx, ptr_t virt, phys_ptr_t phys,
 	uint32_t access, unsigned mmflag);
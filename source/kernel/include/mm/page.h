@@ -58,7 +58,8 @@ typedef struct page {
 	unsigned range;			/**< Memory range that the page belongs to. */
 	unsigned state;			/**< State of the page. */
 	bool modified : 1;		/**< Whether the page has been modified. */
-	uint8_t unused: 7;
+	bool reclaim : 1;		/**< Page should be reclaimed before others. */
+	uint8_t unused: 6;
 
 	/** Information about how the page is being used. */
 	page_ops_t *ops;		/**< Operations for the page. */
@@ -68,6 +69,15 @@ typedef struct page {
 	avl_tree_node_t avl_link;	/**< Link to AVL tree for use by owner. */
 } page_t;
 
+/** Number of pages that can be held in a page batch. */
+#define PAGE_BATCH_SIZE		32
+
+/** Structure collecting pages to be freed together. */
+typedef struct page_batch {
+	size_t count;			/**< Number of pages in the batch. */
+	page_t *pages[PAGE_BATCH_SIZE];	/**< Pages to free. */
+} page_batch_t;
+
 /** Possible states of a page. */
 #define PAGE_STATE_ALLOCATED	0	/**< Allocated. */
 #define PAGE_STATE_MODIFIED	1	/**< Modified. */
@@ -90,6 +100,7 @@ extern page_t *page_lookup(phys_ptr_t addr);
 extern page_t *page_alloc(unsigned mmflag);
 extern void page_free(page_t *page);
 extern page_t *page_copy(page_t *page, unsigned mmflag);
+extern void page_batch_flush(page_batch_t *batch);
 
 extern void page_stats_get(page_stats_t *stats);
 
@@ -104,4 +115,22 @@ extern void page_init(void);
 extern void page_daemon_init(void);
 extern void page_late_init(void);
 
+/** Initialize a page batch.
+ * @param batch		Batch to initialize. */
+static inline void page_batch_init(page_batch_t *batch) {
+	batch->count = 0;
+}
+
+/** Add a page to a batch to be freed.
+ * @note		The batch is freed if it is full. The caller must call
+ *			page_batch_flush() once done adding pages.
+ * @param batch		Batch to add to.
+ * @param page		Page to free. */
+static inline void page_batch_add(page_batch_t *batch, page_t *page) {
+	if(batch->count == PAGE_BATCH_SIZE)
+		page_batch_flush(batch);
+
+	batch->pages[batch->count++] = page;
+}
+
 #endif /* __MM_PAGE_H */
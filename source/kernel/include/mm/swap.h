@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Compressed swap store.
+ */
+
+#ifndef __MM_SWAP_H
+#define __MM_SWAP_H
+
+#include <kernel/system.h>
+
+#include <mm/page.h>
+
+struct swap_slot;
+
+/** Type of a handle to a page in the swap store. */
+typedef struct swap_slot swap_slot_t;
+
+extern swap_slot_t *swap_store(page_t *page);
+extern void swap_load(swap_slot_t *slot, page_t *page);
+extern void swap_free(swap_slot_t *slot);
+
+extern void swap_info(swap_info_t *info);
+
+extern void swap_init(void);
+
+#endif /* __MM_SWAP_H */
@@ -39,6 +39,7 @@
 
 struct frame;
 struct mmu_context;
+struct swap_slot;
 struct vm_aspace;
 struct vm_region;
 
@@ -63,8 +64,11 @@ typedef struct vm_region_ops {
 	 * @param region	Region to get page for.
 	 * @param offset	Offset into object to get page from.
 	 * @param pagep		Where to store pointer to page structure.
+	 * @param majorp	Where to store whether the page had to be read
+	 *			in from backing storage (can be NULL).
 	 * @return		Status code describing result of the operation. */
-	status_t (*get_page)(struct vm_region *region, offset_t offset, page_t **pagep);
+	status_t (*get_page)(struct vm_region *region, offset_t offset, page_t **pagep,
+		bool *majorp);
 } vm_region_ops_t;
 
 /** Structure containing an anonymous memory map. */
@@ -75,6 +79,7 @@ typedef struct vm_amap {
 	size_t curr_size;		/**< Number of pages currently contained in object. */
 	size_t max_size;		/**< Maximum number of pages in object. */
 	page_t **pages;			/**< Array of pages currently in object. */
+	struct swap_slot **slots;	/**< Array of swapped out pages (can be NULL). */
 	uint16_t *rref;			/**< Region reference count array. */
 } vm_amap_t;
 
@@ -103,6 +108,11 @@ typedef struct vm_region {
 	offset_t amap_offset;		/**< Offset into the anonymous map. */
 	vm_region_ops_t *ops;		/**< Operations provided by the object. */
 	void *private;			/**< Private data for the object type. */
+	unsigned advice;		/**< Access pattern hint (VM_ADVISE_*). */
+
+	/** Fault statistics. */
+	uint64_t minor_faults;		/**< Faults handled without I/O. */
+	uint64_t major_faults;		/**< Faults which required I/O. */
 
 	/** Kernel locking state. */
 	size_t locked;			/**< Number of calls to vm_lock_page() on the region. */
@@ -111,10 +121,20 @@ typedef struct vm_region {
 	char *name;			/**< Name of the region (can be NULL). */
 } vm_region_t;
 
+/** Memory usage and fault statistics for an address space. */
+typedef struct vm_aspace_stats {
+	size_t anon_pages;		/**< Number of anonymous pages mapped. */
+	size_t file_pages;		/**< Number of object pages mapped. */
+	uint64_t cow_breaks;		/**< Number of copy-on-write copies made. */
+	uint64_t minor_faults;		/**< Faults handled without I/O. */
+	uint64_t major_faults;		/**< Faults which required I/O. */
+} vm_aspace_stats_t;
+
 /** Structure containing a virtual address space. */
 typedef struct vm_aspace {
 	mutex_t lock;			/**< Lock to protect address space. */
 	refcount_t count;		/**< Reference count of CPUs using address space. */
+	list_t header;			/**< Link to the address space list. */
 
 	/** Address lookup stuff. */
 	vm_region_t *find_cache;	/**< Cached pointer to last region searched for. */
@@ -129,6 +149,9 @@ typedef struct vm_aspace {
 
 	/** Sorted list of all (including unused) regions. */
 	list_t regions;
+
+	/** Statistics (protected by the address space lock). */
+	vm_aspace_stats_t stats;
 } vm_aspace_t;
 
 /** Page fault reason codes. */
@@ -146,11 +169,15 @@ extern status_t vm_map(vm_aspace_t *as, ptr_t *addrp, size_t size,
 	offset_t offset, const char *name);
 extern status_t vm_unmap(vm_aspace_t *as, ptr_t start, size_t size);
 extern status_t vm_reserve(vm_aspace_t *as, ptr_t start, size_t size);
+extern status_t vm_advise(vm_aspace_t *as, ptr_t start, size_t size, unsigned advice);
 
 extern void vm_aspace_switch(vm_aspace_t *as);
 extern vm_aspace_t *vm_aspace_create(vm_aspace_t *parent);
 extern vm_aspace_t *vm_aspace_clone(vm_aspace_t *parent);
 extern void vm_aspace_destroy(vm_aspace_t *as);
+extern void vm_aspace_stats(vm_aspace_t *as, vm_aspace_stats_t *stats);
+
+extern size_t vm_reclaim(size_t target);
 
 extern void vm_init(void);
 
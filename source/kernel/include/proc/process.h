@@ -31,6 +31,7 @@
 
 #include <proc/thread.h>
 
+#include <sync/rcu.h>
 #include <sync/semaphore.h>
 #include <sync/spinlock.h>
 
@@ -68,6 +69,10 @@ typedef struct process {
 	/** Scheduling information. */
 	unsigned flags;			/**< Behaviour flags for the process. */
 	int priority;			/**< Priority class of the process. */
+	cpu_mask_t affinity;		/**< CPUs that new threads may run on. */
+	#if CONFIG_SCHED_FAIR
+	atomic_t fair_load;		/**< Total weight of runnable threads. */
+	#endif
 
 	/** Resource information. */
 	token_t *token;			/**< Security token for the process. */
@@ -94,6 +99,7 @@ typedef struct process {
 
 	/** Other process information. */
 	avl_tree_node_t tree_link;	/**< Link to process tree. */
+	rcu_head_t rcu;			/**< RCU head for freeing the process. */
 	process_id_t id;		/**< ID of the process. */
 	char *name;			/**< Name of the process. */
 	notifier_t death_notifier;	/**< Notifier for process death. */
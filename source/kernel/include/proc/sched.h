@@ -22,12 +22,37 @@
 #ifndef __PROC_SCHED_H
 #define __PROC_SCHED_H
 
+#include <lib/utility.h>
+
 #include <proc/thread.h>
 
+/** Limits on the quantum of a round-robin real-time thread. */
+#define SCHED_RR_QUANTUM_MIN	USECS2NSECS(100)
+#define SCHED_RR_QUANTUM_MAX	SECS2NSECS(1)
+
+/** Get the effective scheduling priority of a thread.
+ * @param thread	Thread to get priority of.
+ * @return		Higher of the thread's own priority and the priority it
+ *			has inherited from threads blocked on it. */
+static inline int sched_thread_priority(thread_t *thread) {
+	return max(thread->curr_prio, thread->pi_prio);
+}
+
 extern void sched_reschedule(bool state);
 extern void sched_post_switch(bool state);
 extern void sched_preempt(void);
 extern void sched_insert_thread(thread_t *thread);
+extern bool sched_affinity_valid(cpu_mask_t mask);
+extern bool sched_set_affinity(thread_t *thread, cpu_mask_t mask);
+extern bool sched_set_policy(thread_t *thread, int policy, int priority,
+	nstime_t quantum);
+
+extern thread_t *sched_pi_pick(list_t *threads);
+extern void sched_pi_block(void *object, thread_t *owner);
+extern void sched_pi_unblock(void);
+extern void sched_pi_set_owner(thread_t *thread, thread_t *owner);
+extern void sched_pi_transfer(void *object, thread_t *next);
+extern void sched_pi_exit(void);
 
 extern void sched_init(void);
 extern void sched_init_percpu(void);
@@ -35,6 +35,7 @@
 
 #include <security/token.h>
 
+#include <sync/rcu.h>
 #include <sync/spinlock.h>
 
 #include <time.h>
@@ -83,10 +84,38 @@ typedef struct thread {
 	int curr_prio;			/**< Current scheduling priority. */
 	struct cpu *cpu;		/**< CPU that the thread runs on. */
 	nstime_t timeslice;		/**< Current timeslice. */
+	nstime_t sched_time;		/**< Time that the thread last stopped running. */
+	cpu_mask_t affinity;		/**< CPUs that the thread is allowed to run on. */
+	int policy;			/**< Scheduling policy (THREAD_SCHED_*). */
+	int rt_priority;		/**< Real-time priority. */
+	nstime_t rt_quantum;		/**< Real-time round-robin quantum. */
+	#if CONFIG_SCHED_FAIR
+	avl_tree_node_t fair_link;	/**< Link to fair run queue. */
+	nstime_t vruntime;		/**< Weighted virtual runtime. */
+	uint32_t fair_weight;		/**< Weight added to the owner's load. */
+	#endif
+
+	/** Scheduling statistics. */
+	nstime_t run_start;		/**< Time that the thread last started running. */
+	nstime_t ready_time;		/**< Time that the thread last became ready. */
+	nstime_t run_time;		/**< Total time spent running. */
+	nstime_t wait_time;		/**< Total time spent ready but not running. */
+	nstime_t max_wait_time;		/**< Longest time spent ready before running. */
+	uint64_t voluntary_switches;	/**< Times the thread gave up the CPU. */
+	uint64_t involuntary_switches;	/**< Times the thread was preempted. */
+
+	/** Priority inheritance information (protected by sched_pi_lock). */
+	int pi_prio;			/**< Priority inherited from blocked threads (-1 if none). */
+	list_t pi_waiters;		/**< Threads blocked on locks held by this thread. */
+	list_t pi_link;			/**< Link to owner's waiter list. */
+	struct thread *pi_owner;	/**< Thread holding the lock being waited on. */
+	void *pi_object;		/**< Lock being waited on. */
+	bool pi_exited;			/**< Whether the thread can no longer own locks. */
 
 	/** Sleeping information. */
 	list_t wait_link;		/**< Link to a waiting list. */
 	timer_t sleep_timer;		/**< Sleep timeout timer. */
+	nstime_t timer_slack;		/**< Slack for sleeps and new user timers. */
 	status_t sleep_status;		/**< Sleep status (timed out/interrupted). */
 	spinlock_t *wait_lock;		/**< Lock for the waiting list. */
 	const char *waiting_on;		/**< What is being waited on (for informational purposes). */
@@ -143,6 +172,7 @@ typedef struct thread {
 	size_t ustack_size;		/**< Size of the user stack. */
 	thread_id_t id;			/**< ID of the thread. */
 	avl_tree_node_t tree_link;	/**< Link to thread tree. */
+	rcu_head_t rcu;			/**< RCU head for freeing the thread. */
 	char name[THREAD_NAME_MAX];	/**< Name of the thread. */
 	notifier_t death_notifier;	/**< Notifier for thread death. */
 	int status;			/**< Exit status of the thread. */
@@ -211,6 +241,7 @@ extern void thread_release(thread_t *thread);
 extern void thread_rename(thread_t *thread, const char *name);
 extern void thread_wire(thread_t *thread);
 extern void thread_unwire(thread_t *thread);
+extern status_t thread_set_affinity(thread_t *thread, cpu_mask_t mask);
 extern void thread_wake(thread_t *thread);
 extern void thread_kill(thread_t *thread);
 extern void thread_interrupt(thread_t *thread, thread_interrupt_t *interrupt);
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Big reader lock implementation.
+ */
+
+#ifndef __SYNC_BRLOCK_H
+#define __SYNC_BRLOCK_H
+
+#include <arch/cache.h>
+
+#include <lib/atomic.h>
+
+#include <sync/mutex.h>
+
+/** Per-CPU state of a big reader lock. */
+typedef struct brlock_cpu {
+	atomic_t readers;		/**< Number of readers on the CPU. */
+} __cacheline_aligned brlock_cpu_t;
+
+/**
+ * Structure containing a big reader lock.
+ *
+ * A big reader lock is a readers-writer lock for data that is read far more
+ * often than it is written. Readers only modify a counter belonging to the
+ * current CPU, so they do not contend with readers on other CPUs. Writers are
+ * expensive, as they must wait for the readers on every CPU to finish.
+ */
+typedef struct brlock {
+	brlock_cpu_t *cpus;		/**< Per-CPU reader counts. */
+	volatile bool writer;		/**< Whether a writer holds the lock. */
+	mutex_t lock;			/**< Mutex serializing writers. */
+	const char *name;		/**< Name of the lock. */
+} brlock_t;
+
+extern void brlock_read_lock(brlock_t *lock);
+extern void brlock_read_unlock(brlock_t *lock);
+extern void brlock_write_lock(brlock_t *lock);
+extern void brlock_write_unlock(brlock_t *lock);
+
+extern void brlock_init(brlock_t *lock, const char *name);
+
+#endif /* __SYNC_BRLOCK_H */
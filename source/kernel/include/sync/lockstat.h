@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Lock statistics.
+ */
+
+#ifndef __SYNC_LOCKSTAT_H
+#define __SYNC_LOCKSTAT_H
+
+#include <arch/cpu.h>
+
+#include <kernel/system.h>
+
+struct lockstat_class;
+
+/** Lock statistics state embedded in an exclusive lock. */
+typedef struct lockstat_lock {
+	struct lockstat_class *class;	/**< Class of the current acquisition. */
+	uint64_t acquired;		/**< Cycle count at acquisition. */
+} lockstat_lock_t;
+
+/** Get a timestamp for lock statistics.
+ * @return		Current timestamp (in CPU cycles). */
+static inline uint64_t lockstat_time(void) {
+	return arch_cpu_cycles();
+}
+
+extern void lockstat_acquired(lockstat_lock_t *stat, unsigned type, const char *name,
+	void *caller, uint64_t start, bool contended);
+extern void lockstat_released(lockstat_lock_t *stat);
+extern void lockstat_waited(const char *name, void *caller, uint64_t start);
+
+extern status_t lockstat_export(lock_stat_t *buf, size_t *countp);
+
+#endif /* __SYNC_LOCKSTAT_H */
@@ -27,6 +27,7 @@
 
 #include <sync/spinlock.h>
 
+struct cpu;
 struct thread;
 
 /** Structure containing a mutex. */
@@ -36,10 +37,14 @@ typedef struct mutex {
 	spinlock_t lock;		/**< Lock to protect the thread list. */
 	list_t threads;			/**< List of waiting threads. */
 	struct thread *holder;		/**< Thread holding the lock. */
+	struct cpu *holder_cpu;		/**< CPU the holder acquired the lock on. */
 	const char *name;		/**< Name of the lock. */
 	#if CONFIG_DEBUG
 	void *caller;			/**< Return address of lock call. */
 	#endif
+	#if CONFIG_LOCKSTAT
+	lockstat_lock_t stat;		/**< Lock statistics state. */
+	#endif
 } mutex_t;
 
 /** Initializes a statically defined mutex. */
@@ -50,6 +55,7 @@ typedef struct mutex {
 		.lock = SPINLOCK_INITIALIZER("mutex_lock"), \
 		.threads = LIST_INITIALIZER(_var.threads), \
 		.holder = NULL, \
+		.holder_cpu = NULL, \
 		.name = _name, \
 	}
 
@@ -76,6 +82,7 @@ static inline int mutex_recursion(mutex_t *lock) {
 
 extern status_t mutex_lock_etc(mutex_t *lock, nstime_t timeout, unsigned flags);
 extern void mutex_lock(mutex_t *lock);
+extern void mutex_lock_caller(mutex_t *lock, void *caller);
 extern void mutex_unlock(mutex_t *lock);
 extern void mutex_init(mutex_t *lock, const char *name, unsigned flags);
 
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Read-copy-update.
+ */
+
+#ifndef __SYNC_RCU_H
+#define __SYNC_RCU_H
+
+#include <arch/barrier.h>
+
+#include <lib/list.h>
+
+#include <kernel.h>
+
+struct rcu_head;
+
+/** Type of an RCU callback function.
+ * @param head		RCU head that the callback was queued with. */
+typedef void (*rcu_func_t)(struct rcu_head *head);
+
+/** Structure used to queue a callback after a grace period. */
+typedef struct rcu_head {
+	list_t header;			/**< Link to callback list. */
+	rcu_func_t func;		/**< Function to call. */
+} rcu_head_t;
+
+/**
+ * Begin an RCU read-side critical section.
+ *
+ * Begins an RCU read-side critical section. Data read within the section
+ * that is protected by RCU will not be freed until the section has ended.
+ * This disables preemption: the section must not sleep, and should be kept
+ * short. Sections can be nested.
+ */
+static inline void rcu_read_lock(void) {
+	preempt_disable();
+}
+
+/** End an RCU read-side critical section. */
+static inline void rcu_read_unlock(void) {
+	preempt_enable();
+}
+
+/** Read an RCU-protected pointer.
+ * @param p		Pointer to read.
+ * @return		Value of the pointer. */
+#define rcu_dereference(p) \
+	(*(__typeof__(p) volatile *)&(p))
+
+/** Publish a new value for an RCU-protected pointer.
+ * @param p		Pointer to assign to.
+ * @param v		Value to assign. Writes to the data it points to
+ *			will be visible before the pointer is. */
+#define rcu_assign_pointer(p, v) \
+	__extension__ \
+	({ \
+		write_barrier(); \
+		(*(__typeof__(p) volatile *)&(p)) = (v); \
+	})
+
+/** Iterate over a list within an RCU read-side critical section.
+ * @param list		Head of list to iterate.
+ * @param iter		Variable name to set to node pointer on each iteration. */
+#define LIST_FOREACH_RCU(list, iter) \
+	for(list_t *iter = rcu_dereference((list)->next); iter != (list); \
+		iter = rcu_dereference(iter->next))
+
+/**
+ * Add an entry to the end of an RCU-protected list.
+ *
+ * Adds an entry to the end of a list that may be concurrently traversed by
+ * LIST_FOREACH_RCU(). Updates to the list must still be serialized with a
+ * lock. The entry must not be on another list.
+ *
+ * @param list		List to append to.
+ * @param entry		Entry to append.
+ */
+static inline void list_append_rcu(list_t *list, list_t *entry) {
+	entry->next = list;
+	entry->prev = list->prev;
+	rcu_assign_pointer(list->prev->next, entry);
+	list->prev = entry;
+}
+
+/**
+ * Remove an entry from an RCU-protected list.
+ *
+ * Removes an entry from a list that may be concurrently traversed by
+ * LIST_FOREACH_RCU(). The entry's own pointers are left intact so that
+ * readers currently on it can continue. It must not be reused or freed until
+ * a grace period has elapsed.
+ *
+ * @param entry		Entry to remove.
+ */
+static inline void list_remove_rcu(list_t *entry) {
+	entry->next->prev = entry->prev;
+	rcu_assign_pointer(entry->prev->next, entry->next);
+}
+
+extern void call_rcu(rcu_head_t *head, rcu_func_t func);
+extern void synchronize_rcu(void);
+
+extern void rcu_idle_enter(void);
+extern void rcu_idle_exit(void);
+extern void rcu_quiescent(void);
+
+#endif /* __SYNC_RCU_H */
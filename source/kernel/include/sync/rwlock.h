@@ -33,6 +33,9 @@ typedef struct rwlock {
 	spinlock_t lock;		/**< Lock to protect the thread list. */
 	list_t threads;			/**< List of waiting threads. */
 	const char *name;		/**< Name of the lock. */
+	#if CONFIG_LOCKSTAT
+	lockstat_lock_t stat;		/**< Lock statistics state (writer). */
+	#endif
 } rwlock_t;
 
 /** Initializes a statically defined readers-writer lock. */
@@ -24,17 +24,60 @@
 
 #include <lib/atomic.h>
 
-/** Structure containing a spinlock. */
+#if CONFIG_LOCKSTAT
+# include <sync/lockstat.h>
+#endif
+
+/**
+ * Spinlock queue node.
+ *
+ * A CPU waiting for a spinlock that is contended by more than one other CPU
+ * queues itself using one of these, and spins on its own node rather than on
+ * the lock. Each CPU has a small array of them so that a lock can be waited
+ * for in a context that interrupted waiting for another.
+ */
+typedef struct spinlock_node {
+	struct spinlock_node *volatile next;	/**< Next CPU in the queue. */
+	volatile bool locked;			/**< Set when the CPU is at the queue head. */
+} spinlock_node_t;
+
+/** Number of queue nodes per CPU. */
+#define SPINLOCK_NODE_COUNT	4
+
+/**
+ * Structure containing a spinlock.
+ *
+ * The lock word contains a locked byte, a pending bit that is used by the
+ * first CPU to wait for the lock, and the tail of the queue of CPUs that are
+ * waiting behind it (the CPU ID plus 1, and the index of the node within that
+ * CPU's array). The locked byte is the low byte of the word, so that it can
+ * be cleared with a plain store on unlock.
+ */
 typedef struct spinlock {
-	atomic_t value;			/**< Value of lock (1 == free, 0 == held, others == held with waiters). */
+	union {
+		atomic_t value;		/**< Lock word. */
+		volatile uint8_t locked;/**< Locked byte of the lock word. */
+	};
+
 	volatile bool state;		/**< Interrupt state prior to locking. */
 	const char *name;		/**< Name of the spinlock. */
+	#if CONFIG_LOCKSTAT
+	lockstat_lock_t stat;		/**< Lock statistics state. */
+	#endif
 } spinlock_t;
 
+/** Spinlock word definitions. */
+#define SPINLOCK_LOCKED			(1 << 0)	/**< Lock is held. */
+#define SPINLOCK_PENDING		(1 << 8)	/**< A CPU is waiting for the lock. */
+#define SPINLOCK_TAIL_IDX_SHIFT		16		/**< Shift of the tail node index. */
+#define SPINLOCK_TAIL_IDX_MASK		(0x3 << SPINLOCK_TAIL_IDX_SHIFT)
+#define SPINLOCK_TAIL_CPU_SHIFT		18		/**< Shift of the tail CPU ID. */
+#define SPINLOCK_TAIL_MASK		0xffff0000	/**< Mask of the queue tail. */
+
 /** Initializes a statically defined spinlock. */
 #define SPINLOCK_INITIALIZER(_name) \
 	{ \
-		.value = 1, \
+		.value = 0, \
 		.state = 0, \
 		.name = _name, \
 	}
@@ -47,7 +90,7 @@ typedef struct spinlock {
  * @param lock		Spinlock to check.
  * @return		True if lock is locked, false otherwise. */
 static inline bool spinlock_held(spinlock_t *lock) {
-	return atomic_get(&lock->value) != 1;
+	return atomic_get(&lock->value) & SPINLOCK_LOCKED;
 }
 
 extern void spinlock_lock(spinlock_t *lock);
@@ -24,9 +24,13 @@
 
 #include <kernel/time.h>
 #include <lib/list.h>
+
+#include <dpc.h>
 #include <types.h>
 
 struct cpu;
+struct time_page;
+struct vm_aspace;
 
 /** Convert seconds to nanoseconds. */
 #define SECS2NSECS(secs)	((nstime_t)secs * 1000000000)
@@ -70,8 +74,43 @@ typedef struct timer_device {
 	 * 			shows that the timer's target has been reached.
 	 * @param nsecs		Nanoseconds to fire in. */
 	void (*prepare)(nstime_t nsecs);
+
+	/** Set up the next tick for an absolute time (for one-shot devices,
+	 * optional). If provided, this is used instead of prepare(). The
+	 * same note about firing early applies.
+	 * @param target	System time to fire at. */
+	void (*prepare_at)(nstime_t target);
 } timer_device_t;
 
+/** Timer wheel geometry. */
+#define TIMER_WHEEL_LEVELS	5	/**< Number of levels. */
+#define TIMER_WHEEL_BITS	6	/**< Log2 of the number of slots per level. */
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+
+/** Number of timer lateness histogram buckets. Bucket 0 counts ticks under
+ * 1ns late, bucket N counts 2^(N-1) to 2^N ns, and the last bucket also
+ * counts anything later. */
+#define TIMER_LATENCY_BUCKETS	24
+
+/** Per-CPU hierarchical timer wheel. */
+typedef struct timer_wheel {
+	uint64_t clock;			/**< Time processed up to, in level 0 slots. */
+	size_t count;			/**< Number of timers in the wheel. */
+	nstime_t next;			/**< Earliest timer deadline (INT64_MAX if none). */
+	uint64_t expired;		/**< Number of timers that have expired. */
+	uint64_t interrupts;		/**< Number of ticks that expired a timer. */
+
+	/** Timer device accuracy statistics. */
+	nstime_t armed;			/**< Deadline the device was set for (-1 if none). */
+	uint64_t early;			/**< Ticks that arrived before the deadline. */
+	uint64_t latency[TIMER_LATENCY_BUCKETS];	/**< Histogram of tick lateness. */
+	nstime_t latency_total;		/**< Total lateness of all ticks. */
+	nstime_t latency_max;		/**< Latest tick. */
+
+	uint64_t bitmap[TIMER_WHEEL_LEVELS];	/**< Bitmap of non-empty slots. */
+	list_t slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
 /** Callback function for timers.
  * @warning		Unless TIMER_THREAD is specified in the timer's flags,
  *			this function is called in interrupt context. Be
@@ -84,7 +123,7 @@ typedef bool (*timer_func_t)(void *data);
 
 /** Structure containing details of a timer. */
 typedef struct timer {
-	list_t header;			/**< Link to timers list. */
+	list_t header;			/**< Link to timer wheel slot. */
 
 	nstime_t target;		/**< Time at which the timer will fire. */
 	struct cpu *cpu;		/**< CPU that the timer was started on. */
@@ -93,12 +132,21 @@ typedef struct timer {
 	uint32_t flags;			/**< Behaviour flags. */
 	unsigned mode;			/**< Mode of the timer. */
 	nstime_t initial;		/**< Initial time (for periodic timers). */
+	nstime_t slack;			/**< How late the timer is allowed to fire. */
+	unsigned slot;			/**< Wheel slot the timer is in. */
 	const char *name;		/**< Name of the timer (for debugging purposes). */
+	dpc_t dpc;			/**< DPC to run the handler (TIMER_THREAD). */
 } timer_t;
 
 /** Behaviour flags for timers. */
 #define TIMER_THREAD		(1<<0)	/**< Run the handler in thread (DPC) context. */
 
+/** Default timer slack for user threads. */
+#define TIMER_SLACK_DEFAULT	USECS2NSECS(50)
+
+/** Maximum timer slack. */
+#define TIMER_SLACK_MAX		SECS2NSECS(1)
+
 extern nstime_t time_to_unix(unsigned year, unsigned month, unsigned day,
 	unsigned hour, unsigned min, unsigned sec);
 
@@ -106,6 +154,8 @@ extern nstime_t system_time(void);
 extern nstime_t unix_time(void);
 extern nstime_t boot_time(void);
 
+extern void timer_wheel_init(timer_wheel_t *wheel);
+
 extern void timer_device_set(timer_device_t *device);
 extern bool timer_tick(void);
 extern void timer_init(timer_t *timer, const char *name, timer_func_t func,
@@ -117,7 +167,11 @@ extern status_t delay_etc(nstime_t nsecs, int flags);
 extern void delay(nstime_t nsecs);
 extern void spin(nstime_t nsecs);
 
+extern status_t time_page_map(struct vm_aspace *as, ptr_t *addrp);
+
 extern nstime_t platform_time_from_hardware(void);
+extern void arch_time_page_init(struct time_page *page);
+extern nstime_t arch_cycles_to_nsecs(uint64_t cycles);
 
 extern void time_init(void);
 
@@ -24,6 +24,9 @@
 #include <kernel/system.h>
 
 #include <mm/safe.h>
+#include <mm/swap.h>
+
+#include <sync/lockstat.h>
 
 #include <kernel.h>
 #include <status.h>
@@ -42,13 +45,47 @@
  *			STATUS_INVALID_ARG if what is unknown or buf is NULL.
  */
 status_t kern_system_info(unsigned what, void *buf) {
+	swap_info_t swap;
+
 	if(!buf)
 		return STATUS_INVALID_ARG;
 
 	switch(what) {
 	case SYSTEM_INFO_PAGE_SIZE:
 		return write_user((size_t *)buf, PAGE_SIZE);
+	case SYSTEM_INFO_SWAP:
+		swap_info(&swap);
+		return memcpy_to_user(buf, &swap, sizeof(swap));
 	default:
 		return STATUS_INVALID_ARG;
 	}
 }
+
+/**
+ * Get kernel lock statistics.
+ *
+ * Retrieves statistics for the kernel's lock classes (a lock name and the
+ * place that it was acquired from), most contended first. This is only
+ * available if the kernel was built with lock statistics enabled.
+ *
+ * @param buf		Buffer to store statistics in (can be NULL to just
+ *			get the number of classes).
+ * @param countp	On entry, the number of entries that the buffer can
+ *			hold. On return, the total number of classes, which
+ *			may be more than were stored.
+ *
+ * @return		STATUS_SUCCESS on success.
+ *			STATUS_INVALID_ARG if countp is NULL.
+ *			STATUS_NOT_SUPPORTED if lock statistics are not
+ *			enabled.
+ */
+status_t kern_system_lock_stats(lock_stat_t *buf, size_t *countp) {
+	if(!countp)
+		return STATUS_INVALID_ARG;
+
+	#if CONFIG_LOCKSTAT
+	return lockstat_export(buf, countp);
+	#else
+	return STATUS_NOT_SUPPORTED;
+	#endif
+}
@@ -147,6 +147,7 @@ __init_text void kmain_secondary(cpu_t *cpu) {
 	mmu_init_percpu();
 	cpu_init_percpu();
 	sched_init_percpu();
+	dpc_init_percpu();
 
 	/* Signal that we're up. */
 	smp_boot_status = SMP_BOOT_BOOTED;
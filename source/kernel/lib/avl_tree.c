@@ -29,6 +29,8 @@
  *   http://www.cmcrossroads.com/bradapp/ftp/src/libs/C++/AvlTrees.html
  */
 
+#include <arch/barrier.h>
+
 #include <lib/avl_tree.h>
 
 #include <mm/malloc.h>
@@ -156,13 +158,25 @@ static inline void avl_tree_balance_node(avl_tree_t *tree, avl_tree_node_t *node
 	}
 }
 
+/** Begin modifying an AVL tree.
+ * @param tree		Tree being modified. */
+static inline void avl_tree_write_begin(avl_tree_t *tree) {
+	tree->seq++;
+	write_barrier();
+}
+
+/** Finish modifying an AVL tree.
+ * @param tree		Tree being modified. */
+static inline void avl_tree_write_end(avl_tree_t *tree) {
+	write_barrier();
+	tree->seq++;
+}
+
 /** Insert a node in an AVL tree.
  * @param tree		Tree to insert into.
  * @param key		Key to give the node.
- * @param node		Node that the key will map to. This function does NOT
- *			check if the node is already in another tree: it must
- *			be removed by the caller if it is. */
-void avl_tree_insert(avl_tree_t *tree, avl_tree_key_t key, avl_tree_node_t *node) {
+ * @param node		Node that the key will map to. */
+static void avl_tree_insert_internal(avl_tree_t *tree, avl_tree_key_t key, avl_tree_node_t *node) {
 	avl_tree_node_t **next, *curr = NULL;
 	int balance;
 
@@ -204,10 +218,22 @@ void avl_tree_insert(avl_tree_t *tree, avl_tree_key_t key, avl_tree_node_t *node
 	}
 }
 
+/** Insert a node in an AVL tree.
+ * @param tree		Tree to insert into.
+ * @param key		Key to give the node.
+ * @param node		Node that the key will map to. This function does NOT
+ *			check if the node is already in another tree: it must
+ *			be removed by the caller if it is. */
+void avl_tree_insert(avl_tree_t *tree, avl_tree_key_t key, avl_tree_node_t *node) {
+	avl_tree_write_begin(tree);
+	avl_tree_insert_internal(tree, key, node);
+	avl_tree_write_end(tree);
+}
+
 /** Remove a node from an AVL tree.
  * @param tree		Tree to remove from.
  * @param node		Node to remove. */
-void avl_tree_remove(avl_tree_t *tree, avl_tree_node_t *node) {
+static void avl_tree_remove_internal(avl_tree_t *tree, avl_tree_node_t *node) {
 	avl_tree_node_t *child, *start;
 	int balance;
 
@@ -300,6 +326,15 @@ void avl_tree_remove(avl_tree_t *tree, avl_tree_node_t *node) {
 	}
 }
 
+/** Remove a node from an AVL tree.
+ * @param tree		Tree to remove from.
+ * @param node		Node to remove. */
+void avl_tree_remove(avl_tree_t *tree, avl_tree_node_t *node) {
+	avl_tree_write_begin(tree);
+	avl_tree_remove_internal(tree, node);
+	avl_tree_write_end(tree);
+}
+
 /** Look up a node in an AVL tree.
  * @param tree		Tree to look up in.
  * @param key		Key to look for.
@@ -321,6 +356,61 @@ avl_tree_node_t *avl_tree_lookup_node(avl_tree_t *tree, avl_tree_key_t key) {
 	return NULL;
 }
 
+/**
+ * Look up a node in an AVL tree without locking.
+ *
+ * Looks up a node in an AVL tree without holding the lock that serializes
+ * modifications to it. This must be done within an RCU read-side critical
+ * section, and nodes removed from the tree must not be freed until a grace
+ * period has elapsed. A rebalance can move a node out of the path being
+ * followed, so if the tree is modified during the lookup, the result cannot
+ * be trusted and the lookup must be retried with the tree locked.
+ *
+ * @param tree		Tree to look up in.
+ * @param key		Key to look for.
+ * @param nodep		Where to store pointer to node if found, or NULL if
+ *			not found.
+ *
+ * @return		Whether the lookup completed without the tree being
+ *			modified.
+ */
+bool avl_tree_lookup_node_rcu(avl_tree_t *tree, avl_tree_key_t key,
+	avl_tree_node_t **nodep)
+{
+	avl_tree_node_t *node;
+	unsigned depth = 0;
+	uint32_t seq;
+
+	seq = tree->seq;
+	if(seq & 1)
+		return false;
+
+	read_barrier();
+
+	node = *(avl_tree_node_t *volatile *)&tree->root;
+	while(node) {
+		/* A concurrent rotation can briefly send us round in a loop.
+		 * No valid tree is this deep. */
+		if(++depth > AVL_TREE_MAX_DEPTH)
+			return false;
+
+		if(node->key > key) {
+			node = *(avl_tree_node_t *volatile *)&node->left;
+		} else if(node->key < key) {
+			node = *(avl_tree_node_t *volatile *)&node->right;
+		} else {
+			break;
+		}
+	}
+
+	read_barrier();
+	if(tree->seq != seq)
+		return false;
+
+	*nodep = node;
+	return true;
+}
+
 /**
  * Get the first node in an AVL tree.
  *
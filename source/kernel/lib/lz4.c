@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		LZ4 compression functions.
+ *
+ * This is a simple implementation of the LZ4 block format, intended for
+ * compressing small buffers (such as single pages). The compressor is greedy
+ * and uses a single-entry hash table, trading compression ratio for speed.
+ *
+ * Reference:
+ * - LZ4 Block Format Description.
+ *   https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ */
+
+#include <lib/lz4.h>
+#include <lib/string.h>
+
+#include <assert.h>
+
+/** Format parameters. */
+#define MIN_MATCH		4	/**< Minimum match length. */
+#define LAST_LITERALS		5	/**< Number of bytes at the end which must be literals. */
+#define MF_LIMIT		12	/**< Matches must start this far from the end. */
+#define RUN_MASK		15	/**< Maximum length stored in a token field. */
+
+/** Number of bits in a hash table index. */
+#define HASH_BITS		12
+
+/** Structure used for unaligned 32-bit accesses. */
+typedef struct unaligned32 {
+	uint32_t val;
+} __packed unaligned32_t;
+
+/** Read an unaligned 32-bit value.
+ * @param ptr		Pointer to read from.
+ * @return		Value read. */
+static inline uint32_t read32(const uint8_t *ptr) {
+	return ((const unaligned32_t *)ptr)->val;
+}
+
+/** Get the hash table index for a sequence.
+ * @param seq		Sequence to hash.
+ * @return		Hash table index. */
+static inline unsigned hash_sequence(uint32_t seq) {
+	return (seq * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/** Write out a length extension.
+ * @param op		Output pointer.
+ * @param len		Remaining length after the token field.
+ * @return		Updated output pointer. */
+static inline uint8_t *write_length(uint8_t *op, size_t len) {
+	while(len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+
+	*op++ = len;
+	return op;
+}
+
+/**
+ * Compress a buffer.
+ *
+ * Compresses a buffer into the LZ4 block format. The work area is used to hold
+ * the compressor's hash table, and must be LZ4_WORK_SIZE bytes. It does not
+ * need to be initialized.
+ *
+ * @param src		Buffer to compress.
+ * @param size		Size of the buffer (at most LZ4_MAX_INPUT).
+ * @param dest		Buffer to write compressed data to.
+ * @param max		Size of the destination buffer.
+ * @param work		Work area.
+ *
+ * @return		Size of the compressed data, or 0 if it does not fit
+ *			in the destination buffer.
+ */
+size_t lz4_compress(const void *src, size_t size, void *dest, size_t max, void *work) {
+	const uint8_t *ip = src, *anchor = src, *end = ip + size;
+	const uint8_t *mf_limit = end - MF_LIMIT, *match_limit = end - LAST_LITERALS;
+	const uint8_t *match;
+	uint8_t *op = dest, *op_end = op + max, *token;
+	uint16_t *table = work;
+	size_t lit, len, offset;
+	unsigned hash;
+
+	assert(size <= LZ4_MAX_INPUT);
+
+	/* Inputs that are too small cannot contain a match. The table holds
+	 * offsets from the start of the input: zero it so that every entry
+	 * initially refers to the first byte, and start searching after it. */
+	if(size > MF_LIMIT) {
+		memset(table, 0, LZ4_WORK_SIZE);
+		ip++;
+
+		while(ip < mf_limit) {
+			hash = hash_sequence(read32(ip));
+			match = (const uint8_t *)src + table[hash];
+			table[hash] = ip - (const uint8_t *)src;
+
+			if(read32(match) != read32(ip)) {
+				ip++;
+				continue;
+			}
+
+			/* Found a match, see how far it extends. */
+			len = MIN_MATCH;
+			while(ip + len < match_limit && match[len] == ip[len])
+				len++;
+
+			/* Check that the sequence will fit in the output. This
+			 * is conservative, the length extensions are generally
+			 * far smaller. */
+			lit = ip - anchor;
+			if((size_t)(op_end - op) < lit + (lit / 255) + (len / 255) + 8)
+				return 0;
+
+			token = op++;
+			if(lit >= RUN_MASK) {
+				*token = RUN_MASK << 4;
+				op = write_length(op, lit - RUN_MASK);
+			} else {
+				*token = lit << 4;
+			}
+
+			memcpy(op, anchor, lit);
+			op += lit;
+
+			offset = ip - match;
+			*op++ = offset & 0xff;
+			*op++ = offset >> 8;
+
+			len -= MIN_MATCH;
+			if(len >= RUN_MASK) {
+				*token |= RUN_MASK;
+				op = write_length(op, len - RUN_MASK);
+			} else {
+				*token |= len;
+			}
+
+			ip += len + MIN_MATCH;
+			anchor = ip;
+		}
+	}
+
+	/* Write out the remaining literals as the final sequence. */
+	lit = end - anchor;
+	if((size_t)(op_end - op) < lit + (lit / 255) + 2)
+		return 0;
+
+	token = op++;
+	if(lit >= RUN_MASK) {
+		*token = RUN_MASK << 4;
+		op = write_length(op, lit - RUN_MASK);
+	} else {
+		*token = lit << 4;
+	}
+
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	return op - (uint8_t *)dest;
+}
+
+/** Decompress a buffer.
+ * @param src		Compressed data.
+ * @param size		Size of the compressed data.
+ * @param dest		Buffer to write decompressed data to.
+ * @param max		Size of the destination buffer.
+ * @return		Size of the decompressed data, or 0 if the input is
+ *			malformed or does not fit in the destination. */
+size_t lz4_decompress(const void *src, size_t size, void *dest, size_t max) {
+	const uint8_t *ip = src, *end = ip + size, *match;
+	uint8_t *op = dest, *op_end = op + max;
+	size_t lit, len, offset;
+	uint8_t token, byte;
+
+	while(ip < end) {
+		token = *ip++;
+
+		/* Copy literals. */
+		lit = token >> 4;
+		if(lit == RUN_MASK) {
+			do {
+				if(ip >= end)
+					return 0;
+
+				byte = *ip++;
+				lit += byte;
+			} while(byte == 255);
+		}
+
+		if(lit > (size_t)(end - ip) || lit > (size_t)(op_end - op))
+			return 0;
+
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+
+		/* The final sequence only contains literals. */
+		if(ip == end)
+			break;
+
+		if(end - ip < 2)
+			return 0;
+
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(!offset || offset > (size_t)(op - (uint8_t *)dest))
+			return 0;
+
+		len = token & RUN_MASK;
+		if(len == RUN_MASK) {
+			do {
+				if(ip >= end)
+					return 0;
+
+				byte = *ip++;
+				len += byte;
+			} while(byte == 255);
+		}
+
+		len += MIN_MATCH;
+		if(len > (size_t)(op_end - op))
+			return 0;
+
+		/* Copy the match. Matches can overlap the output, in which
+		 * case they must be copied a byte at a time. */
+		match = op - offset;
+		if(offset >= len) {
+			memcpy(op, match, len);
+			op += len;
+		} else {
+			while(len--)
+				*op++ = *match++;
+		}
+	}
+
+	return op - (uint8_t *)dest;
+}
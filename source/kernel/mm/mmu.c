@@ -77,6 +77,16 @@ void mmu_context_unlock(mmu_context_t *ctx) {
 	mutex_unlock(&ctx->lock);
 }
 
+/** Flush changes to an MMU context without unlocking it.
+ * @note		Once this returns, no CPU can access a page through a
+ *			mapping that has been removed from the context.
+ * @param ctx		Context to flush (must be locked). */
+void mmu_context_flush(mmu_context_t *ctx) {
+	assert(mutex_held(&ctx->lock));
+
+	mmu_ops->flush(ctx);
+}
+
 /** Create a mapping in an MMU context.
  * @param ctx		Context to map in.
  * @param virt		Virtual address to map.
@@ -41,6 +41,9 @@
  *  - Cached:    Pages that are not currently mapped, but are holding cached
  *               data. Pages are taken from this queue and freed up when the
  *               number of free pages gets low.
+ * When the number of free pages falls below a low watermark, the page
+ * reclaimer thread is woken, which asks the VM to swap out cold anonymous
+ * pages until the high watermark is reached again.
  * The movement of pages between queues as required is mostly left up to the
  * users of the pages: pages will just be placed on the allocated queue when
  * first allocated, and must be moved manually using page_set_state().
@@ -81,10 +84,13 @@
 #include <mm/mmu.h>
 #include <mm/page.h>
 #include <mm/phys.h>
+#include <mm/vm.h>
 
 #include <proc/thread.h>
 
+#include <sync/condvar.h>
 #include <sync/mutex.h>
+#include <sync/semaphore.h>
 
 #include <assert.h>
 #include <laos.h>
@@ -133,6 +139,12 @@ typedef struct page_freelist {
 #define PAGE_WRITER_INTERVAL		SECS2NSECS(4)
 #define PAGE_WRITER_MAX_PER_RUN		128
 
+/** Page reclaimer settings. */
+#define PAGE_RECLAIM_BATCH		64
+#define PAGE_RECLAIM_PASSES		4
+#define PAGE_RECLAIM_LOW(total)		((total) / 32)
+#define PAGE_RECLAIM_HIGH(total)	((total) / 16)
+
 /** Number of page queues. */
 #define PAGE_QUEUE_COUNT		3
 
@@ -157,9 +169,81 @@ static size_t memory_range_count = 0;
 static boot_range_t boot_ranges[MEMORY_RANGE_MAX] __init_data;
 static size_t boot_range_count __init_data = 0;
 
+/** Page reclaimer state. */
+static thread_t *page_reclaimer_thread;
+static SEMAPHORE_DEFINE(page_reclaim_sem, 0);
+static atomic_t page_reclaim_pending = 0;
+static MUTEX_DEFINE(page_reclaim_lock, 0);
+static CONDVAR_DEFINE(page_reclaim_cvar);
+static size_t page_reclaim_result;
+
 /** Whether the physical memory manager has been initialized. */
 bool page_init_done = false;
 
+/** Get the number of free pages.
+ * @return		Number of free pages. */
+static inline page_num_t page_free_count(void) {
+	return total_page_count - page_queues[PAGE_STATE_ALLOCATED].count
+		- page_queues[PAGE_STATE_MODIFIED].count
+		- page_queues[PAGE_STATE_CACHED].count;
+}
+
+/** Wake the page reclaimer if it is not already running. */
+static inline void page_reclaim_wake(void) {
+	if(atomic_cas(&page_reclaim_pending, 0, 1) == 0)
+		semaphore_up(&page_reclaim_sem, 1);
+}
+
+/** Wait for the page reclaimer to free some memory.
+ * @return		Whether any memory was freed. */
+static bool page_reclaim_wait(void) {
+	bool ret;
+
+	/* The reclaimer cannot wait for itself. */
+	if(curr_thread == page_reclaimer_thread)
+		return false;
+
+	mutex_lock(&page_reclaim_lock);
+	page_reclaim_wake();
+	condvar_wait(&page_reclaim_cvar, &page_reclaim_lock);
+	ret = page_reclaim_result != 0;
+	mutex_unlock(&page_reclaim_lock);
+	return ret;
+}
+
+/** Page reclaimer thread.
+ * @param arg1		Unused.
+ * @param arg2		Unused. */
+static void page_reclaimer(void *arg1, void *arg2) {
+	size_t freed, count, passes;
+
+	while(true) {
+		semaphore_down(&page_reclaim_sem);
+
+		/* The first pass over a page only unmaps it, so it may take
+		 * more than one pass to free anything. */
+		freed = 0;
+		passes = 0;
+		while(page_free_count() < PAGE_RECLAIM_HIGH(total_page_count)
+			&& passes < PAGE_RECLAIM_PASSES)
+		{
+			count = vm_reclaim(PAGE_RECLAIM_BATCH);
+			if(!count)
+				passes++;
+
+			freed += count;
+		}
+
+		dprintf("page: reclaimer freed %zu pages\n", freed);
+
+		mutex_lock(&page_reclaim_lock);
+		atomic_set(&page_reclaim_pending, 0);
+		page_reclaim_result = freed;
+		condvar_broadcast(&page_reclaim_cvar);
+		mutex_unlock(&page_reclaim_lock);
+	}
+}
+
 /** Page writer thread.
  * @param arg1		Unused.
  * @param arg2		Unused. */
@@ -216,6 +300,18 @@ static inline void page_queue_append(unsigned index, page_t *page) {
 	spinlock_unlock(&page_queues[index].lock);
 }
 
+/** Push a page onto the start of a page queue.
+ * @param index		Queue index to prepend to.
+ * @param page		Page to push. */
+static inline void page_queue_prepend(unsigned index, page_t *page) {
+	assert(list_empty(&page->header));
+
+	spinlock_lock(&page_queues[index].lock);
+	list_prepend(&page_queues[index].pages, &page->header);
+	page_queues[index].count++;
+	spinlock_unlock(&page_queues[index].lock);
+}
+
 /** Remove a page from a page queue queue.
  * @param index		Queue index to remove from.
  * @param page		Page to remove. */
@@ -247,9 +343,16 @@ void page_set_state(page_t *page, unsigned state) {
 	if(unlikely(state >= PAGE_QUEUE_COUNT))
 		fatal("Setting invalid state on 0x%" PRIxPHYS " (%u)\n", page->addr, state);
 
-	/* Set new state and push on the new queue. */
+	/* Set new state and push on the new queue. Pages which have been
+	 * hinted as reclaim candidates (see vm_advise()) go on the front of
+	 * the queue so that they are looked at before any others. */
 	page->state = state;
-	page_queue_append(state, page);
+	if(page->reclaim) {
+		page->reclaim = false;
+		page_queue_prepend(state, page);
+	} else {
+		page_queue_append(state, page);
+	}
 }
 
 /** Look up the page structure for a physical address.
@@ -279,6 +382,7 @@ page_t *page_alloc(unsigned mmflag) {
 
 	assert((mmflag & (MM_WAIT | MM_ATOMIC)) != (MM_WAIT | MM_ATOMIC));
 
+retry:
 	preempt_disable();
 	mutex_lock(&free_page_lock);
 
@@ -300,6 +404,10 @@ page_t *page_alloc(unsigned mmflag) {
 		/* Put the page onto the allocated queue. */
 		page_queue_append(PAGE_STATE_ALLOCATED, page);
 
+		/* Start reclaiming if memory is getting low. */
+		if(page_free_count() < PAGE_RECLAIM_LOW(total_page_count))
+			page_reclaim_wake();
+
 		/* If we require a zero page, clear it now. */
 		if(mmflag & MM_ZERO) {
 			mapping = phys_map(page->addr, PAGE_SIZE, mmflag & MM_FLAG_MASK);
@@ -319,16 +427,21 @@ page_t *page_alloc(unsigned mmflag) {
 		return page;
 	}
 
-	// TODO: Reclaim/wait for memory.
-	if(mmflag & MM_BOOT) {
+	if(mmflag & MM_BOOT)
 		fatal("Unable to satisfy boot page allocation");
-	} else if(mmflag & MM_WAIT) {
-		/* TODO: Try harder. */
-		fatal("TODO: Reclaim/wait for memory");
-	}
 
 	mutex_unlock(&free_page_lock);
 	preempt_enable();
+
+	if(mmflag & MM_WAIT) {
+		/* Wait for the reclaimer to free up some memory. */
+		if(page_reclaim_wait())
+			goto retry;
+
+		fatal("Out of memory");
+	}
+
+	page_reclaim_wake();
 	return NULL;
 }
 
@@ -340,6 +453,7 @@ static void page_free_internal(page_t *page) {
 	/* Reset the page structure to a clear state. */
 	page->state = PAGE_STATE_FREE;
 	page->modified = false;
+	page->reclaim = false;
 	page->ops = NULL;
 	page->private = NULL;
 
@@ -364,6 +478,58 @@ void page_free(page_t *page) {
 		memory_ranges[page->range].freelist);
 }
 
+/**
+ * Free a batch of pages.
+ *
+ * Frees all pages in a batch, taking each page queue lock and the free page
+ * lock once for the whole batch rather than once per page. The batch is empty
+ * afterwards and can be reused.
+ *
+ * @param batch		Batch to free.
+ */
+void page_batch_flush(page_batch_t *batch) {
+	page_queue_t *queue = NULL;
+	page_t *page;
+	size_t i;
+
+	if(!batch->count)
+		return;
+
+	/* Remove each page from its queue, only switching queue lock when the
+	 * state differs from the previous page. */
+	for(i = 0; i < batch->count; i++) {
+		page = batch->pages[i];
+
+		if(unlikely(page->state == PAGE_STATE_FREE))
+			fatal("Attempting to free already free page 0x%" PRIxPHYS, page->addr);
+		if(unlikely(page->state >= PAGE_QUEUE_COUNT))
+			fatal("Page 0x%" PRIxPHYS " has invalid state (%u)\n", page->addr, page->state);
+
+		if(queue != &page_queues[page->state]) {
+			if(queue)
+				spinlock_unlock(&queue->lock);
+
+			queue = &page_queues[page->state];
+			spinlock_lock(&queue->lock);
+		}
+
+		list_remove(&page->header);
+		queue->count--;
+	}
+
+	spinlock_unlock(&queue->lock);
+
+	mutex_lock(&free_page_lock);
+
+	for(i = 0; i < batch->count; i++)
+		page_free_internal(batch->pages[i]);
+
+	mutex_unlock(&free_page_lock);
+
+	dprintf("page: freed batch of %zu pages\n", batch->count);
+	batch->count = 0;
+}
+
 /** Create a copy of a page.
  * @param page		Page to copy.
  * @param mmflag	Allocation flags.
@@ -944,6 +1110,13 @@ __init_text void page_daemon_init(void) {
 	ret = thread_create("page_writer", NULL, 0, page_writer, NULL, NULL, NULL);
 	if(ret != STATUS_SUCCESS)
 		fatal("Could not start page writer (%d)", ret);
+
+	ret = thread_create("page_reclaimer", NULL, 0, page_reclaimer, NULL,
+		NULL, &page_reclaimer_thread);
+	if(ret != STATUS_SUCCESS)
+		fatal("Could not start page reclaimer (%d)", ret);
+
+	thread_run(page_reclaimer_thread);
 }
 
 /** Reclaim memory no longer in use after kernel initialization. */
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Compressed swap store.
+ *
+ * There is no backing store to page anonymous memory out to, so instead cold
+ * anonymous pages are compressed with LZ4 and kept in memory. Compressed data
+ * is stored in a set of slab caches, one for each 256 byte size class, which
+ * keeps fragmentation of the store low and lets freed slabs be returned to the
+ * system. Pages which do not compress to less than 7/8 of their size are not
+ * worth storing and are rejected.
+ *
+ * The VM decides which pages to swap out (see vm_reclaim()): this just takes
+ * care of storing the page content.
+ */
+
+#include <lib/lz4.h>
+#include <lib/string.h>
+
+#include <mm/phys.h>
+#include <mm/slab.h>
+#include <mm/swap.h>
+
+#include <proc/thread.h>
+
+#include <sync/mutex.h>
+
+#include <assert.h>
+#include <kdb.h>
+#include <kernel.h>
+#include <time.h>
+
+/** Size of each slot size class. */
+#define SWAP_CLASS_SIZE		256
+
+/** Number of size classes. */
+#define SWAP_CLASS_COUNT	((PAGE_SIZE - (PAGE_SIZE / 8)) / SWAP_CLASS_SIZE)
+
+/** Structure containing a compressed page. */
+struct swap_slot {
+	uint16_t size;			/**< Size of the compressed data. */
+	uint16_t class;			/**< Size class of the slot. */
+	uint8_t data[];			/**< Compressed data. */
+};
+
+/** Maximum compressed size that can be stored. */
+#define SWAP_MAX_COMPRESSED	\
+	((SWAP_CLASS_COUNT * SWAP_CLASS_SIZE) - sizeof(struct swap_slot))
+
+/** Slab caches for each size class. */
+static slab_cache_t *swap_caches[SWAP_CLASS_COUNT];
+
+/** Lock protecting the compression buffers and statistics. */
+static MUTEX_DEFINE(swap_lock, 0);
+
+/** Compression buffers. */
+static uint8_t swap_buffer[PAGE_SIZE];
+static uint8_t swap_work[LZ4_WORK_SIZE] __aligned(sizeof(uint16_t));
+
+/** Swap statistics. */
+static swap_info_t swap_stats;
+
+/**
+ * Store a page in the swap store.
+ *
+ * Compresses the content of a page into the swap store. The page itself is
+ * not modified or freed. This can fail if the page does not compress well
+ * enough, or if memory for the compressed data is not available.
+ *
+ * @param page		Page to store.
+ *
+ * @return		Handle to the stored page, or NULL if it could not be
+ *			stored.
+ */
+swap_slot_t *swap_store(page_t *page) {
+	swap_slot_t *slot;
+	void *mapping;
+	size_t size;
+	unsigned class;
+
+	mutex_lock(&swap_lock);
+
+	/* The mapping is only accessed by this thread. */
+	thread_wire(curr_thread);
+	mapping = phys_map(page->addr, PAGE_SIZE, MM_NOWAIT);
+	if(!mapping) {
+		thread_unwire(curr_thread);
+		mutex_unlock(&swap_lock);
+		return NULL;
+	}
+
+	size = lz4_compress(mapping, PAGE_SIZE, swap_buffer, SWAP_MAX_COMPRESSED,
+		swap_work);
+
+	phys_unmap(mapping, PAGE_SIZE, false);
+	thread_unwire(curr_thread);
+
+	if(!size) {
+		swap_stats.rejected++;
+		mutex_unlock(&swap_lock);
+		return NULL;
+	}
+
+	class = (size + sizeof(*slot) - 1) / SWAP_CLASS_SIZE;
+	assert(class < SWAP_CLASS_COUNT);
+
+	slot = slab_cache_alloc(swap_caches[class], MM_NOWAIT);
+	if(!slot) {
+		mutex_unlock(&swap_lock);
+		return NULL;
+	}
+
+	slot->size = size;
+	slot->class = class;
+	memcpy(slot->data, swap_buffer, size);
+
+	swap_stats.stored++;
+	swap_stats.compressed += size;
+	swap_stats.pool_size += (class + 1) * SWAP_CLASS_SIZE;
+	swap_stats.swapped_out++;
+
+	mutex_unlock(&swap_lock);
+	return slot;
+}
+
+/**
+ * Load a page from the swap store.
+ *
+ * Decompresses a stored page into a page. The slot is not freed, this must be
+ * done with swap_free() once it is no longer needed.
+ *
+ * @param slot		Slot to load.
+ * @param page		Page to decompress into.
+ */
+void swap_load(swap_slot_t *slot, page_t *page) {
+	nstime_t start, elapsed;
+	void *mapping;
+	size_t size;
+
+	start = system_time();
+
+	thread_wire(curr_thread);
+	mapping = phys_map(page->addr, PAGE_SIZE, MM_KERNEL);
+
+	size = lz4_decompress(slot->data, slot->size, mapping, PAGE_SIZE);
+	if(unlikely(size != PAGE_SIZE))
+		fatal("Swap slot %p is corrupt (%zu)", slot, size);
+
+	phys_unmap(mapping, PAGE_SIZE, false);
+	thread_unwire(curr_thread);
+
+	elapsed = system_time() - start;
+
+	mutex_lock(&swap_lock);
+
+	swap_stats.swapped_in++;
+	swap_stats.fault_time += elapsed;
+	if(elapsed > swap_stats.fault_max)
+		swap_stats.fault_max = elapsed;
+
+	mutex_unlock(&swap_lock);
+}
+
+/** Free a slot in the swap store.
+ * @param slot		Slot to free. */
+void swap_free(swap_slot_t *slot) {
+	mutex_lock(&swap_lock);
+
+	swap_stats.stored--;
+	swap_stats.compressed -= slot->size;
+	swap_stats.pool_size -= (slot->class + 1) * SWAP_CLASS_SIZE;
+
+	mutex_unlock(&swap_lock);
+
+	slab_cache_free(swap_caches[slot->class], slot);
+}
+
+/** Get swap statistics.
+ * @param info		Where to store statistics. */
+void swap_info(swap_info_t *info) {
+	mutex_lock(&swap_lock);
+	memcpy(info, &swap_stats, sizeof(*info));
+	mutex_unlock(&swap_lock);
+}
+
+/** Print swap statistics.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_swap(int argc, char **argv, kdb_filter_t *filter) {
+	uint64_t ratio;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints statistics about the compressed swap store.\n");
+		return KDB_SUCCESS;
+	}
+
+	/* Ratio of the original size to the compressed size, times 100. */
+	ratio = (swap_stats.compressed)
+		? (swap_stats.stored * PAGE_SIZE * 100) / swap_stats.compressed
+		: 0;
+
+	kdb_printf("Stored:      %" PRIu64 " pages (%" PRIu64 " KiB)\n",
+		swap_stats.stored, (swap_stats.stored * PAGE_SIZE) / 1024);
+	kdb_printf("Compressed:  %" PRIu64 " KiB (ratio: %" PRIu64 ".%02" PRIu64 ")\n",
+		swap_stats.compressed / 1024, ratio / 100, ratio % 100);
+	kdb_printf("Pool size:   %" PRIu64 " KiB\n", swap_stats.pool_size / 1024);
+	kdb_printf("Swapped out: %" PRIu64 "\n", swap_stats.swapped_out);
+	kdb_printf("Swapped in:  %" PRIu64 "\n", swap_stats.swapped_in);
+	kdb_printf("Rejected:    %" PRIu64 "\n", swap_stats.rejected);
+	kdb_printf("Fault time:  %" PRIu64 "us average, %" PRIu64 "us max\n",
+		(swap_stats.swapped_in)
+			? (uint64_t)(swap_stats.fault_time / swap_stats.swapped_in) / 1000
+			: 0,
+		(uint64_t)swap_stats.fault_max / 1000);
+
+	return KDB_SUCCESS;
+}
+
+/** Initialize the swap store. */
+__init_text void swap_init(void) {
+	char name[SLAB_NAME_MAX];
+	unsigned i;
+
+	for(i = 0; i < SWAP_CLASS_COUNT; i++) {
+		snprintf(name, sizeof(name), "swap_slot_%u",
+			(i + 1) * SWAP_CLASS_SIZE);
+		swap_caches[i] = slab_cache_create(name, (i + 1) * SWAP_CLASS_SIZE,
+			0, NULL, NULL, NULL, 0, MM_BOOT);
+	}
+
+	kdb_register_command("swap", "Print compressed swap statistics.",
+		kdb_cmd_swap);
+}
@@ -57,7 +57,12 @@
  * @todo		The anonymous object page array could be changed into a
  *			two-level array, which would reduce memory consumption
  *			for large, sparsely-used objects.
- * @todo		Swap support.
+ *
+ * Anonymous pages can be swapped out to the compressed swap store when memory
+ * is low (see vm_reclaim()). A swapped out page is removed from the anonymous
+ * map's page array and its swap slot is stored in a parallel slot array in its
+ * place: the page is brought back in by map_anon_page() on the next fault.
+ * Only pages referred to by a single region and a single map are swapped.
  * @todo		Implement VM_MAP_OVERCOMMIT (at the moment we just
  *			overcommit regardless).
  * @todo		Proper memory locking. Note that when eviction gets
@@ -82,12 +87,15 @@
 #include <mm/phys.h>
 #include <mm/safe.h>
 #include <mm/slab.h>
+#include <mm/swap.h>
 #include <mm/vm.h>
 #include <mm/vm_cache.h>
 
 #include <proc/process.h>
 #include <proc/thread.h>
 
+#include <sync/semaphore.h>
+
 #include <assert.h>
 #include <kdb.h>
 #include <setjmp.h>
@@ -108,6 +116,21 @@ static slab_cache_t *vm_aspace_cache = NULL;
 static slab_cache_t *vm_region_cache = NULL;
 static slab_cache_t *vm_amap_cache = NULL;
 
+/** List of all address spaces, used for reclaim. */
+static LIST_DEFINE(vm_aspace_list);
+static size_t vm_aspace_count = 0;
+static MUTEX_DEFINE(vm_aspace_list_lock, 0);
+
+#if CONFIG_VM_DEFERRED_TEARDOWN
+
+/** Address spaces waiting to be freed by the reaper thread. */
+static LIST_DEFINE(vm_reaper_list);
+static MUTEX_DEFINE(vm_reaper_lock, 0);
+static SEMAPHORE_DEFINE(vm_reaper_sem, 0);
+static thread_t *vm_reaper_thread;
+
+#endif
+
 /** Constructor for address space objects.
  * @param obj		Pointer to object.
  * @param data		Ignored. */
@@ -117,6 +140,7 @@ static void vm_aspace_ctor(void *obj, void *data) {
 
 	mutex_init(&as->lock, "vm_aspace_lock", 0);
 	refcount_set(&as->count, 0);
+	list_init(&as->header);
 	avl_tree_init(&as->tree);
 	list_init(&as->regions);
 
@@ -259,12 +283,35 @@ static vm_amap_t *vm_amap_create(size_t size) {
 	map->curr_size = 0;
 	map->max_size = size >> PAGE_WIDTH;
 	map->pages = kcalloc(map->max_size, sizeof(*map->pages), MM_KERNEL);
+	map->slots = NULL;
 	map->rref = kcalloc(map->max_size, sizeof(*map->rref), MM_KERNEL);
 	dprintf("vm: created anonymous map %p (size: %zu, pages: %zu)\n", map,
 		size, map->max_size);
 	return map;
 }
 
+/** Bring a swapped out page back into an anonymous map.
+ * @note		Map should be locked.
+ * @param map		Map to swap into.
+ * @param idx		Index of the page to swap in. */
+static void vm_amap_swap_in(vm_amap_t *map, size_t idx) {
+	page_t *page;
+
+	assert(map->slots[idx]);
+	assert(!map->pages[idx]);
+
+	page = page_alloc(MM_KERNEL);
+	swap_load(map->slots[idx], page);
+	swap_free(map->slots[idx]);
+	map->slots[idx] = NULL;
+
+	refcount_inc(&page->count);
+	map->pages[idx] = page;
+
+	dprintf("vm: swapped in page %zu of anonymous map %p to 0x%" PRIxPHYS "\n",
+		idx, map, page->addr);
+}
+
 /** Clone an existing anonymous map.
  * @param src		Existing map to clone.
  * @param offset	Offset into the map to clone from.
@@ -287,6 +334,10 @@ static vm_amap_t *vm_amap_clone(vm_amap_t *src, offset_t offset, size_t size) {
 	 * source or the destination. Set the region reference count for each
 	 * page to 1, to account for the destination region. */
 	for(i = start; i < end; i++) {
+		/* Pages are shared by reference, so they must be in memory. */
+		if(src->slots && src->slots[i])
+			vm_amap_swap_in(src, i);
+
 		if(src->pages[i]) {
 			refcount_inc(&src->pages[i]->count);
 			dest->curr_size++;
@@ -307,6 +358,7 @@ static void vm_amap_release(vm_amap_t *map) {
 		assert(!map->curr_size);
 
 		kfree(map->rref);
+		kfree(map->slots);
 		kfree(map->pages);
 		dprintf("vm: destroyed anonymous map %p\n", map);
 		slab_cache_free(vm_amap_cache, map);
@@ -356,8 +408,11 @@ static status_t vm_amap_map(vm_amap_t *map, offset_t offset, size_t size) {
  * @param offset	Offset into the map to start from.
  * @param size		Size of the range. */
 static void vm_amap_unmap(vm_amap_t *map, offset_t offset, size_t size) {
+	page_batch_t batch;
 	size_t i, start, end;
 
+	page_batch_init(&batch);
+
 	mutex_lock(&map->lock);
 
 	/* Work out the entries within the object that this covers and ensure
@@ -375,14 +430,19 @@ static void vm_amap_unmap(vm_amap_t *map, offset_t offset, size_t size) {
 				PRIxPHYS "\n", map, i, map->pages[i]->addr);
 
 			if(refcount_dec(&map->pages[i]->count) == 0)
-				page_free(map->pages[i]);
+				page_batch_add(&batch, map->pages[i]);
 
 			map->pages[i] = NULL;
 			map->curr_size--;
+		} else if(map->rref[i] == 0 && map->slots && map->slots[i]) {
+			swap_free(map->slots[i]);
+			map->slots[i] = NULL;
+			map->curr_size--;
 		}
 	}
 
 	mutex_unlock(&map->lock);
+	page_batch_flush(&batch);
 }
 
 /**
@@ -395,15 +455,17 @@ static void vm_amap_unmap(vm_amap_t *map, offset_t offset, size_t size) {
  * @param addr		Virtual address to map.
  * @param requested	Requested access for the page.
  * @param physp		Where to store physical address of page.
+ * @param majorp	Where to store whether I/O was required (can be NULL).
  * @return		Status code describing the result of the operation. */
 static status_t
 map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
-	phys_ptr_t *physp)
+	phys_ptr_t *physp, bool *majorp)
 {
 	vm_amap_t *amap = region->amap;
+	vm_aspace_stats_t *stats = &region->as->stats;
 	phys_ptr_t phys;
 	uint32_t access;
-	bool exist;
+	bool exist, was_anon, major = false;
 	offset_t offset;
 	size_t idx;
 	page_t *page, *prev;
@@ -415,6 +477,8 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
 	if(exist && (access & requested) == requested) {
 		if(physp)
 			*physp = phys;
+		if(majorp)
+			*majorp = false;
 
 		return STATUS_SUCCESS;
 	}
@@ -431,6 +495,15 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
 
 	assert(idx < amap->max_size);
 
+	/* Bring the page back in if it has been swapped out. */
+	if(amap->slots && amap->slots[idx]) {
+		vm_amap_swap_in(amap, idx);
+		major = true;
+	}
+
+	/* Record where any existing mapping came from for accounting. */
+	was_anon = amap->pages[idx] != NULL;
+
 	if(!amap->pages[idx] && !region->handle) {
 		/* No page existing and no source. Allocate a zeroed page. */
 		dprintf("vm:  anon fault: no existing page and no source, allocating new\n");
@@ -464,6 +537,7 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
 					page_free(amap->pages[idx]);
 
 				amap->pages[idx] = page;
+				stats->cow_breaks++;
 			}
 
 			phys = amap->pages[idx]->addr;
@@ -479,7 +553,7 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
 				assert(region->ops && region->ops->get_page);
 
 				ret = region->ops->get_page(region,
-					offset + region->obj_offset, &prev);
+					offset + region->obj_offset, &prev, &major);
 				if(ret != STATUS_SUCCESS) {
 					dprintf("vm: failed to get page at offset 0x%"
 						PRIx64 " from %p: %d\n",
@@ -511,6 +585,7 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
 				prev->ops->release_page(prev);
 
 			amap->curr_size++;
+			stats->cow_breaks++;
 			phys = page->addr;
 		}
 	} else {
@@ -533,7 +608,7 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
 
 			/* Get the page from the source, and map read-only. */
 			ret = region->ops->get_page(region,
-				offset + region->obj_offset, &page);
+				offset + region->obj_offset, &page, &major);
 			if(ret != STATUS_SUCCESS) {
 				dprintf("vm: failed to get page at offset 0x%"
 					PRIx64 " from %p: %d\n",
@@ -558,13 +633,27 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
 	if(exist) {
 		if(!mmu_context_unmap(region->as->mmu, addr, true, NULL))
 			fatal("Could not remove previous mapping for %p", addr);
+
+		if(was_anon) {
+			stats->anon_pages--;
+		} else {
+			stats->file_pages--;
+		}
 	}
 
 	/* Map the entry in. Should always succeed with MM_KERNEL set. */
 	mmu_context_map(region->as->mmu, addr, phys, access, MM_KERNEL);
 
+	if(amap->pages[idx]) {
+		stats->anon_pages++;
+	} else {
+		stats->file_pages++;
+	}
+
 	if(physp)
 		*physp = phys;
+	if(majorp)
+		*majorp = major;
 
 	dprintf("vm: mapped 0x%" PRIxPHYS " at %p (as: %p, access: 0x%x)\n",
 		phys, addr, region->as, access);
@@ -577,12 +666,17 @@ map_anon_page(vm_region_t *region, ptr_t addr, uint32_t requested,
  * @param region	Region to map in.
  * @param addr		Virtual address to map.
  * @param physp		Where to store physical address of page.
+ * @param majorp	Where to store whether I/O was required (can be NULL).
  * @return		Status code describing the result of the operation. */
-static status_t map_object_page(vm_region_t *region, ptr_t addr, phys_ptr_t *physp) {
+static status_t
+map_object_page(vm_region_t *region, ptr_t addr, phys_ptr_t *physp,
+	bool *majorp)
+{
 	offset_t offset;
 	phys_ptr_t phys;
 	uint32_t access;
 	page_t *page;
+	bool major = false;
 	status_t ret;
 
 	assert(region->handle);
@@ -594,6 +688,8 @@ static status_t map_object_page(vm_region_t *region, ptr_t addr, phys_ptr_t *phy
 
 		if(physp)
 			*physp = phys;
+		if(majorp)
+			*majorp = false;
 
 		return STATUS_SUCCESS;
 	}
@@ -603,7 +699,7 @@ static status_t map_object_page(vm_region_t *region, ptr_t addr, phys_ptr_t *phy
 
 	/* Get a page from the object. */
 	offset = (offset_t)(addr - region->start) + region->obj_offset;
-	ret = region->ops->get_page(region, offset, &page);
+	ret = region->ops->get_page(region, offset, &page, &major);
 	if(ret != STATUS_SUCCESS) {
 		dprintf("vm: failed to get page at offset 0x%" PRIx64 " from %p: %d\n",
 			offset, region->handle, ret);
@@ -616,9 +712,12 @@ static status_t map_object_page(vm_region_t *region, ptr_t addr, phys_ptr_t *phy
 	 * we could run into issues because we're holding the address space and
 	 * context locks. */
 	mmu_context_map(region->as->mmu, addr, page->addr, region->access, MM_KERNEL);
+	region->as->stats.file_pages++;
 
 	if(physp)
 		*physp = page->addr;
+	if(majorp)
+		*majorp = major;
 
 	dprintf("vm: mapped 0x%" PRIxPHYS " at %p (as: %p, access: 0x%x)\n",
 		page->addr, addr, region->as, region->access);
@@ -636,8 +735,8 @@ static status_t map_page(vm_region_t *region, ptr_t addr, uint32_t requested, ph
 	assert(vm_region_contains(region, addr));
 
 	return (region->amap)
-		? map_anon_page(region, addr, requested, physp)
-		: map_object_page(region, addr, physp);
+		? map_anon_page(region, addr, requested, physp, NULL)
+		: map_object_page(region, addr, physp, NULL);
 }
 
 /** Unmap a page within a region.
@@ -667,12 +766,15 @@ static bool unmap_page(vm_region_t *region, ptr_t addr) {
 		/* If page is in the object, then do nothing. */
 		if(region->amap->pages[idx]) {
 			assert(region->amap->pages[idx] == page);
+			region->as->stats.anon_pages--;
 			return true;
 		}
 
 		assert(region->handle);
 	}
 
+	region->as->stats.file_pages--;
+
 	if(page && page->ops && page->ops->release_page) {
 		offset += region->obj_offset;
 		page->ops->release_page(page);
@@ -703,6 +805,9 @@ static vm_region_t *vm_region_clone(vm_region_t *src, vm_aspace_t *as) {
 	dest->state = src->state;
 	dest->ops = src->ops;
 	dest->private = src->private;
+	dest->advice = src->advice;
+	dest->minor_faults = 0;
+	dest->major_faults = 0;
 
 	if(src->state != VM_REGION_ALLOCATED) {
 		dest->handle = NULL;
@@ -846,14 +951,12 @@ static void vm_region_unmap(vm_region_t *region, ptr_t start, size_t size) {
 	}
 }
 
-/** Unmap an entire region.
- * @param region	Region to destroy. */
-static void vm_region_destroy(vm_region_t *region) {
-	/* Unmap the region and drop references to the object/anonymous map,
-	 * and remove it from the tree or freelist. */
+/** Free a region once its pages have been unmapped.
+ * @param region	Region to free. */
+static void vm_region_free(vm_region_t *region) {
+	/* Drop references to the object/anonymous map, and remove it from the
+	 * tree or freelist. */
 	if(region->state == VM_REGION_ALLOCATED) {
-		vm_region_unmap(region, region->start, region->size);
-
 		if(region->amap)
 			vm_amap_release(region->amap);
 		if(region->handle)
@@ -876,10 +979,336 @@ static void vm_region_destroy(vm_region_t *region) {
 	slab_cache_free(vm_region_cache, region);
 }
 
+/** Unmap an entire region.
+ * @param region	Region to destroy. */
+static void vm_region_destroy(vm_region_t *region) {
+	if(region->state == VM_REGION_ALLOCATED)
+		vm_region_unmap(region, region->start, region->size);
+
+	vm_region_free(region);
+}
+
+/** Bring the pages for part of a region into memory without mapping them.
+ * @note		Only pages that come from the region's object are read,
+ *			anonymous pages are allocated on demand anyway.
+ * @param region	Region to read in.
+ * @param start		Start of range.
+ * @param size		Size of range. */
+static void vm_region_willneed(vm_region_t *region, ptr_t start, size_t size) {
+	offset_t offset;
+	page_t *page;
+	size_t i, idx;
+	status_t ret;
+
+	if(!region->handle || !region->ops || !region->ops->get_page)
+		return;
+
+	for(i = 0; i < size; i += PAGE_SIZE) {
+		offset = (start + i) - region->start;
+
+		/* Pages already in the anonymous map need nothing doing. */
+		if(region->amap) {
+			offset += region->amap_offset;
+			idx = (size_t)(offset >> PAGE_WIDTH);
+			if(region->amap->pages[idx])
+				continue;
+		}
+
+		ret = region->ops->get_page(region, offset + region->obj_offset, &page,
+			NULL);
+		if(ret != STATUS_SUCCESS)
+			break;
+
+		if(page->ops && page->ops->release_page)
+			page->ops->release_page(page);
+	}
+}
+
+/** Map all pages for part of a region.
+ * @param region	Region to populate.
+ * @param start		Start of range.
+ * @param size		Size of range.
+ * @return		Status code describing result of the operation. */
+static status_t vm_region_populate(vm_region_t *region, ptr_t start, size_t size) {
+	size_t i;
+	status_t ret = STATUS_SUCCESS;
+
+	mmu_context_lock(region->as->mmu);
+
+	for(i = 0; i < size; i += PAGE_SIZE) {
+		/* Leave the stack guard page alone. TODO: Stack direction. */
+		if(region->flags & VM_MAP_STACK && start + i == region->start)
+			continue;
+
+		/* Only map for read access: write faults on private regions
+		 * will still copy the page when (and if) they happen. */
+		ret = map_page(region, start + i, VM_ACCESS_READ, NULL);
+		if(ret != STATUS_SUCCESS)
+			break;
+	}
+
+	mmu_context_unlock(region->as->mmu);
+	return ret;
+}
+
+/** Discard the pages in part of a region.
+ * @note		Pages in a private anonymous map which are only
+ *			referred to by this region are freed, so later accesses
+ *			see zeroed memory (or the original object content).
+ *			Everything else is only unmapped.
+ * @param region	Region to discard in.
+ * @param start		Start of range.
+ * @param size		Size of range. */
+static void vm_region_dontneed(vm_region_t *region, ptr_t start, size_t size) {
+	vm_amap_t *amap = region->amap;
+	size_t i, idx, end;
+
+	/* Wait until the region becomes unlocked, as for vm_region_unmap(). */
+	while(region->locked)
+		condvar_wait(&region->waiters, &region->as->lock);
+
+	mmu_context_lock(region->as->mmu);
+
+	for(i = 0; i < size; i += PAGE_SIZE)
+		unmap_page(region, start + i);
+
+	mmu_context_unlock(region->as->mmu);
+
+	if(!amap || !(region->flags & VM_MAP_PRIVATE))
+		return;
+
+	idx = (size_t)((region->amap_offset + (start - region->start)) >> PAGE_WIDTH);
+	end = idx + (size >> PAGE_WIDTH);
+
+	mutex_lock(&amap->lock);
+
+	assert(end <= amap->max_size);
+
+	for(; idx < end; idx++) {
+		if(amap->rref[idx] != 1) {
+			continue;
+		} else if(amap->slots && amap->slots[idx]) {
+			swap_free(amap->slots[idx]);
+			amap->slots[idx] = NULL;
+			amap->curr_size--;
+			continue;
+		} else if(!amap->pages[idx]) {
+			continue;
+		}
+
+		if(refcount_dec(&amap->pages[idx]->count) == 0)
+			page_free(amap->pages[idx]);
+
+		amap->pages[idx] = NULL;
+		amap->curr_size--;
+	}
+
+	mutex_unlock(&amap->lock);
+}
+
+/** Mark the pages in part of a region as prime reclaim candidates.
+ * @note		Object pages mapped in the range are unmapped, so that
+ *			once nothing else is using them they move to the front
+ *			of their page queue. Anonymous pages remain mapped but
+ *			are flagged for when they can be reclaimed.
+ * @param region	Region to mark.
+ * @param start		Start of range.
+ * @param size		Size of range. */
+static void vm_region_cold(vm_region_t *region, ptr_t start, size_t size) {
+	vm_amap_t *amap = region->amap;
+	phys_ptr_t phys;
+	page_t *page;
+	size_t i, idx;
+
+	while(region->locked)
+		condvar_wait(&region->waiters, &region->as->lock);
+
+	mmu_context_lock(region->as->mmu);
+
+	if(amap)
+		mutex_lock(&amap->lock);
+
+	for(i = 0; i < size; i += PAGE_SIZE) {
+		if(amap) {
+			idx = (size_t)((region->amap_offset + (start + i - region->start))
+				>> PAGE_WIDTH);
+			if(amap->pages[idx]) {
+				amap->pages[idx]->reclaim = true;
+				continue;
+			}
+		}
+
+		if(!mmu_context_query(region->as->mmu, start + i, &phys, NULL))
+			continue;
+
+		page = page_lookup(phys);
+		if(page)
+			page->reclaim = true;
+
+		unmap_page(region, start + i);
+	}
+
+	if(amap)
+		mutex_unlock(&amap->lock);
+
+	mmu_context_unlock(region->as->mmu);
+}
+
+/** Check whether a page in an anonymous map can be swapped out.
+ * @param amap		Map containing the page (must be locked).
+ * @param idx		Index of the page in the map.
+ * @return		Whether the page can be swapped out. */
+static inline bool vm_amap_swappable(vm_amap_t *amap, size_t idx) {
+	page_t *page = amap->pages[idx];
+
+	/* Shared pages would need every mapping of them removed. */
+	return page && amap->rref[idx] == 1 && refcount_get(&page->count) == 1;
+}
+
+/** Swap out a page from an anonymous map.
+ * @param amap		Map containing the page (must be locked).
+ * @param idx		Index of the page in the map. The page must not be
+ *			mapped anywhere, and no CPU may hold a TLB entry for
+ *			it.
+ * @return		Whether the page was freed. */
+static bool vm_amap_swap_out(vm_amap_t *amap, size_t idx) {
+	page_t *page = amap->pages[idx];
+	swap_slot_t *slot;
+
+	slot = swap_store(page);
+	if(!slot)
+		return false;
+
+	amap->slots[idx] = slot;
+	amap->pages[idx] = NULL;
+
+	refcount_dec(&page->count);
+	page_free(page);
+	return true;
+}
+
+/** Swap out pages from a region.
+ * @note		Pages are given a second chance: a page that is still
+ *			mapped is only unmapped, and is swapped out if it is
+ *			still unmapped when the next pass reaches it. Pages
+ *			marked with VM_ADVISE_COLD are swapped out in the same
+ *			pass, once other CPUs' TLBs have been flushed.
+ * @param region	Region to reclaim from (must be private anonymous).
+ * @param target	Maximum number of pages to free.
+ * @return		Number of pages freed. */
+static size_t vm_region_reclaim(vm_region_t *region, size_t target) {
+	vm_amap_t *amap = region->amap;
+	size_t i, idx, end, freed = 0;
+	bool cold = false;
+	ptr_t addr;
+
+	mmu_context_lock(region->as->mmu);
+
+	if(mutex_lock_etc(&amap->lock, 0, 0) != STATUS_SUCCESS) {
+		mmu_context_unlock(region->as->mmu);
+		return 0;
+	}
+
+	if(!amap->slots) {
+		amap->slots = kcalloc(amap->max_size, sizeof(*amap->slots), MM_NOWAIT);
+		if(!amap->slots)
+			goto out;
+	}
+
+	/* Pages that were unmapped by an earlier pass have already had their
+	 * TLB entries flushed on other CPUs, so they can be swapped out. */
+	for(i = 0; i < region->size && freed < target; i += PAGE_SIZE) {
+		addr = region->start + i;
+		idx = (size_t)((region->amap_offset + i) >> PAGE_WIDTH);
+
+		if(!vm_amap_swappable(amap, idx))
+			continue;
+
+		if(unmap_page(region, addr)) {
+			cold |= amap->pages[idx]->reclaim;
+			continue;
+		}
+
+		if(vm_amap_swap_out(amap, idx))
+			freed++;
+	}
+
+	end = i;
+
+	/* Other CPUs can still write to the cold pages that were just unmapped
+	 * until their TLBs are flushed, so do that before swapping them out.
+	 * Faults cannot map them again, as the address space is locked. */
+	if(cold && freed < target) {
+		mmu_context_flush(region->as->mmu);
+
+		for(i = 0; i < end && freed < target; i += PAGE_SIZE) {
+			idx = (size_t)((region->amap_offset + i) >> PAGE_WIDTH);
+
+			if(!vm_amap_swappable(amap, idx) || !amap->pages[idx]->reclaim)
+				continue;
+
+			if(vm_amap_swap_out(amap, idx))
+				freed++;
+		}
+	}
+
+out:
+	mutex_unlock(&amap->lock);
+	mmu_context_unlock(region->as->mmu);
+	return freed;
+}
+
 /**
  * Kernel internal API functions.
  */
 
+/**
+ * Reclaim memory from address spaces.
+ *
+ * Swaps out anonymous pages from user address spaces to free up memory. This
+ * is called by the page reclaimer when free memory is low. Address spaces and
+ * anonymous maps which are currently locked are skipped rather than waited
+ * for, so this is safe to call from a thread that may be blocking a fault.
+ * Address spaces are scanned in round-robin order across calls.
+ *
+ * @param target	Number of pages to try to free.
+ *
+ * @return		Number of pages freed.
+ */
+size_t vm_reclaim(size_t target) {
+	vm_aspace_t *as;
+	vm_region_t *region;
+	size_t i, freed = 0;
+
+	mutex_lock(&vm_aspace_list_lock);
+
+	for(i = 0; i < vm_aspace_count && freed < target; i++) {
+		/* Move to the end of the list so the next call starts with the
+		 * next address space. */
+		as = list_first(&vm_aspace_list, vm_aspace_t, header);
+		list_append(&vm_aspace_list, &as->header);
+
+		if(mutex_lock_etc(&as->lock, 0, 0) != STATUS_SUCCESS)
+			continue;
+
+		AVL_TREE_FOREACH(&as->tree, iter) {
+			region = avl_tree_entry(iter, vm_region_t, tree_link);
+
+			if(!region->amap || !(region->flags & VM_MAP_PRIVATE) || region->locked)
+				continue;
+
+			freed += vm_region_reclaim(region, target - freed);
+			if(freed >= target)
+				break;
+		}
+
+		mutex_unlock(&as->lock);
+	}
+
+	mutex_unlock(&vm_aspace_list_lock);
+	return freed;
+}
+
 /**
  * Lock a single page in an address space.
  *
@@ -974,7 +1403,7 @@ bool vm_fault(frame_t *frame, ptr_t addr, int reason, uint32_t access) {
 	exception_info_t exception;
 	ptr_t base;
 	vm_region_t *region;
-	bool user, in_usermem;
+	bool user, in_usermem, major;
 
 	assert(!local_irq_state());
 
@@ -1059,15 +1488,23 @@ bool vm_fault(frame_t *frame, ptr_t addr, int reason, uint32_t access) {
 			}
 		}
 
-		exception.status = map_anon_page(region, base, access, NULL);
+		exception.status = map_anon_page(region, base, access, NULL, &major);
 	} else {
-		exception.status = map_object_page(region, base, NULL);
+		exception.status = map_object_page(region, base, NULL, &major);
 	}
 
 	local_irq_disable();
 	mmu_context_unlock(as->mmu);
 
-	if(exception.status != STATUS_SUCCESS) {
+	if(exception.status == STATUS_SUCCESS) {
+		if(major) {
+			region->major_faults++;
+			as->stats.major_faults++;
+		} else {
+			region->minor_faults++;
+			as->stats.minor_faults++;
+		}
+	} else {
 		exception.code = EXCEPTION_PAGE_ERROR;
 		kprintf(LOG_NOTICE, "vm: thread %" PRId32 " (%s) page fault at %p: "
 			"failed to map page: %d\n", curr_thread->id, curr_thread->name,
@@ -1169,6 +1606,9 @@ static vm_region_t *trim_regions(vm_aspace_t *as, ptr_t start, size_t size) {
 			split->state = region->state;
 			split->ops = region->ops;
 			split->private = region->private;
+			split->advice = region->advice;
+			split->minor_faults = 0;
+			split->major_faults = 0;
 			split->handle = region->handle;
 			split->obj_offset = region->obj_offset;
 			split->amap = region->amap;
@@ -1328,6 +1768,7 @@ alloc_region(vm_aspace_t *as, size_t size, uint32_t access, uint32_t flags,
 				split->amap_offset = 0;
 				split->ops = NULL;
 				split->private = NULL;
+				split->advice = VM_ADVISE_NORMAL;
 
 				/* Add the split to the lists. */
 				vm_freelist_insert(split, split->size);
@@ -1375,6 +1816,7 @@ static void free_region(vm_aspace_t *as, ptr_t start, size_t size, int state) {
 	region->amap_offset = 0;
 	region->ops = NULL;
 	region->private = NULL;
+	region->advice = VM_ADVISE_NORMAL;
 	region->name = NULL;
 
 	insert_region(as, region);
@@ -1514,6 +1956,10 @@ vm_map(vm_aspace_t *as, ptr_t *addrp, size_t size, unsigned spec,
 		break;
 	}
 
+	region->advice = VM_ADVISE_NORMAL;
+	region->minor_faults = 0;
+	region->major_faults = 0;
+
 	/* Attach the object to the region. */
 	if(handle) {
 		region->handle = handle;
@@ -1614,6 +2060,106 @@ status_t vm_reserve(vm_aspace_t *as, ptr_t start, size_t size) {
 	return STATUS_SUCCESS;
 }
 
+/**
+ * Give advice on how a range of memory will be used.
+ *
+ * Applies a usage hint to all regions within a range of an address space. The
+ * following advice values are currently defined:
+ *
+ *  - VM_ADVISE_NORMAL: Clear any access pattern hint on the range.
+ *  - VM_ADVISE_SEQUENTIAL: The range will be accessed sequentially. Faults on
+ *    pages from a cache will read ahead the following pages.
+ *  - VM_ADVISE_RANDOM: The range will be accessed in a random order, so there
+ *    is no point reading ahead.
+ *  - VM_ADVISE_WILLNEED: The range will be accessed soon. Pages from the
+ *    backing object are brought into memory now, but are not mapped.
+ *  - VM_ADVISE_DONTNEED: The content of the range is no longer needed. Private
+ *    anonymous pages are freed (subsequent accesses will see zeroed memory,
+ *    or the original object content), other pages are unmapped. The range
+ *    itself remains mapped.
+ *  - VM_ADVISE_POPULATE: Map every page in the range now, so that subsequent
+ *    accesses do not incur page faults (write accesses to private regions
+ *    may still fault to copy the page).
+ *  - VM_ADVISE_COLD: The range is unlikely to be used again soon. Its pages
+ *    will be the first to be considered when memory is reclaimed.
+ *
+ * The whole range must be covered by allocated regions.
+ *
+ * @param as		Address space to operate on.
+ * @param start		Start of range (multiple of page size).
+ * @param size		Size of range (multiple of page size).
+ * @param advice	Advice value (VM_ADVISE_*).
+ *
+ * @return		Status code describing result of the operation.
+ */
+status_t vm_advise(vm_aspace_t *as, ptr_t start, size_t size, unsigned advice) {
+	vm_region_t *region, *next;
+	ptr_t end, match_start, match_end;
+	status_t ret;
+
+	if(!size || start % PAGE_SIZE || size % PAGE_SIZE) {
+		return STATUS_INVALID_ARG;
+	} else if(advice > VM_ADVISE_COLD) {
+		return STATUS_INVALID_ARG;
+	}
+
+	mutex_lock(&as->lock);
+
+	if(!vm_aspace_fits(as, start, size)) {
+		mutex_unlock(&as->lock);
+		return STATUS_NO_MEMORY;
+	}
+
+	end = start + size;
+
+	/* Check that there are no holes in the range before doing anything. */
+	region = vm_region_find(as, start, true);
+	for(next = region; next && next->start < end; next = vm_region_next(next)) {
+		if(next->state != VM_REGION_ALLOCATED) {
+			mutex_unlock(&as->lock);
+			return STATUS_INVALID_ADDR;
+		}
+	}
+
+	ret = STATUS_SUCCESS;
+
+	for(; region && region->start < end; region = vm_region_next(region)) {
+		match_start = max(start, region->start);
+		match_end = min(end, region->start + region->size);
+
+		switch(advice) {
+		case VM_ADVISE_NORMAL:
+		case VM_ADVISE_SEQUENTIAL:
+		case VM_ADVISE_RANDOM:
+			/* These apply to the whole region rather than just
+			 * the range given, splitting the region is not worth
+			 * it for a hint. */
+			region->advice = advice;
+			break;
+		case VM_ADVISE_WILLNEED:
+			vm_region_willneed(region, match_start, match_end - match_start);
+			break;
+		case VM_ADVISE_DONTNEED:
+			vm_region_dontneed(region, match_start, match_end - match_start);
+			break;
+		case VM_ADVISE_POPULATE:
+			ret = vm_region_populate(region, match_start, match_end - match_start);
+			break;
+		case VM_ADVISE_COLD:
+			vm_region_cold(region, match_start, match_end - match_start);
+			break;
+		}
+
+		if(ret != STATUS_SUCCESS)
+			break;
+	}
+
+	dprintf("vm: advised region [%p,%p) in %p (advice: %u, ret: %d)\n",
+		start, end, as, advice, ret);
+	mutex_unlock(&as->lock);
+	return ret;
+}
+
 /** Switch to another address space.
  * @param as		Address space to switch to. */
 void vm_aspace_switch(vm_aspace_t *as) {
@@ -1653,6 +2199,7 @@ vm_aspace_t *vm_aspace_create(vm_aspace_t *parent) {
 	as->mmu = mmu_context_create(MM_KERNEL);
 	as->find_cache = NULL;
 	as->free_map = 0;
+	memset(&as->stats, 0, sizeof(as->stats));
 
 	/* Insert the initial free region. */
 	region = slab_cache_alloc(vm_region_cache, MM_KERNEL);
@@ -1668,6 +2215,7 @@ vm_aspace_t *vm_aspace_create(vm_aspace_t *parent) {
 	region->amap_offset = 0;
 	region->ops = NULL;
 	region->private = NULL;
+	region->advice = VM_ADVISE_NORMAL;
 	region->name = NULL;
 	list_append(&as->regions, &region->header);
 	vm_freelist_insert(region, USER_SIZE);
@@ -1700,6 +2248,11 @@ vm_aspace_t *vm_aspace_create(vm_aspace_t *parent) {
 		mutex_unlock(&parent->lock);
 	}
 
+	mutex_lock(&vm_aspace_list_lock);
+	list_append(&vm_aspace_list, &as->header);
+	vm_aspace_count++;
+	mutex_unlock(&vm_aspace_list_lock);
+
 	return as;
 }
 
@@ -1722,6 +2275,7 @@ vm_aspace_t *vm_aspace_clone(vm_aspace_t *parent) {
 	as->mmu = mmu_context_create(MM_KERNEL);
 	as->find_cache = NULL;
 	as->free_map = 0;
+	memset(&as->stats, 0, sizeof(as->stats));
 
 	mutex_lock(&parent->lock);
 
@@ -1740,6 +2294,12 @@ vm_aspace_t *vm_aspace_clone(vm_aspace_t *parent) {
 	}
 
 	mutex_unlock(&parent->lock);
+
+	mutex_lock(&vm_aspace_list_lock);
+	list_append(&vm_aspace_list, &as->header);
+	vm_aspace_count++;
+	mutex_unlock(&vm_aspace_list_lock);
+
 	return as;
 }
 
@@ -1762,11 +2322,69 @@ static status_t switch_to_kernel(void *_as) {
 	return STATUS_SUCCESS;
 }
 
+/** Free all memory used by an address space that is no longer in use.
+ * @param as		Address space to free. */
+static void vm_aspace_teardown(vm_aspace_t *as) {
+	vm_region_t *region;
+
+	/* No CPU can have the context loaded, and the context is about to be
+	 * destroyed along with all its page tables, so there is no need to
+	 * remove mappings of anonymous pages individually. Object pages must
+	 * still be unmapped so they are released back to their owner. */
+	LIST_FOREACH_SAFE(&as->regions, iter) {
+		region = list_entry(iter, vm_region_t, header);
+
+		if(region->state == VM_REGION_ALLOCATED) {
+			if(region->handle) {
+				vm_region_unmap(region, region->start, region->size);
+			} else {
+				vm_amap_unmap(region->amap, region->amap_offset,
+					region->size);
+			}
+		}
+
+		vm_region_free(region);
+	}
+
+	/* Destroy the MMU context. */
+	mmu_context_destroy(as->mmu);
+
+	assert(list_empty(&as->regions));
+	assert(avl_tree_empty(&as->tree));
+
+	slab_cache_free(vm_aspace_cache, as);
+}
+
+#if CONFIG_VM_DEFERRED_TEARDOWN
+
+/** Thread which frees destroyed address spaces.
+ * @param arg1		Unused.
+ * @param arg2		Unused. */
+static void vm_reaper(void *arg1, void *arg2) {
+	vm_aspace_t *as;
+
+	while(true) {
+		semaphore_down(&vm_reaper_sem);
+
+		mutex_lock(&vm_reaper_lock);
+		assert(!list_empty(&vm_reaper_list));
+		as = list_first(&vm_reaper_list, vm_aspace_t, header);
+		list_remove(&as->header);
+		mutex_unlock(&vm_reaper_lock);
+
+		vm_aspace_teardown(as);
+	}
+}
+
+#endif
+
 /**
  * Destroy an address space.
  *
- * Removes all memory mappings in an address space and frees it. This must
- * not be called if the address space is in use on any CPU. There should also
+ * Removes all memory mappings in an address space and frees it. If the kernel
+ * is configured with CONFIG_VM_DEFERRED_TEARDOWN, the memory is freed by a
+ * background thread after this function returns. This must not be called if
+ * the address space is in use on any CPU. There should also
  * be no references to it in any processes, to ensure that nothing will attempt
  * to access it while it is being destroyed.
  *
@@ -1798,17 +2416,34 @@ void vm_aspace_destroy(vm_aspace_t *as) {
 		assert(refcount_get(&as->count) == 0);
 	}
 
-	/* Unmap and destroy each region. */
-	LIST_FOREACH_SAFE(&as->regions, iter)
-		vm_region_destroy(list_entry(iter, vm_region_t, header));
-
-	/* Destroy the MMU context. */
-	mmu_context_destroy(as->mmu);
+	mutex_lock(&vm_aspace_list_lock);
+	list_remove(&as->header);
+	vm_aspace_count--;
+	mutex_unlock(&vm_aspace_list_lock);
+
+	#if CONFIG_VM_DEFERRED_TEARDOWN
+	/* Leave the bulk of the work to the reaper so that the exiting thread
+	 * is not held up by it. */
+	if(vm_reaper_thread) {
+		mutex_lock(&vm_reaper_lock);
+		list_append(&vm_reaper_list, &as->header);
+		mutex_unlock(&vm_reaper_lock);
+
+		semaphore_up(&vm_reaper_sem, 1);
+		return;
+	}
+	#endif
 
-	assert(list_empty(&as->regions));
-	assert(avl_tree_empty(&as->tree));
+	vm_aspace_teardown(as);
+}
 
-	slab_cache_free(vm_aspace_cache, as);
+/** Get memory usage statistics for an address space.
+ * @param as		Address space to get statistics for.
+ * @param stats		Where to store statistics. */
+void vm_aspace_stats(vm_aspace_t *as, vm_aspace_stats_t *stats) {
+	mutex_lock(&as->lock);
+	memcpy(stats, &as->stats, sizeof(*stats));
+	mutex_unlock(&as->lock);
 }
 
 /** Show information about a region within an address space.
@@ -1867,6 +2502,9 @@ static kdb_status_t kdb_cmd_region(int argc, char **argv, kdb_filter_t *filter)
 		(region->access & VM_ACCESS_EXECUTE) ? 'X' : '-',
 		region->access);
 	kdb_printf("flags:       0x%" PRIx32 "\n", region->flags);
+	kdb_printf("advice:      %u\n", region->advice);
+	kdb_printf("faults:      %" PRIu64 " minor, %" PRIu64 " major\n",
+		region->minor_faults, region->major_faults);
 	switch(region->state) {
 	case VM_REGION_FREE:
 		kdb_printf("state:       %d (free)\n", region->state);
@@ -1995,7 +2633,14 @@ static kdb_status_t kdb_cmd_aspace(int argc, char **argv, kdb_filter_t *filter)
 		kdb_printf("count:      %d\n", refcount_get(&as->count));
 		kdb_printf("find_cache: %p\n", as->find_cache);
 		kdb_printf("mmu:        %p\n", as->mmu);
-		kdb_printf("free_map:   0x%lx\n\n", as->free_map);
+		kdb_printf("free_map:   0x%lx\n", as->free_map);
+		kdb_printf("rss:        %zu KiB (anon: %zu KiB, file: %zu KiB)\n",
+			((as->stats.anon_pages + as->stats.file_pages) * PAGE_SIZE) / 1024,
+			(as->stats.anon_pages * PAGE_SIZE) / 1024,
+			(as->stats.file_pages * PAGE_SIZE) / 1024);
+		kdb_printf("cow_breaks: %" PRIu64 "\n", as->stats.cow_breaks);
+		kdb_printf("faults:     %" PRIu64 " minor, %" PRIu64 " major\n\n",
+			as->stats.minor_faults, as->stats.major_faults);
 	}
 
 	if(mode == DUMP_FREE) kdb_printf("List ");
@@ -2046,6 +2691,19 @@ __init_text void vm_init(void) {
 	/* Initialize the caching system. */
 	vm_cache_init();
 
+	/* Initialize the swap store. */
+	swap_init();
+
+	#if CONFIG_VM_DEFERRED_TEARDOWN
+	if(thread_create("vm_reaper", NULL, 0, vm_reaper, NULL, NULL,
+		&vm_reaper_thread) != STATUS_SUCCESS)
+	{
+		fatal("Could not start VM reaper");
+	}
+
+	thread_run(vm_reaper_thread);
+	#endif
+
 	/* Register the KDB commands. */
 	kdb_register_command("region", "Print details about a VM region.",
 		kdb_cmd_region);
@@ -2165,3 +2823,19 @@ kern_vm_map(void **addrp, size_t size, unsigned spec, uint32_t access,
 status_t kern_vm_unmap(void *start, size_t size) {
 	return vm_unmap(curr_proc->aspace, (ptr_t)start, size);
 }
+
+/**
+ * Give advice on how a range of memory will be used.
+ *
+ * Applies a usage hint to all regions within a range of the calling process'
+ * address space. See vm_advise() for details of the advice values.
+ *
+ * @param start		Start of range (multiple of page size).
+ * @param size		Size of range (multiple of page size).
+ * @param advice	Advice value (VM_ADVISE_*).
+ *
+ * @return		Status code describing result of the operation.
+ */
+status_t kern_vm_advise(void *start, size_t size, unsigned advice) {
+	return vm_advise(curr_proc->aspace, (ptr_t)start, size, advice);
+}
@@ -43,6 +43,9 @@
 # define dprintf(fmt...)	
 #endif
 
+/** Number of pages to read ahead for sequentially accessed regions. */
+#define VM_CACHE_READAHEAD_PAGES	8
+
 static page_ops_t vm_cache_page_ops;
 
 /** Slab cache for allocating VM cache structures. */
@@ -71,9 +74,12 @@ static void vm_cache_ctor(void *obj, void *data) {
  *			the function returns.
  * @param sharedp	Where to store value stating whether a mapping had to
  *			be shared. Only used if mappingp is set.
+ * @param readp		Where to store whether the page's data had to be read
+ *			in from the source (can be NULL).
  * @return		Status code describing result of the operation. */
 static status_t vm_cache_get_page_internal(vm_cache_t *cache, offset_t offset,
-	bool overwrite, page_t **pagep, void **mappingp, bool *sharedp)
+	bool overwrite, page_t **pagep, void **mappingp, bool *sharedp,
+	bool *readp)
 {
 	void *mapping = NULL;
 	bool shared = false;
@@ -96,6 +102,9 @@ static status_t vm_cache_get_page_internal(vm_cache_t *cache, offset_t offset,
 	/* Check if we have it cached. */
 	page = avl_tree_lookup(&cache->pages, offset, page_t, avl_link);
 	if(page) {
+		if(readp)
+			*readp = false;
+
 		if(refcount_inc(&page->count) == 1)
 			page_set_state(page, PAGE_STATE_ALLOCATED);
 
@@ -122,6 +131,8 @@ static status_t vm_cache_get_page_internal(vm_cache_t *cache, offset_t offset,
 
 	/* Allocate a new page. */
 	page = page_alloc(MM_KERNEL);
+	if(readp)
+		*readp = false;
 
 	/* Only bother filling the page with data if it's not going to be
 	 * immediately overwritten. */
@@ -143,6 +154,9 @@ static status_t vm_cache_get_page_internal(vm_cache_t *cache, offset_t offset,
 				mutex_unlock(&cache->lock);
 				return ret;
 			}
+
+			if(readp)
+				*readp = true;
 		} else {
 			thread_wire(curr_thread);
 			mapping = phys_map(page->addr, PAGE_SIZE, MM_KERNEL);
@@ -266,7 +280,7 @@ static status_t vm_cache_map_page(vm_cache_t *cache, offset_t offset, bool overw
 	assert(addrp && sharedp);
 
 	return vm_cache_get_page_internal(cache, offset, overwrite, NULL, addrp,
-		sharedp);
+		sharedp, NULL);
 }
 
 /** Unmap and release a page from a cache.
@@ -340,14 +354,75 @@ static page_ops_t vm_cache_page_ops = {
 	.release_page = vm_cache_release_page,
 };
 
+/** Read pages into a cache without keeping them.
+ * @param cache		Cache to read into.
+ * @param start		Offset to start reading from.
+ * @param end		Offset to stop reading at. */
+static void vm_cache_readahead(vm_cache_t *cache, offset_t start, offset_t end) {
+	page_t *page;
+	offset_t offset;
+
+	for(offset = start; offset < end; offset += PAGE_SIZE) {
+		mutex_lock(&cache->lock);
+
+		/* Stop at the end of the cache. Skip over pages that are
+		 * already cached, there is no need to take a reference. */
+		if(offset >= cache->size) {
+			mutex_unlock(&cache->lock);
+			break;
+		} else if(avl_tree_lookup(&cache->pages, offset, page_t, avl_link)) {
+			mutex_unlock(&cache->lock);
+			continue;
+		}
+
+		mutex_unlock(&cache->lock);
+
+		/* Pull the page in and then release it straight away, leaving
+		 * it on the cached page queue. Readahead is best effort, so
+		 * just give up if there is an error. */
+		if(vm_cache_get_page_internal(cache, offset, false, &page, NULL,
+			NULL, NULL) != STATUS_SUCCESS)
+		{
+			break;
+		}
+
+		mutex_lock(&cache->lock);
+		vm_cache_release_page_internal(cache, page, false);
+		mutex_unlock(&cache->lock);
+	}
+}
+
 /** Get a page from a cache.
  * @param region	Region to get page for.
  * @param offset	Offset into object to get page from.
  * @param pagep		Where to store pointer to page structure.
+ * @param majorp	Where to store whether the page had to be read in.
  * @return		Status code describing result of the operation. */
-static status_t vm_cache_get_page(vm_region_t *region, offset_t offset, page_t **pagep) {
-	return vm_cache_get_page_internal(region->private, offset, false, pagep,
-		NULL, NULL);
+static status_t
+vm_cache_get_page(vm_region_t *region, offset_t offset, page_t **pagep,
+	bool *majorp)
+{
+	offset_t end;
+	status_t ret;
+
+	ret = vm_cache_get_page_internal(region->private, offset, false, pagep,
+		NULL, NULL, majorp);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	/* If the region is expected to be accessed sequentially, get the
+	 * following pages into the cache now so that the faults on them will
+	 * not have to wait for I/O. Don't go past the end of the region. */
+	if(region->advice == VM_ADVISE_SEQUENTIAL) {
+		end = region->obj_offset + region->size;
+		if(region->amap)
+			end += region->amap_offset;
+
+		end = min(end, offset + ((VM_CACHE_READAHEAD_PAGES + 1) * PAGE_SIZE));
+		vm_cache_readahead(region->private, offset + PAGE_SIZE, end);
+	}
+
+	return STATUS_SUCCESS;
 }
 
 /** VM region operations for mapping a VM cache. */
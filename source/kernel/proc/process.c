@@ -42,6 +42,7 @@
 #include <mm/vm.h>
 
 #include <proc/process.h>
+#include <proc/sched.h>
 #include <proc/thread.h>
 
 #include <security/security.h>
@@ -87,6 +88,7 @@ typedef struct process_load {
 	elf_image_t *image;		/**< ELF loader data. */
 	ptr_t arg_block;		/**< Address of argument block mapping. */
 	ptr_t stack;			/**< Address of stack mapping. */
+	ptr_t time_page;		/**< Address of time page mapping. */
 
 	semaphore_t sem;		/**< Semaphore to wait for completion on. */
 	status_t status;		/**< Status code to return from the call. */
@@ -158,6 +160,10 @@ process_alloc(const char *name, process_id_t id, process_t *parent, int priority
 	object_process_init(process);
 	process->flags = 0;
 	process->priority = priority;
+	process->affinity = (parent) ? parent->affinity : CPU_MASK_ALL;
+	#if CONFIG_SCHED_FAIR
+	atomic_set(&process->fair_load, 0);
+	#endif
 	process->token = token;
 	process->aspace = aspace;
 	process->thread_restore = 0;
@@ -184,13 +190,18 @@ process_alloc(const char *name, process_id_t id, process_t *parent, int priority
 /** Free a process' resources after it has died.
  * @param process	Process to clean up. */
 static void process_cleanup(process_t *process) {
+	vm_aspace_t *as;
+
 	elf_process_cleanup(process);
 	futex_process_cleanup(process);
 
-	if(process->aspace) {
-		vm_aspace_destroy(process->aspace);
-		process->aspace = NULL;
-	}
+	mutex_lock(&process->lock);
+	as = process->aspace;
+	process->aspace = NULL;
+	mutex_unlock(&process->lock);
+
+	if(as)
+		vm_aspace_destroy(as);
 
 	if(process->root_port)
 		ipc_port_release(process->root_port);
@@ -214,6 +225,14 @@ void process_retain(process_t *process) {
 	refcount_inc(&process->count);
 }
 
+/** Free a process once a grace period has passed.
+ * @param head		RCU head in the process. */
+static void process_free(rcu_head_t *head) {
+	process_t *process = container_of(head, process_t, rcu);
+
+	slab_cache_free(process_cache, process);
+}
+
 /**
  * Decrease the reference count of a process.
  *
@@ -248,7 +267,9 @@ void process_release(process_t *process) {
 		process->status);
 
 	kfree(process->name);
-	slab_cache_free(process_cache, process);
+
+	/* process_lookup() may still be looking at the process. */
+	call_rcu(&process->rcu, process_free);
 }
 
 /** Attach a thread to a process.
@@ -410,13 +431,31 @@ process_t *process_lookup_unsafe(process_id_t id) {
  * @return		Pointer to process found, or NULL if not found.
  */
 process_t *process_lookup(process_id_t id) {
+	avl_tree_node_t *node;
 	process_t *process;
 
+	/* Try to look up without taking the tree lock. Processes are freed
+	 * through RCU so the one we find cannot go away underneath us. The
+	 * reference count is 0 if process_release() is destroying it. */
+	rcu_read_lock();
+
+	if(avl_tree_lookup_node_rcu(&process_tree, id, &node)) {
+		process = (node) ? avl_tree_entry(node, process_t, tree_link) : NULL;
+		if(process && !refcount_inc_not_zero(&process->count))
+			process = NULL;
+
+		rcu_read_unlock();
+		return process;
+	}
+
+	rcu_read_unlock();
+
+	/* The tree was modified while we were looking, use the lock. */
 	rwlock_read_lock(&process_tree_lock);
 
 	process = process_lookup_unsafe(id);
-	if(process)
-		process_retain(process);
+	if(process && !refcount_inc_not_zero(&process->count))
+		process = NULL;
 
 	rwlock_unlock(&process_tree_lock);
 	return process;
@@ -471,6 +510,11 @@ static status_t process_load(process_load_t *load, process_t *parent) {
 	if(ret != STATUS_SUCCESS)
 		goto fail;
 
+	/* Map the time data page, used by libkernel to read the time. */
+	ret = time_page_map(load->aspace, &load->time_page);
+	if(ret != STATUS_SUCCESS)
+		goto fail;
+
 	/* Determine the size of the argument block. Each argument/environment
 	 * entry requires the length of the string plus another pointer for the
 	 * array entry, and 2 more pointers for the NULL terminators. */
@@ -557,6 +601,7 @@ process_entry_trampoline(void *arg1, void *arg2)
 	uargs->arg_count = load->arg_count;
 	uargs->env_count = load->env_count;
 	uargs->load_base = (void *)LIBKERNEL_BASE;
+	uargs->time_page = (void *)load->time_page;
 
 	/* Copy path string, arguments and environment variables. */
 	strcpy(uargs->path, load->path);
@@ -712,6 +757,42 @@ static kdb_status_t kdb_cmd_process(int argc, char **argv, kdb_filter_t *filter)
 	return KDB_SUCCESS;;
 }
 
+/** Print memory usage statistics for all processes.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_memstat(int argc, char **argv, kdb_filter_t *filter) {
+	process_t *process;
+	vm_aspace_stats_t *stats;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints the resident memory usage (in KiB), copy-on-write and page fault counts\n");
+		kdb_printf("of all processes.\n");
+		return KDB_SUCCESS;
+	}
+
+	kdb_printf("ID     RSS        Anon       File       COW        Minor      Major      Name\n");
+	kdb_printf("==     ===        ====       ====       ===        =====      =====      ====\n");
+
+	AVL_TREE_FOREACH(&process_tree, iter) {
+		process = avl_tree_entry(iter, process_t, tree_link);
+		if(!process->aspace)
+			continue;
+
+		stats = &process->aspace->stats;
+		kdb_printf("%-6" PRId32 " %-10zu %-10zu %-10zu %-10" PRIu64 " %-10"
+			PRIu64 " %-10" PRIu64 " %s\n", process->id,
+			((stats->anon_pages + stats->file_pages) * PAGE_SIZE) / 1024,
+			(stats->anon_pages * PAGE_SIZE) / 1024,
+			(stats->file_pages * PAGE_SIZE) / 1024, stats->cow_breaks,
+			stats->minor_faults, stats->major_faults, process->name);
+	}
+
+	return KDB_SUCCESS;
+}
+
 /** Initialize the process table and slab cache. */
 __init_text void process_init(void) {
 	/* Create the process ID allocator. We reserve ID 0 as it is always
@@ -724,10 +805,13 @@ __init_text void process_init(void) {
 		"process_cache", process_t, process_ctor, NULL, NULL, 0,
 		MM_BOOT);
 
-	/* Register the KDB command. */
+	/* Register the KDB commands. */
 	kdb_register_command(
 		"process", "Print a list of running processes.",
 		kdb_cmd_process);
+	kdb_register_command(
+		"memstat", "Print memory usage statistics for all processes.",
+		kdb_cmd_memstat);
 
 	/* Create the kernel process and register the kernel image to it. */
 	token_retain(system_token);
@@ -1370,6 +1454,7 @@ kern_process_clone(handle_t *handlep)
     memcpy(&process->exceptions, &curr_proc->exceptions, sizeof(process->exceptions));
 	thread->ustack = curr_thread->ustack;
 	thread->ustack_size = curr_thread->ustack_size;
+	thread->affinity = curr_thread->affinity;
 
 	thread_run(thread);
 	thread_release(thread);
@@ -1600,6 +1685,163 @@ kern_process_kill(handle_t handle)
 	return ret;
 }
 
+/** Get memory usage information for a process.
+ * @param process	Process to get information for.
+ * @param info		Where to store information. */
+static void process_memory_info(process_t *process, process_memory_info_t *info) {
+	vm_aspace_stats_t stats;
+
+	memset(info, 0, sizeof(*info));
+
+	/* The address space is replaced under the process lock by exec and
+	 * removed under it when the process dies. */
+	mutex_lock(&process->lock);
+
+	if(process->aspace) {
+		vm_aspace_stats(process->aspace, &stats);
+
+		info->anon = (uint64_t)stats.anon_pages * PAGE_SIZE;
+		info->file = (uint64_t)stats.file_pages * PAGE_SIZE;
+		info->rss = info->anon + info->file;
+		info->cow_breaks = stats.cow_breaks;
+		info->minor_faults = stats.minor_faults;
+		info->major_faults = stats.major_faults;
+	}
+
+	mutex_unlock(&process->lock);
+}
+
+/**
+ * Get information about a process.
+ *
+ * Gets information about a process. The calling thread must have privileged
+ * access to the process. The following information types are currently
+ * defined:
+ *
+ *  - PROCESS_INFO_MEMORY: Memory usage and page fault statistics
+ *    (process_memory_info_t).
+ *
+ * @param handle	Handle to process, or PROCESS_SELF for calling process.
+ * @param what		Type of information to get (PROCESS_INFO_*).
+ * @param buf		Buffer to store information in (must be large enough
+ *			for the requested information type).
+ *
+ * @return		STATUS_SUCCESS on success.
+ *			STATUS_INVALID_HANDLE if handle is invalid.
+ *			STATUS_ACCESS_DENIED if the caller does not have
+ *			privileged access to the process.
+ *			STATUS_INVALID_ARG if the information type is invalid.
+ */
+status_t kern_process_info(handle_t handle, unsigned what, void *buf) {
+	process_memory_info_t memory;
+	process_t *process;
+	status_t ret;
+
+	if(!buf)
+		return STATUS_INVALID_ARG;
+
+	ret = process_handle_lookup(handle, &process);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	if(!process_access(process)) {
+		process_release(process);
+		return STATUS_ACCESS_DENIED;
+	}
+
+	switch(what) {
+	case PROCESS_INFO_MEMORY:
+		process_memory_info(process, &memory);
+		ret = memcpy_to_user(buf, &memory, sizeof(memory));
+		break;
+	default:
+		ret = STATUS_INVALID_ARG;
+		break;
+	}
+
+	process_release(process);
+	return ret;
+}
+
+/** Get the CPU affinity of a process.
+ * @param handle	Handle to process, or PROCESS_SELF for calling process.
+ * @param maskp		Where to store mask of CPUs the process can run on.
+ * @return		Status code describing result of the operation. */
+status_t kern_process_affinity(handle_t handle, cpu_mask_t *maskp) {
+	process_t *process;
+	status_t ret;
+
+	if(!maskp)
+		return STATUS_INVALID_ARG;
+
+	ret = process_handle_lookup(handle, &process);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	ret = write_user(maskp, process->affinity);
+	process_release(process);
+	return ret;
+}
+
+/**
+ * Set the CPU affinity of a process.
+ *
+ * Sets the set of CPUs that a process is allowed to run on. The affinity of
+ * every thread currently in the process is set to the given mask, and new
+ * threads and child processes will inherit it. See kern_thread_set_affinity()
+ * for a description of the mask. The calling thread must have privileged
+ * access to the process.
+ *
+ * @param handle	Handle to process, or PROCESS_SELF for calling process.
+ * @param mask		New affinity mask.
+ *
+ * @return		STATUS_SUCCESS on success.
+ *			STATUS_INVALID_HANDLE if handle is invalid.
+ *			STATUS_ACCESS_DENIED if the caller does not have
+ *			privileged access to the process.
+ *			STATUS_INVALID_ARG if the mask does not include any
+ *			running CPUs.
+ */
+status_t kern_process_set_affinity(handle_t handle, cpu_mask_t mask) {
+	process_t *process;
+	thread_t *thread;
+	bool resched = false;
+	status_t ret;
+
+	if(!sched_affinity_valid(mask))
+		return STATUS_INVALID_ARG;
+
+	ret = process_handle_lookup(handle, &process);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	if(!process_access(process)) {
+		process_release(process);
+		return STATUS_ACCESS_DENIED;
+	}
+
+	mutex_lock(&process->lock);
+
+	process->affinity = mask;
+
+	LIST_FOREACH(&process->threads, iter) {
+		thread = list_entry(iter, thread_t, owner_link);
+
+		spinlock_lock(&thread->lock);
+		if(sched_set_affinity(thread, mask))
+			resched = true;
+		spinlock_unlock(&thread->lock);
+	}
+
+	mutex_unlock(&process->lock);
+	process_release(process);
+
+	/* Move the current thread off this CPU if it is no longer allowed. */
+	if(resched)
+		thread_yield();
+
+	return STATUS_SUCCESS;
+}
 
 /** Get the calling process' security token.
  * @param handlep	Where to store handle to token.
@@ -40,27 +40,92 @@
  * chance to run. The current heuristic used to determine whether a thread is
  * CPU-bound is to see whether it uses up all of its timeslice.
  *
+ * Real-time threads (THREAD_SCHED_FIFO and THREAD_SCHED_RR) use a further 32
+ * priority levels above the timesharing ones, so they always take precedence
+ * over timesharing threads. Their priority is fixed, and they are never placed
+ * on the expired queue. A FIFO thread runs until it blocks, yields or is
+ * preempted by a higher priority thread, and has no preemption timer. A
+ * round-robin thread is moved to the back of its priority level when its
+ * quantum runs out. A real-time thread that is preempted keeps its place at
+ * the front of its priority level, and a round-robin thread also keeps the
+ * rest of its quantum.
+ *
  * On multi-CPU systems, load is balanced between CPUs when moving threads into
  * the Ready state by picking an appropriate CPU to run on. Currently, the CPU
  * that the thread previously ran on is favoured if it is not heavily loaded.
- * Otherwise, the CPU with the lowest load is picked.
- *
- * @todo		Load balancing could be improved in situations where
- *			there are several CPU-bound threads running. Currently,
- *			a thread is only moved to another CPU when it is woken
- *			from sleep. This could be done by stealing threads from
- *			other CPUs when a CPU becomes idle.
- * @todo		Once the facility to get CPU topology information is
- *			implemented, we should be more friendly to HT systems
- *			when picking a CPU for a thread to run on by favouring
- *			idle logical CPUs on a core that is not already running
- *			a thread on another of its logical CPUs.
+ * Otherwise, the CPU with the lowest load is picked. Each CPU keeps a decaying
+ * average of its run queue length which is only written by that CPU, or while
+ * holding its scheduler lock, so there is no global state to contend on. The
+ * least loaded CPU is found by scanning these averages, but the result is
+ * cached for a short period so that a burst of wakeups does not scan for every
+ * thread.
+ *
+ * Since that alone does nothing for CPU-bound threads which never sleep,
+ * threads are also moved between CPUs once they are queued. A CPU that is
+ * about to go idle pulls a thread from the busiest CPU, and a busy CPU
+ * periodically pushes threads to any idle CPUs from its preemption timer.
+ * Threads that have not run for a while are preferred for moving, as they are
+ * less likely to have anything useful left in the cache of the CPU they are
+ * leaving.
+ *
+ * Threads have an affinity mask restricting the CPUs that they can be placed
+ * on, which both CPU allocation and the balancing above honour. When the mask
+ * of a thread is changed so that it excludes the CPU it is currently on, it is
+ * moved immediately if it is queued. If it is running, it is moved when it
+ * next gets rescheduled: rather than being requeued on its current CPU it is
+ * left off the run queues, and is inserted on another CPU once the switch
+ * away from it has completed.
+ *
+ * Threads blocked on a mutex or a PI futex lend their priority to the thread
+ * that holds it, and on to whatever that thread is blocked on in turn, so
+ * that a high priority thread is not held up behind a low priority lock
+ * holder that cannot get the CPU. The inherited priority is tracked
+ * separately from a thread's own priority, and the higher of the two is used
+ * for queueing and preemption decisions. All inheritance state is protected
+ * by a single lock, as lock chains can span any number of threads.
+ *
+ * When a CPU has only one runnable thread, the preemption timer is not started
+ * for it as there is nothing to preempt it for. If another thread is then
+ * queued on the CPU, the timer is started for whatever is left of the running
+ * thread's timeslice, or to expire immediately if it has already used it.
+ *
+ * For diagnosing latency, each thread records how long it has spent running
+ * and waiting on a run queue, and how many times it gave up the CPU or was
+ * preempted. Each CPU keeps a histogram of how long threads waited on its run
+ * queues before being run.
+ *
+ * CPU allocation on wakeup also takes the CPU topology into account. If the
+ * previous CPU is busy, an idle CPU sharing its last level cache is preferred,
+ * and one on a different core over an SMT sibling, as the thread's working set
+ * is likely still in that cache. Failing that the least loaded CPU in the same
+ * package is used if it is sufficiently less loaded, and the thread is only
+ * moved to another package if the imbalance is large, since that loses all
+ * cache warmth.
+ *
+ * Where the architecture supports it, an idle CPU waits for a write to its
+ * need_resched word rather than for an interrupt, so waking it to run a
+ * thread is a plain store with no IPI. The time taken for a CPU to wake is
+ * recorded separately for both kinds of wakeup.
+ *
+ * Optionally (CONFIG_SCHED_FAIR), timesharing threads are instead scheduled by
+ * weighted virtual runtime. Each CPU keeps such threads in a tree ordered by
+ * virtual runtime, and always runs the leftmost. The rate at which a thread's
+ * virtual runtime advances is inversely proportional to its share of the CPU:
+ * a process gets a share according to its priority class, which is divided
+ * between its runnable threads according to their priorities. A process
+ * therefore cannot get more CPU time by running more threads. Virtual runtime
+ * is kept relative to the CPU's minimum while a thread sleeps, and a thread
+ * that wakes is only given a small credit for the time it slept. Real-time
+ * threads and threads with an inherited priority still use the priority
+ * queues, which are always served before the tree.
+ *
  * @todo		Possibly a better heuristic for determining whether a
  *			thread is CPU-/IO-bound is to look at how much time it
  *			spends sleeping.
  * @todo		Alter timeslice based on priority?
  */
 
+#include <arch/barrier.h>
 #include <arch/bitops.h>
 
 #include <lib/string.h>
@@ -72,6 +137,8 @@
 #include <proc/sched.h>
 #include <proc/thread.h>
 
+#include <sync/rcu.h>
+
 #include <assert.h>
 #include <cpu.h>
 #include <kdb.h>
@@ -90,7 +157,10 @@
 #endif
 
 /** Number of priority levels. */
-#define PRIORITY_COUNT		32
+#define PRIORITY_COUNT		64
+
+/** First priority level used by real-time threads. */
+#define PRIORITY_RT_BASE	32
 
 /** Timeslice to give to threads. */
 #define THREAD_TIMESLICE	MSECS2NSECS(3)
@@ -98,6 +168,57 @@
 /** Maximum penalty to CPU-bound threads. */
 #define MAX_PENALTY		5
 
+/** Interval between attempts to push threads to idle CPUs. */
+#define BALANCE_INTERVAL	MSECS2NSECS(20)
+
+/** Time since last run after which a thread is considered to be cache-cold. */
+#define CACHE_HOT_TIME		MSECS2NSECS(2)
+
+/** Load average parameters. Loads are fixed point, 1 << LOAD_SHIFT is 1.0. */
+#define LOAD_SHIFT		10
+#define LOAD_PERIOD		MSECS2NSECS(4)
+#define LOAD_DECAY		3	/**< Each period moves 1/8 of the way. */
+#define LOAD_PERIODS_MAX	32	/**< Periods after which old load is gone. */
+
+/** Imbalance required to move a thread away from its previous CPU. */
+#define LOAD_IMBALANCE		(1UL << LOAD_SHIFT)
+
+/** How long the least loaded CPU lookup is cached for. */
+#define IDLEST_CACHE_TIME	MSECS2NSECS(1)
+
+#if CONFIG_SCHED_FAIR
+
+/** Weight that gives a thread an unscaled share of the CPU. */
+#define FAIR_WEIGHT_BASE	1024
+
+/** Virtual runtime a thread must be ahead by for a wakeup to preempt it. */
+#define FAIR_WAKEUP_GRANULARITY	MSECS2NSECS(1)
+
+/** Most virtual runtime that a thread can be credited for having slept. */
+#define FAIR_SLEEPER_CREDIT	THREAD_TIMESLICE
+
+/** Weights of each process priority class. */
+static const uint32_t fair_class_weights[] = {
+	[PRIORITY_CLASS_LOW] = 512,
+	[PRIORITY_CLASS_NORMAL] = 1024,
+	[PRIORITY_CLASS_HIGH] = 2048,
+	[PRIORITY_CLASS_SYSTEM] = 4096,
+};
+
+/** Weights of each thread priority within a process. */
+static const uint32_t fair_thread_weights[] = {
+	[THREAD_PRIORITY_LOW] = 512,
+	[THREAD_PRIORITY_NORMAL] = 1024,
+	[THREAD_PRIORITY_HIGH] = 2048,
+};
+
+#endif
+
+/** Number of run queue latency histogram buckets. Bucket 0 counts waits of
+ * under 1us, bucket N counts waits of 2^(N-1) to 2^N us, and the last bucket
+ * also counts anything longer. */
+#define LATENCY_BUCKETS		20
+
 /** Run queue structure. */
 typedef struct sched_queue {
 	unsigned long bitmap;		/**< Bitmap of queues with data. */
@@ -116,28 +237,325 @@ typedef struct sched_cpu {
 	sched_queue_t *expired;		/**< Expired queue. */
 	sched_queue_t queues[2];	/**< Active and expired queues. */
 	size_t total;			/**< Total running/ready thread count. */
+	thread_t *migrate_thread;	/**< Previous thread needing to be moved. */
+	bool preempted;			/**< Whether the current thread is being preempted. */
+	bool tick_stopped;		/**< Whether the current thread has no timer. */
+	nstime_t tick_stop_time;	/**< Time that the timer was last not started. */
+	uint64_t ticks_avoided;		/**< Number of timer ticks avoided. */
+
+	/** Run queue latency statistics. */
+	uint64_t latency[LATENCY_BUCKETS];	/**< Histogram of waits to run. */
+	nstime_t latency_total;		/**< Total of all waits to run. */
+	nstime_t latency_max;		/**< Longest wait to run. */
+
+	#if CONFIG_SCHED_FAIR
+	/** Fair scheduling information. */
+	avl_tree_t fair_tree;		/**< Threads ordered by virtual runtime. */
+	nstime_t min_vruntime;		/**< Minimum virtual runtime (monotonic). */
+	#endif
+
+	#if CONFIG_SMP
+	/** Load balancing information. */
+	unsigned long load;		/**< Decaying average of total (fixed point). */
+	nstime_t load_time;		/**< Time of last load average update. */
+	nstime_t next_balance;		/**< Time of next push balancing attempt. */
+	uint64_t migrations;		/**< Threads placed on this CPU from another. */
+	uint64_t pulls;			/**< Threads stolen by this CPU while idle. */
+	uint64_t pushes;		/**< Threads pushed from this CPU to idle CPUs. */
+
+	/** Idle wakeup statistics, indexed by whether an IPI was needed. */
+	nstime_t wake_time;		/**< Time of the pending wakeup request. */
+	bool wake_ipi;			/**< Whether the pending wakeup used an IPI. */
+	uint64_t wakeups[2];		/**< Number of wakeups from idle. */
+	nstime_t wake_total[2];		/**< Total of wakeup latencies. */
+	nstime_t wake_max[2];		/**< Longest wakeup latency. */
+	#endif
 } sched_cpu_t;
 
+/** Check whether a thread is allowed to run on a CPU.
+ * @note		CPUs with IDs that cannot be represented in a mask
+ *			can only be used by threads that can run anywhere.
+ * @param thread	Thread to check.
+ * @param cpu		CPU to check.
+ * @return		Whether the thread can run on the CPU. */
+static inline bool sched_cpu_allowed(thread_t *thread, cpu_t *cpu) {
+	if(thread->affinity == CPU_MASK_ALL)
+		return true;
+
+	return cpu->id < (sizeof(cpu_mask_t) * CHAR_BIT)
+		&& thread->affinity & ((cpu_mask_t)1 << cpu->id);
+}
+
 #if CONFIG_SMP
-/** Total number of running/ready threads across all CPUs. */
-static atomic_t threads_running = 0;
-#endif
+
+/**
+ * Get another CPU to reschedule.
+ *
+ * Gets another CPU to pick a new thread to run. If the CPU is idle and is
+ * monitoring its need_resched word, it is woken by writing to that, which
+ * avoids the cost of sending and handling an IPI. Otherwise an IPI is sent.
+ *
+ * @param cpu		CPU to kick (must not be the current CPU).
+ */
+static void sched_kick_cpu(cpu_t *cpu) {
+	sched_cpu_t *sched = cpu->sched;
+
+	if(cpu->idle) {
+		if(!sched->wake_time)
+			sched->wake_time = system_time();
+
+		/* Pairs with the barrier in arch_cpu_idle(): either the CPU
+		 * sees need_resched set before waiting, or we see that it is
+		 * monitoring it and the write will wake it. */
+		cpu->need_resched = 1;
+		memory_barrier();
+		if(cpu->idle_monitor) {
+			sched->wake_ipi = false;
+			return;
+		}
+
+		sched->wake_ipi = true;
+	}
+
+	smp_call_single(cpu->id, NULL, NULL, SMP_CALL_ASYNC);
+}
+
+/** Record the latency of a wakeup of the current CPU from idle.
+ * @param sched		Scheduler information for the current CPU. */
+static void sched_account_wakeup(sched_cpu_t *sched) {
+	nstime_t latency;
+	unsigned type;
+
+	/* This is only used for statistics, so races with another CPU
+	 * requesting a wakeup at the same time are harmless. */
+	if(!sched->wake_time)
+		return;
+
+	latency = system_time() - sched->wake_time;
+	type = sched->wake_ipi;
+	sched->wake_time = 0;
+
+	sched->wakeups[type]++;
+	sched->wake_total[type] += latency;
+	if(latency > sched->wake_max[type])
+		sched->wake_max[type] = latency;
+}
+
+/** Cached result of the least loaded CPU lookup. */
+static cpu_t *sched_idlest_cpu = NULL;
+static nstime_t sched_idlest_time = 0;
+
+/** Update the load average of a CPU.
+ * @param cpu		Scheduler information for the CPU (must be locked).
+ * @param now		Current system time. */
+static inline void sched_update_load(sched_cpu_t *cpu, nstime_t now) {
+	unsigned long current = cpu->total << LOAD_SHIFT;
+	nstime_t periods;
+
+	periods = (now - cpu->load_time) / LOAD_PERIOD;
+	if(!periods)
+		return;
+
+	cpu->load_time += periods * LOAD_PERIOD;
+
+	if(periods >= LOAD_PERIODS_MAX) {
+		cpu->load = current;
+	} else {
+		while(periods--)
+			cpu->load = cpu->load - (cpu->load >> LOAD_DECAY) + (current >> LOAD_DECAY);
+	}
+}
+
+/** Get the effective load of a CPU.
+ * @note		The instantaneous load is taken into account so that
+ *			a CPU which has just been given threads does not look
+ *			idle until its average catches up. The average is only
+ *			updated when the CPU reschedules, so it would never
+ *			decay on an idle CPU: a CPU with nothing to run is
+ *			reported as having no load.
+ * @param cpu		CPU to get load of.
+ * @return		Load of the CPU (fixed point). */
+static inline unsigned long sched_cpu_load(cpu_t *cpu) {
+	unsigned long total = cpu->sched->total;
+
+	return (total) ? max(cpu->sched->load, total << LOAD_SHIFT) : 0;
+}
+
+#endif /* CONFIG_SMP */
+
+#if CONFIG_SCHED_FAIR
+
+/** Check whether a thread is scheduled by virtual runtime.
+ * @note		A timesharing thread with an inherited priority is
+ *			queued by that priority so that it is run promptly.
+ * @param thread	Thread to check.
+ * @return		Whether the thread belongs in the fair tree. */
+static inline bool sched_thread_fair(thread_t *thread) {
+	return thread->policy == THREAD_SCHED_NORMAL && thread->pi_prio <= thread->curr_prio;
+}
+
+/** Convert an amount of CPU time used by a thread to virtual runtime.
+ * @param thread	Thread that used the time.
+ * @param delta		Time used.
+ * @return		Virtual runtime to charge the thread. */
+static inline nstime_t sched_fair_delta(thread_t *thread, nstime_t delta) {
+	uint64_t weight = fair_thread_weights[thread->priority];
+	uint64_t load = max((uint64_t)atomic_get(&thread->owner->fair_load), weight);
+
+	/* The thread's share of its process' weight is weight / load. */
+	return ((delta * FAIR_WEIGHT_BASE) / fair_class_weights[thread->owner->priority])
+		* load / weight;
+}
+
+/** Add a runnable thread's weight to the load of its process.
+ * @param thread	Thread that has become runnable. */
+static inline void sched_fair_join(thread_t *thread) {
+	if(thread->policy != THREAD_SCHED_NORMAL || thread->fair_weight)
+		return;
+
+	thread->fair_weight = fair_thread_weights[thread->priority];
+	atomic_add(&thread->owner->fair_load, thread->fair_weight);
+}
+
+/** Remove a thread's weight from the load of its process.
+ * @param thread	Thread that is no longer runnable. */
+static inline void sched_fair_leave(thread_t *thread) {
+	if(!thread->fair_weight)
+		return;
+
+	atomic_sub(&thread->owner->fair_load, thread->fair_weight);
+	thread->fair_weight = 0;
+}
+
+/** Add a thread to the fair tree of a CPU.
+ * @param cpu		Scheduler information for the CPU.
+ * @param thread	Thread to add. */
+static inline void sched_fair_insert(sched_cpu_t *cpu, thread_t *thread) {
+	avl_tree_key_t key = thread->vruntime;
+
+	/* Keys must be unique. Being a nanosecond out makes no difference. */
+	while(avl_tree_lookup_node(&cpu->fair_tree, key))
+		key++;
+
+	thread->vruntime = key;
+	avl_tree_insert(&cpu->fair_tree, key, &thread->fair_link);
+}
+
+/** Make the virtual runtime of a thread leaving a CPU relative to it.
+ * @param cpu		Scheduler information for the CPU.
+ * @param thread	Thread leaving the CPU. */
+static inline void sched_fair_detach(sched_cpu_t *cpu, thread_t *thread) {
+	if(thread->policy == THREAD_SCHED_NORMAL)
+		thread->vruntime -= cpu->min_vruntime;
+}
+
+/** Make the relative virtual runtime of a thread joining a CPU absolute.
+ * @param cpu		Scheduler information for the CPU.
+ * @param thread	Thread joining the CPU. */
+static inline void sched_fair_attach(sched_cpu_t *cpu, thread_t *thread) {
+	if(thread->policy == THREAD_SCHED_NORMAL)
+		thread->vruntime = max(cpu->min_vruntime + thread->vruntime, 0);
+}
+
+#endif /* CONFIG_SCHED_FAIR */
+
+/** Check whether a CPU has threads waiting on its run queues.
+ * @param cpu		Scheduler information for the CPU (must be locked).
+ * @return		Whether any threads are queued. */
+static inline bool sched_cpu_queued(sched_cpu_t *cpu) {
+	#if CONFIG_SCHED_FAIR
+	if(!avl_tree_empty(&cpu->fair_tree))
+		return true;
+	#endif
+
+	return cpu->active->bitmap || cpu->expired->bitmap;
+}
+
+/** Check whether a newly queued thread should preempt a CPU's current thread.
+ * @param cpu		CPU the thread is queued on (its scheduler
+ *			information must be locked, and it must not be idle).
+ * @param thread	Thread that has been queued.
+ * @return		Whether to preempt the current thread. */
+static inline bool sched_should_preempt(cpu_t *cpu, thread_t *thread) {
+	#if CONFIG_SCHED_FAIR
+	thread_t *curr = cpu->thread;
+	nstime_t vruntime;
+
+	/* The current thread's virtual runtime is only updated when it is
+	 * rescheduled, so account for what it has used so far. */
+	if(sched_thread_fair(thread) && sched_thread_fair(curr)) {
+		vruntime = curr->vruntime + sched_fair_delta(curr, system_time() - curr->run_start);
+		return thread->vruntime + FAIR_WAKEUP_GRANULARITY < vruntime;
+	}
+	#endif
+
+	return sched_thread_priority(thread) > sched_thread_priority(cpu->thread);
+}
 
 /** Add a thread to a queue.
  * @param queue		Queue to add to.
  * @param thread	Thread to add. */
 static inline void sched_queue_insert(sched_queue_t *queue, thread_t *thread) {
-	list_append(&queue->threads[thread->curr_prio], &thread->runq_link);
-	queue->bitmap |= (1 << thread->curr_prio);
+	int prio = sched_thread_priority(thread);
+
+	#if CONFIG_SCHED_FAIR
+	if(sched_thread_fair(thread)) {
+		sched_fair_insert(thread->cpu->sched, thread);
+		return;
+	}
+	#endif
+
+	list_append(&queue->threads[prio], &thread->runq_link);
+	queue->bitmap |= (1UL << prio);
+}
+
+/** Add a thread to the front of its priority level in a queue.
+ * @param queue		Queue to add to.
+ * @param thread	Thread to add. */
+static inline void sched_queue_insert_head(sched_queue_t *queue, thread_t *thread) {
+	int prio = sched_thread_priority(thread);
+
+	#if CONFIG_SCHED_FAIR
+	if(sched_thread_fair(thread)) {
+		sched_fair_insert(thread->cpu->sched, thread);
+		return;
+	}
+	#endif
+
+	list_prepend(&queue->threads[prio], &thread->runq_link);
+	queue->bitmap |= (1UL << prio);
 }
 
 /** Remove a thread from a queue.
  * @param queue		Queue to remove from.
  * @param thread	Thread to remove. */
 static inline void sched_queue_remove(sched_queue_t *queue, thread_t *thread) {
+	int prio = sched_thread_priority(thread);
+
+	#if CONFIG_SCHED_FAIR
+	if(sched_thread_fair(thread)) {
+		avl_tree_remove(&thread->cpu->sched->fair_tree, &thread->fair_link);
+		return;
+	}
+	#endif
+
 	list_remove(&thread->runq_link);
-	if(list_empty(&queue->threads[thread->curr_prio]))
-		queue->bitmap &= ~(1 << thread->curr_prio);
+	if(list_empty(&queue->threads[prio]))
+		queue->bitmap &= ~(1UL << prio);
+}
+
+/** Find the queue that a thread is in.
+ * @param cpu		Scheduler information for the CPU the thread is on
+ *			(must be locked).
+ * @param thread	Thread to find (must be in the Ready state).
+ * @return		Queue containing the thread. */
+static sched_queue_t *sched_thread_queue(sched_cpu_t *cpu, thread_t *thread) {
+	LIST_FOREACH(&cpu->expired->threads[sched_thread_priority(thread)], iter) {
+		if(iter == &thread->runq_link)
+			return cpu->expired;
+	}
+
+	return cpu->active;
 }
 
 /** Calculate the initial priority of a thread.
@@ -145,6 +563,13 @@ static inline void sched_queue_remove(sched_queue_t *queue, thread_t *thread) {
 static inline void sched_calculate_priority(thread_t *thread) {
 	int priority;
 
+	/* Real-time threads have a fixed priority above all timesharing
+	 * threads. */
+	if(thread->policy != THREAD_SCHED_NORMAL) {
+		thread->max_prio = thread->curr_prio = PRIORITY_RT_BASE + thread->rt_priority;
+		return;
+	}
+
 	/* We need to map the priority class and the thread priority onto our
 	 * 32 priority levels. See documentation/sched-priorities.txt for a
 	 * pretty bad explanation of what this is doing. */
@@ -162,6 +587,9 @@ static inline void sched_calculate_priority(thread_t *thread) {
  * @param cpu		Per-CPU scheduler information structure.
  * @param thread	Thread to tweak. */
 static inline void sched_tweak_priority(sched_cpu_t *cpu, thread_t *thread) {
+	if(thread->policy != THREAD_SCHED_NORMAL)
+		return;
+
 	if(thread->timeslice != 0) {
 		/* The timeslice wasn't fully used, give a bonus if we're not
 		 * already at the maximum priority. */
@@ -185,6 +613,26 @@ static inline void sched_tweak_priority(sched_cpu_t *cpu, thread_t *thread) {
 	}
 }
 
+/** Account for the time a thread spent waiting to run.
+ * @param cpu		Per-CPU scheduler information structure.
+ * @param thread	Thread that is about to run (must be locked).
+ * @param now		Current time. */
+static inline void sched_account_wait(sched_cpu_t *cpu, thread_t *thread, nstime_t now) {
+	nstime_t wait = now - thread->ready_time;
+	unsigned long usecs = NSECS2USECS(wait);
+	unsigned bucket;
+
+	thread->wait_time += wait;
+	if(wait > thread->max_wait_time)
+		thread->max_wait_time = wait;
+
+	bucket = (usecs) ? min(fls(usecs) + 1, LATENCY_BUCKETS - 1) : 0;
+	cpu->latency[bucket]++;
+	cpu->latency_total += wait;
+	if(wait > cpu->latency_max)
+		cpu->latency_max = wait;
+}
+
 /** Pick a new thread to run.
  * @param cpu		Per-CPU scheduler information structure.
  * @return		Pointer to thread, or NULL if no threads available. */
@@ -193,6 +641,16 @@ static thread_t *sched_pick_thread(sched_cpu_t *cpu) {
 	int i;
 
 	if(!cpu->active->bitmap) {
+		#if CONFIG_SCHED_FAIR
+		/* Nothing on the priority queues, run the thread that has had
+		 * the least of its share. */
+		if(!avl_tree_empty(&cpu->fair_tree)) {
+			thread = avl_tree_entry(avl_tree_first(&cpu->fair_tree), thread_t, fair_link);
+			sched_queue_remove(cpu->active, thread);
+			return thread;
+		}
+		#endif
+
 		/* The active queue is empty. If there are threads on the
 		 * expired queue, swap them. */
 		if(cpu->expired->bitmap) {
@@ -209,11 +667,262 @@ static thread_t *sched_pick_thread(sched_cpu_t *cpu) {
 	return thread;
 }
 
+#if CONFIG_SMP
+
+/** Lock the scheduler information for two CPUs.
+ * @note		Locks are taken in order of CPU ID to avoid deadlock.
+ * @param a		First CPU.
+ * @param b		Second CPU. */
+static inline void sched_lock_pair(cpu_t *a, cpu_t *b) {
+	if(a->id < b->id) {
+		spinlock_lock_noirq(&a->sched->lock);
+		spinlock_lock_noirq(&b->sched->lock);
+	} else {
+		spinlock_lock_noirq(&b->sched->lock);
+		spinlock_lock_noirq(&a->sched->lock);
+	}
+}
+
+/** Unlock the scheduler information for two CPUs.
+ * @param a		First CPU.
+ * @param b		Second CPU. */
+static inline void sched_unlock_pair(cpu_t *a, cpu_t *b) {
+	spinlock_unlock_noirq(&a->sched->lock);
+	spinlock_unlock_noirq(&b->sched->lock);
+}
+
+/** Check whether a queued thread can be moved to another CPU.
+ * @param thread	Thread to check.
+ * @param to		CPU that the thread would be moved to.
+ * @return		Whether the thread can be moved. */
+static inline bool sched_thread_movable(thread_t *thread, cpu_t *to) {
+	return !thread->wired && !thread->preempt_count && sched_cpu_allowed(thread, to);
+}
+
+/** Find a thread that can be moved away from a CPU.
+ * @note		Threads with the most virtual runtime in the fair tree
+ *			are looked at first, followed by threads on the
+ *			expired queue, as
+ *			they will be waiting the longest to run. Cache-cold
+ *			threads are preferred, but a cache-hot thread will be
+ *			returned if there is no cold one.
+ * @param cpu		Scheduler information for the CPU (must be locked).
+ * @param to		CPU that the thread will be moved to.
+ * @param queuep	Where to store queue that the thread is in.
+ * @return		Thread found, or NULL if none can be moved. */
+static thread_t *sched_find_movable(sched_cpu_t *cpu, cpu_t *to, sched_queue_t **queuep) {
+	sched_queue_t *queues[2] = { cpu->expired, cpu->active };
+	thread_t *thread, *hot = NULL;
+	sched_queue_t *hot_queue = NULL;
+	#if CONFIG_SCHED_FAIR
+	avl_tree_node_t *node;
+	#endif
+	unsigned long bitmap;
+	nstime_t now;
+	unsigned i;
+	int prio;
+
+	now = system_time();
+
+	#if CONFIG_SCHED_FAIR
+	for(node = avl_tree_last(&cpu->fair_tree); node; node = avl_tree_prev(node)) {
+		thread = avl_tree_entry(node, thread_t, fair_link);
+
+		if(!sched_thread_movable(thread, to))
+			continue;
+
+		if(now - thread->sched_time >= CACHE_HOT_TIME) {
+			*queuep = cpu->active;
+			return thread;
+		} else if(!hot) {
+			hot = thread;
+			hot_queue = cpu->active;
+		}
+	}
+	#endif
+
+	for(i = 0; i < 2; i++) {
+		bitmap = queues[i]->bitmap;
+		while(bitmap) {
+			prio = fls(bitmap);
+			bitmap &= ~(1UL << prio);
+
+			LIST_FOREACH(&queues[i]->threads[prio], iter) {
+				thread = list_entry(iter, thread_t, runq_link);
+
+				if(!sched_thread_movable(thread, to))
+					continue;
+
+				if(now - thread->sched_time >= CACHE_HOT_TIME) {
+					*queuep = queues[i];
+					return thread;
+				} else if(!hot) {
+					hot = thread;
+					hot_queue = queues[i];
+				}
+			}
+		}
+	}
+
+	*queuep = hot_queue;
+	return hot;
+}
+
+/** Move a thread from one CPU to another.
+ * @note		Both CPUs' scheduler information must be locked.
+ * @param from		CPU to move from.
+ * @param to		CPU to move to.
+ * @return		Whether a thread was moved. */
+static bool sched_move_thread(cpu_t *from, cpu_t *to) {
+	sched_queue_t *queue;
+	thread_t *thread;
+
+	thread = sched_find_movable(from->sched, to, &queue);
+	if(!thread)
+		return false;
+
+	sched_queue_remove(queue, thread);
+	from->sched->total--;
+
+	thread->cpu = to;
+	#if CONFIG_SCHED_FAIR
+	sched_fair_detach(from->sched, thread);
+	sched_fair_attach(to->sched, thread);
+	#endif
+	sched_queue_insert(to->sched->active, thread);
+	to->sched->total++;
+	to->sched->migrations++;
+
+	dprintf("sched: moved thread %" PRId32 " from CPU %" PRIu32 " to %"
+		PRIu32 "\n", thread->id, from->id, to->id);
+	return true;
+}
+
+/** Pull a thread from the busiest CPU onto the current CPU.
+ * @note		Called with interrupts disabled by the idle thread
+ *			before it reschedules. */
+static void sched_pull_thread(void) {
+	cpu_t *cpu, *busiest = NULL;
+	size_t max = 1;
+
+	/* Unlocked check of the loads, we'll check again once locked. A CPU
+	 * must have at least one thread waiting in addition to the one it is
+	 * running for it to be worth pulling from. */
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		if(cpu != curr_cpu && cpu->sched->total > max) {
+			busiest = cpu;
+			max = cpu->sched->total;
+		}
+	}
+
+	if(!busiest)
+		return;
+
+	sched_lock_pair(curr_cpu, busiest);
+
+	if(!curr_cpu->sched->total && busiest->sched->total > 1) {
+		if(sched_move_thread(busiest, curr_cpu))
+			curr_cpu->sched->pulls++;
+	}
+
+	sched_unlock_pair(curr_cpu, busiest);
+}
+
+/** Push threads from the current CPU to idle CPUs. */
+static void sched_push_threads(void) {
+	sched_cpu_t *sched = curr_cpu->sched;
+	nstime_t now;
+	cpu_t *cpu;
+	bool moved;
+
+	now = system_time();
+	if(now < sched->next_balance || sched->total < 2)
+		return;
+
+	sched->next_balance = now + BALANCE_INTERVAL;
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		if(cpu == curr_cpu || !cpu->idle || cpu->sched->total)
+			continue;
+
+		sched_lock_pair(curr_cpu, cpu);
+
+		moved = sched->total > 1 && !cpu->sched->total
+			&& sched_move_thread(curr_cpu, cpu);
+		if(moved)
+			sched->pushes++;
+
+		sched_unlock_pair(curr_cpu, cpu);
+
+		/* Wake the CPU up to run the thread. */
+		if(moved)
+			sched_kick_cpu(cpu);
+
+		if(sched->total < 2)
+			break;
+	}
+}
+
+#endif /* CONFIG_SMP */
+
+/** Account for the ticks avoided while the preemption timer was stopped.
+ * @param cpu		Scheduler information for the current CPU (must be
+ *			locked).
+ * @param now		Current system time. */
+static inline void sched_tick_resume(sched_cpu_t *cpu, nstime_t now) {
+	cpu->ticks_avoided += (now - cpu->tick_stop_time) / THREAD_TIMESLICE;
+	cpu->tick_stopped = false;
+}
+
+/** Start the preemption timer if it was stopped with one runnable thread.
+ * @param arg		Unused.
+ * @return		Always returns STATUS_SUCCESS. */
+static status_t sched_restart_tick(void *arg) {
+	sched_cpu_t *cpu = curr_cpu->sched;
+	nstime_t now, remaining;
+
+	spinlock_lock_noirq(&cpu->lock);
+
+	if(!cpu->tick_stopped || cpu->total < 2) {
+		spinlock_unlock_noirq(&cpu->lock);
+		return STATUS_SUCCESS;
+	}
+
+	now = system_time();
+	sched_tick_resume(cpu, now);
+
+	/* Let the thread have the rest of its timeslice, counted from when it
+	 * was scheduled. */
+	remaining = cpu->tick_stop_time + curr_thread->timeslice - now;
+
+	spinlock_unlock_noirq(&cpu->lock);
+
+	timer_start(&cpu->timer, max(remaining, 1), TIMER_ONESHOT);
+	return STATUS_SUCCESS;
+}
+
+/** Check whether a running thread must leave the current CPU.
+ * @param thread	Thread to check (must be locked).
+ * @return		Whether the thread must be moved. */
+static inline bool sched_must_migrate(thread_t *thread) {
+	return !thread->wired && !thread->preempt_count
+		&& !sched_cpu_allowed(thread, curr_cpu);
+}
+
 /** Scheduler timer handler function.
  * @param data		Data argument (unused).
  * @return		Always returns true. */
 static bool sched_timer_handler(void *data) {
 	curr_thread->timeslice = 0;
+
+	#if CONFIG_SMP
+	sched_push_threads();
+	#endif
+
 	return true;
 }
 
@@ -233,12 +942,20 @@ static bool sched_timer_handler(void *data) {
  */
 void sched_reschedule(bool state) {
 	sched_cpu_t *cpu = curr_cpu->sched;
+	bool preempted, involuntary;
 	thread_t *next;
+	nstime_t now;
 
 	assert(!atomic_get(&kdb_running));
 
 	spinlock_lock_noirq(&cpu->lock);
 
+	/* Passing through the scheduler is a quiescent state for RCU. */
+	rcu_quiescent();
+
+	preempted = cpu->preempted;
+	cpu->preempted = false;
+
 	/* Stop the preemption timer if it is running. */
 	timer_stop(&cpu->timer);
 
@@ -246,33 +963,127 @@ void sched_reschedule(bool state) {
 	assert(curr_thread->state != THREAD_READY);
 
 	/* Tweak the priority of the thread based on whether it used up its
-	 * timeslice. */
+	 * timeslice. Virtual runtime already accounts for this. */
+	#if !CONFIG_SCHED_FAIR
 	if(curr_thread != cpu->idle_thread)
 		sched_tweak_priority(cpu, curr_thread);
+	#endif
+
+	/* Record when the thread stopped running for load balancing. */
+	now = system_time();
+	curr_thread->sched_time = now;
+	curr_thread->run_time += now - curr_thread->run_start;
+	#if CONFIG_SCHED_FAIR
+	if(curr_thread != cpu->idle_thread && curr_thread->policy == THREAD_SCHED_NORMAL)
+		curr_thread->vruntime += sched_fair_delta(curr_thread, now - curr_thread->run_start);
+	#endif
+	involuntary = preempted && curr_thread->state == THREAD_RUNNING;
+
+	/* A round-robin thread that was preempted before its quantum expired
+	 * keeps the rest of it, otherwise it would get more than its share of
+	 * the CPU. It gets a new quantum only once the old one has been used
+	 * up, or when it gives up the CPU itself. */
+	if(curr_thread->policy == THREAD_SCHED_RR) {
+		if(involuntary && curr_thread->timeslice > now - curr_thread->run_start) {
+			curr_thread->timeslice -= now - curr_thread->run_start;
+		} else {
+			curr_thread->timeslice = 0;
+		}
+	}
+
+	if(cpu->tick_stopped)
+		sched_tick_resume(cpu, now);
 
 	if(curr_thread->state == THREAD_RUNNING) {
 		/* The thread hasn't gone to sleep, re-queue it. */
 		curr_thread->state = THREAD_READY;
-		if(curr_thread != cpu->idle_thread)
-			sched_queue_insert(cpu->expired, curr_thread);
+		curr_thread->ready_time = now;
+		if(curr_thread != cpu->idle_thread) {
+			if(unlikely(sched_must_migrate(curr_thread))) {
+				/* Its affinity no longer includes this CPU.
+				 * It cannot be placed on another CPU while we
+				 * are still running on its stack, so this is
+				 * done by sched_post_switch(). */
+				cpu->migrate_thread = curr_thread;
+				cpu->total--;
+				#if CONFIG_SCHED_FAIR
+				sched_fair_detach(cpu, curr_thread);
+				#endif
+			} else if(curr_thread->policy != THREAD_SCHED_NORMAL) {
+				/* A real-time thread that was preempted goes
+				 * back to the front of its priority level. It
+				 * goes to the back if it yielded or used up its
+				 * round-robin quantum. */
+				if(preempted && (curr_thread->policy == THREAD_SCHED_FIFO
+					|| curr_thread->timeslice))
+				{
+					sched_queue_insert_head(cpu->active, curr_thread);
+				} else {
+					sched_queue_insert(cpu->active, curr_thread);
+				}
+			} else if(curr_thread->pi_prio > curr_thread->curr_prio) {
+				/* A thread holding up a higher priority thread
+				 * should not have to wait for the expired queue
+				 * to come round. */
+				sched_queue_insert(cpu->active, curr_thread);
+			} else {
+				sched_queue_insert(cpu->expired, curr_thread);
+			}
+		}
 	} else {
 		/* Thread is no longer running, decrease counts. */
 		assert(curr_thread != cpu->idle_thread);
 		cpu->total--;
-		#if CONFIG_SMP
-		atomic_dec(&threads_running);
+		#if CONFIG_SCHED_FAIR
+		sched_fair_detach(cpu, curr_thread);
+		sched_fair_leave(curr_thread);
 		#endif
 	}
 
+	#if CONFIG_SCHED_FAIR
+	if(!avl_tree_empty(&cpu->fair_tree)) {
+		cpu->min_vruntime = max(cpu->min_vruntime,
+			(nstime_t)avl_tree_first(&cpu->fair_tree)->key);
+	}
+	#endif
+
+	#if CONFIG_SMP
+	sched_update_load(cpu, now);
+	#endif
+
 	/* Find a new thread to run. A NULL return value means no threads are
 	 * ready, so we schedule the idle thread in this case. */
 	next = sched_pick_thread(cpu);
 	if(next) {
-		if(next != curr_thread)
+		if(next != curr_thread) {
 			spinlock_lock_noirq(&next->lock);
+			sched_account_wait(cpu, next, now);
+		}
+
+		/* FIFO threads run until they give up the CPU or something of
+		 * a higher priority turns up, so they need no timer. */
+		switch(next->policy) {
+		case THREAD_SCHED_FIFO:
+			next->timeslice = 0;
+			break;
+		case THREAD_SCHED_RR:
+			if(!next->timeslice)
+				next->timeslice = next->rt_quantum;
+
+			break;
+		default:
+			next->timeslice = THREAD_TIMESLICE;
+			break;
+		}
 
-		next->timeslice = THREAD_TIMESLICE;
 		curr_cpu->idle = false;
+
+		/* Don't bother with the preemption timer if there is nothing
+		 * else to run. It is started if another thread turns up. */
+		if(next->timeslice && !sched_cpu_queued(cpu)) {
+			cpu->tick_stopped = true;
+			cpu->tick_stop_time = now;
+		}
 	} else {
 		next = cpu->idle_thread;
 		if(next != curr_thread) {
@@ -285,20 +1096,38 @@ void sched_reschedule(bool state) {
 		 * something to be woken up. */
 		next->timeslice = 0;
 		curr_cpu->idle = true;
+
+		/* An idle CPU is as good as any for new threads. Avoid
+		 * writing the shared cache line unless it changes. */
+		#if CONFIG_SMP
+		if(sched_idlest_cpu != curr_cpu) {
+			sched_idlest_cpu = curr_cpu;
+			sched_idlest_time = now;
+		}
+		#endif
 	}
 
 	assert(next->cpu == curr_cpu);
 
+	if(next != curr_thread) {
+		if(involuntary) {
+			curr_thread->involuntary_switches++;
+		} else {
+			curr_thread->voluntary_switches++;
+		}
+	}
+
 	/* Move the thread to the running state. */
 	cpu->prev_thread = curr_thread;
 	next->state = THREAD_RUNNING;
+	next->run_start = now;
 	curr_cpu->thread = next;
 
 	/* Finished with the scheduler queues, unlock. */
 	spinlock_unlock_noirq(&cpu->lock);
 
 	/* Set off the timer if necessary. */
-	if(next->timeslice > 0)
+	if(next->timeslice > 0 && !cpu->tick_stopped)
 		timer_start(&cpu->timer, next->timeslice, TIMER_ONESHOT);
 
 	/* Only need to continue if the new thread is different. */
@@ -331,7 +1160,14 @@ void sched_post_switch(bool state) {
 	if(likely(curr_cpu->sched->prev_thread)) {
 		/* Unlock previous. This will not be the current thread, as a
 		 * switch is not performed if the new thread is the same as the
-		 * previous. */
+		 * previous. If it needs to move to another CPU, it is safe
+		 * to do so now that it is no longer running. */
+		if(unlikely(curr_cpu->sched->migrate_thread)) {
+			assert(curr_cpu->sched->migrate_thread == curr_cpu->sched->prev_thread);
+			curr_cpu->sched->migrate_thread = NULL;
+			sched_insert_thread(curr_cpu->sched->prev_thread);
+		}
+
 		spinlock_unlock_noirq(&curr_cpu->sched->prev_thread->lock);
 	}
 
@@ -350,6 +1186,7 @@ void sched_preempt(void) {
 		spinlock_unlock_noirq(&curr_thread->lock);
 		local_irq_restore(state);
 	} else {
+		curr_cpu->sched->preempted = true;
 		sched_reschedule(state);
 	}
 }
@@ -391,6 +1228,7 @@ void preempt_enable(void) {
 		/* If a preemption was missed then preempt immediately. */
 		if(curr_thread->flags & THREAD_PREEMPTED) {
 			curr_thread->flags &= ~THREAD_PREEMPTED;
+			curr_cpu->sched->preempted = true;
 			sched_reschedule(state);
 			return;
 		}
@@ -403,52 +1241,156 @@ void preempt_enable(void) {
 
 #if CONFIG_SMP
 
-/** Allocate a CPU for a thread to run on.
- * @param thread	Thread to allocate for. */
-static inline cpu_t *sched_allocate_cpu(thread_t *thread) {
-	size_t total, average, load;
-	cpu_t *cpu, *other;
+/** Find the least loaded CPU that a thread is allowed to run on.
+ * @note		Only the result for threads that can run on any CPU
+ *			is cached, others always scan.
+ * @param thread	Thread to find a CPU for.
+ * @return		Least loaded CPU, or NULL if the thread is not
+ *			allowed on any running CPU. */
+static cpu_t *sched_least_loaded(thread_t *thread) {
+	bool all = thread->affinity == CPU_MASK_ALL;
+	cpu_t *cpu, *idlest = NULL;
+	nstime_t now;
 
-	/* On uniprocessor systems, we only have one choice. */
-	if(cpu_count == 1)
-		return curr_cpu;
+	now = system_time();
 
-	/* Add 1 to the total number of threads to account for the thread we're
-	 * adding. */
-	total = atomic_get(&threads_running) + 1;
+	/* Races here are harmless, the worst that can happen is that the
+	 * lookup is done again or a slightly stale result is used. */
+	if(all && sched_idlest_cpu && now - sched_idlest_time < IDLEST_CACHE_TIME)
+		return sched_idlest_cpu;
 
-	/* Start on the current CPU that the thread currently belongs to. */
-	cpu = (thread->cpu) ? thread->cpu : curr_cpu;
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
 
-	/* Get the average number of threads that a CPU should have as well as
-	 * the CPU's current load. We round up to a multiple of the CPU count
-	 * rather than rounding down here to stop us from loading off threads
-	 * unnecessarily. */
-	average = (round_up(total, cpu_count) / cpu_count);
-	load = cpu->sched->total;
+		if(!sched_cpu_allowed(thread, cpu))
+			continue;
 
-	/* If the CPU has less than or equal to the average, we're OK to keep
-	 * the thread on it. */
-	if(load <= average)
-		return cpu;
+		if(!idlest || sched_cpu_load(cpu) < sched_cpu_load(idlest))
+			idlest = cpu;
+	}
 
-	/* We need to pick another CPU. Try to find one with a load less than
-	 * the average. If there isn't one, we just keep the thread on its
-	 * current CPU. */
+	if(all) {
+		sched_idlest_cpu = idlest;
+		sched_idlest_time = now;
+	}
+
+	return idlest;
+}
+
+/** Find a CPU for a real-time thread.
+ * @note		Load does not matter much for a real-time thread, as
+ *			it will run ahead of any timesharing threads. What
+ *			does matter is that it does not wait behind another
+ *			real-time thread when it could run straight away
+ *			elsewhere, so look for a CPU that it will preempt.
+ * @param thread	Thread to find a CPU for.
+ * @param cpu		CPU that the thread previously ran on.
+ * @return		CPU to run on. */
+static cpu_t *sched_rt_cpu(thread_t *thread, cpu_t *cpu) {
+	cpu_t *other, *lowest;
+
+	if(cpu->idle || sched_thread_priority(cpu->thread) < sched_thread_priority(thread))
+		return cpu;
+
+	/* The idle thread has a priority of -1, so an idle CPU will always be
+	 * picked if there is one. */
+	lowest = cpu;
 	LIST_FOREACH(&running_cpus, iter) {
 		other = list_entry(iter, cpu_t, header);
 
-		load = other->sched->total;
-		if(load < average) {
-			dprintf("sched: CPU %" PRIu32 " load %zu less than "
-				"average %zu, giving it thread %" PRId32 "\n",
-				other->id, load, average, thread->id);
-			cpu = other;
-			break;
+		if(sched_cpu_allowed(thread, other)
+			&& sched_thread_priority(other->thread) < sched_thread_priority(lowest->thread))
+		{
+			lowest = other;
 		}
 	}
 
-	return cpu;
+	return (sched_thread_priority(lowest->thread) < sched_thread_priority(thread)) ? lowest : cpu;
+}
+
+/** Find a CPU near to a thread's previous CPU.
+ * @param thread	Thread to find a CPU for.
+ * @param cpu		CPU that the thread previously ran on.
+ * @param nearestp	Where to store the least loaded other CPU in the
+ *			same package (NULL if none).
+ * @return		Idle CPU sharing a cache with the previous CPU, or
+ *			NULL if none. */
+static cpu_t *sched_nearby_cpu(thread_t *thread, cpu_t *cpu, cpu_t **nearestp) {
+	cpu_t *other, *idle = NULL, *nearest = NULL;
+	list_t *iter;
+
+	/* Only look at the other CPUs in the same package. */
+	for(iter = cpu->package_link.next; iter != &cpu->package_link; iter = iter->next) {
+		other = list_entry(iter, cpu_t, package_link);
+
+		if(!sched_cpu_allowed(thread, other))
+			continue;
+
+		/* An SMT sibling shares execution resources with the busy
+		 * thread on the previous CPU, so a different core is better. */
+		if(!other->sched->total && cpu_shares_cache(cpu, other)) {
+			if(!idle || (cpu_shares_core(cpu, idle) && !cpu_shares_core(cpu, other)))
+				idle = other;
+		}
+
+		if(!nearest || sched_cpu_load(other) < sched_cpu_load(nearest))
+			nearest = other;
+	}
+
+	*nearestp = nearest;
+	return idle;
+}
+
+/** Allocate a CPU for a thread to run on.
+ * @param thread	Thread to allocate for. */
+static inline cpu_t *sched_allocate_cpu(thread_t *thread) {
+	cpu_t *cpu, *idlest, *nearest;
+
+	/* On uniprocessor systems, we only have one choice. */
+	if(cpu_count == 1)
+		return curr_cpu;
+
+	/* Start on the current CPU that the thread currently belongs to. If it
+	 * has nothing to run, there is no better choice. If the thread is not
+	 * allowed to run there, it must go to whichever CPU is best. */
+	cpu = (thread->cpu) ? thread->cpu : curr_cpu;
+	if(!sched_cpu_allowed(thread, cpu)) {
+		idlest = sched_least_loaded(thread);
+		return (idlest) ? idlest : cpu;
+	} else if(!cpu->sched->total) {
+		return cpu;
+	} else if(thread->policy != THREAD_SCHED_NORMAL) {
+		return sched_rt_cpu(thread, cpu);
+	}
+
+	/* Try to keep the thread close to the cache it last ran with. */
+	idlest = sched_nearby_cpu(thread, cpu, &nearest);
+	if(idlest)
+		return idlest;
+
+	if(nearest && nearest->sched->total < cpu->sched->total
+		&& sched_cpu_load(cpu) >= sched_cpu_load(nearest) + LOAD_IMBALANCE)
+	{
+		return nearest;
+	}
+
+	/* Only move the thread to another package if the least loaded CPU is
+	 * much less loaded than the thread's CPU, as it will lose all cache
+	 * warmth. The cached lookup may be slightly out of date, so check its
+	 * current load. */
+	idlest = sched_least_loaded(thread);
+	if(!idlest || cpu_shares_package(cpu, idlest)
+		|| idlest->sched->total >= cpu->sched->total)
+	{
+		return cpu;
+	}
+
+	if(sched_cpu_load(cpu) < sched_cpu_load(idlest) + (2 * LOAD_IMBALANCE))
+		return cpu;
+
+	dprintf("sched: CPU %" PRIu32 " less loaded than %" PRIu32 ", giving "
+		"it thread %" PRId32 "\n", idlest->id, cpu->id, thread->id);
+	return idlest;
 }
 
 #else /* CONFIG_SMP */
@@ -464,9 +1406,18 @@ static inline cpu_t *sched_allocate_cpu(thread_t *thread) {
  *			state). */
 void sched_insert_thread(thread_t *thread) {
 	sched_cpu_t *sched;
+	bool restart = false;
+	nstime_t now;
+	cpu_t *cpu;
+	#if CONFIG_SMP
+	bool migrated = false;
+	#endif
 
 	assert(thread->state == THREAD_READY);
 
+	now = system_time();
+	thread->ready_time = now;
+
 	/* If we've been newly created, we will not have a priority set.
 	 * Calculate the maximum priority for the thread. */
 	if(unlikely(thread->max_prio < 0)) {
@@ -474,31 +1425,575 @@ void sched_insert_thread(thread_t *thread) {
 	}
 
 	/* Pick a new CPU for the thread to run on. */
-	if(!thread->wired && !thread->preempt_count)
-		thread->cpu = sched_allocate_cpu(thread);
+	if(!thread->wired && !thread->preempt_count) {
+		cpu = sched_allocate_cpu(thread);
+
+		#if CONFIG_SMP
+		if(thread->cpu && cpu != thread->cpu)
+			migrated = true;
+		#endif
+
+		thread->cpu = cpu;
+	}
 
 	sched = thread->cpu->sched;
 	spinlock_lock(&sched->lock);
 
+	/* A thread coming off a sleep is placed relative to the other threads
+	 * on the CPU, with a limited credit for the time it was asleep. */
+	#if CONFIG_SCHED_FAIR
+	if(thread->policy == THREAD_SCHED_NORMAL) {
+		thread->vruntime = max(thread->vruntime, -FAIR_SLEEPER_CREDIT);
+		sched_fair_attach(sched, thread);
+		sched_fair_join(thread);
+	}
+	#endif
+
 	sched_queue_insert(sched->active, thread);
 	sched->total++;
 	#if CONFIG_SMP
-	atomic_inc(&threads_running);
+	sched_update_load(sched, now);
+	if(migrated)
+		sched->migrations++;
 	#endif
 
 	/* If the thread has a higher priority than the currently running
 	 * thread on the CPU, or if the CPU is idle, preempt it. */
-	if(thread->cpu->idle || thread->curr_prio > thread->cpu->thread->curr_prio) {
+	if(thread->cpu->idle || sched_should_preempt(thread->cpu, thread)) {
 		if(!thread->cpu->idle)
 			thread->cpu->should_preempt = true;
 
 		#if CONFIG_SMP
 		if(thread->cpu != curr_cpu)
-			smp_call_single(thread->cpu->id, NULL, NULL, SMP_CALL_ASYNC);
+			sched_kick_cpu(thread->cpu);
 		#endif
+	} else if(sched->tick_stopped) {
+		restart = true;
 	}
 
+	cpu = thread->cpu;
 	spinlock_unlock(&sched->lock);
+
+	/* The running thread now has something to share the CPU with. */
+	if(restart)
+		smp_call_single(cpu->id, sched_restart_tick, NULL, SMP_CALL_ASYNC);
+}
+
+/**
+ * Release the lock of a thread to take run queue locks.
+ *
+ * sched_reschedule() locks a run queue before the thread that it picks from
+ * it, so a queued thread's lock must not be held while waiting for a run
+ * queue lock. The thread lock is dropped and taken again afterwards with
+ * sched_relock_thread(). Interrupts stay disabled in between.
+ *
+ * @param thread	Thread to unlock (must be locked).
+ *
+ * @return		Interrupt state saved in the thread lock.
+ */
+static inline bool sched_drop_thread(thread_t *thread) {
+	bool state = thread->lock.state;
+
+	spinlock_unlock_noirq(&thread->lock);
+	return state;
+}
+
+/** Retake the lock of a thread released by sched_drop_thread().
+ * @param thread	Thread to lock.
+ * @param state		Interrupt state returned by sched_drop_thread(). */
+static inline void sched_relock_thread(thread_t *thread, bool state) {
+	spinlock_lock_noirq(&thread->lock);
+	thread->lock.state = state;
+}
+
+/** Lock the run queue of a queued thread.
+ * @param thread	Thread to lock the run queue of (must be locked). Its
+ *			lock is dropped while the run queue is locked, so its
+ *			state may change.
+ * @return		CPU whose run queue has been locked, or NULL if the
+ *			thread is not queued, in which case no run queue lock
+ *			is held. */
+static cpu_t *sched_lock_queued(thread_t *thread) {
+	cpu_t *cpu;
+	bool state;
+
+	/* The thread can be picked or stolen by another CPU while it is
+	 * unlocked, so check that it is still on the same queue. */
+	while(thread->state == THREAD_READY) {
+		cpu = thread->cpu;
+
+		state = sched_drop_thread(thread);
+		spinlock_lock_noirq(&cpu->sched->lock);
+		sched_relock_thread(thread, state);
+
+		if(thread->state == THREAD_READY && thread->cpu == cpu)
+			return cpu;
+
+		spinlock_unlock_noirq(&cpu->sched->lock);
+	}
+
+	return NULL;
+}
+
+#if CONFIG_SMP
+
+/** Move a queued thread to a CPU that it is allowed to run on.
+ * @param thread	Thread to move (must be locked). Its lock is dropped
+ *			while the run queues are locked, so its state may
+ *			change.
+ * @return		Whether the thread was still queued, false if it
+ *			started running or stopped while it was unlocked. */
+static bool sched_migrate_queued(thread_t *thread) {
+	sched_queue_t *queue;
+	bool restart = false;
+	cpu_t *from, *to;
+	bool state;
+
+	/* The thread can be picked or stolen by another CPU while it is
+	 * unlocked, so check that it is still on the same queue. */
+	while(true) {
+		if(thread->state != THREAD_READY)
+			return false;
+
+		from = thread->cpu;
+		if(sched_cpu_allowed(thread, from))
+			return true;
+
+		to = sched_allocate_cpu(thread);
+		if(to == from)
+			return true;
+
+		state = sched_drop_thread(thread);
+		sched_lock_pair(from, to);
+		sched_relock_thread(thread, state);
+
+		if(thread->state == THREAD_READY && thread->cpu == from)
+			break;
+
+		sched_unlock_pair(from, to);
+	}
+
+	queue = sched_thread_queue(from->sched, thread);
+	sched_queue_remove(queue, thread);
+	from->sched->total--;
+
+	thread->cpu = to;
+	#if CONFIG_SCHED_FAIR
+	sched_fair_detach(from->sched, thread);
+	sched_fair_attach(to->sched, thread);
+	#endif
+	sched_queue_insert(to->sched->active, thread);
+	to->sched->total++;
+	to->sched->migrations++;
+
+	if(to->idle || sched_should_preempt(to, thread)) {
+		if(!to->idle)
+			to->should_preempt = true;
+
+		if(to != curr_cpu)
+			sched_kick_cpu(to);
+	} else if(to->sched->tick_stopped) {
+		restart = true;
+	}
+
+	sched_unlock_pair(from, to);
+
+	if(restart)
+		smp_call_single(to->id, sched_restart_tick, NULL, SMP_CALL_ASYNC);
+
+	return true;
+}
+
+#endif /* CONFIG_SMP */
+
+/**
+ * Set the CPU affinity of a thread.
+ *
+ * Sets the affinity mask of a thread, and moves it off its current CPU if
+ * it is no longer allowed to run there. A queued thread is moved straight
+ * away. A thread running on another CPU is preempted, and will be moved when
+ * it is rescheduled. A wired thread is left where it is until it is unwired.
+ *
+ * @param thread	Thread to set affinity of (must be locked). Its lock
+ *			may be dropped while it is moved between run queues.
+ * @param mask		New affinity mask (should have been checked with
+ *			sched_affinity_valid()).
+ *
+ * @return		Whether the thread is the current thread and must be
+ *			rescheduled to move it. The caller should call
+ *			thread_yield() once it has unlocked the thread.
+ */
+bool sched_set_affinity(thread_t *thread, cpu_mask_t mask) {
+	cpu_t *cpu;
+
+	thread->affinity = mask;
+
+	cpu = thread->cpu;
+	if(!cpu || thread->wired || sched_cpu_allowed(thread, cpu))
+		return false;
+
+	switch(thread->state) {
+	case THREAD_READY:
+		#if CONFIG_SMP
+		if(sched_migrate_queued(thread) || thread->state != THREAD_RUNNING)
+			return false;
+
+		/* It was picked to run while it was unlocked. */
+		cpu = thread->cpu;
+		if(sched_cpu_allowed(thread, cpu))
+			return false;
+		#else
+		return false;
+		#endif
+
+		/* Fall through. */
+	case THREAD_RUNNING:
+		if(thread == curr_thread)
+			return true;
+
+		#if CONFIG_SMP
+		cpu->should_preempt = true;
+		smp_call_single(cpu->id, NULL, NULL, SMP_CALL_ASYNC);
+		#endif
+		return false;
+	default:
+		/* The thread will be placed on an allowed CPU when woken. */
+		return false;
+	}
+}
+
+/** Store the scheduling policy of a thread and recalculate its priority.
+ * @param thread	Thread to set policy of (must be locked, and not on
+ *			a run queue).
+ * @param policy	New scheduling policy.
+ * @param priority	Real-time priority.
+ * @param quantum	Round-robin quantum, 0 for the default. */
+static void sched_apply_policy(thread_t *thread, int policy, int priority, nstime_t quantum) {
+	#if CONFIG_SCHED_FAIR
+	bool runnable = thread->state == THREAD_READY || thread->state == THREAD_RUNNING;
+	int prev = thread->policy;
+	#endif
+
+	thread->policy = policy;
+	thread->rt_priority = (policy != THREAD_SCHED_NORMAL) ? priority : 0;
+	thread->rt_quantum = (quantum) ? quantum : THREAD_TIMESLICE;
+
+	/* A round-robin thread starts with a full quantum. */
+	if(policy == THREAD_SCHED_RR)
+		thread->timeslice = 0;
+
+	/* Real-time threads do not accumulate virtual runtime, so a thread
+	 * becoming timesharing starts from the CPU's minimum. */
+	#if CONFIG_SCHED_FAIR
+	if(policy == THREAD_SCHED_NORMAL && prev != THREAD_SCHED_NORMAL) {
+		thread->vruntime = (runnable) ? thread->cpu->sched->min_vruntime : 0;
+		if(runnable)
+			sched_fair_join(thread);
+	} else if(policy != THREAD_SCHED_NORMAL) {
+		sched_fair_leave(thread);
+	}
+	#endif
+
+	/* Threads that have not yet been run have their priority calculated
+	 * when they are first inserted. */
+	if(thread->max_prio >= 0)
+		sched_calculate_priority(thread);
+}
+
+/**
+ * Set the scheduling policy of a thread.
+ *
+ * Sets the scheduling policy and real-time priority of a thread, and updates
+ * its scheduling priority. If the thread is queued, it is moved to the queue
+ * for its new priority.
+ *
+ * @param thread	Thread to set policy of (must be locked). Its lock may
+ *			be dropped while it is moved between run queues.
+ * @param policy	New scheduling policy (THREAD_SCHED_*).
+ * @param priority	Real-time priority (ignored for THREAD_SCHED_NORMAL).
+ * @param quantum	Quantum for THREAD_SCHED_RR, 0 for the default.
+ *
+ * @return		Whether the thread is the current thread and must be
+ *			rescheduled for its new priority to take effect. The
+ *			caller should call thread_yield() once it has unlocked
+ *			the thread.
+ */
+bool sched_set_policy(thread_t *thread, int policy, int priority, nstime_t quantum) {
+	sched_queue_t *queue;
+	cpu_t *cpu;
+
+	cpu = sched_lock_queued(thread);
+	if(!cpu) {
+		sched_apply_policy(thread, policy, priority, quantum);
+
+		if(thread->state != THREAD_RUNNING)
+			return false;
+
+		if(thread == curr_thread)
+			return true;
+
+		/* Let the thread's CPU pick again with the new priority. */
+		thread->cpu->should_preempt = true;
+		#if CONFIG_SMP
+		smp_call_single(thread->cpu->id, NULL, NULL, SMP_CALL_ASYNC);
+		#endif
+		return false;
+	}
+
+	queue = sched_thread_queue(cpu->sched, thread);
+	sched_queue_remove(queue, thread);
+
+	sched_apply_policy(thread, policy, priority, quantum);
+	sched_queue_insert(cpu->sched->active, thread);
+
+	if(!cpu->idle && sched_should_preempt(cpu, thread)) {
+		cpu->should_preempt = true;
+
+		#if CONFIG_SMP
+		if(cpu != curr_cpu)
+			smp_call_single(cpu->id, NULL, NULL, SMP_CALL_ASYNC);
+		#endif
+	}
+
+	spinlock_unlock_noirq(&cpu->sched->lock);
+	return false;
+}
+
+/** Lock protecting priority inheritance state of all threads. */
+static SPINLOCK_DEFINE(sched_pi_lock);
+
+/** Change the inherited priority of a thread.
+ * @param thread	Thread to change (sched_pi_lock must be held).
+ * @param prio		New inherited priority, -1 for none. */
+static void sched_pi_set(thread_t *thread, int prio) {
+	sched_queue_t *queue;
+	cpu_t *cpu;
+
+	spinlock_lock(&thread->lock);
+
+	/* The queue a thread is on depends on its priority, so a queued
+	 * thread must be moved. */
+	cpu = sched_lock_queued(thread);
+	if(!cpu) {
+		thread->pi_prio = prio;
+		spinlock_unlock(&thread->lock);
+		return;
+	}
+
+	queue = sched_thread_queue(cpu->sched, thread);
+	sched_queue_remove(queue, thread);
+
+	thread->pi_prio = prio;
+	if(prio > thread->curr_prio)
+		queue = cpu->sched->active;
+
+	sched_queue_insert(queue, thread);
+
+	if(!cpu->idle && sched_should_preempt(cpu, thread)) {
+		cpu->should_preempt = true;
+
+		#if CONFIG_SMP
+		if(cpu != curr_cpu)
+			smp_call_single(cpu->id, NULL, NULL, SMP_CALL_ASYNC);
+		#endif
+	}
+
+	spinlock_unlock_noirq(&cpu->sched->lock);
+	spinlock_unlock(&thread->lock);
+}
+
+/** Recalculate inherited priorities along a chain of lock holders.
+ * @param thread	First thread in the chain (sched_pi_lock must be
+ *			held). */
+static void sched_pi_update(thread_t *thread) {
+	thread_t *waiter;
+	int prio;
+
+	/* Each holder may itself be blocked on a lock, in which case the
+	 * change carries on to the holder of that lock. Stop as soon as a
+	 * thread's inherited priority is unaffected. */
+	while(thread) {
+		prio = -1;
+		LIST_FOREACH(&thread->pi_waiters, iter) {
+			waiter = list_entry(iter, thread_t, pi_link);
+			prio = max(prio, sched_thread_priority(waiter));
+		}
+
+		if(prio == thread->pi_prio)
+			break;
+
+		sched_pi_set(thread, prio);
+		thread = thread->pi_owner;
+	}
+}
+
+/** Pick the thread to hand a lock to.
+ * @param threads	List of threads waiting for the lock, linked by their
+ *			wait_link (must not be empty).
+ * @return		Highest priority waiting thread. The first of those
+ *			at that priority is picked. */
+thread_t *sched_pi_pick(list_t *threads) {
+	thread_t *next, *thread;
+
+	next = list_first(threads, thread_t, wait_link);
+	LIST_FOREACH(threads, iter) {
+		thread = list_entry(iter, thread_t, wait_link);
+
+		if(sched_thread_priority(thread) > sched_thread_priority(next))
+			next = thread;
+	}
+
+	return next;
+}
+
+/**
+ * Record that the current thread is blocking on a lock.
+ *
+ * Records the lock that the current thread is about to block on, and lends
+ * the thread's priority to the holder of the lock. Must be followed by either
+ * sched_pi_transfer() from the holder handing the lock to the thread, or by
+ * sched_pi_unblock() if the thread stops waiting without getting the lock.
+ *
+ * @param object	Lock being blocked on.
+ * @param owner		Thread currently holding the lock. If NULL, the holder
+ *			is not yet known, and can be set later with
+ *			sched_pi_set_owner().
+ */
+void sched_pi_block(void *object, thread_t *owner) {
+	spinlock_lock(&sched_pi_lock);
+
+	curr_thread->pi_object = object;
+
+	if(owner && owner != curr_thread && !owner->pi_exited) {
+		curr_thread->pi_owner = owner;
+		list_append(&owner->pi_waiters, &curr_thread->pi_link);
+		sched_pi_update(owner);
+	}
+
+	spinlock_unlock(&sched_pi_lock);
+}
+
+/** Record that the current thread has stopped waiting without the lock. */
+void sched_pi_unblock(void) {
+	thread_t *owner;
+
+	spinlock_lock(&sched_pi_lock);
+
+	owner = curr_thread->pi_owner;
+	if(owner) {
+		list_remove(&curr_thread->pi_link);
+		curr_thread->pi_owner = NULL;
+		sched_pi_update(owner);
+	}
+
+	curr_thread->pi_object = NULL;
+
+	spinlock_unlock(&sched_pi_lock);
+}
+
+/** Set the holder of the lock that a thread is blocked on.
+ * @param thread	Thread that is blocked.
+ * @param owner		Thread now holding the lock. */
+void sched_pi_set_owner(thread_t *thread, thread_t *owner) {
+	thread_t *prev;
+
+	spinlock_lock(&sched_pi_lock);
+
+	prev = thread->pi_owner;
+	if(prev != owner && thread->pi_object && !owner->pi_exited) {
+		if(prev)
+			list_remove(&thread->pi_link);
+
+		thread->pi_owner = owner;
+		list_append(&owner->pi_waiters, &thread->pi_link);
+
+		if(prev)
+			sched_pi_update(prev);
+
+		sched_pi_update(owner);
+	}
+
+	spinlock_unlock(&sched_pi_lock);
+}
+
+/**
+ * Hand a lock held by the current thread to another thread.
+ *
+ * Clears the blocked state of the thread being given the lock, and moves any
+ * other threads blocked on the lock over to it. The priority that the current
+ * thread inherited through the lock is dropped.
+ *
+ * @param object	Lock being handed over.
+ * @param next		Thread that is being given the lock.
+ */
+void sched_pi_transfer(void *object, thread_t *next) {
+	thread_t *thread;
+
+	spinlock_lock(&sched_pi_lock);
+
+	if(next->pi_owner)
+		list_remove(&next->pi_link);
+
+	next->pi_owner = NULL;
+	next->pi_object = NULL;
+
+	LIST_FOREACH_SAFE(&curr_thread->pi_waiters, iter) {
+		thread = list_entry(iter, thread_t, pi_link);
+
+		if(thread->pi_object == object) {
+			list_remove(&thread->pi_link);
+			thread->pi_owner = next;
+			list_append(&next->pi_waiters, &thread->pi_link);
+		}
+	}
+
+	sched_pi_update(curr_thread);
+	sched_pi_update(next);
+
+	spinlock_unlock(&sched_pi_lock);
+}
+
+/** Drop priority inheritance state of the current thread when it exits. */
+void sched_pi_exit(void) {
+	thread_t *thread;
+
+	spinlock_lock(&sched_pi_lock);
+
+	/* Locks still held can never be handed on by us, so the threads
+	 * blocked on them have nothing to lend their priority to. */
+	curr_thread->pi_exited = true;
+	LIST_FOREACH_SAFE(&curr_thread->pi_waiters, iter) {
+		thread = list_entry(iter, thread_t, pi_link);
+
+		list_remove(&thread->pi_link);
+		thread->pi_owner = NULL;
+	}
+
+	sched_pi_update(curr_thread);
+
+	spinlock_unlock(&sched_pi_lock);
+}
+
+/** Check whether an affinity mask is usable.
+ * @param mask		Mask to check.
+ * @return		Whether the mask includes at least one running CPU. */
+bool sched_affinity_valid(cpu_mask_t mask) {
+	cpu_t *cpu;
+
+	if(mask == CPU_MASK_ALL)
+		return true;
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		if(cpu->id < (sizeof(cpu_mask_t) * CHAR_BIT)
+			&& mask & ((cpu_mask_t)1 << cpu->id))
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
 /** Scheduler idle thread function.
@@ -510,17 +2005,139 @@ static void sched_idle_thread(void *arg1, void *arg2) {
 	local_irq_disable();
 
 	while(true) {
+		/* Clear this before looking for work, so that a wakeup request
+		 * made after we have looked is not missed. */
+		curr_cpu->need_resched = 0;
+
+		/* Try to find something to do from another CPU. */
+		#if CONFIG_SMP
+		if(cpu_count > 1)
+			sched_pull_thread();
+		#endif
+
 		spinlock_lock_noirq(&curr_thread->lock);
 		sched_reschedule(false);
 
+		rcu_idle_enter();
 		arch_cpu_idle();
+		rcu_idle_exit();
+
+		#if CONFIG_SMP
+		sched_account_wakeup(curr_cpu->sched);
+		#endif
+	}
+}
+
+/** Print scheduler statistics.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_sched(int argc, char **argv, kdb_filter_t *filter) {
+	cpu_t *cpu;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints run queue, load balancing and preemption timer statistics for\n");
+		kdb_printf("each CPU.\n");
+		return KDB_SUCCESS;
 	}
+
+	#if CONFIG_SMP
+	kdb_printf("CPU  Idle Total  Load   Migrations Pulls      Pushes     Ticks avoided\n");
+	kdb_printf("===  ==== =====  ====   ========== =====      ======     =============\n");
+	#else
+	kdb_printf("CPU  Idle Total  Ticks avoided\n");
+	kdb_printf("===  ==== =====  =============\n");
+	#endif
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		kdb_printf("%-4" PRIu32 " %-4d %-6zu", cpu->id, cpu->idle,
+			cpu->sched->total);
+		#if CONFIG_SMP
+		kdb_printf(" %lu.%02lu   %-10" PRIu64 " %-10" PRIu64 " %-10" PRIu64,
+			cpu->sched->load >> LOAD_SHIFT,
+			((cpu->sched->load & ((1UL << LOAD_SHIFT) - 1)) * 100) >> LOAD_SHIFT,
+			cpu->sched->migrations, cpu->sched->pulls,
+			cpu->sched->pushes);
+		#endif
+		kdb_printf(" %" PRIu64 "\n", cpu->sched->ticks_avoided);
+	}
+
+	return KDB_SUCCESS;
+}
+
+/** Print run queue latency histograms.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_schedlat(int argc, char **argv, kdb_filter_t *filter) {
+	uint64_t count;
+	cpu_t *cpu;
+	unsigned i;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints a histogram for each CPU of how long threads waited on its run\n");
+		kdb_printf("queues before being run, and how long it took to wake from idle when\n");
+		kdb_printf("woken by another CPU.\n");
+		return KDB_SUCCESS;
+	}
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		count = 0;
+		for(i = 0; i < LATENCY_BUCKETS; i++)
+			count += cpu->sched->latency[i];
+
+		kdb_printf("CPU %" PRIu32 ": %" PRIu64 " waits, mean %" PRId64 "us, "
+			"max %" PRId64 "us\n", cpu->id, count,
+			(count) ? NSECS2USECS(cpu->sched->latency_total / (nstime_t)count) : 0,
+			NSECS2USECS(cpu->sched->latency_max));
+
+		#if CONFIG_SMP
+		for(i = 0; i < 2; i++) {
+			if(!cpu->sched->wakeups[i])
+				continue;
+
+			kdb_printf("  %" PRIu64 " idle wakeups by %s, mean %" PRId64 "us, "
+				"max %" PRId64 "us\n", cpu->sched->wakeups[i],
+				(i) ? "IPI" : "store",
+				NSECS2USECS(cpu->sched->wake_total[i] / (nstime_t)cpu->sched->wakeups[i]),
+				NSECS2USECS(cpu->sched->wake_max[i]));
+		}
+		#endif
+
+		for(i = 0; i < LATENCY_BUCKETS; i++) {
+			if(!cpu->sched->latency[i])
+				continue;
+
+			if(i == LATENCY_BUCKETS - 1) {
+				kdb_printf("  >= %7lu us  %" PRIu64 "\n", 1UL << (i - 1),
+					cpu->sched->latency[i]);
+			} else {
+				kdb_printf("  <  %7lu us  %" PRIu64 "\n", 1UL << i,
+					cpu->sched->latency[i]);
+			}
+		}
+	}
+
+	return KDB_SUCCESS;
 }
 
 /** Initialize the scheduler globally. */
 __init_text void sched_init(void) {
 	/* Initialize for the boot CPU. */
 	sched_init_percpu();
+
+	kdb_register_command("sched", "Print scheduler statistics.",
+		kdb_cmd_sched);
+	kdb_register_command("schedlat", "Print run queue latency histograms.",
+		kdb_cmd_schedlat);
 }
 
 /** Initialize the scheduler for the current CPU. */
@@ -533,6 +2150,31 @@ __init_text void sched_init_percpu(void) {
 	curr_cpu->sched = kmalloc(sizeof(sched_cpu_t), MM_BOOT);
 	spinlock_init(&curr_cpu->sched->lock, "sched_lock");
 	curr_cpu->sched->total = 0;
+	curr_cpu->sched->migrate_thread = NULL;
+	curr_cpu->sched->preempted = false;
+	curr_cpu->sched->tick_stopped = false;
+	curr_cpu->sched->tick_stop_time = 0;
+	curr_cpu->sched->ticks_avoided = 0;
+	memset(curr_cpu->sched->latency, 0, sizeof(curr_cpu->sched->latency));
+	curr_cpu->sched->latency_total = 0;
+	curr_cpu->sched->latency_max = 0;
+	#if CONFIG_SMP
+	curr_cpu->sched->load = 0;
+	curr_cpu->sched->load_time = 0;
+	curr_cpu->sched->next_balance = 0;
+	curr_cpu->sched->migrations = 0;
+	curr_cpu->sched->pulls = 0;
+	curr_cpu->sched->pushes = 0;
+	curr_cpu->sched->wake_time = 0;
+	curr_cpu->sched->wake_ipi = false;
+	memset(curr_cpu->sched->wakeups, 0, sizeof(curr_cpu->sched->wakeups));
+	memset(curr_cpu->sched->wake_total, 0, sizeof(curr_cpu->sched->wake_total));
+	memset(curr_cpu->sched->wake_max, 0, sizeof(curr_cpu->sched->wake_max));
+	#endif
+	#if CONFIG_SCHED_FAIR
+	avl_tree_init(&curr_cpu->sched->fair_tree);
+	curr_cpu->sched->min_vruntime = 0;
+	#endif
 	curr_cpu->sched->active = &curr_cpu->sched->queues[0];
 	curr_cpu->sched->expired = &curr_cpu->sched->queues[1];
 
@@ -570,6 +2212,7 @@ __init_text void sched_init_percpu(void) {
 __init_text void sched_enter(void) {
 	/* Lock the idle thread - sched_post_switch() expects it to be locked. */
 	spinlock_lock_noirq(&curr_cpu->thread->lock);
+	curr_cpu->thread->run_start = system_time();
 
 	/* Switch to the idle thread. */
 	arch_thread_switch(curr_cpu->thread, NULL);
@@ -152,6 +152,8 @@ static void thread_ctor(void *obj, void *data) {
     list_init(&thread->interrupts);
     list_init(&thread->callbacks);
 	list_init(&thread->owner_link);
+	list_init(&thread->pi_waiters);
+	list_init(&thread->pi_link);
 	timer_init(&thread->sleep_timer, "thread_sleep_timer", thread_timeout, thread, 0);
 	notifier_init(&thread->death_notifier, thread);
 }
@@ -193,6 +195,14 @@ static void thread_cleanup(thread_t *thread) {
 	}
 }
 
+/** Free a thread once a grace period has passed.
+ * @param head		RCU head in the thread. */
+static void thread_free(rcu_head_t *head) {
+	thread_t *thread = container_of(head, thread_t, rcu);
+
+	slab_cache_free(thread_cache, thread);
+}
+
 /**
  * Decrease the reference count of a thread.
  *
@@ -227,7 +237,8 @@ void thread_release(thread_t *thread) {
 	dprintf("thread: destroyed thread %" PRId32 " (%s) (thread: %p)\n", thread->id,
 		thread->name, thread);
 
-	slab_cache_free(thread_cache, thread);
+	/* thread_lookup() may still be looking at the thread. */
+	call_rcu(&thread->rcu, thread_free);
 }
 
 /** Dead thread reaper.
@@ -318,6 +329,39 @@ void thread_unwire(thread_t *thread) {
 	}
 }
 
+/**
+ * Set the CPU affinity of a thread.
+ *
+ * Sets the set of CPUs that a thread is allowed to run on. If the thread is
+ * currently on a CPU that is not in the new set, it will be moved to one that
+ * is. A wired thread will not be moved until it is unwired.
+ *
+ * @param thread	Thread to set affinity of.
+ * @param mask		Mask of CPUs that the thread can run on. Bit N
+ *			corresponds to the CPU with ID N.
+ *
+ * @return		STATUS_SUCCESS on success.
+ *			STATUS_INVALID_ARG if the mask does not include any
+ *			running CPUs.
+ */
+status_t thread_set_affinity(thread_t *thread, cpu_mask_t mask) {
+	bool resched;
+
+	if(!sched_affinity_valid(mask))
+		return STATUS_INVALID_ARG;
+
+	spinlock_lock(&thread->lock);
+	resched = sched_set_affinity(thread, mask);
+	spinlock_unlock(&thread->lock);
+
+	/* If the current thread is no longer allowed on this CPU, yield so
+	 * that the scheduler moves it off. */
+	if(resched)
+		thread_yield();
+
+	return STATUS_SUCCESS;
+}
+
 /** Internal part of thread_wake().
  * @param thread	Thread to wake up. */
 static void thread_wake_unsafe(thread_t *thread) {
@@ -572,9 +616,13 @@ status_t thread_sleep(spinlock_t *lock, nstime_t timeout, const char *name, unsi
 	if(flags & SLEEP_INTERRUPTIBLE)
 		curr_thread->flags |= THREAD_INTERRUPTIBLE;
 
-	/* Start off the timer if required. */
-	if(timeout > 0)
+	/* Start off the timer if required. Real-time threads do not get any
+	 * slack on their timeouts. */
+	if(timeout > 0) {
+		curr_thread->sleep_timer.slack = (curr_thread->policy == THREAD_SCHED_NORMAL)
+			? curr_thread->timer_slack : 0;
 		timer_start(&curr_thread->sleep_timer, timeout, TIMER_ONESHOT);
+	}
 
 	/* Drop the specified lock. Do not want to restore IRQ state, we saved
 	 * it above and it will be restored once we're resumed by the
@@ -608,6 +656,10 @@ void thread_yield(void) {
 void thread_exit(void) {
 	bool state;
 
+	/* Anything still blocked on a lock we hold can no longer inherit our
+	 * priority. */
+	sched_pi_exit();
+
 	state = local_irq_disable();
 	spinlock_lock_noirq(&curr_thread->lock);
 
@@ -752,6 +804,23 @@ thread_t *thread_lookup_unsafe(thread_id_t id) {
 	return avl_tree_lookup(&thread_tree, id, thread_t, tree_link);
 }
 
+/** Add a reference to a thread found by thread_lookup().
+ * @param thread	Thread that was found.
+ * @return		Thread if a reference was added, NULL if it should be
+ *			ignored. */
+static thread_t *thread_lookup_retain(thread_t *thread) {
+	/* Ignore newly created and dead threads. TODO: Perhaps we want to
+	 * allow dead threads to be looked up. Possible case: process/thread
+	 * list utility, we may want to be able to see that there's a dead
+	 * thread lying around that's being held onto by some handles, and
+	 * query information. */
+	if(thread->state == THREAD_DEAD || thread->state == THREAD_CREATED)
+		return NULL;
+
+	/* The count is 0 if thread_release() is destroying the thread. */
+	return (refcount_inc_not_zero(&thread->count)) ? thread : NULL;
+}
+
 /**
  * Look up a running thread.
  *
@@ -765,24 +834,28 @@ thread_t *thread_lookup_unsafe(thread_id_t id) {
  * @return		Pointer to thread found, or NULL if not found.
  */
 thread_t *thread_lookup(thread_id_t id) {
+	avl_tree_node_t *node;
 	thread_t *thread;
 
+	/* Try to look up without taking the tree lock. Threads are freed
+	 * through RCU so the one we find cannot go away underneath us. */
+	rcu_read_lock();
+
+	if(avl_tree_lookup_node_rcu(&thread_tree, id, &node)) {
+		thread = (node) ? avl_tree_entry(node, thread_t, tree_link) : NULL;
+		thread = (thread) ? thread_lookup_retain(thread) : NULL;
+		rcu_read_unlock();
+		return thread;
+	}
+
+	rcu_read_unlock();
+
+	/* The tree was modified while we were looking, use the lock. */
 	rwlock_read_lock(&thread_tree_lock);
 
 	thread = thread_lookup_unsafe(id);
-	if(thread) {
-		/* Ignore newly created and dead threads. TODO: Perhaps we want
-		 * to allow dead threads to be looked up. Possible case:
-		 * process/thread list utility, we may want to be able to see
-		 * that there's a dead thread lying around that's being held
-		 * onto by some handles, and query information. Note that if
-		 * this is allowed, a change will be necessary to prevent a
-		 * race condition with thread_release(). */
-		if(thread->state == THREAD_DEAD || thread->state == THREAD_CREATED)
-			return NULL;
-
-		thread_retain(thread);
-	}
+	if(thread)
+		thread = thread_lookup_retain(thread);
 
 	rwlock_unlock(&thread_tree_lock);
 	return thread;
@@ -854,6 +927,27 @@ thread_create(const char *name, process_t *owner, unsigned flags,
 	thread->max_prio = -1;
 	thread->curr_prio = -1;
 	thread->timeslice = 0;
+	thread->sched_time = 0;
+	thread->affinity = owner->affinity;
+	thread->policy = THREAD_SCHED_NORMAL;
+	thread->rt_priority = 0;
+	thread->rt_quantum = 0;
+	thread->timer_slack = (owner == kernel_proc) ? 0 : TIMER_SLACK_DEFAULT;
+	#if CONFIG_SCHED_FAIR
+	thread->vruntime = 0;
+	thread->fair_weight = 0;
+	#endif
+	thread->run_start = 0;
+	thread->ready_time = 0;
+	thread->run_time = 0;
+	thread->wait_time = 0;
+	thread->max_wait_time = 0;
+	thread->voluntary_switches = 0;
+	thread->involuntary_switches = 0;
+	thread->pi_prio = -1;
+	thread->pi_owner = NULL;
+	thread->pi_object = NULL;
+	thread->pi_exited = false;
 	thread->wait_lock = NULL;
 	thread->last_time = 0;
 	thread->kernel_time = 0;
@@ -945,7 +1039,7 @@ static inline void dump_thread(thread_t *thread) {
 
 	kdb_printf("%-5d %-4" PRIu32 " %-4zu %-4d %-4d 0x%-3x %-20s %-5" PRId32 " %s\n",
 		refcount_get(&thread->count), (thread->cpu) ? thread->cpu->id : 0,
-		thread->wired, thread->priority, thread->curr_prio, thread->flags,
+		thread->wired, thread->priority, sched_thread_priority(thread), thread->flags,
 		(thread->state == THREAD_SLEEPING) ? thread->waiting_on : "<none>",
 		thread->owner->id, thread->name);
 }
@@ -996,6 +1090,64 @@ static kdb_status_t kdb_cmd_thread(int argc, char **argv, kdb_filter_t *filter)
 	return KDB_SUCCESS;
 }
 
+/** Print scheduling statistics for a thread.
+ * @param thread	Thread to print. */
+static inline void dump_thread_stats(thread_t *thread) {
+	kdb_printf("%-5" PRId32 "%s %-12" PRId64 " %-12" PRId64 " %-13" PRId64
+		" %-10" PRIu64 " %-11" PRIu64 " %s\n", thread->id,
+		(thread == curr_thread) ? "*" : " ",
+		NSECS2USECS(thread->run_time), NSECS2USECS(thread->wait_time),
+		NSECS2USECS(thread->max_wait_time), thread->voluntary_switches,
+		thread->involuntary_switches, thread->name);
+}
+
+/** Print scheduling statistics for threads.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_threadstat(int argc, char **argv, kdb_filter_t *filter) {
+	process_t *process;
+	thread_t *thread;
+	uint64_t pid;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s [<process ID>]\n\n", argv[0]);
+
+		kdb_printf("Prints the time spent running and waiting to run, and the number of\n");
+		kdb_printf("voluntary and involuntary context switches, for all threads, or for\n");
+		kdb_printf("threads within a process if given a process ID. Times are in\n");
+		kdb_printf("microseconds.\n");
+		return KDB_SUCCESS;
+	} else if(argc != 1 && argc != 2) {
+		kdb_printf("Incorrect number of argments. See 'help %s' for help.\n", argv[0]);
+		return KDB_FAILURE;
+	}
+
+	kdb_printf("ID     Run          Wait         Max Wait      Voluntary  Involuntary Name\n");
+	kdb_printf("==     ===          ====         ========      =========  =========== ====\n");
+
+	if(argc == 2) {
+		if(kdb_parse_expression(argv[1], &pid, NULL) != KDB_SUCCESS) {
+			return KDB_FAILURE;
+		} else if(!(process = process_lookup_unsafe(pid))) {
+			kdb_printf("Invalid process ID.\n");
+			return KDB_FAILURE;
+		}
+
+		LIST_FOREACH(&process->threads, iter) {
+			thread = list_entry(iter, thread_t, owner_link);
+			dump_thread_stats(thread);
+		}
+	} else {
+		AVL_TREE_FOREACH(&thread_tree, iter) {
+			thread = avl_tree_entry(iter, thread_t, tree_link);
+			dump_thread_stats(thread);
+		}
+	}
+
+	return KDB_SUCCESS;
+}
+
 /** Kill a thread.
  * @param argc		Argument count.
  * @param argv		Argument array.
@@ -1044,6 +1196,9 @@ __init_text void thread_init(void) {
 	kdb_register_command("kill",
 		"Kill a running user thread.",
 		kdb_cmd_kill);
+	kdb_register_command("threadstat",
+		"Print scheduling statistics for threads.",
+		kdb_cmd_threadstat);
 
 	/* Initialize the scheduler. */
 	sched_init();
@@ -1242,6 +1397,9 @@ kern_thread_create(const char *name, thread_entry_t entry, void *arg,
     if(ret != STATUS_SUCCESS)
         goto fail;
 
+    /* The new thread inherits the affinity of its creator. */
+    thread->affinity = curr_thread->affinity;
+
     /* Create a handle to the thread if necessary. */
     if(handlep) {
         refcount_inc(&thread->count);
@@ -1447,6 +1605,248 @@ kern_thread_kill(handle_t handle)
 	return ret;
 }
 
+/** Get the CPU affinity of a thread.
+ * @param handle	Handle to thread, or THREAD_SELF for calling thread.
+ * @param maskp		Where to store mask of CPUs the thread can run on.
+ * @return		Status code describing result of the operation. */
+status_t kern_thread_affinity(handle_t handle, cpu_mask_t *maskp) {
+	thread_t *thread;
+	status_t ret;
+
+	if(!maskp)
+		return STATUS_INVALID_ARG;
+
+	ret = thread_handle_lookup(handle, &thread);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	ret = write_user(maskp, thread->affinity);
+	thread_release(thread);
+	return ret;
+}
+
+/**
+ * Set the CPU affinity of a thread.
+ *
+ * Sets the set of CPUs that a thread is allowed to run on. Bit N of the mask
+ * corresponds to the CPU with ID N. CPUs with an ID too large to be
+ * represented in the mask can only be used by threads with an affinity of
+ * CPU_MASK_ALL. The calling thread must have privileged access to the process
+ * owning the thread.
+ *
+ * @param handle	Handle to thread, or THREAD_SELF for calling thread.
+ * @param mask		New affinity mask.
+ *
+ * @return		STATUS_SUCCESS on success.
+ *			STATUS_INVALID_HANDLE if handle is invalid.
+ *			STATUS_ACCESS_DENIED if the caller does not have
+ *			privileged access to the thread.
+ *			STATUS_INVALID_ARG if the mask does not include any
+ *			running CPUs.
+ */
+status_t kern_thread_set_affinity(handle_t handle, cpu_mask_t mask) {
+	thread_t *thread;
+	status_t ret;
+
+	ret = thread_handle_lookup(handle, &thread);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	if(!process_access(thread->owner)) {
+		ret = STATUS_ACCESS_DENIED;
+	} else {
+		ret = thread_set_affinity(thread, mask);
+	}
+
+	thread_release(thread);
+	return ret;
+}
+
+/** Get the scheduling parameters of a thread.
+ * @param handle	Handle to thread, or THREAD_SELF for calling thread.
+ * @param schedp	Where to store scheduling parameters.
+ * @return		Status code describing result of the operation. */
+status_t kern_thread_sched(handle_t handle, thread_sched_t *schedp) {
+	thread_sched_t ksched;
+	thread_t *thread;
+	status_t ret;
+
+	if(!schedp)
+		return STATUS_INVALID_ARG;
+
+	ret = thread_handle_lookup(handle, &thread);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	spinlock_lock(&thread->lock);
+	ksched.policy = thread->policy;
+	ksched.priority = thread->rt_priority;
+	ksched.quantum = (thread->policy == THREAD_SCHED_RR) ? thread->rt_quantum : 0;
+	spinlock_unlock(&thread->lock);
+
+	thread_release(thread);
+	return memcpy_to_user(schedp, &ksched, sizeof(ksched));
+}
+
+/**
+ * Set the scheduling parameters of a thread.
+ *
+ * Sets the scheduling policy of a thread. Real-time threads (with a policy
+ * of THREAD_SCHED_FIFO or THREAD_SCHED_RR) always run ahead of timesharing
+ * threads, and have a fixed priority. The calling thread must have privileged
+ * access to the process owning the thread, and in order to set a real-time
+ * policy its security context must have the PRIV_SCHED_REALTIME privilege.
+ *
+ * @param handle	Handle to thread, or THREAD_SELF for calling thread.
+ * @param sched		Scheduling parameters. The priority is ignored for
+ *			THREAD_SCHED_NORMAL, and the quantum is only used for
+ *			THREAD_SCHED_RR.
+ *
+ * @return		STATUS_SUCCESS on success.
+ *			STATUS_INVALID_HANDLE if handle is invalid.
+ *			STATUS_ACCESS_DENIED if the caller does not have
+ *			privileged access to the thread.
+ *			STATUS_PERM_DENIED if a real-time policy was requested
+ *			and the caller does not have the required privilege.
+ *			STATUS_INVALID_ARG if the parameters are invalid.
+ */
+status_t kern_thread_set_sched(handle_t handle, const thread_sched_t *sched) {
+	thread_sched_t ksched;
+	thread_t *thread;
+	status_t ret;
+	bool resched;
+
+	if(!sched)
+		return STATUS_INVALID_ARG;
+
+	ret = memcpy_from_user(&ksched, sched, sizeof(ksched));
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	switch(ksched.policy) {
+	case THREAD_SCHED_NORMAL:
+		ksched.priority = 0;
+		ksched.quantum = 0;
+		break;
+	case THREAD_SCHED_RR:
+		if(ksched.quantum && (ksched.quantum < SCHED_RR_QUANTUM_MIN
+			|| ksched.quantum > SCHED_RR_QUANTUM_MAX))
+		{
+			return STATUS_INVALID_ARG;
+		}
+
+		/* Fall through. */
+	case THREAD_SCHED_FIFO:
+		if(ksched.priority < 0 || ksched.priority > THREAD_RT_PRIORITY_MAX)
+			return STATUS_INVALID_ARG;
+
+		if(!security_check_priv(PRIV_SCHED_REALTIME))
+			return STATUS_PERM_DENIED;
+
+		break;
+	default:
+		return STATUS_INVALID_ARG;
+	}
+
+	ret = thread_handle_lookup(handle, &thread);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	if(!process_access(thread->owner)) {
+		thread_release(thread);
+		return STATUS_ACCESS_DENIED;
+	}
+
+	spinlock_lock(&thread->lock);
+	resched = sched_set_policy(thread, ksched.policy, ksched.priority,
+		(ksched.policy == THREAD_SCHED_RR) ? ksched.quantum : 0);
+	spinlock_unlock(&thread->lock);
+
+	thread_release(thread);
+
+	if(resched)
+		thread_yield();
+
+	return STATUS_SUCCESS;
+}
+
+/** Get scheduling statistics for a thread.
+ * @param thread	Thread to get statistics for.
+ * @param info		Information structure to fill in. */
+static void thread_sched_info(thread_t *thread, thread_sched_info_t *info) {
+	spinlock_lock(&thread->lock);
+
+	info->run_time = thread->run_time;
+	info->wait_time = thread->wait_time;
+	info->max_wait_time = thread->max_wait_time;
+	info->voluntary_switches = thread->voluntary_switches;
+	info->involuntary_switches = thread->involuntary_switches;
+
+	/* Include the current run or wait, which is not added to the totals
+	 * until it ends. */
+	if(thread->state == THREAD_RUNNING) {
+		info->run_time += system_time() - thread->run_start;
+	} else if(thread->state == THREAD_READY) {
+		info->wait_time += system_time() - thread->ready_time;
+	}
+
+	info->kernel_time = thread->kernel_time;
+	info->user_time = thread->user_time;
+
+	spinlock_unlock(&thread->lock);
+}
+
+/**
+ * Get information about a thread.
+ *
+ * Gets information about a thread. The calling thread must have privileged
+ * access to the process owning the thread. The following information types
+ * are currently defined:
+ *
+ *  - THREAD_INFO_SCHED: Scheduling statistics (thread_sched_info_t).
+ *
+ * @param handle	Handle to thread, or THREAD_SELF for calling thread.
+ * @param what		Type of information to get (THREAD_INFO_*).
+ * @param buf		Buffer to store information in (must be large enough
+ *			for the requested information type).
+ *
+ * @return		STATUS_SUCCESS on success.
+ *			STATUS_INVALID_HANDLE if handle is invalid.
+ *			STATUS_ACCESS_DENIED if the caller does not have
+ *			privileged access to the thread.
+ *			STATUS_INVALID_ARG if the information type is invalid.
+ */
+status_t kern_thread_info(handle_t handle, unsigned what, void *buf) {
+	thread_sched_info_t sched;
+	thread_t *thread;
+	status_t ret;
+
+	if(!buf)
+		return STATUS_INVALID_ARG;
+
+	ret = thread_handle_lookup(handle, &thread);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	if(!process_access(thread->owner)) {
+		thread_release(thread);
+		return STATUS_ACCESS_DENIED;
+	}
+
+	switch(what) {
+	case THREAD_INFO_SCHED:
+		thread_sched_info(thread, &sched);
+		ret = memcpy_to_user(buf, &sched, sizeof(sched));
+		break;
+	default:
+		ret = STATUS_INVALID_ARG;
+		break;
+	}
+
+	thread_release(thread);
+	return ret;
+}
+
 /**
  * Get the calling thread's IPL.
  *
@@ -1747,6 +2147,9 @@ void kern_thread_exit(int status) {
  * @param out		Pointer to output buffer.
  * @return		Status code describing result of the operation. */
 status_t kern_thread_control(unsigned action, const void *in, void *out) {
+	nstime_t slack;
+	status_t ret;
+
 	switch(action) {
 	case THREAD_SET_TLS_ADDR:
 		if(!is_user_address(in))
@@ -1754,6 +2157,19 @@ status_t kern_thread_control(unsigned action, const void *in, void *out) {
 
 		arch_thread_set_tls_addr((ptr_t)in);
 		return STATUS_SUCCESS;
+	case THREAD_TIMER_SLACK:
+		return write_user((nstime_t *)out, curr_thread->timer_slack);
+	case THREAD_SET_TIMER_SLACK:
+		ret = read_user((const nstime_t *)in, &slack);
+		if(ret != STATUS_SUCCESS) {
+			return ret;
+		} else if(slack < 0 || slack > TIMER_SLACK_MAX) {
+			return STATUS_INVALID_ARG;
+		}
+
+		/* Only affects timeouts and timers started from now on. */
+		curr_thread->timer_slack = slack;
+		return STATUS_SUCCESS;
 	default:
 		return STATUS_INVALID_ARG;
 	}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Big reader lock implementation.
+ *
+ * A reader increments the reader count of its CPU, then checks whether a
+ * writer holds the lock. A writer sets the writer flag, then waits for the
+ * reader count of every CPU to drop to 0. Both sides use a full barrier
+ * between their store and their load, so either the reader sees the flag and
+ * backs out to wait on the writer mutex, or the writer sees the reader's
+ * count and waits for it.
+ *
+ * Readers keep preemption disabled while they hold the lock, so that they
+ * release it on the CPU they acquired it on, and so that a writer only ever
+ * has to wait for a short time. Read-side critical sections must therefore
+ * not sleep. Write-side critical sections can.
+ */
+
+#include <arch/barrier.h>
+
+#include <lib/utility.h>
+
+#include <mm/malloc.h>
+
+#include <sync/brlock.h>
+
+#include <cpu.h>
+#include <kernel.h>
+
+/**
+ * Acquire a big reader lock for reading.
+ *
+ * Acquires a big reader lock for reading. If a writer holds the lock, the
+ * function will block until it is released. Preemption is disabled until the
+ * lock is released with brlock_read_unlock(), so the caller must not sleep
+ * while holding the lock.
+ *
+ * @param lock		Lock to acquire.
+ */
+void brlock_read_lock(brlock_t *lock) {
+	atomic_t *readers;
+
+	preempt_disable();
+
+	while(true) {
+		readers = &lock->cpus[curr_cpu->id].readers;
+
+		/* The atomic increment is a full barrier, ordering it against
+		 * the check of the writer flag. */
+		atomic_inc(readers);
+		if(likely(!lock->writer))
+			return;
+
+		/* A writer holds or is waiting for the lock. Back out, and
+		 * wait for it to finish by taking the writer mutex. */
+		atomic_dec(readers);
+		preempt_enable();
+
+		mutex_lock(&lock->lock);
+		mutex_unlock(&lock->lock);
+
+		preempt_disable();
+	}
+}
+
+/** Release a big reader lock held for reading.
+ * @param lock		Lock to release. */
+void brlock_read_unlock(brlock_t *lock) {
+	atomic_dec(&lock->cpus[curr_cpu->id].readers);
+	preempt_enable();
+}
+
+/**
+ * Acquire a big reader lock for writing.
+ *
+ * Acquires a big reader lock for writing. New readers are blocked, and the
+ * function waits for readers on all CPUs to release the lock. When it
+ * returns, no other readers or writers will be holding the lock.
+ *
+ * @param lock		Lock to acquire.
+ */
+void brlock_write_lock(brlock_t *lock) {
+	size_t i;
+
+	mutex_lock(&lock->lock);
+
+	lock->writer = true;
+	memory_barrier();
+
+	/* Readers do not sleep with the lock held, so just spin. Any reader
+	 * that increments a count we have already checked will see the flag
+	 * and back out. */
+	for(i = 0; i <= highest_cpu_id; i++) {
+		while(atomic_get(&lock->cpus[i].readers))
+			arch_cpu_spin_hint();
+	}
+}
+
+/** Release a big reader lock held for writing.
+ * @param lock		Lock to release. */
+void brlock_write_unlock(brlock_t *lock) {
+	write_barrier();
+	lock->writer = false;
+
+	mutex_unlock(&lock->lock);
+}
+
+/**
+ * Initialize a big reader lock.
+ *
+ * Initializes a big reader lock. The per-CPU state is sized for the CPUs
+ * detected at the time of the call, so this must not be called before SMP
+ * detection has been performed.
+ *
+ * @param lock		Lock to initialize.
+ * @param name		Name to give the lock.
+ */
+void brlock_init(brlock_t *lock, const char *name) {
+	ptr_t cpus;
+
+	/* Give each CPU its own cache line. The allocation is padded so that
+	 * the array can be aligned. Locks are never freed. */
+	cpus = (ptr_t)kcalloc(highest_cpu_id + 2, sizeof(*lock->cpus), MM_KERNEL);
+	lock->cpus = (brlock_cpu_t *)round_up(cpus, CPU_CACHE_SIZE);
+
+	lock->writer = false;
+	mutex_init(&lock->lock, name, 0);
+	lock->name = name;
+}
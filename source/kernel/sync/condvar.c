@@ -24,6 +24,44 @@
 #include <sync/condvar.h>
 
 #include <assert.h>
+#include <status.h>
+
+/** Internal code to wait for a condition to become true.
+ * @param cv		Condition variable to wait on.
+ * @param mutex		Mutex to atomically release while waiting.
+ * @param timeout	Timeout in nanoseconds.
+ * @param flags		Sleeping behaviour flags.
+ * @param caller	Address the wait is being performed from.
+ * @return		Status code describing result of the operation. */
+static inline status_t condvar_wait_internal(condvar_t *cv, mutex_t *mutex, nstime_t timeout,
+	unsigned flags, void *caller)
+{
+	status_t ret;
+	#if CONFIG_LOCKSTAT
+	uint64_t start = lockstat_time();
+	#endif
+
+	spinlock_lock(&cv->lock);
+
+	/* Release the specfied lock. */
+	if(mutex)
+		mutex_unlock(mutex);
+
+	/* Go to sleep. */
+	list_append(&cv->threads, &curr_thread->wait_link);
+	ret = thread_sleep(&cv->lock, timeout, cv->name, flags);
+
+	#if CONFIG_LOCKSTAT
+	if(ret == STATUS_SUCCESS)
+		lockstat_waited(cv->name, caller, start);
+	#endif
+
+	/* Re-acquire the lock. */
+	if(mutex)
+		mutex_lock_caller(mutex, caller);
+
+	return ret;
+}
 
 /**
  * Wait for a condition to become true.
@@ -51,23 +89,7 @@
  *			SLEEP_INTERRUPTIBLE flag is set.
  */
 status_t condvar_wait_etc(condvar_t *cv, mutex_t *mutex, nstime_t timeout, unsigned flags) {
-	status_t ret;
-
-	spinlock_lock(&cv->lock);
-
-	/* Release the specfied lock. */
-	if(mutex)
-		mutex_unlock(mutex);
-
-	/* Go to sleep. */
-	list_append(&cv->threads, &curr_thread->wait_link);
-	ret = thread_sleep(&cv->lock, timeout, cv->name, flags);
-
-	/* Re-acquire the lock. */
-	if(mutex)
-		mutex_lock(mutex);
-
-	return ret;
+	return condvar_wait_internal(cv, mutex, timeout, flags, __builtin_return_address(0));
 }
 
 /**
@@ -83,7 +105,7 @@ status_t condvar_wait_etc(condvar_t *cv, mutex_t *mutex, nstime_t timeout, unsig
  * @param mutex		Mutex to atomically release while waiting.
  */
 void condvar_wait(condvar_t *cv, mutex_t *mutex) {
-	condvar_wait_etc(cv, mutex, -1, 0);
+	condvar_wait_internal(cv, mutex, -1, 0, __builtin_return_address(0));
 }
 
 /**
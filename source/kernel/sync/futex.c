@@ -41,6 +41,7 @@
 #include <mm/vm.h>
 
 #include <proc/process.h>
+#include <proc/sched.h>
 #include <proc/thread.h>
 
 #include <sync/futex.h>
@@ -358,6 +359,172 @@ out:
 	return ret;
 }
 
+/**
+ * Lock a priority inheritance futex.
+ *
+ * Acquires a futex used as a lock with priority inheritance. The value of
+ * such a futex is 0 when it is unlocked, and the ID of the owning thread when
+ * it is locked, with FUTEX_PI_WAITERS set if any threads are waiting for it in
+ * the kernel. An uncontended lock can be taken by changing the value from 0
+ * to the thread's ID with an atomic compare and swap, and this function only
+ * needs to be called if that fails. While the calling thread waits, the owner
+ * inherits its priority. The owner must be a thread in the same process as
+ * the calling thread, otherwise the wait fails. When the owner unlocks
+ * the futex, ownership is handed directly to the highest priority waiting
+ * thread.
+ *
+ * @param addr		Pointer to futex.
+ * @param timeout	Timeout in nanoseconds. If -1, the function will block
+ *			until the futex can be acquired. If 0, an error will be
+ *			returned immediately if the futex is held.
+ *
+ * @return		STATUS_SUCCESS if the futex was acquired.
+ *			STATUS_WOULD_BLOCK if the calling thread already owns
+ *			the futex, or the timeout is 0 and it is held.
+ *			STATUS_NOT_FOUND if the owner of the futex does not
+ *			exist (e.g. it exited without unlocking it), or is
+ *			not a thread in the calling process.
+ *			Other status codes from the sleep on failure.
+ */
+status_t kern_futex_lock(int32_t *addr, nstime_t timeout) {
+	int32_t val, id, waiters;
+	thread_t *owner;
+	futex_t *futex;
+	status_t ret;
+
+	ret = futex_lookup(addr, &futex);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	/* The page is locked meaning it is safe to access it directly. */
+	while(true) {
+		val = atomic_get((atomic_t *)addr);
+		if(!val) {
+			if(atomic_cas((atomic_t *)addr, 0, curr_thread->id) == 0)
+				break;
+
+			continue;
+		}
+
+		id = val & FUTEX_PI_OWNER;
+		if(id == curr_thread->id) {
+			ret = STATUS_WOULD_BLOCK;
+			break;
+		}
+
+		/* Looking up the owner can sleep, so must be done before
+		 * taking the futex lock. The value is under the control of
+		 * userspace, so only lend our priority within our own
+		 * process. */
+		owner = thread_lookup(id);
+		if(owner && owner->owner != curr_proc) {
+			thread_release(owner);
+			owner = NULL;
+		}
+
+		/* Don't wait without an owner to lend our priority to. If the
+		 * owner has changed since we read the value, the lookup was
+		 * for a stale owner, so try again with the new one. */
+		if(!owner) {
+			if((atomic_get((atomic_t *)addr) & FUTEX_PI_OWNER) != id)
+				continue;
+
+			ret = STATUS_NOT_FOUND;
+			break;
+		}
+
+		spinlock_lock(&futex->lock);
+
+		/* Mark that there are waiters so that the owner does not
+		 * release the futex without calling kern_futex_unlock(),
+		 * which must take the futex lock. If the value has changed in
+		 * the meantime, start again. */
+		waiters = val | FUTEX_PI_WAITERS;
+		if(atomic_cas((atomic_t *)addr, val, waiters) != val
+			&& atomic_get((atomic_t *)addr) != waiters)
+		{
+			spinlock_unlock(&futex->lock);
+			thread_release(owner);
+			continue;
+		}
+
+		list_append(&futex->threads, &curr_thread->wait_link);
+		sched_pi_block(futex, owner);
+
+		/* If sleep is successful, ownership will have been handed to
+		 * us by the previous owner. */
+		ret = thread_sleep(&futex->lock, timeout, "futex_pi", SLEEP_INTERRUPTIBLE);
+		if(ret != STATUS_SUCCESS) {
+			sched_pi_unblock();
+
+			/* Clear the waiters bit if we were the last waiter so
+			 * that the owner can unlock without the kernel. */
+			spinlock_lock(&futex->lock);
+			if(list_empty(&futex->threads))
+				atomic_and((atomic_t *)addr, ~FUTEX_PI_WAITERS);
+			spinlock_unlock(&futex->lock);
+		}
+
+		thread_release(owner);
+		break;
+	}
+
+	futex_finish(addr);
+	return ret;
+}
+
+/**
+ * Unlock a priority inheritance futex.
+ *
+ * Releases a futex locked by kern_futex_lock(). If there are threads waiting
+ * for the futex, ownership is handed to the highest priority of them, and any
+ * priority inherited from them is dropped. Otherwise, the futex is set to 0.
+ * This only needs to be called if the futex has FUTEX_PI_WAITERS set: if it
+ * does not, the owner can unlock it by changing the value to 0 with an atomic
+ * compare and swap.
+ *
+ * @param addr		Pointer to futex.
+ *
+ * @return		STATUS_SUCCESS if the futex was released.
+ *			STATUS_PERM_DENIED if the calling thread does not own
+ *			the futex.
+ */
+status_t kern_futex_unlock(int32_t *addr) {
+	thread_t *thread;
+	futex_t *futex;
+	int32_t val;
+	status_t ret;
+
+	ret = futex_lookup(addr, &futex);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	spinlock_lock(&futex->lock);
+
+	/* While the waiters bit is set, only the owner can change the value,
+	 * and it must do so through here, so the value is stable. */
+	val = atomic_get((atomic_t *)addr);
+	if((val & FUTEX_PI_OWNER) != curr_thread->id) {
+		ret = STATUS_PERM_DENIED;
+	} else if(list_empty(&futex->threads)) {
+		atomic_set((atomic_t *)addr, 0);
+	} else {
+		thread = sched_pi_pick(&futex->threads);
+
+		val = thread->id;
+		if(!list_is_singular(&futex->threads))
+			val |= FUTEX_PI_WAITERS;
+
+		atomic_set((atomic_t *)addr, val);
+		sched_pi_transfer(futex, thread);
+		thread_wake(thread);
+	}
+
+	spinlock_unlock(&futex->lock);
+	futex_finish(addr);
+	return ret;
+}
+
 /** Initialize the futex cache. */
 static __init_text void futex_init(void) {
 	futex_cache = object_cache_create("futex_cache", futex_t, futex_ctor,
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Lock contention benchmark.
+ *
+ * Runs a thread on each of an increasing number of CPUs, all repeatedly
+ * acquiring the same lock, and reports the lock throughput along with how
+ * evenly acquisitions were shared out between the CPUs and the longest time
+ * any CPU had to wait for the lock. This is done for a spinlock, and then to
+ * compare reader scaling, for a readers-writer lock and a big reader lock
+ * taken for reading.
+ */
+
+#include <lib/utility.h>
+
+#include <mm/malloc.h>
+
+#include <proc/thread.h>
+
+#include <sync/brlock.h>
+#include <sync/rwlock.h>
+#include <sync/semaphore.h>
+#include <sync/spinlock.h>
+
+#include <cpu.h>
+#include <kernel.h>
+#include <status.h>
+#include <time.h>
+
+/** Length of each benchmark run. */
+#define LOCKBENCH_DURATION	SECS2NSECS(1)
+
+/** Number of spin iterations between acquisitions. */
+#define LOCKBENCH_DELAY		50
+
+/** Per-thread benchmark results. */
+typedef struct lockbench_result {
+	uint64_t count;			/**< Number of acquisitions. */
+	nstime_t max_wait;		/**< Longest wait for the lock. */
+	uint64_t sum;			/**< Sum of data read (prevents optimization). */
+} __cacheline_aligned lockbench_result_t;
+
+/** Types of lock to benchmark. */
+typedef enum lockbench_type {
+	LOCKBENCH_SPINLOCK,		/**< Spinlock. */
+	LOCKBENCH_RWLOCK_READ,		/**< Readers-writer lock, for reading. */
+	LOCKBENCH_BRLOCK_READ,		/**< Big reader lock, for reading. */
+} lockbench_type_t;
+
+/** Names of lock types. */
+static const char *lockbench_type_names[] = {
+	[LOCKBENCH_SPINLOCK] = "spinlock",
+	[LOCKBENCH_RWLOCK_READ] = "rwlock",
+	[LOCKBENCH_BRLOCK_READ] = "brlock",
+};
+
+/** Locks being benchmarked and the data that they protect. */
+static SPINLOCK_DEFINE(lockbench_lock);
+static RWLOCK_DEFINE(lockbench_rwlock);
+static brlock_t lockbench_brlock;
+static volatile uint64_t lockbench_data[CPU_CACHE_SIZE / sizeof(uint64_t)];
+
+/** Benchmark run state. */
+static lockbench_type_t lockbench_type;
+static volatile bool lockbench_go;
+static volatile nstime_t lockbench_end;
+static SEMAPHORE_DEFINE(lockbench_sem, 0);
+
+/** Benchmark thread.
+ * @param _result	Where to store results.
+ * @param arg2		Unused. */
+static void lockbench_thread(void *_result, void *arg2) {
+	lockbench_result_t *result = _result;
+	nstime_t start, wait = 0;
+	uint64_t count = 0, sum = 0;
+	unsigned i;
+
+	while(!lockbench_go)
+		arch_cpu_spin_hint();
+
+	do {
+		start = system_time();
+
+		switch(lockbench_type) {
+		case LOCKBENCH_SPINLOCK:
+			spinlock_lock(&lockbench_lock);
+			wait = system_time() - start;
+
+			/* Touch the protected data so that it moves between
+			 * CPUs along with the lock, as it would for a real
+			 * lock. */
+			for(i = 0; i < ARRAY_SIZE(lockbench_data); i++)
+				lockbench_data[i]++;
+
+			spinlock_unlock(&lockbench_lock);
+			break;
+		case LOCKBENCH_RWLOCK_READ:
+			rwlock_read_lock(&lockbench_rwlock);
+			wait = system_time() - start;
+
+			/* Readers only read the data, so it can stay cached
+			 * on every CPU. Only the lock itself is shared. */
+			for(i = 0; i < ARRAY_SIZE(lockbench_data); i++)
+				sum += lockbench_data[i];
+
+			rwlock_unlock(&lockbench_rwlock);
+			break;
+		case LOCKBENCH_BRLOCK_READ:
+			brlock_read_lock(&lockbench_brlock);
+			wait = system_time() - start;
+
+			for(i = 0; i < ARRAY_SIZE(lockbench_data); i++)
+				sum += lockbench_data[i];
+
+			brlock_read_unlock(&lockbench_brlock);
+			break;
+		}
+
+		result->max_wait = max(result->max_wait, wait);
+		count++;
+
+		for(i = 0; i < LOCKBENCH_DELAY; i++)
+			arch_cpu_spin_hint();
+	} while(start < lockbench_end);
+
+	result->count = count;
+	result->sum = sum;
+	semaphore_up(&lockbench_sem, 1);
+}
+
+/** Run the benchmark on a number of CPUs.
+ * @param type		Type of lock to benchmark.
+ * @param count		Number of CPUs to use. */
+static void lockbench_run(lockbench_type_t type, size_t count) {
+	lockbench_result_t *results;
+	uint64_t total = 0, min_count = UINT64_MAX, max_count = 0;
+	nstime_t max_wait = 0;
+	thread_t *thread;
+	cpu_t *cpu;
+	status_t ret;
+	size_t i = 0;
+
+	results = kmalloc(sizeof(*results) * count, MM_KERNEL | MM_ZERO);
+	lockbench_type = type;
+	lockbench_go = false;
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		if(i == count)
+			break;
+
+		ret = thread_create("lockbench", NULL, 0, lockbench_thread,
+			&results[i], NULL, &thread);
+		if(ret != STATUS_SUCCESS)
+			fatal("Failed to create lock benchmark thread: %d", ret);
+
+		thread_set_affinity(thread, (cpu_mask_t)1 << cpu->id);
+		thread_run(thread);
+		thread_release(thread);
+		i++;
+	}
+
+	lockbench_end = system_time() + LOCKBENCH_DURATION;
+	lockbench_go = true;
+
+	for(i = 0; i < count; i++)
+		semaphore_down(&lockbench_sem);
+
+	for(i = 0; i < count; i++) {
+		total += results[i].count;
+		min_count = min(min_count, results[i].count);
+		max_count = max(max_count, results[i].count);
+		max_wait = max(max_wait, results[i].max_wait);
+	}
+
+	kprintf(LOG_NOTICE, "lockbench: %-8s %2zu CPUs: %9" PRIu64 " acquisitions/s, "
+		"per-CPU min %" PRIu64 " max %" PRIu64 " (%" PRIu64 "%% fair), "
+		"max wait %" PRIu64 " us\n", lockbench_type_names[type], count,
+		total * SECS2NSECS(1) / LOCKBENCH_DURATION, min_count, max_count,
+		(max_count) ? min_count * 100 / max_count : 0,
+		NSECS2USECS(max_wait));
+
+	kfree(results);
+}
+
+/** Run the lock benchmarks. */
+static __init_text void lockbench_init(void) {
+	lockbench_type_t type;
+	size_t count;
+
+	if(cpu_count < 2)
+		return;
+
+	brlock_init(&lockbench_brlock, "lockbench_brlock");
+
+	for(type = LOCKBENCH_SPINLOCK; type <= LOCKBENCH_BRLOCK_READ; type++) {
+		for(count = 1; count < cpu_count; count *= 2)
+			lockbench_run(type, count);
+
+		lockbench_run(type, cpu_count);
+	}
+}
+
+INITCALL(lockbench_init);
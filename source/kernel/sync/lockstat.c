@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Lock statistics.
+ *
+ * Statistics are recorded per lock class, which is the combination of a lock
+ * name and the address that the lock was acquired from, so that the
+ * individual users of a commonly named lock (e.g. the lock inside every
+ * mutex) can be told apart. Classes are kept in a fixed size hash table that
+ * is only ever added to, so that recording can be done with atomic operations
+ * alone: this code is called with spinlocks held and must never take a lock
+ * itself. Times are recorded in CPU cycles and converted when read.
+ *
+ * Hold times are only recorded for exclusive acquisitions, as the place that
+ * a shared lock is released from cannot be matched up with its acquisition.
+ * Condition variable waits are recorded along with the time spent asleep, but
+ * a thread waiting for a condition is not contention, so they are never
+ * counted as contended and are ranked after all locks.
+ */
+
+#include <arch/barrier.h>
+
+#include <lib/string.h>
+#include <lib/utility.h>
+
+#include <mm/malloc.h>
+#include <mm/safe.h>
+
+#include <sync/lockstat.h>
+
+#include <kdb.h>
+#include <kernel.h>
+#include <status.h>
+#include <time.h>
+
+/** Number of lock classes that can be recorded (must be a power of 2). */
+#define LOCKSTAT_CLASS_COUNT	2048
+
+/** Number of hash table entries to look at before giving up. */
+#define LOCKSTAT_PROBE_COUNT	32
+
+/** Default number of classes to print from KDB. */
+#define LOCKSTAT_KDB_COUNT	20
+
+/** Statistics for a lock class. */
+typedef struct lockstat_class {
+	atomic64_t caller;		/**< Acquisition address (0 if free). */
+	const char *volatile name;	/**< Name of the lock (NULL until set). */
+	unsigned type;			/**< Type of the lock. */
+
+	atomic64_t acquisitions;	/**< Number of acquisitions. */
+	atomic64_t contentions;		/**< Acquisitions that had to wait. */
+	atomic64_t wait_total;		/**< Total cycles spent waiting. */
+	atomic64_t wait_max;		/**< Longest wait in cycles. */
+	atomic64_t hold_total;		/**< Total cycles held. */
+	atomic64_t hold_max;		/**< Longest hold in cycles. */
+} lockstat_class_t;
+
+/** Lock class hash table. */
+static lockstat_class_t lockstat_classes[LOCKSTAT_CLASS_COUNT];
+
+/** Number of acquisitions not recorded due to the table being full. */
+static atomic64_t lockstat_lost;
+
+/** Sort buffer used by KDB (cannot allocate memory there). */
+static lockstat_class_t *lockstat_kdb_sorted[LOCKSTAT_CLASS_COUNT];
+
+/** Name used for locks with no name. */
+static const char lockstat_unnamed[] = "<unnamed>";
+
+/** Raise a maximum value.
+ * @param max		Maximum to update.
+ * @param val		New value. */
+static inline void lockstat_update_max(atomic64_t *max, uint64_t val) {
+	int64_t old;
+
+	while((uint64_t)(old = atomic_get64(max)) < val) {
+		if(atomic_cas64(max, old, val) == old)
+			break;
+	}
+}
+
+/** Find or create the class for a lock acquisition.
+ * @param type		Type of the lock.
+ * @param name		Name of the lock.
+ * @param caller	Acquisition address.
+ * @return		Pointer to class, or NULL if the table is full. */
+static lockstat_class_t *lockstat_class(unsigned type, const char *name, void *caller) {
+	lockstat_class_t *class;
+	const char *curr;
+	size_t hash, i;
+
+	hash = ((ptr_t)caller >> 2) ^ ((ptr_t)name >> 4) ^ type;
+	hash ^= hash >> 11;
+
+	for(i = 0; i < LOCKSTAT_PROBE_COUNT; i++) {
+		class = &lockstat_classes[(hash + i) & (LOCKSTAT_CLASS_COUNT - 1)];
+
+		if(atomic_get64(&class->caller) == 0) {
+			if(atomic_cas64(&class->caller, 0, (ptr_t)caller) == 0) {
+				/* Publish the name last, it is what tells
+				 * other CPUs that the entry is complete. */
+				class->type = type;
+				write_barrier();
+				class->name = name;
+				return class;
+			}
+		}
+
+		if(atomic_get64(&class->caller) != (ptr_t)caller)
+			continue;
+
+		/* Another CPU may be just claiming this entry. */
+		while(!(curr = class->name))
+			arch_cpu_spin_hint();
+
+		read_barrier();
+		if(curr == name && class->type == type)
+			return class;
+	}
+
+	return NULL;
+}
+
+/**
+ * Record a lock acquisition.
+ *
+ * Records a lock acquisition in the statistics. Must be called after the lock
+ * has been acquired. For exclusive locks, a statistics structure in the lock
+ * should be given so that the hold time can be recorded when the lock is
+ * released with lockstat_released().
+ *
+ * @param stat		Statistics structure in the lock (can be NULL).
+ * @param type		Type of the lock (LOCK_STAT_*).
+ * @param name		Name of the lock.
+ * @param caller	Address the lock was acquired from.
+ * @param start		Timestamp at which the acquisition began.
+ * @param contended	Whether the acquisition had to wait.
+ */
+void lockstat_acquired(lockstat_lock_t *stat, unsigned type, const char *name,
+	void *caller, uint64_t start, bool contended)
+{
+	lockstat_class_t *class;
+	uint64_t now, wait;
+
+	now = lockstat_time();
+
+	class = lockstat_class(type, (name) ? name : lockstat_unnamed, caller);
+	if(unlikely(!class)) {
+		atomic_inc64(&lockstat_lost);
+		if(stat)
+			stat->class = NULL;
+
+		return;
+	}
+
+	atomic_inc64(&class->acquisitions);
+
+	if(contended) {
+		wait = now - start;
+
+		atomic_inc64(&class->contentions);
+		atomic_add64(&class->wait_total, wait);
+		lockstat_update_max(&class->wait_max, wait);
+	}
+
+	if(stat) {
+		stat->class = class;
+		stat->acquired = now;
+	}
+}
+
+/**
+ * Record a condition variable wait.
+ *
+ * Records a completed wait on a condition variable. The time spent asleep is
+ * recorded as the wait time, but the wait does not count as contention.
+ *
+ * @param name		Name of the condition variable.
+ * @param caller	Address the wait was performed from.
+ * @param start		Timestamp at which the wait began.
+ */
+void lockstat_waited(const char *name, void *caller, uint64_t start) {
+	lockstat_class_t *class;
+	uint64_t wait;
+
+	wait = lockstat_time() - start;
+
+	class = lockstat_class(LOCK_STAT_CONDVAR, (name) ? name : lockstat_unnamed, caller);
+	if(unlikely(!class)) {
+		atomic_inc64(&lockstat_lost);
+		return;
+	}
+
+	atomic_inc64(&class->acquisitions);
+	atomic_add64(&class->wait_total, wait);
+	lockstat_update_max(&class->wait_max, wait);
+}
+
+/** Record a lock release.
+ * @param stat		Statistics structure in the lock. Must be called while
+ *			the lock is still held. */
+void lockstat_released(lockstat_lock_t *stat) {
+	lockstat_class_t *class = stat->class;
+	uint64_t hold;
+
+	if(!class)
+		return;
+
+	hold = lockstat_time() - stat->acquired;
+	stat->class = NULL;
+
+	atomic_add64(&class->hold_total, hold);
+	lockstat_update_max(&class->hold_max, hold);
+}
+
+/** Compare two lock classes, most contended first (condvars last). */
+static int lockstat_compare(const void *a, const void *b) {
+	lockstat_class_t *first = *(lockstat_class_t **)a;
+	lockstat_class_t *second = *(lockstat_class_t **)b;
+	int64_t first_val, second_val;
+
+	first_val = first->type == LOCK_STAT_CONDVAR;
+	second_val = second->type == LOCK_STAT_CONDVAR;
+	if(first_val != second_val)
+		return (first_val) ? 1 : -1;
+
+	first_val = atomic_get64(&first->contentions);
+	second_val = atomic_get64(&second->contentions);
+	if(first_val == second_val) {
+		first_val = atomic_get64(&first->wait_total);
+		second_val = atomic_get64(&second->wait_total);
+		if(first_val == second_val) {
+			first_val = atomic_get64(&first->acquisitions);
+			second_val = atomic_get64(&second->acquisitions);
+		}
+	}
+
+	return (first_val < second_val) ? 1 : (first_val > second_val) ? -1 : 0;
+}
+
+/** Get a sorted list of lock classes.
+ * @param array		Array to fill (LOCKSTAT_CLASS_COUNT entries).
+ * @return		Number of classes in the array. */
+static size_t lockstat_sort(lockstat_class_t **array) {
+	lockstat_class_t *class;
+	size_t i, count = 0;
+
+	for(i = 0; i < LOCKSTAT_CLASS_COUNT; i++) {
+		class = &lockstat_classes[i];
+		if(class->name && atomic_get64(&class->acquisitions))
+			array[count++] = class;
+	}
+
+	qsort(array, count, sizeof(*array), lockstat_compare);
+	return count;
+}
+
+/** Convert a lock class to its exported form.
+ * @param class		Class to convert.
+ * @param stat		Structure to fill in. */
+static void lockstat_convert(lockstat_class_t *class, lock_stat_t *stat) {
+	memset(stat, 0, sizeof(*stat));
+	strncpy(stat->name, class->name, LOCK_STAT_NAME_MAX - 1);
+	stat->caller = atomic_get64(&class->caller);
+	stat->type = class->type;
+	stat->acquisitions = atomic_get64(&class->acquisitions);
+	stat->contentions = atomic_get64(&class->contentions);
+	stat->wait_time = arch_cycles_to_nsecs(atomic_get64(&class->wait_total));
+	stat->wait_max = arch_cycles_to_nsecs(atomic_get64(&class->wait_max));
+	stat->hold_time = arch_cycles_to_nsecs(atomic_get64(&class->hold_total));
+	stat->hold_max = arch_cycles_to_nsecs(atomic_get64(&class->hold_max));
+}
+
+/** Reset all lock statistics. */
+static void lockstat_reset(void) {
+	lockstat_class_t *class;
+	size_t i;
+
+	/* Classes themselves are kept, only the counts are cleared. */
+	for(i = 0; i < LOCKSTAT_CLASS_COUNT; i++) {
+		class = &lockstat_classes[i];
+
+		atomic_set64(&class->acquisitions, 0);
+		atomic_set64(&class->contentions, 0);
+		atomic_set64(&class->wait_total, 0);
+		atomic_set64(&class->wait_max, 0);
+		atomic_set64(&class->hold_total, 0);
+		atomic_set64(&class->hold_max, 0);
+	}
+
+	atomic_set64(&lockstat_lost, 0);
+}
+
+/**
+ * Export lock statistics to user space.
+ *
+ * Copies the statistics of the most contended lock classes to a user buffer.
+ * This is the implementation of kern_system_lock_stats().
+ *
+ * @param buf		User buffer to store statistics in (can be NULL).
+ * @param countp	User pointer containing the capacity of the buffer on
+ *			entry, and set to the total number of classes.
+ *
+ * @return		Status code describing result of the operation.
+ */
+status_t lockstat_export(lock_stat_t *buf, size_t *countp) {
+	lockstat_class_t **array;
+	lock_stat_t stat;
+	size_t count, total, i;
+	status_t ret;
+
+	ret = read_user(countp, &count);
+	if(ret != STATUS_SUCCESS)
+		return ret;
+
+	array = kmalloc(sizeof(*array) * LOCKSTAT_CLASS_COUNT, MM_KERNEL);
+	total = lockstat_sort(array);
+
+	if(buf) {
+		count = min(count, total);
+		for(i = 0; i < count; i++) {
+			lockstat_convert(array[i], &stat);
+
+			ret = memcpy_to_user(&buf[i], &stat, sizeof(stat));
+			if(ret != STATUS_SUCCESS)
+				goto out;
+		}
+	}
+
+	ret = write_user(countp, total);
+out:
+	kfree(array);
+	return ret;
+}
+
+/** Names of lock types. */
+static const char *lockstat_type_names[] = {
+	[LOCK_STAT_SPINLOCK] = "spinlock",
+	[LOCK_STAT_MUTEX] = "mutex",
+	[LOCK_STAT_RWLOCK_READ] = "rwlock(r)",
+	[LOCK_STAT_RWLOCK_WRITE] = "rwlock(w)",
+	[LOCK_STAT_CONDVAR] = "condvar",
+};
+
+/** Print lock statistics.
+ * @param argc		Number of arguments.
+ * @param argv		Arguments passed to the command.
+ * @param filter	Ignored.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_lockstat(int argc, char **argv, kdb_filter_t *filter) {
+	lock_stat_t stat;
+	uint64_t count = LOCKSTAT_KDB_COUNT, waits;
+	size_t total, i;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s [<count>]\n", argv[0]);
+		kdb_printf("       %s reset\n\n", argv[0]);
+
+		kdb_printf("Prints statistics for the most contended lock classes (a lock name and the\n");
+		kdb_printf("address it was acquired from), or resets all statistics. Times are in\n");
+		kdb_printf("microseconds. Hold times are only recorded for exclusive locks.\n");
+		kdb_printf("Condition variable waits are listed after locks, with the time spent\n");
+		kdb_printf("asleep as the wait time.\n");
+		return KDB_SUCCESS;
+	} else if(argc > 2) {
+		kdb_printf("Incorrect number of arguments. See 'help %s' for help.\n", argv[0]);
+		return KDB_FAILURE;
+	}
+
+	if(argc == 2) {
+		if(strcmp(argv[1], "reset") == 0) {
+			lockstat_reset();
+			return KDB_SUCCESS;
+		} else if(kdb_parse_expression(argv[1], &count, NULL) != KDB_SUCCESS) {
+			return KDB_FAILURE;
+		}
+	}
+
+	total = lockstat_sort(lockstat_kdb_sorted);
+
+	kdb_printf("Name                 Type       Acquired     Contended  Wait avg  Wait max  Hold avg  Hold max  Caller\n");
+	kdb_printf("====                 ====       ========     =========  ========  ========  ========  ========  ======\n");
+
+	for(i = 0; i < min(total, count); i++) {
+		lockstat_convert(lockstat_kdb_sorted[i], &stat);
+
+		/* Every condition variable wait is a wait. */
+		waits = (stat.type == LOCK_STAT_CONDVAR) ? stat.acquisitions : stat.contentions;
+
+		kdb_printf("%-20s %-10s %-12" PRIu64 " %-10" PRIu64 " %-9" PRId64 " %-9"
+			PRId64 " %-9" PRId64 " %-9" PRId64 " %pB\n",
+			stat.name, lockstat_type_names[stat.type], stat.acquisitions,
+			stat.contentions,
+			(waits) ? NSECS2USECS(stat.wait_time / (nstime_t)waits) : 0,
+			NSECS2USECS(stat.wait_max),
+			NSECS2USECS(stat.hold_time / (nstime_t)stat.acquisitions),
+			NSECS2USECS(stat.hold_max), (void *)stat.caller);
+	}
+
+	kdb_printf("\n%zu classes, %" PRId64 " acquisitions not recorded\n", total,
+		atomic_get64(&lockstat_lost));
+	return KDB_SUCCESS;
+}
+
+/** Register the lock statistics KDB command. */
+static __init_text void lockstat_init(void) {
+	kdb_register_command("lockstat", "Print or reset lock statistics.", kdb_cmd_lockstat);
+}
+
+INITCALL(lockstat_init);
@@ -17,14 +17,37 @@
 /**
  * @file
  * @brief		Mutex implementation.
+ *
+ * Mutexes implement priority inheritance: a thread that blocks on a mutex
+ * lends its priority to the holder until the mutex is released, and the
+ * mutex is handed to the highest priority waiter. See sched.c for details.
+ *
+ * A thread that finds a mutex held by a thread that is currently running on
+ * another CPU spins for a short while before sleeping, as the holder is
+ * likely to release it soon and sleeping costs two context switches.
  */
 
+#include <arch/barrier.h>
+
+#include <proc/sched.h>
 #include <proc/thread.h>
 
 #include <sync/mutex.h>
 
 #include <assert.h>
+#include <cpu.h>
+#include <kdb.h>
+#include <kernel.h>
 #include <status.h>
+#include <time.h>
+
+/** Maximum time to spin waiting for a running holder. */
+#define MUTEX_SPIN_TIME		USECS2NSECS(20)
+
+/** Mutex contention statistics. */
+static atomic_t mutex_contended;
+static atomic_t mutex_spin_acquired;
+static atomic_t mutex_slept;
 
 /** Handle a recursive locking error.
  * @param lock		Lock error occurred on. */
@@ -37,13 +60,82 @@ static inline void mutex_recursive_error(mutex_t *lock) {
 	#endif
 }
 
+/** Link up threads waiting for a mutex with the current thread as the holder.
+ * @param lock		Mutex that has been acquired. */
+static void mutex_pi_claim(mutex_t *lock) {
+	thread_t *thread;
+
+	spinlock_lock(&lock->lock);
+
+	LIST_FOREACH(&lock->threads, iter) {
+		thread = list_entry(iter, thread_t, wait_link);
+		sched_pi_set_owner(thread, curr_thread);
+	}
+
+	spinlock_unlock(&lock->lock);
+}
+
+/**
+ * Spin waiting for a mutex while its holder is running.
+ *
+ * Spins trying to acquire a mutex for as long as its holder is running on
+ * another CPU, up to a time limit. Spinning stops if there are threads
+ * sleeping on the mutex, as it will be handed directly to one of them, or if
+ * the current thread should be preempted.
+ *
+ * @param lock		Mutex to acquire.
+ *
+ * @return		Whether the mutex was acquired.
+ */
+static bool mutex_spin(mutex_t *lock) {
+	thread_t *holder;
+	nstime_t end;
+	cpu_t *cpu;
+
+	if(cpu_count == 1)
+		return false;
+
+	end = system_time() + MUTEX_SPIN_TIME;
+
+	while(true) {
+		compiler_barrier();
+
+		/* The holder is never dereferenced here, as it may have
+		 * released the mutex and exited. It is only compared with what
+		 * the CPU it acquired the lock on is running. If it is NULL,
+		 * the mutex is between holders. */
+		holder = lock->holder;
+		cpu = lock->holder_cpu;
+		if(holder && (!cpu || cpu == curr_cpu || cpu->thread != holder))
+			return false;
+
+		if(!list_empty(&lock->threads) || curr_cpu->should_preempt)
+			return false;
+
+		if(atomic_get(&lock->value) == 0 && atomic_cas(&lock->value, 0, 1) == 0)
+			return true;
+
+		if(system_time() >= end)
+			return false;
+
+		arch_cpu_spin_hint();
+	}
+}
+
 /** Internal mutex locking code.
  * @param lock		Mutex to acquire.
  * @param timeout	Timeout in nanoseconds.
  * @param flags		Sleeping behaviour flags.
+ * @param caller	Address the lock is being acquired from.
  * @return		Status code describing result of the operation. */
-static inline status_t mutex_lock_internal(mutex_t *lock, nstime_t timeout, unsigned flags) {
+static inline status_t mutex_lock_internal(mutex_t *lock, nstime_t timeout, unsigned flags,
+	void *caller)
+{
 	status_t ret;
+	#if CONFIG_LOCKSTAT
+	uint64_t start = lockstat_time();
+	bool contended = false;
+	#endif
 
 	if(atomic_cas(&lock->value, 0, 1) != 0) {
 		if(lock->holder == curr_thread) {
@@ -54,6 +146,17 @@ static inline status_t mutex_lock_internal(mutex_t *lock, nstime_t timeout, unsi
 				mutex_recursive_error(lock);
 			}
 		} else {
+			atomic_inc(&mutex_contended);
+			#if CONFIG_LOCKSTAT
+			contended = true;
+			#endif
+
+			/* A timeout of 0 is a try, so don't spin. */
+			if(timeout != 0 && mutex_spin(lock)) {
+				atomic_inc(&mutex_spin_acquired);
+				goto out;
+			}
+
 			spinlock_lock(&lock->lock);
 
 			/* Check again now that we have the lock, in case
@@ -61,18 +164,43 @@ static inline status_t mutex_lock_internal(mutex_t *lock, nstime_t timeout, unsi
 			if(atomic_cas(&lock->value, 0, 1) == 0) {
 				spinlock_unlock(&lock->lock);
 			} else {
+				/* The holder is NULL if the thread that has just
+				 * taken the mutex has not recorded itself yet. It
+				 * links us to itself in mutex_pi_claim() once it
+				 * has: that takes the lock, which we hold until we
+				 * are asleep, so it cannot miss us. */
 				list_append(&lock->threads, &curr_thread->wait_link);
+				memory_barrier();
+				sched_pi_block(lock, lock->holder);
+				atomic_inc(&mutex_slept);
 
 				/* If sleep is successful, lock ownership will
 				 * have been transferred to us. */
 				ret = thread_sleep(&lock->lock, timeout, lock->name, flags);
-				if(ret != STATUS_SUCCESS)
+				if(ret != STATUS_SUCCESS) {
+					sched_pi_unblock();
 					return ret;
+				}
 			}
 		}
 	}
 
+out:
 	lock->holder = curr_thread;
+	lock->holder_cpu = curr_cpu;
+
+	#if CONFIG_LOCKSTAT
+	lockstat_acquired(&lock->stat, LOCK_STAT_MUTEX, lock->name, caller, start, contended);
+	#endif
+
+	/* A thread that blocked between us taking the lock and setting the
+	 * holder will not have been able to lend us its priority. The barrier
+	 * orders the holder store against the waiter list check, pairing with
+	 * the waiter adding itself before reading the holder. */
+	memory_barrier();
+	if(unlikely(!list_empty(&lock->threads)))
+		mutex_pi_claim(lock);
+
 	return STATUS_SUCCESS;
 }
 
@@ -103,7 +231,7 @@ static inline status_t mutex_lock_internal(mutex_t *lock, nstime_t timeout, unsi
 status_t mutex_lock_etc(mutex_t *lock, nstime_t timeout, unsigned flags) {
 	status_t ret;
 
-	ret = mutex_lock_internal(lock, timeout, flags);
+	ret = mutex_lock_internal(lock, timeout, flags, __builtin_return_address(0));
 	#if CONFIG_DEBUG
 	if(likely(ret == STATUS_SUCCESS))
 		lock->caller = __builtin_return_address(0);
@@ -125,11 +253,34 @@ void mutex_lock(mutex_t *lock) {
 	#if CONFIG_DEBUG
 	status_t ret;
 
-	ret = mutex_lock_internal(lock, -1, 0);
+	ret = mutex_lock_internal(lock, -1, 0, __builtin_return_address(0));
 	assert(ret == STATUS_SUCCESS);
 	lock->caller = __builtin_return_address(0);
 	#else
-	mutex_lock_internal(lock, -1, 0);
+	mutex_lock_internal(lock, -1, 0, __builtin_return_address(0));
+	#endif
+}
+
+/**
+ * Acquire a mutex on behalf of a caller.
+ *
+ * Acquires a mutex in the same way as mutex_lock(), but records the given
+ * address as the place that it was acquired from. This is for use by other
+ * synchronization primitives that acquire a mutex for their caller, so that
+ * debugging information and lock statistics refer to the real caller.
+ *
+ * @param lock		Mutex to acquire.
+ * @param caller	Address to record the mutex as acquired from.
+ */
+void mutex_lock_caller(mutex_t *lock, void *caller) {
+	#if CONFIG_DEBUG
+	status_t ret;
+
+	ret = mutex_lock_internal(lock, -1, 0, caller);
+	assert(ret == STATUS_SUCCESS);
+	lock->caller = caller;
+	#else
+	mutex_lock_internal(lock, -1, 0, caller);
 	#endif
 }
 
@@ -159,12 +310,21 @@ void mutex_unlock(mutex_t *lock) {
 	 * a thread waiting, we do not need to modify the count, as we transfer
 	 * ownership of the lock to it. Otherwise, decrement the count. */
 	if(atomic_get(&lock->value) == 1) {
-		lock->holder = NULL;
+		#if CONFIG_LOCKSTAT
+		lockstat_released(&lock->stat);
+		#endif
 
 		if(!list_empty(&lock->threads)) {
-			thread = list_first(&lock->threads, thread_t, wait_link);
+			/* Hand the lock to the highest priority waiter, and
+			 * give back any priority inherited through it. */
+			thread = sched_pi_pick(&lock->threads);
+			lock->holder = thread;
+			lock->holder_cpu = NULL;
+			sched_pi_transfer(lock, thread);
 			thread_wake(thread);
 		} else {
+			lock->holder = NULL;
+			lock->holder_cpu = NULL;
 			atomic_dec(&lock->value);
 		}
 	} else {
@@ -184,5 +344,46 @@ void mutex_init(mutex_t *lock, const char *name, unsigned flags) {
 	list_init(&lock->threads);
 	lock->flags = flags;
 	lock->holder = NULL;
+	lock->holder_cpu = NULL;
+	#if CONFIG_LOCKSTAT
+	lock->stat.class = NULL;
+	#endif
 	lock->name = name;
 }
+
+/** Print mutex contention statistics.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @param filter	Ignored.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_mutexstat(int argc, char **argv, kdb_filter_t *filter) {
+	int32_t contended, spun, slept;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints the number of times a mutex was found held by another thread,\n");
+		kdb_printf("and how many of those were acquired by spinning while the holder ran\n");
+		kdb_printf("rather than by sleeping.\n");
+		return KDB_SUCCESS;
+	}
+
+	contended = atomic_get(&mutex_contended);
+	spun = atomic_get(&mutex_spin_acquired);
+	slept = atomic_get(&mutex_slept);
+
+	kdb_printf("Contended:         %" PRIu32 "\n", contended);
+	kdb_printf("Acquired spinning: %" PRIu32 " (%" PRIu32 "%%)\n", spun,
+		(contended) ? (uint32_t)spun * 100 / (uint32_t)contended : 0);
+	kdb_printf("Slept:             %" PRIu32 " (%" PRIu32 "%%)\n", slept,
+		(contended) ? (uint32_t)slept * 100 / (uint32_t)contended : 0);
+	return KDB_SUCCESS;
+}
+
+/** Register the mutex KDB command. */
+static __init_text void mutex_kdb_init(void) {
+	kdb_register_command("mutexstat", "Print mutex contention statistics.",
+		kdb_cmd_mutexstat);
+}
+
+INITCALL(mutex_kdb_init);
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Read-copy-update.
+ *
+ * This is a quiescent state based implementation. Read-side critical
+ * sections disable preemption, so a CPU that has context switched cannot be
+ * within one that began before the switch. The same goes for a CPU that has
+ * been interrupted from user mode, or that is idle. A grace period has
+ * elapsed once every CPU has been through such a quiescent state since it
+ * began.
+ *
+ * Grace periods are driven by a thread that waits for callbacks to be queued,
+ * waits for every other CPU to pass through a quiescent state, and then runs
+ * the callbacks. A CPU that does not do so in a reasonable time is asked to
+ * reschedule.
+ *
+ * Read-side critical sections must not be used in interrupt handlers that
+ * may run on an idle CPU, unless the handler is entered through
+ * interrupt_handler(), which takes the CPU out of the idle state first.
+ */
+
+#include <arch/barrier.h>
+
+#include <lib/utility.h>
+
+#include <mm/malloc.h>
+
+#include <proc/thread.h>
+
+#include <sync/rcu.h>
+#include <sync/semaphore.h>
+#include <sync/spinlock.h>
+
+#include <assert.h>
+#include <cpu.h>
+#include <kdb.h>
+#include <kernel.h>
+#include <smp.h>
+#include <status.h>
+#include <time.h>
+
+/** Interval between checks on whether CPUs have passed a quiescent state. */
+#define RCU_POLL_INTERVAL	MSECS2NSECS(1)
+
+/** Number of checks before asking CPUs to reschedule. */
+#define RCU_FORCE_POLLS		10
+
+/** Queued callbacks. */
+static LIST_DEFINE(rcu_callbacks);
+static SPINLOCK_DEFINE(rcu_lock);
+static bool rcu_gp_pending;
+static SEMAPHORE_DEFINE(rcu_gp_sem, 0);
+
+/** Grace period state. */
+static uint64_t *rcu_snapshot;
+static bool *rcu_cpu_pending;
+
+/** Statistics. */
+static uint64_t rcu_gp_count;
+static uint64_t rcu_gp_forced;
+static uint64_t rcu_callback_count;
+static nstime_t rcu_gp_time_max;
+
+/** Record a quiescent state on the current CPU.
+ * @note		Must be called with interrupts disabled. */
+void rcu_quiescent(void) {
+	curr_cpu->rcu_qs++;
+}
+
+/**
+ * Mark the current CPU as idle.
+ *
+ * Marks the current CPU as being in an extended quiescent state, so that grace
+ * periods do not need to wait for it. Must be called with interrupts disabled
+ * outside of any read-side critical section, and undone with rcu_idle_exit()
+ * before any further read-side critical sections.
+ */
+void rcu_idle_enter(void) {
+	/* Make sure any reads before this are complete before we appear idle. */
+	memory_barrier();
+	curr_cpu->rcu_idle = true;
+}
+
+/** Mark the current CPU as no longer idle. */
+void rcu_idle_exit(void) {
+	curr_cpu->rcu_idle = false;
+
+	/* Pairs with the barrier in rcu_wait_cpus(): either the grace period
+	 * thread sees us as busy, or we see any changes made before it began
+	 * waiting. */
+	memory_barrier();
+}
+
+/** Force a CPU through a quiescent state.
+ * @param cpu		CPU to force. */
+static void rcu_force_cpu(cpu_t *cpu) {
+	#if CONFIG_SMP
+	/* Preempting the CPU's current thread will take it through the
+	 * scheduler, either immediately or, if it is within a read-side
+	 * critical section, when the section ends. */
+	cpu->should_preempt = true;
+	smp_call_single(cpu->id, NULL, NULL, SMP_CALL_ASYNC);
+	#endif
+}
+
+/** Wait for all CPUs to pass through a quiescent state. */
+static void rcu_wait_cpus(void) {
+	size_t remaining = 0;
+	unsigned polls = 0;
+	cpu_t *cpu, *self;
+
+	/* Order anything done before the grace period began (e.g. removing
+	 * entries from a structure) before the snapshot. */
+	memory_barrier();
+
+	/* The CPU that we are on cannot be within a read-side critical
+	 * section, since we are running on it. */
+	self = curr_cpu;
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		rcu_snapshot[cpu->id] = cpu->rcu_qs;
+		rcu_cpu_pending[cpu->id] = cpu != self && !cpu->rcu_idle;
+		if(rcu_cpu_pending[cpu->id])
+			remaining++;
+	}
+
+	while(remaining) {
+		delay(RCU_POLL_INTERVAL);
+
+		memory_barrier();
+
+		LIST_FOREACH(&running_cpus, iter) {
+			cpu = list_entry(iter, cpu_t, header);
+
+			if(!rcu_cpu_pending[cpu->id])
+				continue;
+
+			if(cpu->rcu_qs != rcu_snapshot[cpu->id] || cpu->rcu_idle) {
+				rcu_cpu_pending[cpu->id] = false;
+				remaining--;
+			} else if(polls == RCU_FORCE_POLLS) {
+				rcu_force_cpu(cpu);
+				rcu_gp_forced++;
+			}
+		}
+
+		polls++;
+	}
+}
+
+/** Grace period thread.
+ * @param arg1		Unused.
+ * @param arg2		Unused. */
+static void rcu_gp_thread(void *arg1, void *arg2) {
+	rcu_head_t *head;
+	nstime_t start;
+	LIST_DEFINE(batch);
+
+	while(true) {
+		semaphore_down(&rcu_gp_sem);
+
+		while(true) {
+			spinlock_lock(&rcu_lock);
+
+			if(list_empty(&rcu_callbacks)) {
+				rcu_gp_pending = false;
+				spinlock_unlock(&rcu_lock);
+				break;
+			}
+
+			/* Everything queued so far is covered by this grace
+			 * period. Anything queued while it is in progress must
+			 * wait for the next. */
+			list_splice_before(&batch, &rcu_callbacks);
+			spinlock_unlock(&rcu_lock);
+
+			start = system_time();
+			rcu_wait_cpus();
+			rcu_gp_time_max = max(rcu_gp_time_max, system_time() - start);
+			rcu_gp_count++;
+
+			while(!list_empty(&batch)) {
+				head = list_first(&batch, rcu_head_t, header);
+				list_remove(&head->header);
+				head->func(head);
+				rcu_callback_count++;
+			}
+		}
+	}
+}
+
+/**
+ * Queue a callback to run after a grace period.
+ *
+ * Queues a function to be called once all RCU read-side critical sections
+ * that are currently in progress have ended. This is typically used to free
+ * an object that has been removed from an RCU-protected structure. The
+ * callback is called from thread context, and may sleep.
+ *
+ * @param head		RCU head to queue the callback with, usually embedded
+ *			in the object being freed.
+ * @param func		Function to call.
+ */
+void call_rcu(rcu_head_t *head, rcu_func_t func) {
+	bool wake;
+
+	list_init(&head->header);
+	head->func = func;
+
+	spinlock_lock(&rcu_lock);
+
+	list_append(&rcu_callbacks, &head->header);
+	wake = !rcu_gp_pending;
+	rcu_gp_pending = true;
+
+	spinlock_unlock(&rcu_lock);
+
+	if(wake)
+		semaphore_up(&rcu_gp_sem, 1);
+}
+
+/** Structure used by synchronize_rcu(). */
+typedef struct rcu_sync {
+	rcu_head_t head;		/**< RCU head. */
+	semaphore_t sem;		/**< Semaphore to wake the waiter with. */
+} rcu_sync_t;
+
+/** Wake a thread waiting in synchronize_rcu().
+ * @param head		RCU head. */
+static void rcu_sync_callback(rcu_head_t *head) {
+	rcu_sync_t *sync = (rcu_sync_t *)head;
+
+	semaphore_up(&sync->sem, 1);
+}
+
+/**
+ * Wait for a grace period to elapse.
+ *
+ * Waits until all RCU read-side critical sections that are currently in
+ * progress have ended. Must not be called from within a read-side critical
+ * section.
+ */
+void synchronize_rcu(void) {
+	rcu_sync_t sync;
+
+	assert(!curr_thread->preempt_count);
+
+	semaphore_init(&sync.sem, "rcu_sync_sem", 0);
+	call_rcu(&sync.head, rcu_sync_callback);
+	semaphore_down(&sync.sem);
+}
+
+/** Print RCU information.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @param filter	Ignored.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_rcu(int argc, char **argv, kdb_filter_t *filter) {
+	size_t queued = 0;
+	cpu_t *cpu;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints grace period statistics, the number of callbacks waiting for a\n");
+		kdb_printf("grace period, and the quiescent state count of each CPU.\n");
+		return KDB_SUCCESS;
+	}
+
+	LIST_FOREACH(&rcu_callbacks, iter)
+		queued++;
+
+	kdb_printf("Grace periods:    %" PRIu64 " (%" PRIu64 " CPUs forced)\n",
+		rcu_gp_count, rcu_gp_forced);
+	kdb_printf("Longest (us):     %" PRId64 "\n", NSECS2USECS(rcu_gp_time_max));
+	kdb_printf("Callbacks run:    %" PRIu64 "\n", rcu_callback_count);
+	kdb_printf("Callbacks queued: %zu\n\n", queued);
+
+	kdb_printf("CPU  Quiescent  Idle\n");
+	kdb_printf("===  =========  ====\n");
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+
+		kdb_printf("%-4" PRIu32 " %-10" PRIu64 " %s\n", cpu->id, cpu->rcu_qs,
+			(cpu->rcu_idle) ? "yes" : "no");
+	}
+
+	return KDB_SUCCESS;
+}
+
+/** Start the RCU grace period thread. */
+static __init_text void rcu_init(void) {
+	status_t ret;
+
+	rcu_snapshot = kmalloc(sizeof(*rcu_snapshot) * (highest_cpu_id + 1), MM_BOOT);
+	rcu_cpu_pending = kmalloc(sizeof(*rcu_cpu_pending) * (highest_cpu_id + 1), MM_BOOT);
+
+	ret = thread_create("rcu", NULL, 0, rcu_gp_thread, NULL, NULL, NULL);
+	if(ret != STATUS_SUCCESS)
+		fatal("Failed to create RCU thread: %d", ret);
+
+	kdb_register_command("rcu", "Print RCU grace period information.", kdb_cmd_rcu);
+}
+
+INITCALL(rcu_init);
@@ -67,30 +67,20 @@ static void rwlock_transfer_ownership(rwlock_t *lock) {
 	}
 }
 
-/**
- * Acquire a readers-writer lock for reading.
- *
- * Acquires a readers-writer lock for reading. Multiple readers can hold a
- * readers-writer lock at any one time, however if there are any writers
- * waiting for the lock, the function will block and allow the writer to take
- * the lock, in order to prevent starvation of writers.
- *
+/** Internal code to acquire a readers-writer lock for reading.
  * @param lock		Lock to acquire.
- * @param timeout	Timeout in nanoseconds. If SLEEP_ABSOLUTE is specified,
- *			will always be taken to be a system time at which the
- *			sleep will time out. Otherwise, taken as the number of
- *			nanoseconds in which the sleep will time out. If 0 is
- *			specified, the function will return an error immediately
- *			if the lock cannot be acquired immediately. If -1
- *			is specified, the thread will sleep indefinitely until
- *			the lock can be acquired or it is interrupted.
+ * @param timeout	Timeout in nanoseconds.
  * @param flags		Sleeping behaviour flags.
- *
- * @return		Status code describing result of the operation. Failure
- *			is only possible if the timeout is not -1, or if the
- *			SLEEP_INTERRUPTIBLE flag is set.
- */
-status_t rwlock_read_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags) {
+ * @param caller	Address the lock is being acquired from.
+ * @return		Status code describing result of the operation. */
+static inline status_t rwlock_read_lock_internal(rwlock_t *lock, nstime_t timeout,
+	unsigned flags, void *caller)
+{
+	status_t ret;
+	#if CONFIG_LOCKSTAT
+	uint64_t start = lockstat_time();
+	#endif
+
 	spinlock_lock(&lock->lock);
 
 	if(lock->held) {
@@ -101,7 +91,16 @@ status_t rwlock_read_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags)
 			/* Readers count will have been incremented for us
 			 * upon success. */
 			list_append(&lock->threads, &curr_thread->wait_link);
-			return thread_sleep(&lock->lock, timeout, lock->name, flags);
+			ret = thread_sleep(&lock->lock, timeout, lock->name, flags);
+
+			#if CONFIG_LOCKSTAT
+			if(ret == STATUS_SUCCESS) {
+				lockstat_acquired(NULL, LOCK_STAT_RWLOCK_READ, lock->name,
+					caller, start, true);
+			}
+			#endif
+
+			return ret;
 		}
 	} else {
 		lock->held = 1;
@@ -110,38 +109,37 @@ status_t rwlock_read_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags)
 	lock->readers++;
 
 	spinlock_unlock(&lock->lock);
+
+	#if CONFIG_LOCKSTAT
+	lockstat_acquired(NULL, LOCK_STAT_RWLOCK_READ, lock->name, caller, start, false);
+	#endif
+
 	return STATUS_SUCCESS;
 }
 
-/**
- * Acquire a readers-writer lock for writing.
- *
- * Acquires a readers-writer lock for writing. When the lock has been acquired,
- * no other readers or writers will be holding the lock, or be able to acquire
- * it.
- *
+/** Internal code to acquire a readers-writer lock for writing.
  * @param lock		Lock to acquire.
- * @param timeout	Timeout in nanoseconds. If SLEEP_ABSOLUTE is specified,
- *			will always be taken to be a system time at which the
- *			sleep will time out. Otherwise, taken as the number of
- *			nanoseconds in which the sleep will time out. If 0 is
- *			specified, the function will return an error immediately
- *			if the lock cannot be acquired immediately. If -1
- *			is specified, the thread will sleep indefinitely until
- *			the lock can be acquired or it is interrupted.
+ * @param timeout	Timeout in nanoseconds.
  * @param flags		Sleeping behaviour flags.
- *
- * @return		Status code describing result of the operation. Failure
- *			is only possible if the timeout is not -1, or if the
- *			SLEEP_INTERRUPTIBLE flag is set.
- */
-status_t rwlock_write_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags) {
+ * @param caller	Address the lock is being acquired from.
+ * @return		Status code describing result of the operation. */
+static inline status_t rwlock_write_lock_internal(rwlock_t *lock, nstime_t timeout,
+	unsigned flags, void *caller)
+{
 	status_t ret = STATUS_SUCCESS;
+	#if CONFIG_LOCKSTAT
+	uint64_t start = lockstat_time();
+	bool contended = false;
+	#endif
 
 	spinlock_lock(&lock->lock);
 
 	/* Just acquire the exclusive lock. */
 	if(lock->held) {
+		#if CONFIG_LOCKSTAT
+		contended = true;
+		#endif
+
 		curr_thread->flags |= THREAD_RWLOCK_WRITER;
 		list_append(&lock->threads, &curr_thread->wait_link);
 		ret = thread_sleep(&lock->lock, timeout, lock->name, flags);
@@ -154,15 +152,74 @@ status_t rwlock_write_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags)
 			if(lock->readers)
 				rwlock_transfer_ownership(lock);
 			spinlock_unlock(&lock->lock);
+			return ret;
 		}
 	} else {
 		lock->held = 1;
 		spinlock_unlock(&lock->lock);
 	}
 
+	#if CONFIG_LOCKSTAT
+	lockstat_acquired(&lock->stat, LOCK_STAT_RWLOCK_WRITE, lock->name, caller, start,
+		contended);
+	#endif
+
 	return ret;
 }
 
+/**
+ * Acquire a readers-writer lock for reading.
+ *
+ * Acquires a readers-writer lock for reading. Multiple readers can hold a
+ * readers-writer lock at any one time, however if there are any writers
+ * waiting for the lock, the function will block and allow the writer to take
+ * the lock, in order to prevent starvation of writers.
+ *
+ * @param lock		Lock to acquire.
+ * @param timeout	Timeout in nanoseconds. If SLEEP_ABSOLUTE is specified,
+ *			will always be taken to be a system time at which the
+ *			sleep will time out. Otherwise, taken as the number of
+ *			nanoseconds in which the sleep will time out. If 0 is
+ *			specified, the function will return an error immediately
+ *			if the lock cannot be acquired immediately. If -1
+ *			is specified, the thread will sleep indefinitely until
+ *			the lock can be acquired or it is interrupted.
+ * @param flags		Sleeping behaviour flags.
+ *
+ * @return		Status code describing result of the operation. Failure
+ *			is only possible if the timeout is not -1, or if the
+ *			SLEEP_INTERRUPTIBLE flag is set.
+ */
+status_t rwlock_read_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags) {
+	return rwlock_read_lock_internal(lock, timeout, flags, __builtin_return_address(0));
+}
+
+/**
+ * Acquire a readers-writer lock for writing.
+ *
+ * Acquires a readers-writer lock for writing. When the lock has been acquired,
+ * no other readers or writers will be holding the lock, or be able to acquire
+ * it.
+ *
+ * @param lock		Lock to acquire.
+ * @param timeout	Timeout in nanoseconds. If SLEEP_ABSOLUTE is specified,
+ *			will always be taken to be a system time at which the
+ *			sleep will time out. Otherwise, taken as the number of
+ *			nanoseconds in which the sleep will time out. If 0 is
+ *			specified, the function will return an error immediately
+ *			if the lock cannot be acquired immediately. If -1
+ *			is specified, the thread will sleep indefinitely until
+ *			the lock can be acquired or it is interrupted.
+ * @param flags		Sleeping behaviour flags.
+ *
+ * @return		Status code describing result of the operation. Failure
+ *			is only possible if the timeout is not -1, or if the
+ *			SLEEP_INTERRUPTIBLE flag is set.
+ */
+status_t rwlock_write_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags) {
+	return rwlock_write_lock_internal(lock, timeout, flags, __builtin_return_address(0));
+}
+
 /**
  * Acquire a readers-writer lock for reading.
  *
@@ -174,7 +231,7 @@ status_t rwlock_write_lock_etc(rwlock_t *lock, nstime_t timeout, unsigned flags)
  * @param lock		Lock to acquire.
  */
 void rwlock_read_lock(rwlock_t *lock) {
-	rwlock_read_lock_etc(lock, -1, 0);
+	rwlock_read_lock_internal(lock, -1, 0, __builtin_return_address(0));
 }
 
 /**
@@ -187,7 +244,7 @@ void rwlock_read_lock(rwlock_t *lock) {
  * @param lock		Lock to acquire.
  */
 void rwlock_write_lock(rwlock_t *lock) {
-	rwlock_write_lock_etc(lock, -1, 0);
+	rwlock_write_lock_internal(lock, -1, 0, __builtin_return_address(0));
 }
 
 /** Release a readers-writer lock.
@@ -197,7 +254,13 @@ void rwlock_unlock(rwlock_t *lock) {
 
 	if(!lock->held) {
 		fatal("Unlock of unheld rwlock %s (%p)", lock->name, lock);
-	} else if(!lock->readers || !--lock->readers) {
+	} else if(!lock->readers) {
+		#if CONFIG_LOCKSTAT
+		lockstat_released(&lock->stat);
+		#endif
+
+		rwlock_transfer_ownership(lock);
+	} else if(!--lock->readers) {
 		rwlock_transfer_ownership(lock);
 	}
 
@@ -213,4 +276,7 @@ void rwlock_init(rwlock_t *lock, const char *name) {
 	lock->held = 0;
 	lock->readers = 0;
 	lock->name = name;
+	#if CONFIG_LOCKSTAT
+	lock->stat.class = NULL;
+	#endif
 }
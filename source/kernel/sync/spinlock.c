@@ -29,34 +29,162 @@
 
 #if CONFIG_SMP
 
-/**
-* Internal spinlock locking code.
-*
-* @param lock		Spinlock to acquire.
-*/
-static inline void
-spinlock_lock_internal(spinlock_t *lock)
-{
-	/* Attempt to take the lock. Prefer the uncontended case. */
-	if(likely(atomic_dec(&lock->value) == 1))
+/** Get the queue tail value for a CPU's queue node.
+ * @param cpu		CPU that the node belongs to.
+ * @param idx		Index of the node in the CPU's array.
+ * @return		Tail value for the lock word. */
+static inline uint32_t spinlock_encode_tail(cpu_t *cpu, unsigned idx) {
+	return ((uint32_t)(cpu->id + 1) << SPINLOCK_TAIL_CPU_SHIFT)
+		| (idx << SPINLOCK_TAIL_IDX_SHIFT);
+}
+
+/** Get the queue node referred to by a lock word's tail.
+ * @param val		Lock word value.
+ * @return		Pointer to queue node. */
+static inline spinlock_node_t *spinlock_decode_tail(uint32_t val) {
+	cpu_id_t id = (val >> SPINLOCK_TAIL_CPU_SHIFT) - 1;
+	unsigned idx = (val & SPINLOCK_TAIL_IDX_MASK) >> SPINLOCK_TAIL_IDX_SHIFT;
+
+	return &cpus[id]->spinlock_nodes[idx];
+}
+
+/** Queue on a contended spinlock.
+ * @param lock		Spinlock to acquire. */
+static void spinlock_lock_queued(spinlock_t *lock) {
+	spinlock_node_t *node, *next;
+	uint32_t tail, val, old;
+	unsigned idx;
+
+	idx = curr_cpu->spinlock_node_count;
+	if(unlikely(idx == SPINLOCK_NODE_COUNT)) {
+		/* Nested too deeply to queue, just spin on the lock word. */
+		while(atomic_cas(&lock->value, 0, SPINLOCK_LOCKED) != 0)
+			arch_cpu_spin_hint();
+
 		return;
+	}
+
+	curr_cpu->spinlock_node_count++;
+
+	node = &curr_cpu->spinlock_nodes[idx];
+	node->next = NULL;
+	node->locked = false;
+	tail = spinlock_encode_tail(curr_cpu, idx);
+
+	/* Make ourself the tail of the queue. */
+	do {
+		old = atomic_get(&lock->value);
+		val = (old & ~SPINLOCK_TAIL_MASK) | tail;
+	} while((uint32_t)atomic_cas(&lock->value, old, val) != old);
+
+	/* If there was a CPU before us, link to it and wait for it to pass us
+	 * the head of the queue. Each CPU spins on its own node so the lock's
+	 * cache line is only contended by the CPU at the head. */
+	if(old & SPINLOCK_TAIL_MASK) {
+		spinlock_decode_tail(old)->next = node;
+
+		while(!node->locked)
+			arch_cpu_spin_hint();
+	}
+
+	/* We are at the head of the queue, wait for the holder and the
+	 * pending CPU to be done with the lock. */
+	while(true) {
+		while((val = atomic_get(&lock->value)) & (SPINLOCK_LOCKED | SPINLOCK_PENDING))
+			arch_cpu_spin_hint();
+
+		/* If we are the last CPU in the queue, clear the tail as we take
+		 * the lock. Retry if this fails, as another CPU has either
+		 * queued behind us or briefly set the pending bit. */
+		if((val & SPINLOCK_TAIL_MASK) != tail)
+			break;
+
+		if((uint32_t)atomic_cas(&lock->value, val, SPINLOCK_LOCKED) == val)
+			goto out;
+	}
+
+	/* Other CPUs are queued behind us. As the tail is set, nothing else
+	 * will try to take the lock, so we can just set the locked byte. */
+	atomic_add(&lock->value, SPINLOCK_LOCKED);
+
+	/* Pass the head of the queue on. The next CPU may not have linked
+	 * itself to us yet. */
+	while(!(next = node->next))
+		arch_cpu_spin_hint();
+
+	next->locked = true;
+out:
+	curr_cpu->spinlock_node_count--;
+}
+
+/**
+ * Contended part of spinlock locking code.
+ *
+ * The first CPU to wait for a lock sets the pending bit and spins on the lock
+ * word. This avoids the cost of queueing under light contention, where there
+ * is only ever one waiter. Further CPUs queue in FIFO order, and only the CPU
+ * at the head of the queue spins on the lock word.
+ *
+ * @param lock		Spinlock to acquire.
+ * @param val		Value of the lock word seen by the fast path.
+ */
+static __noinline void spinlock_lock_slow(spinlock_t *lock, uint32_t val) {
+	uint32_t old;
 
 	/* When running on a single processor there is no need for us to spin
 	 * as there should only ever be one thing here at any one time, so just
 	 * die. */
-	if(likely(cpu_count > 1)) {
-		while(true) {
-			/* Wait for it to become unheld. */
-			while(atomic_get(&lock->value) != 1)
+	if(unlikely(cpu_count == 1))
+		fatal("Nested locking of spinlock %p (%s)", lock, lock->name);
+
+	/* If the pending CPU is about to take the lock that was just released,
+	 * wait for it to do so. */
+	while(val == SPINLOCK_PENDING) {
+		arch_cpu_spin_hint();
+		val = atomic_get(&lock->value);
+	}
+
+	/* If there are no other waiters, try to become the pending CPU. */
+	if(!(val & ~SPINLOCK_LOCKED)) {
+		old = atomic_or(&lock->value, SPINLOCK_PENDING);
+		if(!(old & ~SPINLOCK_LOCKED)) {
+			while(atomic_get(&lock->value) & SPINLOCK_LOCKED)
 				arch_cpu_spin_hint();
 
-			/* Try to acquire it. */
-			if(atomic_dec(&lock->value) == 1)
-				break;
+			/* Nothing else will try to take the lock while the
+			 * pending bit is set. Take it and clear the bit. */
+			atomic_add(&lock->value, SPINLOCK_LOCKED - SPINLOCK_PENDING);
+			return;
 		}
-	} else {
-		fatal("Nested locking of spinlock %p (%s)", lock, lock->name);
+
+		/* Another CPU got in first. Undo the pending bit if we were
+		 * the one that set it. */
+		if(!(old & SPINLOCK_PENDING))
+			atomic_and(&lock->value, ~SPINLOCK_PENDING);
 	}
+
+	spinlock_lock_queued(lock);
+}
+
+/**
+* Internal spinlock locking code.
+*
+* @param lock		Spinlock to acquire.
+*
+* @return		Whether the lock was contended.
+*/
+static inline bool
+spinlock_lock_internal(spinlock_t *lock)
+{
+	uint32_t val;
+
+	/* Attempt to take the lock. Prefer the uncontended case. */
+	val = atomic_cas(&lock->value, 0, SPINLOCK_LOCKED);
+	if(likely(val == 0))
+		return false;
+
+	spinlock_lock_slow(lock, val);
+	return true;
 }
 
 #else /* CONFIG_SMP */
@@ -65,19 +193,37 @@ spinlock_lock_internal(spinlock_t *lock)
 * Internal spinlock locking code.
 *
 * @param lock		Spinlock to acquire.
+*
+* @return		Whether the lock was contended (always false).
 */
-static inline void
+static inline bool
 spinlock_lock_internal(spinlock_t *lock)
 {
     /* Same as above. When running on a single processor there is no need
      * for us to spin as there should only ever be one thing here at any
      * one time, so just die. */
-    if(unlikely(atomic_dec(&lock->value) != 1))
+    if(unlikely(atomic_cas(&lock->value, 0, SPINLOCK_LOCKED) != 0))
         fatal("Nested locking of spinlock %p (%s)", lock, lock->name);
+
+    return false;
 }
 
 #endif /* CONFIG_SMP */
 
+/** Clear the locked byte of a spinlock.
+ * @param lock		Spinlock to release. */
+static inline void spinlock_unlock_internal(spinlock_t *lock) {
+	#if CONFIG_LOCKSTAT
+	lockstat_released(&lock->stat);
+	#endif
+
+	/* Only the holder writes the locked byte, and anything that changes
+	 * the rest of the word does so with an atomic operation, so a plain
+	 * store is sufficient. */
+	compiler_barrier();
+	lock->locked = 0;
+}
+
 /**
 * Acquire a spinlock.
 *
@@ -93,12 +239,23 @@ void
 spinlock_lock(spinlock_t *lock)
 {
     bool state;
+    #if CONFIG_LOCKSTAT
+    uint64_t start = lockstat_time();
+    bool contended;
+    #endif
 
     /* Disable interrupts while locked to ensure that nothing else
      * will run on the current CPU for the duration of the lock. */
     state = local_irq_disable();
 
+    #if CONFIG_LOCKSTAT
+    contended = spinlock_lock_internal(lock);
+    lockstat_acquired(&lock->stat, LOCK_STAT_SPINLOCK, lock->name,
+        __builtin_return_address(0), start, contended);
+    #else
     spinlock_lock_internal(lock);
+    #endif
+
     lock->state = state;
 }
 
@@ -121,9 +278,20 @@ spinlock_lock(spinlock_t *lock)
 void
 spinlock_lock_noirq(spinlock_t *lock)
 {
+    #if CONFIG_LOCKSTAT
+    uint64_t start = lockstat_time();
+    bool contended;
+    #endif
+
     assert(!local_irq_state());
 
+    #if CONFIG_LOCKSTAT
+    contended = spinlock_lock_internal(lock);
+    lockstat_acquired(&lock->stat, LOCK_STAT_SPINLOCK, lock->name,
+        __builtin_return_address(0), start, contended);
+    #else
     spinlock_lock_internal(lock);
+    #endif
 }
 
 /**
@@ -144,7 +312,7 @@ spinlock_unlock(spinlock_t *lock)
         fatal("Release of already unlocked spinlock %p (%s)", lock, lock->name);
 
     state = lock->state;
-    atomic_set(&lock->value, 1);
+    spinlock_unlock_internal(lock);
     local_irq_restore(state);
 }
 
@@ -159,7 +327,7 @@ spinlock_unlock_noirq(spinlock_t *lock)
     if(unlikely(!spinlock_held(lock)))
         fatal("Release of already unlocked spinlock %p (%s)", lock, lock->name);
 
-    atomic_set(&lock->value, 1);
+    spinlock_unlock_internal(lock);
 }
 
 /**
@@ -171,7 +339,10 @@ spinlock_unlock_noirq(spinlock_t *lock)
 void
 spinlock_init(spinlock_t *lock, const char *name)
 {
-    atomic_set(&lock->value, 1);
+    atomic_set(&lock->value, 0);
     lock->name = name;
     lock->state = false;
+    #if CONFIG_LOCKSTAT
+    lock->stat.class = NULL;
+    #endif
 }
\ No newline at end of file
@@ -18,6 +18,20 @@
  * @file
  * @brief		Time handling functions.
  *
+ * Each CPU keeps its running timers in a hierarchical timing wheel, so that
+ * starting and stopping a timer is O(1) regardless of how many there are.
+ * Level 0 of the wheel has slots of 2^TIMER_WHEEL_SHIFT nanoseconds (about a
+ * millisecond), and each level above has slots TIMER_WHEEL_SLOTS times wider
+ * than the one below. A timer is placed in the lowest level that can hold
+ * it. When the wheel's clock reaches the start of a higher level slot, the
+ * timers in it are cascaded down into the lower levels. Timers keep their
+ * exact target, and the slot granularity only affects where they are stored.
+ *
+ * A timer can have some slack, which is how late it is allowed to fire. The
+ * timer device is programmed for the earliest deadline (target plus slack),
+ * and every timer whose target has been reached expires on that tick, so
+ * timers with nearby targets are coalesced into a single interrupt.
+ *
  * @todo		Timers are tied to the CPU that they are created on.
  *			This is the right thing to do with, e.g. the scheduler
  *			timers, but what should we do with user timers? Load
@@ -25,12 +39,19 @@
  *			due to thread load balancing. Does it matter that much?
  */
 
-#include <kernel/time.h>
+#include <kernel/private/time.h>
+
+#include <arch/barrier.h>
+#include <arch/bitops.h>
 
 #include <lib/notifier.h>
+#include <lib/utility.h>
 
 #include <mm/malloc.h>
+#include <mm/page.h>
+#include <mm/phys.h>
 #include <mm/safe.h>
+#include <mm/vm.h>
 
 #include <proc/thread.h>
 
@@ -51,6 +72,9 @@ typedef struct user_timer {
 	bool fired;			/**< Whether the event has fired. */
 } user_timer_t;
 
+/** Log2 of the width of a level 0 timer wheel slot in nanoseconds. */
+#define TIMER_WHEEL_SHIFT	20
+
 /** Check if a year is a leap year. */
 #define LEAPYR(y)	(((y) % 4) == 0 && (((y) % 100) != 0 || ((y) % 400) == 0))
 
@@ -80,6 +104,11 @@ nstime_t boot_unix_time = 0;
 /** Hardware timer device. */
 static timer_device_t *timer_device = NULL;
 
+/** Kernel time data page, and the handle used to map it. */
+static time_page_t *time_page;
+static page_t *time_page_page;
+static object_handle_t *time_page_handle;
+
 /** Convert a date/time to nanoseconds since the epoch.
  * @param year		Year.
  * @param month		Month (1-12).
@@ -135,10 +164,44 @@ nstime_t boot_time(void) {
 }
 
 /** Prepares next timer tick.
- * @param timer		Timer to prepare for. */
-static void timer_device_prepare(timer_t *timer) {
-	nstime_t length = timer->target - system_time();
-	timer_device->prepare((length > 0) ? length : 1);
+ * @param target	Time to tick at. */
+static void timer_device_prepare(nstime_t target) {
+	nstime_t length;
+
+	curr_cpu->timers.armed = target;
+
+	if(timer_device->prepare_at) {
+		timer_device->prepare_at(target);
+	} else {
+		length = target - system_time();
+		timer_device->prepare((length > 0) ? length : 1);
+	}
+}
+
+/** Record how late a timer device tick was.
+ * @param wheel		Timer wheel for the current CPU.
+ * @param time		Time that the tick was handled. */
+static void timer_device_account(timer_wheel_t *wheel, nstime_t time) {
+	nstime_t late = time - wheel->armed;
+	unsigned bucket;
+
+	if(wheel->armed < 0)
+		return;
+
+	wheel->armed = -1;
+
+	/* The device may fire early, e.g. if the time could not be represented
+	 * exactly. The tick will then expire nothing and reprogram. */
+	if(late < 0) {
+		wheel->early++;
+		return;
+	}
+
+	bucket = (late) ? min(fls(late) + 1, TIMER_LATENCY_BUCKETS - 1) : 0;
+	wheel->latency[bucket]++;
+	wheel->latency_total += late;
+	if(late > wheel->latency_max)
+		wheel->latency_max = late;
 }
 
 /** Ensure that the timer device is enabled. */
@@ -180,29 +243,205 @@ void timer_device_set(timer_device_t *device) {
 	kprintf(LOG_NOTICE, "timer: activated timer device %s\n", device->name);
 }
 
-/** Start a timer, with CPU timer lock held.
- * @param timer		Timer to start. */
-static void timer_start_unsafe(timer_t *timer) {
-	timer_t *exist;
-	list_t *pos;
+/** Initialize a timer wheel.
+ * @param wheel		Wheel to initialize. */
+void timer_wheel_init(timer_wheel_t *wheel) {
+	unsigned i, j;
+
+	wheel->clock = 0;
+	wheel->count = 0;
+	wheel->next = INT64_MAX;
+	wheel->expired = 0;
+	wheel->interrupts = 0;
+	wheel->armed = -1;
+	wheel->early = 0;
+	wheel->latency_total = 0;
+	wheel->latency_max = 0;
+
+	for(i = 0; i < TIMER_LATENCY_BUCKETS; i++)
+		wheel->latency[i] = 0;
+
+	for(i = 0; i < TIMER_WHEEL_LEVELS; i++) {
+		wheel->bitmap[i] = 0;
+		for(j = 0; j < TIMER_WHEEL_SLOTS; j++)
+			list_init(&wheel->slots[i][j]);
+	}
+}
 
-	assert(list_empty(&timer->header));
+/** Find the first occupied slot of a wheel level, in time order.
+ * @param bitmap	Bitmap of occupied slots.
+ * @param start		Slot corresponding to the current time.
+ * @return		Number of slots after start to the first occupied
+ *			slot, or -1 if there are none. */
+static inline int timer_wheel_find(uint64_t bitmap, unsigned start) {
+	uint64_t after = bitmap & (~0ULL << start);
+
+	if(after) {
+		return ffs(after) - start;
+	} else if(bitmap) {
+		return ffs(bitmap) + TIMER_WHEEL_SLOTS - start;
+	} else {
+		return -1;
+	}
+}
 
-	/* Work out the absolute completion time. */
-	timer->target = system_time() + timer->initial;
+/** Add a timer to a wheel.
+ * @param wheel		Wheel to add to (CPU timer lock must be held).
+ * @param timer		Timer to add. */
+static void timer_wheel_insert(timer_wheel_t *wheel, timer_t *timer) {
+	uint64_t unit, base;
+	unsigned level, shift, slot;
+
+	/* A target that has already been passed goes in the current slot. */
+	unit = max((uint64_t)timer->target >> TIMER_WHEEL_SHIFT, wheel->clock);
 
-	/* Find the insertion point for the timer: the list must be ordered
-	 * with nearest expiration time first. */
-	pos = curr_cpu->timers.next;
-	while(pos != &curr_cpu->timers) {
-		exist = list_entry(pos, timer_t, header);
-		if(exist->target > timer->target)
+	for(level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		shift = level * TIMER_WHEEL_BITS;
+		if((unit >> shift) - (wheel->clock >> shift) < TIMER_WHEEL_SLOTS)
 			break;
+	}
+
+	/* Timers beyond the range of the top level wait in its furthest slot,
+	 * and are placed again when that is cascaded. */
+	shift = level * TIMER_WHEEL_BITS;
+	base = wheel->clock >> shift;
+	slot = min(unit >> shift, base + TIMER_WHEEL_SLOTS - 1) & (TIMER_WHEEL_SLOTS - 1);
+
+	timer->slot = (level * TIMER_WHEEL_SLOTS) + slot;
+	list_append(&wheel->slots[level][slot], &timer->header);
+	wheel->bitmap[level] |= (1ULL << slot);
+	wheel->count++;
+
+	if(timer->target + timer->slack < wheel->next)
+		wheel->next = timer->target + timer->slack;
+}
+
+/** Remove a timer from its wheel slot.
+ * @param wheel		Wheel to remove from (CPU timer lock must be held).
+ * @param timer		Timer to remove. */
+static inline void timer_wheel_unlink(timer_wheel_t *wheel, timer_t *timer) {
+	unsigned level = timer->slot / TIMER_WHEEL_SLOTS;
+	unsigned slot = timer->slot % TIMER_WHEEL_SLOTS;
 
-		pos = pos->next;
+	list_remove(&timer->header);
+	if(list_empty(&wheel->slots[level][slot]))
+		wheel->bitmap[level] &= ~(1ULL << slot);
+
+	wheel->count--;
+}
+
+/** Recalculate the earliest deadline in a wheel.
+ * @param wheel		Wheel to update (CPU timer lock must be held). */
+static void timer_wheel_update_next(timer_wheel_t *wheel) {
+	nstime_t next = INT64_MAX, start;
+	unsigned level, shift, slot;
+	uint64_t base, bitmap;
+	timer_t *timer;
+	int delta;
+
+	/* Within a level, slots are in time order starting from the current
+	 * one. A higher level may still hold a timer earlier than the lower
+	 * ones (placed before the clock moved on), so check each level. A
+	 * timer's deadline is never before the start of its slot, so only
+	 * slots that start before the earliest deadline found so far need to
+	 * be scanned. */
+	for(level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		shift = level * TIMER_WHEEL_BITS;
+		base = wheel->clock >> shift;
+		bitmap = wheel->bitmap[level];
+
+		while((delta = timer_wheel_find(bitmap, base & (TIMER_WHEEL_SLOTS - 1))) >= 0) {
+			start = ((base + delta) << shift) << TIMER_WHEEL_SHIFT;
+			if(start >= next)
+				break;
+
+			slot = (base + delta) & (TIMER_WHEEL_SLOTS - 1);
+			LIST_FOREACH(&wheel->slots[level][slot], iter) {
+				timer = list_entry(iter, timer_t, header);
+
+				if(timer->target + timer->slack < next)
+					next = timer->target + timer->slack;
+			}
+
+			bitmap &= ~(1ULL << slot);
+		}
+	}
+
+	wheel->next = next;
+}
+
+/** Remove a timer from a wheel.
+ * @param wheel		Wheel to remove from (CPU timer lock must be held).
+ * @param timer		Timer to remove. */
+static void timer_wheel_remove(timer_wheel_t *wheel, timer_t *timer) {
+	timer_wheel_unlink(wheel, timer);
+
+	if(!wheel->count) {
+		wheel->next = INT64_MAX;
+	} else if(timer->target + timer->slack == wheel->next) {
+		timer_wheel_update_next(wheel);
+	}
+}
+
+/** Cascade higher level slots that the wheel's clock has reached.
+ * @param wheel		Wheel to cascade (CPU timer lock must be held). */
+static void timer_wheel_cascade(timer_wheel_t *wheel) {
+	unsigned level, shift, slot;
+	timer_t *timer;
+
+	/* Work downwards, as a cascade can move timers into the current slot
+	 * of the level below. */
+	for(level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+		shift = level * TIMER_WHEEL_BITS;
+		if(wheel->clock & ((1ULL << shift) - 1))
+			continue;
+
+		slot = (wheel->clock >> shift) & (TIMER_WHEEL_SLOTS - 1);
+		LIST_FOREACH_SAFE(&wheel->slots[level][slot], iter) {
+			timer = list_entry(iter, timer_t, header);
+
+			timer_wheel_unlink(wheel, timer);
+			timer_wheel_insert(wheel, timer);
+		}
 	}
+}
+
+/** Work out how far a wheel's clock can be advanced without missing anything.
+ * @param wheel		Wheel to check (CPU timer lock must be held).
+ * @param limit		Slot that the clock is being advanced to.
+ * @return		Next slot that needs to be looked at. */
+static uint64_t timer_wheel_advance(timer_wheel_t *wheel, uint64_t limit) {
+	uint64_t next = limit, base;
+	unsigned level, shift, slot;
+	int delta;
+
+	/* The current level 0 slot has just been emptied. */
+	slot = wheel->clock & (TIMER_WHEEL_SLOTS - 1);
+	delta = timer_wheel_find(wheel->bitmap[0] & ~(1ULL << slot), slot);
+	if(delta > 0)
+		next = min(next, wheel->clock + delta);
+
+	/* Higher levels must be cascaded when their first occupied slot is
+	 * reached. */
+	for(level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+		shift = level * TIMER_WHEEL_BITS;
+		base = wheel->clock >> shift;
+		delta = timer_wheel_find(wheel->bitmap[level], base & (TIMER_WHEEL_SLOTS - 1));
+		if(delta > 0)
+			next = min(next, (base + delta) << shift);
+	}
+
+	return max(next, wheel->clock + 1);
+}
 
-	list_add_before(pos, &timer->header);
+/** Start a timer, with CPU timer lock held.
+ * @param timer		Timer to start. */
+static void timer_start_unsafe(timer_t *timer) {
+	assert(list_empty(&timer->header));
+
+	/* Work out the absolute completion time. */
+	timer->target = system_time() + timer->initial;
+	timer_wheel_insert(&curr_cpu->timers, timer);
 }
 
 /** DPC function to run a timer function.
@@ -215,9 +454,12 @@ static void timer_dpc_request(void *_timer) {
 /** Handles a timer tick.
  * @return		Whether to preempt the current thread. */
 bool timer_tick(void) {
+	timer_wheel_t *wheel = &curr_cpu->timers;
 	nstime_t time = system_time();
 	bool preempt = false;
 	timer_t *timer;
+	uint64_t unit;
+	size_t fired;
 
 	assert(timer_device);
 	assert(!local_irq_state());
@@ -226,48 +468,75 @@ bool timer_tick(void) {
 		return false;
 
 	spinlock_lock(&curr_cpu->timer_lock);
+	curr_cpu->timer_ticking = true;
 
-	/* Iterate the list and check for expired timers. */
-	LIST_FOREACH_SAFE(&curr_cpu->timers, iter) {
-		timer = list_entry(iter, timer_t, header);
+	if(timer_device->type == TIMER_DEVICE_ONESHOT)
+		timer_device_account(wheel, time);
+
+	/* Advance the wheel up to the current time, running expired timers in
+	 * each level 0 slot that it passes through. */
+	unit = time >> TIMER_WHEEL_SHIFT;
+	fired = 0;
+	while(true) {
+		LIST_FOREACH_SAFE(&wheel->slots[0][wheel->clock & (TIMER_WHEEL_SLOTS - 1)], iter) {
+			timer = list_entry(iter, timer_t, header);
+
+			/* The current slot can contain timers that are due
+			 * later on within it. */
+			if(time < timer->target)
+				continue;
+
+			/* This timer has expired, remove it from the wheel. */
+			timer_wheel_unlink(wheel, timer);
+			fired++;
+
+			/* Perform its timeout action. If a threaded timer's
+			 * handler has not run since it last expired, it only
+			 * runs once. */
+			if(timer->flags & TIMER_THREAD) {
+				dpc_queue(&timer->dpc);
+			} else {
+				if(timer->func(timer->data))
+					preempt = true;
+			}
+
+			/* If the timer is periodic, restart it. */
+			if(timer->mode == TIMER_PERIODIC)
+				timer_start_unsafe(timer);
+		}
 
-		/* Since the list is ordered soonest expiry first, we can break
-		 * if the current timer has not expired. */
-		if(time < timer->target)
+		if(wheel->clock >= unit)
 			break;
 
-		/* This timer has expired, remove it from the list. */
-		list_remove(&timer->header);
+		wheel->clock = timer_wheel_advance(wheel, unit);
+		timer_wheel_cascade(wheel);
+	}
 
-		/* Perform its timeout action. */
-		if(timer->flags & TIMER_THREAD) {
-			dpc_request(timer_dpc_request, timer);
-		} else {
-			if(timer->func(timer->data))
-				preempt = true;
-		}
+	timer_wheel_update_next(wheel);
 
-		/* If the timer is periodic, restart it. */
-		if(timer->mode == TIMER_PERIODIC)
-			timer_start_unsafe(timer);
+	/* Record how many timers shared this tick, for the timers command. */
+	if(fired) {
+		wheel->expired += fired;
+		wheel->interrupts++;
 	}
 
 	switch(timer_device->type) {
 	case TIMER_DEVICE_ONESHOT:
-		/* Prepare the next tick if there is still a timer in the list. */
-		if(!list_empty(&curr_cpu->timers))
-			timer_device_prepare(list_first(&curr_cpu->timers, timer_t, header));
+		/* Prepare the next tick if there is still a timer running. */
+		if(wheel->count)
+			timer_device_prepare(wheel->next);
 
 		break;
 	case TIMER_DEVICE_PERIODIC:
-		/* For periodic devices, if the list is empty disable the
+		/* For periodic devices, if the wheel is empty disable the
 		 * device so the timer does not interrupt unnecessarily. */
-		if(list_empty(&curr_cpu->timers))
+		if(!wheel->count)
 			timer_device_disable();
 
 		break;
 	}
 
+	curr_cpu->timer_ticking = false;
 	spinlock_unlock(&curr_cpu->timer_lock);
 	return preempt;
 }
@@ -283,7 +552,11 @@ void timer_init(timer_t *timer, const char *name, timer_func_t func, void *data,
 	timer->func = func;
 	timer->data = data;
 	timer->flags = flags;
+	timer->slack = 0;
 	timer->name = name;
+
+	if(flags & TIMER_THREAD)
+		dpc_prepare(&timer->dpc, timer_dpc_request, timer, DPC_PRIORITY_HIGH);
 }
 
 /** Start a timer.
@@ -304,18 +577,26 @@ void timer_start(timer_t *timer, nstime_t length, unsigned mode) {
 	timer->mode = mode;
 	timer->initial = length;
 
+	/* If we are being called from a timer handler on this CPU, the lock is
+	 * already held, and timer_tick() will set up the device once all the
+	 * handlers have been run. */
+	if(curr_cpu->timer_ticking) {
+		timer_start_unsafe(timer);
+		local_irq_restore(state);
+		return;
+	}
+
 	spinlock_lock_noirq(&curr_cpu->timer_lock);
 
-	/* Add the timer to the list. */
+	/* Add the timer to the wheel. */
 	timer_start_unsafe(timer);
 
 	switch(timer_device->type) {
 	case TIMER_DEVICE_ONESHOT:
-		/* If the new timer is at the beginning of the list, then it
-		 * has the shortest remaining time, so we need to adjust the
-		 * device to tick for it. */
-		if(timer == list_first(&curr_cpu->timers, timer_t, header))
-			timer_device_prepare(timer);
+		/* If the new timer now has the earliest deadline, we need to
+		 * adjust the device to tick for it. */
+		if(timer->target + timer->slack == curr_cpu->timers.next)
+			timer_device_prepare(curr_cpu->timers.next);
 
 		break;
 	case TIMER_DEVICE_PERIODIC:
@@ -331,15 +612,17 @@ void timer_start(timer_t *timer, nstime_t length, unsigned mode) {
 /** Cancel a running timer.
  * @param timer		Timer to stop. */
 void timer_stop(timer_t *timer) {
-	timer_t *first;
+	timer_wheel_t *wheel;
+	bool first;
 
 	if(!list_empty(&timer->header)) {
 		assert(timer->cpu);
 
 		spinlock_lock(&timer->cpu->timer_lock);
 
-		first = list_first(&timer->cpu->timers, timer_t, header);
-		list_remove(&timer->header);
+		wheel = &timer->cpu->timers;
+		first = timer->target + timer->slack == wheel->next;
+		timer_wheel_remove(wheel, timer);
 
 		/* If the timer is running on this CPU, adjust the tick length
 		 * or disable the device if required. If the timer is on another
@@ -348,13 +631,12 @@ void timer_stop(timer_t *timer) {
 		if(timer->cpu == curr_cpu) {
 			switch(timer_device->type) {
 			case TIMER_DEVICE_ONESHOT:
-				if(first == timer && !list_empty(&curr_cpu->timers)) {
-					first = list_first(&curr_cpu->timers, timer_t, header);
-					timer_device_prepare(first);
-				}
+				if(first && wheel->count)
+					timer_device_prepare(wheel->next);
+
 				break;
 			case TIMER_DEVICE_PERIODIC:
-				if(list_empty(&curr_cpu->timers))
+				if(!wheel->count)
 					timer_device_disable();
 
 				break;
@@ -363,6 +645,10 @@ void timer_stop(timer_t *timer) {
 
 		spinlock_unlock(&timer->cpu->timer_lock);
 	}
+
+	/* Don't run the handler if it expired but has not been run yet. */
+	if(timer->flags & TIMER_THREAD)
+		dpc_cancel(&timer->dpc);
 }
 
 /** Sleep for a certain amount of time.
@@ -396,18 +682,22 @@ void delay(nstime_t nsecs) {
  * @param argv		Argument array.
  * @return		KDB status code. */
 static kdb_status_t kdb_cmd_timers(int argc, char **argv, kdb_filter_t *filter) {
+	timer_wheel_t *wheel;
+	unsigned level, slot;
 	timer_t *timer;
-	uint64_t id;
+	uint64_t id, saved;
+	nstime_t uptime;
 	cpu_t *cpu;
 
 	if(kdb_help(argc, argv)) {
 		kdb_printf("Usage: %s [<CPU ID>]\n\n", argv[0]);
 
 		kdb_printf("Prints a list of all timers on a CPU. If no ID given, current CPU\n");
-		kdb_printf("will be used.\n");
+		kdb_printf("will be used. Also shows how many timer interrupts have been saved\n");
+		kdb_printf("by expiring several timers on the same tick.\n");
 		return KDB_SUCCESS;
 	} else if(argc != 1 && argc != 2) {
-		kdb_printf("Incorrect number of argments. See 'help %s' for help.\n", argv[0]);
+		kdb_printf("Incorrect number of arguments. See 'help %s' for help.\n", argv[0]);
 		return KDB_FAILURE;
 	}
 
@@ -423,14 +713,81 @@ static kdb_status_t kdb_cmd_timers(int argc, char **argv, kdb_filter_t *filter)
 		cpu = curr_cpu;
 	}
 
-	kdb_printf("Name                 Target           Function           Data\n");
-	kdb_printf("====                 ======           ========           ====\n");
+	wheel = &cpu->timers;
+	kdb_printf("%zu timers, clock %" PRIu64 ", next deadline %lld\n",
+		wheel->count, wheel->clock << TIMER_WHEEL_SHIFT,
+		(wheel->count) ? wheel->next : -1);
+
+	saved = wheel->expired - wheel->interrupts;
+	uptime = max(NSECS2SECS(system_time()), (nstime_t)1);
+	kdb_printf("%" PRIu64 " expiries in %" PRIu64 " interrupts, %" PRIu64 " saved "
+		"(%" PRIu64 " per second)\n\n", wheel->expired, wheel->interrupts,
+		saved, saved / uptime);
+
+	kdb_printf("Name                 Target           Slack      Level Slot Function           Data\n");
+	kdb_printf("====                 ======           =====      ===== ==== ========           ====\n");
 
-	LIST_FOREACH(&cpu->timers, iter) {
-		timer = list_entry(iter, timer_t, header);
+	for(level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		for(slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+			LIST_FOREACH(&wheel->slots[level][slot], iter) {
+				timer = list_entry(iter, timer_t, header);
 
-		kdb_printf("%-20s %-16llu %-18p %p\n", timer->name, timer->target,
-			timer->func, timer->data);
+				kdb_printf("%-20s %-16llu %-10llu %-5u %-4u %-18p %p\n",
+					timer->name, timer->target, timer->slack,
+					level, slot, timer->func, timer->data);
+			}
+		}
+	}
+
+	return KDB_SUCCESS;
+}
+
+/** Print timer device accuracy histograms.
+ * @param argc		Argument count.
+ * @param argv		Argument array.
+ * @param filter	Unused.
+ * @return		KDB status code. */
+static kdb_status_t kdb_cmd_timerlat(int argc, char **argv, kdb_filter_t *filter) {
+	timer_wheel_t *wheel;
+	uint64_t count;
+	cpu_t *cpu;
+	unsigned i;
+
+	if(kdb_help(argc, argv)) {
+		kdb_printf("Usage: %s\n\n", argv[0]);
+
+		kdb_printf("Prints a histogram for each CPU of how late the timer device fired\n");
+		kdb_printf("compared to the deadline it was programmed for.\n");
+		return KDB_SUCCESS;
+	}
+
+	kdb_printf("Timer device: %s\n", (timer_device) ? timer_device->name : "none");
+
+	LIST_FOREACH(&running_cpus, iter) {
+		cpu = list_entry(iter, cpu_t, header);
+		wheel = &cpu->timers;
+
+		count = 0;
+		for(i = 0; i < TIMER_LATENCY_BUCKETS; i++)
+			count += wheel->latency[i];
+
+		kdb_printf("CPU %" PRIu32 ": %" PRIu64 " ticks, %" PRIu64 " early, "
+			"mean %" PRId64 "ns late, max %" PRId64 "ns\n", cpu->id, count,
+			wheel->early, (count) ? wheel->latency_total / (nstime_t)count : 0,
+			wheel->latency_max);
+
+		for(i = 0; i < TIMER_LATENCY_BUCKETS; i++) {
+			if(!wheel->latency[i])
+				continue;
+
+			if(i == TIMER_LATENCY_BUCKETS - 1) {
+				kdb_printf("  >= %8lu ns  %" PRIu64 "\n", 1UL << (i - 1),
+					wheel->latency[i]);
+			} else {
+				kdb_printf("  <  %8lu ns  %" PRIu64 "\n", 1UL << i,
+					wheel->latency[i]);
+			}
+		}
 	}
 
 	return KDB_SUCCESS;
@@ -463,9 +820,102 @@ __init_text void time_init(void) {
 
 	/* Register debugger commands. */
 	kdb_register_command("timers", "Print a list of running timers.", kdb_cmd_timers);
+	kdb_register_command("timerlat", "Print timer device accuracy histograms.",
+		kdb_cmd_timerlat);
 	kdb_register_command("uptime", "Display the system uptime.", kdb_cmd_uptime);
 }
 
+/**
+* Time data page.
+*/
+
+/** Get a page from the time page object.
+ * @param region	Region to get page for.
+ * @param offset	Offset into object to get page from.
+ * @param pagep		Where to store pointer to page structure.
+ * @param majorp	Where to store whether the page was read in.
+ * @return		Status code describing result of the operation. */
+static status_t time_page_get_page(vm_region_t *region, offset_t offset, page_t **pagep,
+	bool *majorp)
+{
+	if(offset)
+		return STATUS_INVALID_ADDR;
+
+	*pagep = time_page_page;
+	if(majorp)
+		*majorp = false;
+
+	return STATUS_SUCCESS;
+}
+
+/** Time page region operations. */
+static vm_region_ops_t time_page_region_ops = {
+	.get_page = time_page_get_page,
+};
+
+/** Map the time page into memory.
+ * @param handle	Handle to the time page.
+ * @param region	Region being mapped.
+ * @return		Status code describing result of the operation. */
+static status_t time_page_object_map(object_handle_t *handle, vm_region_t *region) {
+	if(region->access != VM_ACCESS_READ) {
+		return STATUS_ACCESS_DENIED;
+	} else if(region->flags & VM_MAP_PRIVATE) {
+		return STATUS_NOT_SUPPORTED;
+	} else if(region->obj_offset || region->size != PAGE_SIZE) {
+		return STATUS_INVALID_ARG;
+	}
+
+	region->ops = &time_page_region_ops;
+	return STATUS_SUCCESS;
+}
+
+/** Time page object type. It is only mapped by the kernel. */
+static object_type_t time_page_object_type = {
+	.id = OBJECT_TYPE_AREA,
+	.map = time_page_object_map,
+};
+
+/** Map the time data page into an address space.
+ * @param as		Address space to map into.
+ * @param addrp		Where to store address of the mapping.
+ * @return		Status code describing result of the operation. */
+status_t time_page_map(vm_aspace_t *as, ptr_t *addrp) {
+	assert(time_page_handle);
+
+	return vm_map(as, addrp, PAGE_SIZE, VM_ADDRESS_ANY, VM_ACCESS_READ, 0,
+		time_page_handle, 0, "time_page");
+}
+
+/** Begin an update to the time page. */
+static inline void time_page_write_begin(void) {
+	time_page->seq++;
+	write_barrier();
+}
+
+/** Finish an update to the time page. */
+static inline void time_page_write_end(void) {
+	write_barrier();
+	time_page->seq++;
+}
+
+/** Create the time data page once all CPUs are up. */
+static __init_text void time_page_init(void) {
+	time_page_page = page_alloc(MM_BOOT | MM_ZERO);
+	time_page = phys_map(time_page_page->addr, PAGE_SIZE, MM_BOOT);
+	time_page_handle = object_handle_create(&time_page_object_type, NULL);
+
+	time_page_write_begin();
+	time_page->boot_unix_time = boot_unix_time;
+	arch_time_page_init(time_page);
+	time_page_write_end();
+
+	if(!time_page->cpu_count)
+		kprintf(LOG_NOTICE, "time: time page not usable, time reads will use kernel calls\n");
+}
+
+INITCALL(time_page_init);
+
 /**
 * User timer API.
 */
@@ -555,7 +1005,11 @@ static bool user_timer_func(void *_timer) {
 /**
 * Create a new timer.
 *
-* @param flags		Flags for the timer.
+* Creates a new timer object. Unless TIMER_PRECISE is specified, the timer
+* takes the calling thread's timer slack, allowing it to fire slightly late
+* so that its expiry can be coalesced with that of other timers.
+*
+* @param flags		Flags for the timer (TIMER_*).
 * @param handlep	Where to store handle to timer object.
 *
 * @return		Status code describing result of the operation.
@@ -571,6 +1025,8 @@ kern_timer_create(uint32_t flags, handle_t *handlep)
 
 	timer = kmalloc(sizeof(*timer), MM_KERNEL);
 	timer_init(&timer->timer, "timer_object", user_timer_func, timer, TIMER_THREAD);
+	if(!(flags & TIMER_PRECISE) && curr_thread->policy == THREAD_SCHED_NORMAL)
+		timer->timer.slack = curr_thread->timer_slack;
 	notifier_init(&timer->notifier, timer);
 	timer->flags = flags;
 	timer->fired = false;
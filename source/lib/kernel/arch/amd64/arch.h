@@ -84,6 +84,24 @@ arch_tls_tcb_init(tls_tcb_t *tcb)
     tcb->tpt = tcb;
 }
 
+/**
+* Read the time counter.
+*
+* @param cpup		Where to store the ID of the CPU that the counter
+*			was read on.
+*
+* @return		Counter value.
+*/
+static inline uint64_t
+arch_time_counter(uint32_t *cpup)
+{
+    uint32_t high, low;
+
+    /* The kernel sets TSC_AUX to the CPU ID. */
+    __asm__ __volatile__("rdtscp" : "=a"(low), "=d"(high), "=c"(*cpup));
+    return ((uint64_t)high << 32) | low;
+}
+
 extern void libkernel_relocate(process_args_t *args, elf_dyn_t *dyn);
 
 #endif /* __LIBKERNEL_ARCH_H */
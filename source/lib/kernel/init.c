@@ -53,6 +53,9 @@ libkernel_init(process_args_t *args)
 	void (*func)(void);
 	status_t ret;
 
+	/* Save the time page location for kern_time_get(). */
+	time_page = args->time_page;
+
 	/* Get the system page size. */
 	kern_system_info(SYSTEM_INFO_PAGE_SIZE, &page_size);
 
@@ -159,3 +159,34 @@ kern_thread_exit(int status)
 
 	_kern_thread_exit(status);
 }
+
+/**
+* Get the timer slack of the calling thread.
+*
+* @param slackp	Where to store the timer slack, in nanoseconds.
+*
+* @return		Status code describing result of the operation.
+*/
+status_t __export
+kern_thread_timer_slack(nstime_t *slackp)
+{
+	return kern_thread_control(THREAD_TIMER_SLACK, NULL, slackp);
+}
+
+/**
+* Set the timer slack of the calling thread.
+*
+* The timer slack is how late the calling thread's sleep timeouts, and timers
+* that it creates without TIMER_PRECISE, are allowed to fire. The kernel uses
+* it to expire several timers on the same interrupt. It has no effect on
+* threads with a real-time scheduling policy.
+*
+* @param slack		New timer slack, in nanoseconds.
+*
+* @return		Status code describing result of the operation.
+*/
+status_t __export
+kern_thread_set_timer_slack(nstime_t slack)
+{
+	return kern_thread_control(THREAD_SET_TIMER_SLACK, &slack, NULL);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2010-2014 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		Time functions.
+ */
+
+#include <kernel/private/time.h>
+
+#include "libkernel.h"
+
+/** Kernel time data page. */
+const time_page_t *time_page;
+
+/**
+* Get the current time from a time source.
+*
+* Gets the current time from a time source. See the kernel documentation of
+* kern_time_get() for details of the time sources. Where possible, the time
+* is calculated from the kernel time page rather than with a kernel call.
+*
+* @param source	Time source to get from.
+* @param timep		Where to store time in nanoseconds.
+*
+* @return		Status code describing result of the operation.
+*/
+status_t __export
+kern_time_get(unsigned source, nstime_t *timep)
+{
+	const time_page_t *page = time_page;
+	uint32_t seq, cpu;
+	uint64_t counter;
+	nstime_t time;
+
+	if(!page || !page->cpu_count || !timep)
+		return _kern_time_get(source, timep);
+
+	switch(source) {
+	case TIME_SYSTEM:
+	case TIME_REAL:
+		break;
+	default:
+		return _kern_time_get(source, timep);
+	}
+
+	/* Retry if the kernel was updating the page while we read it. */
+	do {
+		seq = page->seq;
+		__asm__ __volatile__("" ::: "memory");
+
+		counter = arch_time_counter(&cpu);
+		if(cpu >= page->cpu_count)
+			return _kern_time_get(source, timep);
+
+		time = ((unsigned __int128)(counter - page->cpus[cpu].offset)
+			* page->cpus[cpu].mult) >> TIME_PAGE_SHIFT;
+		if(source == TIME_REAL)
+			time += page->boot_unix_time;
+
+		__asm__ __volatile__("" ::: "memory");
+	} while(seq & 1 || seq != page->seq);
+
+	*timep = time;
+	return STATUS_SUCCESS;
+}
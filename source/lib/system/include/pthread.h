@@ -54,12 +54,25 @@ enum {
 	PTHREAD_MUTEX_DEFAULT,
 };
 
+/** Mutex protocol attribute values. */
+enum {
+	/** Priority is not affected by holding the mutex. */
+	PTHREAD_PRIO_NONE,
+
+	/** Holder inherits the priority of threads blocked on the mutex. */
+	PTHREAD_PRIO_INHERIT,
+
+	/** Holder runs at the priority ceiling of the mutex (unsupported). */
+	PTHREAD_PRIO_PROTECT,
+};
+
 /** Initializer for pthread_once_t. */
 #define PTHREAD_ONCE_INIT		0
 
 /** Default initializer for pthread_mutex_t. */
 #define PTHREAD_MUTEX_INITIALIZER	\
-	{ 0, -1, 0, { PTHREAD_MUTEX_DEFAULT, PTHREAD_PROCESS_PRIVATE } }
+	{ 0, -1, 0, { PTHREAD_MUTEX_DEFAULT, PTHREAD_PROCESS_PRIVATE, \
+		PTHREAD_PRIO_NONE } }
 
 /** Default initializer for pthread_cond_t. */
 #define PTHREAD_COND_INITIALIZER	\
@@ -154,14 +167,15 @@ extern int pthread_mutex_unlock(pthread_mutex_t *mutex);
 extern int pthread_mutexattr_init(pthread_mutexattr_t *attr);
 extern int pthread_mutexattr_destroy(pthread_mutexattr_t *attr);
 //int pthread_mutexattr_getprioceiling(const pthread_mutexattr_t *__restrict, int *__restrict);
-//int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *__restrict, int *__restrict);
+extern int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *__restrict attr,
+	int *__restrict protocolp);
 extern int pthread_mutexattr_getpshared(const pthread_mutexattr_t *__restrict attr,
 	int *__restrict psharedp);
 //int pthread_mutexattr_getrobust(const pthread_mutexattr_t *__restrict, int *__restrict);
 extern int pthread_mutexattr_gettype(const pthread_mutexattr_t *__restrict attr,
 	int *__restrict typep);
 //int pthread_mutexattr_setprioceiling(pthread_mutexattr_t *, int);
-//int pthread_mutexattr_setprotocol(pthread_mutexattr_t *, int);
+extern int pthread_mutexattr_setprotocol(pthread_mutexattr_t *attr, int protocol);
 extern int pthread_mutexattr_setpshared(pthread_mutexattr_t *attr, int pshared);
 //int pthread_mutexattr_setrobust(pthread_mutexattr_t *, int);
 extern int pthread_mutexattr_settype(pthread_mutexattr_t *attr, int type);
@@ -40,6 +40,13 @@ extern "C" {
 #define MAP_FIXED		(1<<2)	/**< Use given start address exactly. */
 #define MAP_ANONYMOUS		(1<<3)	/**< Map anonymous memory. */
 
+/** Advice values for posix_madvise(). */
+#define POSIX_MADV_NORMAL	0	/**< No special treatment. */
+#define POSIX_MADV_SEQUENTIAL	1	/**< Range will be accessed sequentially. */
+#define POSIX_MADV_RANDOM	2	/**< Range will be accessed randomly. */
+#define POSIX_MADV_WILLNEED	3	/**< Range will be needed soon. */
+#define POSIX_MADV_DONTNEED	4	/**< Range will not be needed soon. */
+
 /** Value returned by mmap() on failure. */
 #define MAP_FAILED		((void *)-1l)
 
@@ -51,7 +58,7 @@ extern void *mmap(void *start, size_t size, int prot, int flags, int fd, off_t o
 /* int munlock(const void *, size_t); */
 /* int munlockall(void); */
 extern int munmap(void *start, size_t size);
-/* int posix_madvise(void *, size_t, int); */
+extern int posix_madvise(void *start, size_t size, int advice);
 /* int shm_open(const char *, int, mode_t); */
 /* int shm_unlink(const char *); */
 
@@ -38,6 +38,7 @@ typedef int64_t off_t;			/**< Used for file sizes/offsets. */
 typedef uint32_t mode_t;		/**< Used to store file attributes. */
 typedef int64_t suseconds_t;		/**< Used to store a (signed) number of microseconds. */
 typedef uint64_t useconds_t;		/**< Used to store a number of microseconds. */
+typedef int32_t clockid_t;		/**< Used to identify a clock. */
 typedef int32_t blkcnt_t;		/**< Used to store a count of blocks. */
 typedef int32_t blksize_t;		/**< Used to store the size of a block. */
 typedef uint32_t dev_t;			/**< Used to store a device number. */
@@ -52,7 +53,6 @@ typedef unsigned short u_short;
 typedef unsigned int u_int;
 typedef unsigned long u_long;
 
-/* clockid_t */
 /* [XSI] fsblkcnt_t */
 /* [XSI] fsfilcnt_t */
 /* id_t */
@@ -42,6 +42,7 @@ typedef int32_t pthread_key_t;
 typedef struct {
 	int type;				/**< Type of the mutex. */
 	int pshared;				/**< Process sharing attribute. */
+	int protocol;				/**< Priority protocol. */
 } pthread_mutexattr_t;
 
 /** Structure containing a mutex. */
@@ -38,6 +38,10 @@ struct timespec {
 	long tv_nsec;			/**< Additional nanoseconds since. */
 };
 
+/** Clock IDs for clock_gettime(). */
+#define CLOCK_REALTIME		1	/**< System-wide real time clock. */
+#define CLOCK_MONOTONIC		2	/**< Monotonic time since boot. */
+
 /** Structure containing a time. */
 struct tm {
 	int tm_sec;			/**< Seconds [0,60]. */
@@ -54,6 +58,7 @@ struct tm {
 extern char *asctime(const struct tm *tm);
 extern char *asctime_r(const struct tm *__restrict tm, char *__restrict buf);
 //extern clock_t clock(void);
+extern int clock_gettime(clockid_t clock, struct timespec *tp);
 extern char *ctime(const time_t *timep);
 //extern double difftime(time_t, time_t);
 //extern struct tm *getdate(const char *);
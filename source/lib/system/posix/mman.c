@@ -108,3 +108,44 @@ int munmap(void *start, size_t size) {
 
 	return 0;
 }
+
+/** Give advice on how a range of memory will be used.
+ * @note		POSIX_MADV_DONTNEED is treated as a hint that the range
+ *			should be reclaimed first rather than discarding its
+ *			content, as POSIX requires the data to be preserved.
+ * @param start		Start of the range.
+ * @param size		Size of the range.
+ * @param advice	Advice value (POSIX_MADV_*).
+ * @return		0 on success, error number on failure. */
+int posix_madvise(void *start, size_t size, int advice) {
+	unsigned kadvice;
+	status_t ret;
+
+	switch(advice) {
+	case POSIX_MADV_NORMAL:
+		kadvice = VM_ADVISE_NORMAL;
+		break;
+	case POSIX_MADV_SEQUENTIAL:
+		kadvice = VM_ADVISE_SEQUENTIAL;
+		break;
+	case POSIX_MADV_RANDOM:
+		kadvice = VM_ADVISE_RANDOM;
+		break;
+	case POSIX_MADV_WILLNEED:
+		kadvice = VM_ADVISE_WILLNEED;
+		break;
+	case POSIX_MADV_DONTNEED:
+		kadvice = VM_ADVISE_COLD;
+		break;
+	default:
+		return EINVAL;
+	}
+
+	ret = kern_vm_advise(start, size, kadvice);
+	if(ret != STATUS_SUCCESS) {
+		libsystem_status_to_errno(ret);
+		return errno;
+	}
+
+	return 0;
+}
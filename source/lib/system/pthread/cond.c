@@ -160,7 +160,11 @@ int pthread_cond_wait(pthread_cond_t *__restrict cond, pthread_mutex_t *__restri
 
 	kern_mutex_unlock(&cond->lock);
 
-	/* Relock the mutex. */
+	/* Relock the mutex. A priority inheritance mutex uses a different
+	 * futex protocol, so go through the normal path for it. */
+	if(mutex->attr.protocol == PTHREAD_PRIO_INHERIT)
+		return pthread_mutex_lock(mutex);
+
 	while(__sync_lock_test_and_set(&mutex->futex, 2) != 0) {
 		ret = kern_futex_wait((int32_t *)&mutex->futex, 2, -1);
 		if(ret != STATUS_SUCCESS && ret != STATUS_TRY_AGAIN) {
@@ -236,7 +240,9 @@ int pthread_cond_broadcast(pthread_cond_t *cond) {
 	 * changed. */
 	cond->futex++;
 
-	if(cond->attr.pshared != PTHREAD_PROCESS_SHARED && cond->mutex) {
+	if(cond->attr.pshared != PTHREAD_PROCESS_SHARED && cond->mutex
+		&& cond->mutex->attr.protocol != PTHREAD_PRIO_INHERIT)
+	{
 		/* Wake one waiter and requeue the remainder on the mutex. In
 		 * this case the futex value cannot change under us as we hold
 		 * the internal lock, so don't need to check for
@@ -245,7 +251,8 @@ int pthread_cond_broadcast(pthread_cond_t *cond) {
 			(int32_t *)&cond->mutex->futex, NULL);
 	} else {
 		/* Cannot use requeue for shared conditions as we don't know
-		 * the mutex. */
+		 * the mutex, or for priority inheritance mutexes as waiters
+		 * must go through kern_futex_lock(). */
 		ret = kern_futex_wake((int32_t *)&cond->futex, ~0UL, NULL);
 	}
 
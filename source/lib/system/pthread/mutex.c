@@ -24,6 +24,10 @@
  *  - 1 - Locked, no waiters.
  *  - 2 - Locked, one or more waiters.
  *
+ * Mutexes with the PTHREAD_PRIO_INHERIT protocol instead use a priority
+ * inheritance futex, which holds the ID of the owning thread. See
+ * kern_futex_lock() for details.
+ *
  * Reference:
  *  - Futexes are Tricky
  *    http://dept-info.labri.fr/~denis/Enseignement/2008-IR/Articles/01-futex.pdf
@@ -65,6 +69,7 @@ int pthread_mutex_init(pthread_mutex_t *__restrict mutex,
 	} else {
 		mutex->attr.type = PTHREAD_MUTEX_DEFAULT;
 		mutex->attr.pshared = PTHREAD_PROCESS_PRIVATE;
+		mutex->attr.protocol = PTHREAD_PRIO_NONE;
 	}
 
 	return 0;
@@ -103,8 +108,14 @@ int pthread_mutex_lock(pthread_mutex_t *mutex) {
 	int32_t val;
 
 	/* If the futex is currently 0 (unlocked), just set it to 1 (locked, no
-	 * waiters) and return. */
-	val = __sync_val_compare_and_swap(&mutex->futex, 0, 1);
+	 * waiters), or our ID for a priority inheritance mutex, and return. */
+	if(mutex->attr.protocol == PTHREAD_PRIO_INHERIT) {
+		val = __sync_val_compare_and_swap(&mutex->futex, 0,
+			kern_thread_id(THREAD_SELF));
+	} else {
+		val = __sync_val_compare_and_swap(&mutex->futex, 0, 1);
+	}
+
 	if(val != 0) {
 		if(mutex->holder == kern_thread_id(THREAD_SELF)) {
 			if(mutex->attr.type == PTHREAD_MUTEX_RECURSIVE) {
@@ -126,22 +137,32 @@ int pthread_mutex_lock(pthread_mutex_t *mutex) {
 			}
 		}
 
-		/* Set futex to 2 (locked with waiters). */
-		if(val != 2)
-			val = __sync_lock_test_and_set(&mutex->futex, 2);
-
-		/* Loop until we can acquire the futex. */
-		while(val != 0) {
-			ret = kern_futex_wait((int32_t *)&mutex->futex, 2, -1);
-			if(ret != STATUS_SUCCESS && ret != STATUS_TRY_AGAIN) {
+		if(mutex->attr.protocol == PTHREAD_PRIO_INHERIT) {
+			/* The kernel lends our priority to the owner and
+			 * hands the futex over to us when it is unlocked. */
+			ret = kern_futex_lock((int32_t *)&mutex->futex, -1);
+			if(ret != STATUS_SUCCESS) {
 				libsystem_status_to_errno(ret);
 				return errno;
 			}
-
-			/* We cannot know whether there are waiters or not.
-			 * Therefore, to be on the safe side, set that there
-			 * are (see paper linked above). */
-			val = __sync_lock_test_and_set(&mutex->futex, 2);
+		} else {
+			/* Set futex to 2 (locked with waiters). */
+			if(val != 2)
+				val = __sync_lock_test_and_set(&mutex->futex, 2);
+
+			/* Loop until we can acquire the futex. */
+			while(val != 0) {
+				ret = kern_futex_wait((int32_t *)&mutex->futex, 2, -1);
+				if(ret != STATUS_SUCCESS && ret != STATUS_TRY_AGAIN) {
+					libsystem_status_to_errno(ret);
+					return errno;
+				}
+
+				/* We cannot know whether there are waiters or
+				 * not. Therefore, to be on the safe side, set
+				 * that there are (see paper linked above). */
+				val = __sync_lock_test_and_set(&mutex->futex, 2);
+			}
 		}
 	}
 
@@ -167,7 +188,12 @@ int pthread_mutex_lock(pthread_mutex_t *mutex) {
  *			and the maximum recursion count has been reached.
  */
 int pthread_mutex_trylock(pthread_mutex_t *mutex) {
-	if(!__sync_bool_compare_and_swap(&mutex->futex, 0, 1)) {
+	int32_t val;
+
+	val = (mutex->attr.protocol == PTHREAD_PRIO_INHERIT)
+		? kern_thread_id(THREAD_SELF) : 1;
+
+	if(!__sync_bool_compare_and_swap(&mutex->futex, 0, val)) {
 		if(mutex->holder == kern_thread_id(THREAD_SELF)
 			&& mutex->attr.type == PTHREAD_MUTEX_RECURSIVE)
 		{
@@ -224,6 +250,18 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex) {
 
 	mutex->holder = -1;
 
+	if(mutex->attr.protocol == PTHREAD_PRIO_INHERIT) {
+		/* If there are waiters, the kernel must pick which one gets
+		 * the futex. */
+		if(!__sync_bool_compare_and_swap(&mutex->futex,
+			kern_thread_id(THREAD_SELF), 0))
+		{
+			kern_futex_unlock((int32_t *)&mutex->futex);
+		}
+
+		return 0;
+	}
+
 	if(__sync_fetch_and_sub(&mutex->futex, 1) != 1) {
 		/* There were waiters. Wake one up. */
 		mutex->futex = 0;
@@ -239,6 +277,7 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex) {
 int pthread_mutexattr_init(pthread_mutexattr_t *attr) {
 	attr->type = PTHREAD_MUTEX_DEFAULT;
 	attr->pshared = PTHREAD_PROCESS_PRIVATE;
+	attr->protocol = PTHREAD_PRIO_NONE;
 	return 0;
 }
 
@@ -250,6 +289,17 @@ int pthread_mutexattr_destroy(pthread_mutexattr_t *attr) {
 	return 0;
 }
 
+/** Get the value of the protocol attribute.
+ * @param attr		Attributes structure to get from.
+ * @param protocolp	Where to store value of attribute.
+ * @return		Always returns 0. */
+int pthread_mutexattr_getprotocol(const pthread_mutexattr_t *__restrict attr,
+	int *__restrict protocolp)
+{
+	*protocolp = attr->protocol;
+	return 0;
+}
+
 /** Get the value of the process-shared attribute.
  * @param attr		Attributes structure to get from.
  * @param psharedp	Where to store value of attribute.
@@ -272,6 +322,22 @@ int pthread_mutexattr_gettype(const pthread_mutexattr_t *__restrict attr,
 	return 0;
 }
 
+/** Set the value of the protocol attribute.
+ * @param attr		Attributes structure to set in.
+ * @param protocol	New value of the attribute.
+ * @return		0 on success, EINVAL if new value is invalid, ENOTSUP
+ *			if it is PTHREAD_PRIO_PROTECT. */
+int pthread_mutexattr_setprotocol(pthread_mutexattr_t *attr, int protocol) {
+	if(protocol == PTHREAD_PRIO_PROTECT) {
+		return ENOTSUP;
+	} else if(protocol != PTHREAD_PRIO_NONE && protocol != PTHREAD_PRIO_INHERIT) {
+		return EINVAL;
+	}
+
+	attr->protocol = protocol;
+	return 0;
+}
+
 /** Set the value of the process-shared attribute.
  * @param attr		Attributes structure to set in.
  * @param pshared	New value of the attribute.
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2010-2013 Gil Mendes
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/**
+ * @file
+ * @brief		POSIX clock function.
+ */
+
+#include <kernel/status.h>
+#include <kernel/time.h>
+
+#include <errno.h>
+#include <time.h>
+
+/** Get the time of a clock.
+ * @param clock		Clock to get the time of.
+ * @param tp		Where to store the time.
+ * @return		0 on success, -1 on failure. */
+int clock_gettime(clockid_t clock, struct timespec *tp) {
+	nstime_t ktime;
+	status_t ret;
+
+	switch(clock) {
+	case CLOCK_REALTIME:
+		ret = kern_time_get(TIME_REAL, &ktime);
+		break;
+	case CLOCK_MONOTONIC:
+		ret = kern_time_get(TIME_SYSTEM, &ktime);
+		break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(ret != STATUS_SUCCESS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	tp->tv_sec = ktime / 1000000000;
+	tp->tv_nsec = ktime % 1000000000;
+	return 0;
+}